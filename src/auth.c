@@ -0,0 +1,527 @@
+/*
+ * File: auth.c
+ *
+ * Name server for OS/2.
+ *
+ * Tables of networks and domains for which this server is authoritative.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Any number of networks and domains may be configured. After the
+ * configuration file has been read, the networks are compiled into a
+ * binary prefix tree, so that the network for a reverse lookup is found
+ * by a single longest prefix match; the reverse domain name for each
+ * network is built at the same time. The domains are put into a hash
+ * table; the domain for a name is found by looking up each suffix of the
+ * name in turn, longest first. The origins of zone files, and secondary
+ * zones, are included in the domains.
+ *
+ * Each network and domain is given an SOA record, for use in negative
+ * answers; this is only used if the zone file for the domain does not
+ * supply one.
+ *
+ * There is also a table of empty zones, looked up in the same way. These
+ * are domains (mostly reverse domains for private and special purpose
+ * addresses, see RFC 6303) for which queries should never be passed on
+ * to another server; the answer is always that the name does not exist.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, auth_init)
+#pragma	alloc_text(init_seg, add_domain)
+#pragma	alloc_text(init_seg, add_zone_domains)
+#pragma	alloc_text(init_seg, build_empty)
+#pragma	alloc_text(init_seg, build_table)
+#pragma	alloc_text(init_seg, make_revdomain)
+#pragma	alloc_text(init_seg, make_soa)
+
+#define	SOA_SERIAL	1		/* Values for SOA records */
+#define	SOA_REFRESH	3600
+#define	SOA_RETRY	600
+#define	SOA_EXPIRE	86400
+
+/* Forward references */
+
+static	PAUTHDOM add_domain(PCONFIG, PUCHAR);
+static	BOOL	add_zone_domains(PCONFIG, PZONEFILE);
+static	BOOL	build_empty(PCONFIG);
+static	BOOL	build_table(PCONFIG, PAUTHDOM, PAUTHDOM **, PULONG);
+static	ULONG	domain_hash(PUCHAR);
+static	PAUTHDOM find_suffix(PAUTHDOM *, ULONG, PUCHAR);
+static	PUCHAR	make_revdomain(PAUTHNET);
+static	PRR	make_soa(PCONFIG, PUCHAR);
+
+/* Local storage */
+
+static	PUCHAR	builtin_empty[] = {	/* Built in empty zones */
+	"0.in-addr.arpa",		/* 'This' network */
+	"10.in-addr.arpa",		/* RFC 1918 private networks */
+	"16.172.in-addr.arpa",
+	"17.172.in-addr.arpa",
+	"18.172.in-addr.arpa",
+	"19.172.in-addr.arpa",
+	"20.172.in-addr.arpa",
+	"21.172.in-addr.arpa",
+	"22.172.in-addr.arpa",
+	"23.172.in-addr.arpa",
+	"24.172.in-addr.arpa",
+	"25.172.in-addr.arpa",
+	"26.172.in-addr.arpa",
+	"27.172.in-addr.arpa",
+	"28.172.in-addr.arpa",
+	"29.172.in-addr.arpa",
+	"30.172.in-addr.arpa",
+	"31.172.in-addr.arpa",
+	"168.192.in-addr.arpa",
+	"127.in-addr.arpa",		/* Loopback */
+	"254.169.in-addr.arpa",		/* Link local */
+	"2.0.192.in-addr.arpa",		/* Documentation (TEST-NET-1,2,3) */
+	"100.51.198.in-addr.arpa",
+	"113.0.203.in-addr.arpa",
+	"255.255.255.255.in-addr.arpa",	/* Broadcast */
+	"0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.ip6.arpa",
+	"1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.ip6.arpa",
+	"d.f.ip6.arpa",			/* IPv6 unique local */
+	"8.e.f.ip6.arpa",		/* IPv6 link local */
+	"9.e.f.ip6.arpa",
+	"a.e.f.ip6.arpa",
+	"b.e.f.ip6.arpa",
+	"8.b.d.0.1.0.0.2.ip6.arpa",	/* IPv6 documentation */
+	"localhost",			/* Special use names (RFC 6761) */
+	"local",
+	"invalid",
+	(PUCHAR) NULL
+};
+
+
+/*
+ * Build the lookup tables for the authoritative networks and domains.
+ * Networks given without a mask use the one from the AUTH_NETMASK
+ * command. If no network was configured, a default is used that matches
+ * nothing useful; if no domain was configured, the default domain is used.
+ * The origins of zone files, and secondary zones, are then added to the
+ * domains.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+BOOL auth_init(PCONFIG config)
+{	PAUTHNET an;
+	PAUTHDOM ad;
+	PVIEW v;
+	PSECONDARY sec;
+
+	/* Networks */
+
+	if(config->authnets == (PAUTHNET) NULL) {
+		an = (PAUTHNET) calloc(1, sizeof(AUTHNET));
+		if(an == (PAUTHNET) NULL) {
+			dolog("failed to allocate authoritative network entry");
+			return(FALSE);
+		}
+		an->network.s_addr = inet_addr(DEFAULT_AUTH_NETWORK);
+		an->masklen = -1;
+		config->authnets = an;
+	}
+
+	config->authtab = radix_new();
+	if(config->authtab == (PRADIX) NULL) {
+		dolog("failed to allocate authoritative network table");
+		return(FALSE);
+	}
+
+	for(an = config->authnets; an != (PAUTHNET) NULL; an = an->next) {
+		if(an->masklen < 0) an->masklen = radix_masklen(config->netmask);
+		an->network.s_addr &= htonl(an->masklen == 0 ? 0 :
+					0xffffffffUL << (32 - an->masklen));
+		an->revdomain = make_revdomain(an);
+		if(an->revdomain != (PUCHAR) NULL)
+			an->soa = make_soa(config, an->revdomain);
+		if(an->revdomain == (PUCHAR) NULL ||
+		   an->soa == (PRR) NULL ||
+		   radix_add(
+			config->authtab,
+			an->network,
+			an->masklen,
+			(PVOID) an) == FALSE) {
+			dolog("failed to allocate authoritative network entry");
+			return(FALSE);
+		}
+	}
+
+	/* Domains */
+
+	if(config->authdoms == (PAUTHDOM) NULL && config->domain[0] != '\0') {
+		ad = (PAUTHDOM) calloc(1, sizeof(AUTHDOM));
+		if(ad == (PAUTHDOM) NULL) {
+			dolog("failed to allocate authoritative domain entry");
+			return(FALSE);
+		}
+		ad->name = config->domain;
+		config->authdoms = ad;
+	}
+
+	if(add_zone_domains(config, config->zonefiles) == FALSE) return(FALSE);
+	for(v = config->views; v != (PVIEW) NULL; v = v->next)
+		if(add_zone_domains(config, v->zonefiles) == FALSE)
+			return(FALSE);
+	for(sec = config->secondaries;
+	    sec != (PSECONDARY) NULL;
+	    sec = sec->next) {
+		ad = add_domain(config, sec->origin);
+		if(ad == (PAUTHDOM) NULL) return(FALSE);
+		ad->sec = sec;
+	}
+
+	if(build_table(
+		config,
+		config->authdoms,
+		&config->domtab,
+		&config->domtabsize) == FALSE)
+		return(FALSE);
+
+	/* Empty zones */
+
+	if(build_empty(config) == FALSE) return(FALSE);
+
+	return(TRUE);
+}
+
+
+/*
+ * Find the authoritative network containing an address.
+ *
+ * Returns a pointer to the network information, or NULL if the address
+ * is not in any of our networks.
+ *
+ */
+
+PAUTHNET auth_find_network(PCONFIG config, INADDR addr)
+{	return((PAUTHNET) radix_lookup(config->authtab, addr));
+}
+
+
+/*
+ * Find the authoritative domain for a name; this is the longest of our
+ * domains that is a suffix of the name.
+ *
+ * Returns a pointer to the domain information, or NULL if the name is not
+ * in any of our domains.
+ *
+ */
+
+PAUTHDOM auth_find_domain(PCONFIG config, PUCHAR name)
+{	return(find_suffix(config->domtab, config->domtabsize, name));
+}
+
+
+/*
+ * Find the empty zone containing a name, if any. Single label names
+ * (other than the root) that are not empty zones themselves, as
+ * 'localhost' is, are always treated as being in an empty zone, unless
+ * the built in empty zones have been turned off.
+ *
+ * Returns a pointer to the zone information, or NULL if the name is not
+ * in any empty zone. For a single label name, the zone information has
+ * no name and no SOA record.
+ *
+ */
+
+PAUTHDOM auth_find_empty(PCONFIG config, PUCHAR name)
+{	PAUTHDOM ad;
+	static AUTHDOM single = { (PAUTHDOM) NULL, (PAUTHDOM) NULL, 0,
+					(PUCHAR) NULL, (PRR) NULL };
+
+	ad = find_suffix(config->emptytab, config->emptytabsize, name);
+	if(ad == (PAUTHDOM) NULL &&
+	   config->empty_builtin == TRUE &&
+	   name[0] != '\0' &&
+	   strchr(name, '.') == NULL)
+		return(&single);
+
+	return(ad);
+}
+
+
+/*
+ * Look up a name in a hash table of domains, trying each suffix of the
+ * name in turn, longest first.
+ *
+ * Returns a pointer to the longest matching domain, or NULL if there is
+ * none.
+ *
+ */
+
+static PAUTHDOM find_suffix(PAUTHDOM *tab, ULONG size, PUCHAR name)
+{	ULONG hash;
+	PAUTHDOM ad;
+	PUCHAR p = name;
+
+	for(;;) {
+		hash = domain_hash(p);
+		for(ad = tab[hash & (size - 1)];
+		    ad != (PAUTHDOM) NULL;
+		    ad = ad->hnext) {
+			if(ad->hash == hash && name_same(ad->name, p) == TRUE)
+				return(ad);
+		}
+		p = strchr(p, '.');
+		if(p == (PUCHAR) NULL) break;
+		p++;
+	}
+
+	return(PAUTHDOM) NULL;
+}
+
+
+/*
+ * Build a hash table from a list of domains, and give each one an SOA
+ * record.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL build_table(PCONFIG config, PAUTHDOM list, PAUTHDOM **ptab,
+			PULONG psize)
+{	ULONG size, n, i;
+	PAUTHDOM ad;
+	PAUTHDOM *tab;
+
+	n = 0;
+	for(ad = list; ad != (PAUTHDOM) NULL; ad = ad->next)
+		n++;
+	for(size = 8; size < 2*n; size *= 2) ;
+
+	tab = (PAUTHDOM *) calloc(size, sizeof(PAUTHDOM));
+	if(tab == (PAUTHDOM *) NULL) {
+		dolog("failed to allocate domain table");
+		return(FALSE);
+	}
+
+	for(ad = list; ad != (PAUTHDOM) NULL; ad = ad->next) {
+		ad->soa = make_soa(config, ad->name);
+		if(ad->soa == (PRR) NULL) {
+			dolog("failed to allocate domain entry");
+			return(FALSE);
+		}
+		ad->hash = domain_hash(ad->name);
+		i = ad->hash & (size - 1);
+		ad->hnext = tab[i];
+		tab[i] = ad;
+	}
+
+	*ptab = tab;
+	*psize = size;
+
+	return(TRUE);
+}
+
+
+/*
+ * Build the table of empty zones. This is the built in list (less any
+ * that have been turned off), plus any given by EMPTY_ZONE commands.
+ * An empty zone may enclose one of our own domains or networks; this does
+ * no harm, since those are always looked at first.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL build_empty(PCONFIG config)
+{	INT i, n;
+	PAUTHDOM ad, off;
+	UCHAR logmsg[MAXLOG];
+
+	if(config->empty_builtin == TRUE) {
+		for(i = 0; builtin_empty[i] != (PUCHAR) NULL; i++) {
+			for(off = config->emptyoff;
+			    off != (PAUTHDOM) NULL;
+			    off = off->next)
+				if(name_same(off->name, builtin_empty[i]) == TRUE)
+					break;
+			if(off != (PAUTHDOM) NULL) continue;
+
+			ad = (PAUTHDOM) calloc(1, sizeof(AUTHDOM));
+			if(ad == (PAUTHDOM) NULL) {
+				dolog("failed to allocate empty zone entry");
+				return(FALSE);
+			}
+			ad->name = builtin_empty[i];
+			ad->next = config->emptyzones;
+			config->emptyzones = ad;
+		}
+	}
+
+	n = 0;
+	for(ad = config->emptyzones; ad != (PAUTHDOM) NULL; ad = ad->next)
+		n++;
+	sprintf(logmsg, "%d empty zone%s", n, n == 1 ? "" : "s");
+	dolog(logmsg);
+
+	return(build_table(
+		config,
+		config->emptyzones,
+		&config->emptytab,
+		&config->emptytabsize));
+}
+
+
+/*
+ * Add the origins of a chain of zone files to the list of domains, unless
+ * they are already there.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL add_zone_domains(PCONFIG config, PZONEFILE zf)
+{	for(; zf != (PZONEFILE) NULL; zf = zf->next)
+		if(add_domain(config, zf->origin) == (PAUTHDOM) NULL)
+			return(FALSE);
+
+	return(TRUE);
+}
+
+
+/*
+ * Add a domain to the list of domains, unless it is already there.
+ *
+ * Returns a pointer to the entry for the domain, or NULL if memory ran
+ * out.
+ *
+ */
+
+static PAUTHDOM add_domain(PCONFIG config, PUCHAR name)
+{	PAUTHDOM ad, *pad;
+
+	for(pad = &config->authdoms; *pad != (PAUTHDOM) NULL;
+	    pad = &(*pad)->next)
+		if(name_same((*pad)->name, name) == TRUE) return(*pad);
+
+	ad = (PAUTHDOM) calloc(1, sizeof(AUTHDOM));
+	if(ad == (PAUTHDOM) NULL) {
+		dolog("failed to allocate authoritative domain entry");
+		return((PAUTHDOM) NULL);
+	}
+	ad->name = name;
+	*pad = ad;
+
+	return(ad);
+}
+
+
+/*
+ * Build an SOA record for a domain, naming this server as the primary
+ * server. The minimum field, which gives the time for which negative
+ * answers may be cached, is NEGATIVE_TTL.
+ *
+ * Returns a pointer to the record, or NULL if memory ran out or the name
+ * is too long.
+ *
+ */
+
+static PRR make_soa(PCONFIG config, PUCHAR zone)
+{	INT n;
+	PUCHAR p;
+	PRR rr;
+	UCHAR rdata[2*MAXCDNAME + 5*4];
+	UCHAR temp[MAXDNAME+1];
+
+	p = rdata;
+	n = dn_comp(config->myname, p, MAXCDNAME, (PUCHAR *) NULL,
+			(PUCHAR *) NULL);
+	if(n < 0) return(PRR) NULL;
+	p += n;
+
+	if(strlen(zone) + 12 > MAXDNAME) return(PRR) NULL;
+	sprintf(temp, "hostmaster.%s", zone);
+	n = dn_comp(temp, p, MAXCDNAME, (PUCHAR *) NULL, (PUCHAR *) NULL);
+	if(n < 0) return(PRR) NULL;
+	p += n;
+
+	putlong(SOA_SERIAL, p);
+	p += 4;
+	putlong(SOA_REFRESH, p);
+	p += 4;
+	putlong(SOA_RETRY, p);
+	p += 4;
+	putlong(SOA_EXPIRE, p);
+	p += 4;
+	putlong(NEGATIVE_TTL, p);
+	p += 4;
+
+	rr = (PRR) malloc(sizeof(RR) + (p - rdata));
+	if(rr == (PRR) NULL) return(PRR) NULL;
+	rr->next = (PRR) NULL;
+	rr->type = T_SOA;
+	rr->class = C_IN;
+	rr->ttl = NEGATIVE_TTL;
+	rr->rdlength = (USHORT) (p - rdata);
+	memcpy(rr->rdata, rdata, rr->rdlength);
+
+	return(rr);
+}
+
+
+/*
+ * Compute a case-independent hash value for a domain name, ignoring any
+ * trailing dot.
+ *
+ */
+
+static ULONG domain_hash(PUCHAR name)
+{	INT len = strlen(name);
+
+	if(len > 0 && name[len-1] == '.') len--;
+
+	return(name_hash(name, len));
+}
+
+
+/*
+ * Build the name of the reverse domain for a network; for example,
+ * 42.168.192.in-addr.arpa for 192.168.42.0 with a 24 bit mask. Only
+ * whole bytes of the network part are used, so a mask that is not a
+ * multiple of 8 bits gives the enclosing domain; for example,
+ * 168.192.in-addr.arpa for 192.168.16.0 with a 20 bit mask.
+ *
+ * Returns a pointer to the name, or NULL if memory ran out.
+ *
+ */
+
+static PUCHAR make_revdomain(PAUTHNET an)
+{	INT i, nbytes;
+	ULONG a = ntohl(an->network.s_addr);
+	PUCHAR p;
+	UCHAR temp[MAXDNAME+1];
+
+	nbytes = an->masklen/8;
+	temp[0] = '\0';
+	for(i = nbytes - 1; i >= 0; i--)
+		sprintf(
+			temp + strlen(temp),
+			"%lu.",
+			(a >> (24 - 8*i)) & 0xff);
+	strcat(temp, "in-addr.arpa");
+
+	p = malloc(strlen(temp)+1);
+	if(p != (PUCHAR) NULL) strcpy(p, temp);
+
+	return(p);
+}
+
+/*
+ * End of file: auth.c
+ *
+ */
+
\ No newline at end of file
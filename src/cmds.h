@@ -17,7 +17,19 @@
 #define	CMD_AUTH_DOMAIN		4
 #define	CMD_REFER_INTERFACE	5
 #define	CMD_REFER_SERVERS	6
-#define	CMD_BAD			7
+#define	CMD_HEALTH_CHECK	7
+#define	CMD_ZONE_FILE		8
+#define	CMD_VIEW		9
+#define	CMD_VIEW_HOSTS		10
+#define	CMD_VIEW_ZONE_FILE	11
+#define	CMD_EMPTY_ZONE		12
+#define	CMD_NO_EMPTY_ZONE	13
+#define	CMD_REPLICA		14
+#define	CMD_RELOAD_INTERVAL	15
+#define	CMD_SECONDARY		16
+#define	CMD_HEDGE_BUDGET	17
+#define	CMD_REFER_DEADLINE	18
+#define	CMD_BAD			19
 
 static	struct {
 	UCHAR	*cmdname;		/* Command name */
@@ -29,6 +41,18 @@ static	struct {
 	{ "AUTH_DOMAIN",	CMD_AUTH_DOMAIN },
 	{ "REFER_INTERFACE",	CMD_REFER_INTERFACE },
 	{ "REFER_SERVERS",	CMD_REFER_SERVERS },
+	{ "HEALTH_CHECK",	CMD_HEALTH_CHECK },
+	{ "ZONE_FILE",		CMD_ZONE_FILE },
+	{ "VIEW",		CMD_VIEW },
+	{ "VIEW_HOSTS",		CMD_VIEW_HOSTS },
+	{ "VIEW_ZONE_FILE",	CMD_VIEW_ZONE_FILE },
+	{ "EMPTY_ZONE",		CMD_EMPTY_ZONE },
+	{ "NO_EMPTY_ZONE",	CMD_NO_EMPTY_ZONE },
+	{ "REPLICA",		CMD_REPLICA },
+	{ "RELOAD_INTERVAL",	CMD_RELOAD_INTERVAL },
+	{ "SECONDARY",		CMD_SECONDARY },
+	{ "HEDGE_BUDGET",	CMD_HEDGE_BUDGET },
+	{ "REFER_DEADLINE",	CMD_REFER_DEADLINE },
 	{ "",			CMD_BAD }	/* End of table marker */
 };
 
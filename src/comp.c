@@ -0,0 +1,334 @@
+/*
+ * File: comp.c
+ *
+ * Name server for OS/2.
+ *
+ * Domain name compression for replies.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * This does the work of 'dn_comp', but more quickly. 'dn_comp' keeps a
+ * list of the names already in the message, and for each label of a new
+ * name it goes through the whole list, comparing names in full. Here,
+ * every suffix of every name written is entered in a small hash table,
+ * keyed on a hash of its labels; each suffix of a new name is then found
+ * with a single probe or two, and compared only to confirm the match.
+ *
+ * The table is started with the suffixes of the name in the question,
+ * so that names in the reply can refer to any part of it, and not just
+ * to the whole name; the answer names, and common parts such as the
+ * local domain, are then compressed on first use. The result is never
+ * longer than that from 'dn_comp', and is usually the same.
+ *
+ * Most names in a reply are written more than once: the name in the
+ * question is the owner of each answer, and our own name appears in
+ * both the authority and additional sections. The last few names are
+ * therefore noted as they were passed in, with where they can be found;
+ * when the same text is passed again it need only be checked against
+ * the message before a pointer is written, without any other work.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+
+/* Hash of a suffix, from the hash of its first label and of the rest */
+
+#define	SUFFIX_HASH(rest, lhash)	(((rest) ^ (lhash)) * 16777619UL)
+
+/* Forward references */
+
+static	VOID	add_suffix(PCOMP, ULONG, ULONG);
+static	INT	find_suffix(PCOMP, ULONG, PUCHAR);
+static	BOOL	same_suffix(PCOMP, ULONG, PUCHAR);
+static	BOOL	same_text(PCOMP, ULONG, PUCHAR);
+
+
+/*
+ * Set up for compressing the names in a message.
+ *
+ *	comp	points to the compression state
+ *	msg	points to the start of the message
+ *	qn	points to the labels of the name in the question, which
+ *		must be in the message, or is NULL if there is none yet
+ *
+ */
+
+VOID comp_init(PCOMP comp, PUCHAR msg, PQNAME qn)
+{	INT i;
+	ULONG hash;
+
+	comp->msg = msg;
+	comp->nused = 0;
+	comp->nnames = 0;
+	memset(comp->off, 0, sizeof(comp->off));
+	if(qn == (PQNAME) NULL || qn->nlabels == 0) return;
+
+	hash = LABEL_HASH_INIT;
+	for(i = qn->nlabels - 1; i >= 0; i--) {
+		hash = SUFFIX_HASH(hash, qn->hash[i]);
+		add_suffix(comp, hash, qn->label[i] - msg);
+	}
+	if(comp->nused == qn->nlabels) {	/* Whole name reachable */
+		comp->name[0] = qn->text;
+		comp->nameoff[0] = (USHORT) (qn->label[0] - msg);
+		comp->nnames = 1;
+	}
+}
+
+
+/*
+ * Compress a domain name into a message. This is a replacement for
+ * 'dn_comp', and behaves in the same way.
+ *
+ *	comp	points to the compression state
+ *	name	is the name, as text
+ *	dst	points to where the name is to go in the message
+ *	space	is the space available there
+ *
+ * Returns the length of the compressed name, or -1 if the name is
+ * malformed or there is not enough space.
+ *
+ */
+
+INT comp_name(PCOMP comp, PUCHAR name, PUCHAR dst, INT space)
+{	INT i, n, nlabels, len, match;
+	ULONG off, hash;
+	PUCHAR np, wp, lp;
+	UCHAR c;
+	INT start[MAXLABELS+1];
+	ULONG lhash[MAXLABELS];
+	ULONG shash[MAXLABELS];
+	UCHAR wire[MAXCDNAME+MAXLABEL+2];
+
+	/* Look for the same name passed in recently */
+
+	for(i = 0; i < comp->nnames && i < MAXCOMPNAMES; i++) {
+		if(comp->name[i] != name) continue;
+		off = comp->nameoff[i];
+		if(same_text(comp, off, name) == FALSE) continue;
+		if(space < 2) return(-1);
+		dst[0] = (UCHAR) (INDIR_MASK | (off >> 8));
+		dst[1] = (UCHAR) off;
+		return(2);
+	}
+
+	/* Convert the name to labels, hashing each one */
+
+	np = name;
+	if(np[0] == '.' && np[1] == '\0') np++;		/* Root */
+	nlabels = 0;
+	wp = wire;
+	while(*np != '\0') {
+		if(nlabels >= MAXLABELS) return(-1);
+		start[nlabels] = wp - wire;
+		lp = wp++;
+		while((c = *np) != '\0' && c != '.') {
+			np++;
+			if(c == '\\') {
+				if(*np == '\0') break;
+				c = *np++;
+			}
+			if(wp - lp > MAXLABEL) return(-1);
+			*wp++ = c;
+		}
+		n = wp - lp - 1;
+		if(n == 0) return(-1);		/* Empty label */
+		*lp = (UCHAR) n;
+		lhash[nlabels++] = name_hash(lp + 1, n);
+		if(wp - wire >= MAXCDNAME) return(-1);
+		if(c == '.') np++;
+	}
+	start[nlabels] = wp - wire;
+	*wp = 0;				/* Root */
+
+	/* Hash each suffix, from the right */
+
+	hash = LABEL_HASH_INIT;
+	for(i = nlabels - 1; i >= 0; i--) {
+		hash = SUFFIX_HASH(hash, lhash[i]);
+		shash[i] = hash;
+	}
+
+	/* Find the longest suffix already in the message */
+
+	off = 0;
+	for(match = 0; match < nlabels; match++) {
+		n = find_suffix(comp, shash[match], wire + start[match]);
+		if(n >= 0) {
+			off = comp->off[n];
+			break;
+		}
+	}
+
+	/* Copy the labels before it, and a pointer to it */
+
+	len = start[match];
+	if(len + (match < nlabels ? 2 : 1) > space) return(-1);
+	memcpy(dst, wire, len);
+	if(match < nlabels) {
+		dst[len++] = (UCHAR) (INDIR_MASK | (off >> 8));
+		dst[len++] = (UCHAR) off;
+	} else {
+		dst[len++] = 0;
+	}
+
+	/* Note the new suffixes, and the name itself, for later names */
+
+	if(match != 0) off = dst - comp->msg;
+	for(i = 0; i < match; i++)
+		add_suffix(comp, shash[i], off + start[i]);
+	if(nlabels != 0 && off < 0x4000) {
+		i = comp->nnames++ % MAXCOMPNAMES;
+		comp->name[i] = name;
+		comp->nameoff[i] = (USHORT) off;
+	}
+
+	return(len);
+}
+
+
+/*
+ * Forget the names written at or beyond a point in the message, when the
+ * record holding them has been abandoned; the space they used will be
+ * written again. This is rare, so the table is simply rebuilt.
+ *
+ *	comp	points to the compression state
+ *	end	points to where the message now ends
+ *
+ */
+
+VOID comp_undo(PCOMP comp, PUCHAR end)
+{	INT i;
+	ULONG limit = end - comp->msg;
+	USHORT off[MAXCOMP];
+	ULONG hash[MAXCOMP];
+
+	memcpy(off, comp->off, sizeof(off));
+	memcpy(hash, comp->hash, sizeof(hash));
+	memset(comp->off, 0, sizeof(comp->off));
+	comp->nused = 0;
+	for(i = 0; i < MAXCOMP; i++)
+		if(off[i] != 0 && off[i] < limit)
+			add_suffix(comp, hash[i], off[i]);
+
+	for(i = 0; i < comp->nnames && i < MAXCOMPNAMES; i++)
+		if(comp->nameoff[i] >= limit)
+			comp->name[i] = (PUCHAR) NULL;
+}
+
+
+/*
+ * Find a suffix in the table.
+ *
+ *	comp	points to the compression state
+ *	hash	is the hash of the suffix
+ *	labels	points to the suffix, as labels
+ *
+ * Returns the index of the table entry, or -1 if the suffix is not
+ * in the message.
+ *
+ */
+
+static INT find_suffix(PCOMP comp, ULONG hash, PUCHAR labels)
+{	INT i;
+
+	for(i = hash & (MAXCOMP-1); comp->off[i] != 0; i = (i+1) & (MAXCOMP-1))
+		if(comp->hash[i] == hash &&
+		   same_suffix(comp, comp->off[i], labels) == TRUE)
+			return(i);
+
+	return(-1);
+}
+
+
+/*
+ * Enter a suffix in the table. Suffixes at offsets that cannot be
+ * reached by a pointer are ignored, and so are any that arrive once the
+ * table is three quarters full.
+ *
+ */
+
+static VOID add_suffix(PCOMP comp, ULONG hash, ULONG off)
+{	INT i;
+
+	if(off >= 0x4000 || comp->nused >= MAXCOMP*3/4) return;
+
+	for(i = hash & (MAXCOMP-1); comp->off[i] != 0; i = (i+1) & (MAXCOMP-1))
+		;
+	comp->hash[i] = hash;
+	comp->off[i] = (USHORT) off;
+	comp->nused++;
+}
+
+
+/*
+ * Compare a suffix with the name at an offset in the message, ignoring
+ * case. The name in the message may itself be compressed.
+ *
+ * Returns TRUE if they are the same, FALSE if not.
+ *
+ */
+
+static BOOL same_suffix(PCOMP comp, ULONG off, PUCHAR labels)
+{	INT n;
+	PUCHAR cp = comp->msg + off;
+
+	for(;;) {
+		n = *cp;
+		if((n & INDIR_MASK) == INDIR_MASK) {
+			cp = comp->msg + (((n & ~INDIR_MASK) << 8) | cp[1]);
+			continue;
+		}
+		if(n != *labels) return(FALSE);
+		if(n == 0) return(TRUE);
+		if(name_equal(cp + 1, labels + 1, n) == FALSE) return(FALSE);
+		cp += n + 1;
+		labels += n + 1;
+	}
+}
+
+
+/*
+ * Compare a name, as text, with the name at an offset in the message,
+ * ignoring case. The text may contain escaped characters, as for
+ * 'comp_name'.
+ *
+ * Returns TRUE if they are the same, FALSE if not.
+ *
+ */
+
+static BOOL same_text(PCOMP comp, ULONG off, PUCHAR text)
+{	INT n;
+	UCHAR c;
+	PUCHAR cp = comp->msg + off;
+
+	for(;;) {
+		n = *cp;
+		if((n & INDIR_MASK) == INDIR_MASK) {
+			cp = comp->msg + (((n & ~INDIR_MASK) << 8) | cp[1]);
+			continue;
+		}
+		if(n == 0) return(*text == '\0' ? TRUE : FALSE);
+		for(cp++; n > 0; n--, cp++) {
+			c = *text++;
+			if(c == '\0' || c == '.') return(FALSE);
+			if(c == '\\' && (c = *text++) == '\0') return(FALSE);
+			if(c != *cp && tolower(c) != tolower(*cp)) return(FALSE);
+		}
+		if(*text == '.')
+			text++;
+		else if(*text != '\0')
+			return(FALSE);
+	}
+}
+
+/*
+ * End of file: comp.c
+ *
+ */
+
\ No newline at end of file
@@ -19,16 +19,40 @@
 #pragma	alloc_text(init_seg, config_error)
 #pragma	alloc_text(init_seg, getcmd)
 #pragma	alloc_text(init_seg, process_servers)
+#pragma	alloc_text(init_seg, process_health)
+#pragma	alloc_text(init_seg, process_zonefile)
+#pragma	alloc_text(init_seg, process_authdom)
+#pragma	alloc_text(init_seg, process_authnet)
+#pragma	alloc_text(init_seg, process_empty)
+#pragma	alloc_text(init_seg, process_replica)
+#pragma	alloc_text(init_seg, process_secondary)
+#pragma	alloc_text(init_seg, process_view)
+#pragma	alloc_text(init_seg, process_view_hosts)
+#pragma	alloc_text(init_seg, make_path)
+#pragma	alloc_text(init_seg, find_view)
 
 #define	MAXLINE		200		/* Maximum length of a config line */
 
 #define	DOMAINSERVICE	"domain"	/* Name of domain name server service */
+#define	HOSTSFILE	"Hosts"		/* Name of HOSTS file */
 #define	UDP		"udp"		/* UDP protocol */
 
 /* Forward references */
 
 static	VOID	config_error(INT, PUCHAR, ...);
 static	INT	getcmd(PUCHAR);
+static	VOID	process_health(PCONFIG, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_authdom(PCONFIG, PUCHAR, INT, PINT);
+static	VOID	process_authnet(PCONFIG, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_empty(PCONFIG, INT, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_replica(PCONFIG, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_secondary(PCONFIG, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_view(PCONFIG, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_view_hosts(PCONFIG, PUCHAR, PUCHAR, PUCHAR, INT, PINT);
+static	VOID	process_zonefile(PZONEFILE *, PUCHAR, PUCHAR, PUCHAR, INT,
+					PINT);
+static	PUCHAR	make_path(PUCHAR, PUCHAR);
+static	PVIEW	find_view(PCONFIG, PUCHAR, INT, PINT);
 static	VOID	process_servers(PCONFIG, PUCHAR, PUCHAR, INT, PINT);
 
 
@@ -47,17 +71,19 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 {	INT i;
 	PUCHAR p, q, r, temp;
 	UCHAR filename[CCHMAXPATH];
+	UCHAR etcdir[CCHMAXPATH];
 	PSERV domainserv;
 	FILE *fp;
 	UCHAR buf[MAXLINE];
 	PSERVERS dservers;
+	PVIEW v;
 	BOOL port_seen = FALSE;
-	BOOL network_seen = FALSE;
 	BOOL netmask_seen = FALSE;
-	BOOL domain_seen = FALSE;
 	BOOL refer_interface_seen = FALSE;
+	BOOL reload_interval_seen = FALSE;
+	BOOL hedge_budget_seen = FALSE;
+	BOOL refer_deadline_seen = FALSE;
 	INT errors = 0;
-	ULONG addr;
 	INT line = 0;
 
 	p = getenv(direnv);
@@ -65,9 +91,10 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 		config_error(0, "environment variable %s is not set", direnv);
 		return(++errors);
 	}
-	strcpy(filename, p);
-	p = p + strlen(filename) - 1;	/* Point to last character */
-	if(*p != '/' && *p != '\\') strcat(filename, "\\");
+	strcpy(etcdir, p);
+	p = p + strlen(etcdir) - 1;	/* Point to last character */
+	if(*p != '/' && *p != '\\') strcat(etcdir, "\\");
+	strcpy(filename, etcdir);
 	strcat(filename, configfile);
 
 	domainserv = getservbyname(DOMAINSERVICE, UDP);
@@ -81,10 +108,31 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 
 	config->port = domainserv->s_port;
 	config->nsport = domainserv->s_port;
-	config->network.s_addr = inet_addr(DEFAULT_AUTH_NETWORK);
+	config->authnets = (PAUTHNET) NULL;
 	config->netmask.s_addr = inet_addr(DEFAULT_AUTH_NETMASK);
+	config->authdoms = (PAUTHDOM) NULL;
+	config->emptyzones = (PAUTHDOM) NULL;
+	config->emptyoff = (PAUTHDOM) NULL;
+	config->empty_builtin = TRUE;
 	config->domain = _res.defdname;
 	config->refer_interface = DEFAULT_REFER_INTERFACE;
+	config->hostsfile = make_path(etcdir, HOSTSFILE);
+	if(config->hostsfile == (PUCHAR) NULL) {
+		config_error(0, "cannot allocate memory");
+		return(++errors);
+	}
+	config->health_type = HEALTH_NONE;
+	config->health_port = 0;
+	config->health_interval = DEFAULT_HEALTH_INTERVAL;
+	config->zonefiles = (PZONEFILE) NULL;
+	config->views = (PVIEW) NULL;
+	config->nviews = 0;
+	config->viewtab = (PRADIX) NULL;
+	config->replicas = (PREPLICA) NULL;
+	config->secondaries = (PSECONDARY) NULL;
+	config->reload_interval = DEFAULT_RELOAD_INTERVAL;
+	config->hedge_budget = DEFAULT_HEDGE_BUDGET;
+	config->refer_deadline = DEFAULT_REFER_DEADLINE;
 
 	/* Set up the default server structure. This is derived from the
 	   nameserver directives in the RESOLV file. It appears at the end
@@ -177,6 +225,10 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 				break;
 
 			case CMD_AUTH_NETWORK:
+				process_authnet(config, q, r, line, &errors);
+				break;
+
+			case CMD_AUTH_NETMASK:
 				if(r != (PUCHAR) NULL) {
 					config_error(
 						line,
@@ -187,34 +239,139 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 				if(q == (PUCHAR) NULL) {
 					config_error(
 						line,
-						"no network address after "
-						"AUTH_NETWORK command");
+						"no network mask after "
+						"AUTH_NETMASK command");
 					errors++;
 					break;
 				}
-				if(network_seen == TRUE) {
+				if(netmask_seen == TRUE) {
 					config_error(
 						line,
-						"only one AUTH_NETWORK command "
+						"only one AUTH_NETMASK command "
 						"permitted");
 					errors++;
 					break;
 				}
-				network_seen = TRUE;
-				addr = inet_addr(q);
-				if(addr == INADDR_NONE) {
+				netmask_seen = TRUE;
+				config->netmask.s_addr = inet_addr(q);
+				if(radix_masklen(config->netmask) < 0) {
 					config_error(
 						line,
-						"malformed network address "
-						"'%s'",
+						"malformed network mask '%s'",
 						q);
 					errors++;
+				}
+				break;
+
+			case CMD_AUTH_DOMAIN:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				process_authdom(config, q, line, &errors);
+				break;
+
+			case CMD_REFER_INTERFACE:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"no interface name after "
+						"REFER_INTERFACE command");
+					errors++;
+					break;
+				}
+				if(refer_interface_seen == TRUE) {
+					config_error(
+						line,
+						"only one REFER_INTERFACE "
+						"command permitted");
+					errors++;
 					break;
 				}
-				config->network.s_addr = addr;
+				refer_interface_seen = TRUE;
+				p = malloc(strlen(q)+1);
+				if(p == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"cannot allocate memory");
+					errors++;
+					break;
+				}
+				strcpy(p, q);
+				config->refer_interface = p;
 				break;
 
-			case CMD_AUTH_NETMASK:
+			case CMD_REFER_SERVERS:
+				process_servers(config, q, r, line, &errors);
+				break;
+
+			case CMD_HEALTH_CHECK:
+				process_health(config, q, r, line, &errors);
+				break;
+
+			case CMD_ZONE_FILE:
+				process_zonefile(
+					&config->zonefiles,
+					q,
+					r,
+					etcdir,
+					line,
+					&errors);
+				break;
+
+			case CMD_VIEW:
+				process_view(config, q, r, line, &errors);
+				break;
+
+			case CMD_VIEW_HOSTS:
+				process_view_hosts(
+					config,
+					q,
+					r,
+					etcdir,
+					line,
+					&errors);
+				break;
+
+			case CMD_EMPTY_ZONE:
+				process_empty(
+					config,
+					CMD_EMPTY_ZONE,
+					q,
+					r,
+					line,
+					&errors);
+				break;
+
+			case CMD_NO_EMPTY_ZONE:
+				process_empty(
+					config,
+					CMD_NO_EMPTY_ZONE,
+					q,
+					r,
+					line,
+					&errors);
+				break;
+
+			case CMD_REPLICA:
+				process_replica(config, q, r, line, &errors);
+				break;
+
+			case CMD_SECONDARY:
+				process_secondary(config, q, r, line, &errors);
+				break;
+
+			case CMD_RELOAD_INTERVAL:
 				if(r != (PUCHAR) NULL) {
 					config_error(
 						line,
@@ -225,24 +382,34 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 				if(q == (PUCHAR) NULL) {
 					config_error(
 						line,
-						"no network mask after "
-						"AUTH_NETMASK command");
+						"no interval after "
+						"RELOAD_INTERVAL command");
 					errors++;
 					break;
 				}
-				if(netmask_seen == TRUE) {
+				if(reload_interval_seen == TRUE) {
 					config_error(
 						line,
-						"only one AUTH_NETMASK command "
-						"permitted");
+						"only one RELOAD_INTERVAL "
+						"command permitted");
 					errors++;
 					break;
 				}
-				netmask_seen = TRUE;
-				config->netmask.s_addr = inet_addr(q);
+				reload_interval_seen = TRUE;
+				for(p = q; *p != '\0'; p++)
+					if(!isdigit(*p)) break;
+				if(*p != '\0') {
+					config_error(
+						line,
+						"invalid reload interval '%s'",
+						q);
+					errors++;
+					break;
+				}
+				config->reload_interval = atoi(q);
 				break;
 
-			case CMD_AUTH_DOMAIN:
+			case CMD_HEDGE_BUDGET:
 				if(r != (PUCHAR) NULL) {
 					config_error(
 						line,
@@ -253,33 +420,34 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 				if(q == (PUCHAR) NULL) {
 					config_error(
 						line,
-						"no domain after AUTH_DOMAIN "
-						"command");
+						"no percentage after "
+						"HEDGE_BUDGET command");
 					errors++;
 					break;
 				}
-				if(domain_seen == TRUE) {
+				if(hedge_budget_seen == TRUE) {
 					config_error(
 						line,
-						"only one AUTH_DOMAIN command "
-						"permitted");
+						"only one HEDGE_BUDGET "
+						"command permitted");
 					errors++;
 					break;
 				}
-				domain_seen = TRUE;
-				p = malloc(strlen(q)+1);
-				if(p == (PUCHAR) NULL) {
+				hedge_budget_seen = TRUE;
+				for(p = q; *p != '\0'; p++)
+					if(!isdigit(*p)) break;
+				if(*p != '\0' || atoi(q) > 100) {
 					config_error(
 						line,
-						"cannot allocate memory");
+						"invalid hedge budget '%s'",
+						q);
 					errors++;
 					break;
 				}
-				strcpy(p, q);
-				config->domain = p;
+				config->hedge_budget = atoi(q);
 				break;
 
-			case CMD_REFER_INTERFACE:
+			case CMD_REFER_DEADLINE:
 				if(r != (PUCHAR) NULL) {
 					config_error(
 						line,
@@ -290,34 +458,45 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 				if(q == (PUCHAR) NULL) {
 					config_error(
 						line,
-						"no interface name after "
-						"REFER_INTERFACE command");
+						"no time after "
+						"REFER_DEADLINE command");
 					errors++;
 					break;
 				}
-				if(refer_interface_seen == TRUE) {
+				if(refer_deadline_seen == TRUE) {
 					config_error(
 						line,
-						"only one REFER_INTERFACE "
+						"only one REFER_DEADLINE "
 						"command permitted");
 					errors++;
 					break;
 				}
-				refer_interface_seen = TRUE;
-				p = malloc(strlen(q)+1);
-				if(p == (PUCHAR) NULL) {
+				refer_deadline_seen = TRUE;
+				for(p = q; *p != '\0'; p++)
+					if(!isdigit(*p)) break;
+				if(*p != '\0' || atoi(q) == 0 || strlen(q) > 4 ||
+				   atoi(q) > MAX_REFER_DEADLINE) {
 					config_error(
 						line,
-						"cannot allocate memory");
+						"invalid referral deadline '%s'",
+						q);
 					errors++;
 					break;
 				}
-				strcpy(p, q);
-				config->refer_interface = p;
+				config->refer_deadline = atoi(q);
 				break;
 
-			case CMD_REFER_SERVERS:
-				process_servers(config, q, r, line, &errors);
+			case CMD_VIEW_ZONE_FILE:
+				temp = strtok(NULL, " \t");
+				v = find_view(config, q, line, &errors);
+				if(v == (PVIEW) NULL) break;
+				process_zonefile(
+					&v->zonefiles,
+					r,
+					temp,
+					etcdir,
+					line,
+					&errors);
 				break;
 
 			default:
@@ -432,6 +611,650 @@ static VOID process_servers(PCONFIG config, PUCHAR if_addr, PUCHAR if_mask,
 }
 
 
+/*
+ * Process a HEALTH_CHECK command.
+ *
+ */
+
+static VOID process_health(PCONFIG config, PUCHAR type, PUCHAR port,
+				INT line, PINT errors)
+{	PUCHAR p;
+	INT interval;
+
+	if(config->health_type != HEALTH_NONE) {
+		config_error(
+			line,
+			"only one HEALTH_CHECK command permitted");
+		(*errors)++;
+		return;
+	}
+
+	if(type == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no probe type after HEALTH_CHECK command");
+		(*errors)++;
+		return;
+	}
+
+	if(port == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no port number after probe type");
+		(*errors)++;
+		return;
+	}
+
+	for(p = port; *p != '\0'; p++) {
+		if(!isdigit(*p)) {
+			config_error(
+				line,
+				"invalid port number '%s'",
+				port);
+			(*errors)++;
+			return;
+		}
+	}
+
+	/* The probe interval is optional */
+
+	interval = DEFAULT_HEALTH_INTERVAL;
+	p = strtok(NULL, " \t");
+	if(p != (PUCHAR) NULL) {
+		interval = atoi(p);
+		if(interval <= 0) {
+			config_error(
+				line,
+				"invalid probe interval '%s'",
+				p);
+			(*errors)++;
+			return;
+		}
+		p = strtok(NULL, " \t");
+		if(p != (PUCHAR) NULL) {
+			config_error(
+				line,
+				"syntax error (extra on end)");
+			(*errors)++;
+			return;
+		}
+	}
+
+	if(stricmp(type, "TCP") == 0)
+		config->health_type = HEALTH_TCP;
+	else if(stricmp(type, "UDP") == 0)
+		config->health_type = HEALTH_UDP;
+	else {
+		config_error(
+			line,
+			"invalid probe type '%s' (must be TCP or UDP)",
+			type);
+		(*errors)++;
+		return;
+	}
+	config->health_port = htons((USHORT) atoi(port));
+	config->health_interval = interval;
+}
+
+
+/*
+ * Process an AUTH_NETWORK command. The network mask is optional; if it is
+ * omitted, the one given by the AUTH_NETMASK command is used.
+ *
+ */
+
+static VOID process_authnet(PCONFIG config, PUCHAR network, PUCHAR mask,
+				INT line, PINT errors)
+{	INT len = -1;
+	PAUTHNET an, *pan;
+	INADDR addr, m;
+
+	if(network == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no network address after AUTH_NETWORK command");
+		(*errors)++;
+		return;
+	}
+
+	if(mask != (PUCHAR) NULL && strtok(NULL, " \t") != NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	addr.s_addr = inet_addr(network);
+	if(addr.s_addr == INADDR_NONE) {
+		config_error(
+			line,
+			"malformed network address '%s'",
+			network);
+		(*errors)++;
+		return;
+	}
+
+	if(mask != (PUCHAR) NULL) {
+		m.s_addr = inet_addr(mask);
+		len = radix_masklen(m);
+		if(len < 0) {
+			config_error(
+				line,
+				"malformed network mask '%s'",
+				mask);
+			(*errors)++;
+			return;
+		}
+	}
+
+	an = (PAUTHNET) calloc(1, sizeof(AUTHNET));
+	if(an == (PAUTHNET) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+	an->network = addr;
+	an->masklen = len;
+
+	/* Add to the end of the chain */
+
+	pan = &config->authnets;
+	while(*pan != (PAUTHNET) NULL) pan = &(*pan)->next;
+	*pan = an;
+}
+
+
+/*
+ * Process an AUTH_DOMAIN command. The first domain given also becomes the
+ * default domain, which is added to names in the HOSTS file that do not
+ * already have one.
+ *
+ */
+
+static VOID process_authdom(PCONFIG config, PUCHAR domain, INT line,
+				PINT errors)
+{	INT len;
+	PAUTHDOM ad, *pad;
+
+	if(domain == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no domain after AUTH_DOMAIN command");
+		(*errors)++;
+		return;
+	}
+
+	for(pad = &config->authdoms; *pad != (PAUTHDOM) NULL;
+	    pad = &(*pad)->next) {
+		if(name_same((*pad)->name, domain) == TRUE) {
+			config_error(
+				line,
+				"domain '%s' is already given",
+				domain);
+			(*errors)++;
+			return;
+		}
+	}
+
+	ad = (PAUTHDOM) calloc(1, sizeof(AUTHDOM));
+	if(ad != (PAUTHDOM) NULL) ad->name = malloc(strlen(domain)+1);
+	if(ad == (PAUTHDOM) NULL || ad->name == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+	strcpy(ad->name, domain);
+	len = strlen(ad->name);
+	if(len > 1 && ad->name[len-1] == '.')
+		ad->name[len-1] = '\0';	/* Remove any trailing dot */
+
+	if(config->authdoms == (PAUTHDOM) NULL) config->domain = ad->name;
+	*pad = ad;
+}
+
+
+/*
+ * Process an EMPTY_ZONE or NO_EMPTY_ZONE command. The first adds a zone
+ * to the empty zones; the second stops one of the built in empty zones
+ * being used, or all of them (and the treatment of single label names as
+ * empty) if the zone is given as '*'.
+ *
+ */
+
+static VOID process_empty(PCONFIG config, INT cmd, PUCHAR zone, PUCHAR extra,
+				INT line, PINT errors)
+{	INT len;
+	PAUTHDOM ad;
+
+	if(zone == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no zone name given");
+		(*errors)++;
+		return;
+	}
+
+	if(extra != (PUCHAR) NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	if(cmd == CMD_NO_EMPTY_ZONE && strcmp(zone, "*") == 0) {
+		config->empty_builtin = FALSE;
+		return;
+	}
+
+	ad = (PAUTHDOM) calloc(1, sizeof(AUTHDOM));
+	if(ad != (PAUTHDOM) NULL) ad->name = malloc(strlen(zone)+1);
+	if(ad == (PAUTHDOM) NULL || ad->name == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+	strcpy(ad->name, zone);
+	len = strlen(ad->name);
+	if(len > 1 && ad->name[len-1] == '.')
+		ad->name[len-1] = '\0';	/* Remove any trailing dot */
+
+	if(cmd == CMD_EMPTY_ZONE) {
+		ad->next = config->emptyzones;
+		config->emptyzones = ad;
+	} else {
+		ad->next = config->emptyoff;
+		config->emptyoff = ad;
+	}
+}
+
+
+/*
+ * Process a REPLICA command. This gives the address of a server that may
+ * transfer our zones, and that is sent a NOTIFY when they change.
+ *
+ */
+
+static VOID process_replica(PCONFIG config, PUCHAR address, PUCHAR extra,
+				INT line, PINT errors)
+{	PREPLICA rp, *prp;
+	INADDR addr;
+
+	if(address == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no address after REPLICA command");
+		(*errors)++;
+		return;
+	}
+
+	if(extra != (PUCHAR) NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	addr.s_addr = inet_addr(address);
+	if(addr.s_addr == INADDR_NONE) {
+		config_error(
+			line,
+			"malformed address '%s'",
+			address);
+		(*errors)++;
+		return;
+	}
+
+	rp = (PREPLICA) calloc(1, sizeof(REPLICA));
+	if(rp == (PREPLICA) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+	rp->address = addr;
+
+	/* Add to the end of the chain */
+
+	prp = &config->replicas;
+	while(*prp != (PREPLICA) NULL) prp = &(*prp)->next;
+	*prp = rp;
+}
+
+
+/*
+ * Process a SECONDARY command. This gives a zone to be copied from another
+ * server, and the address of that server.
+ *
+ */
+
+static VOID process_secondary(PCONFIG config, PUCHAR origin, PUCHAR address,
+				INT line, PINT errors)
+{	INT len;
+	PSECONDARY sec, *psec;
+
+	if(origin == (PUCHAR) NULL || address == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"SECONDARY command needs a zone name and an address");
+		(*errors)++;
+		return;
+	}
+
+	if(strtok(NULL, " \t") != NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	sec = (PSECONDARY) calloc(1, sizeof(SECONDARY));
+	if(sec != (PSECONDARY) NULL) sec->origin = malloc(strlen(origin)+1);
+	if(sec == (PSECONDARY) NULL || sec->origin == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+	strcpy(sec->origin, origin);
+	len = strlen(sec->origin);
+	if(len > 1 && sec->origin[len-1] == '.')
+		sec->origin[len-1] = '\0';	/* Remove any trailing dot */
+
+	sec->primary.s_addr = inet_addr(address);
+	if(sec->primary.s_addr == INADDR_NONE) {
+		config_error(
+			line,
+			"malformed address '%s'",
+			address);
+		(*errors)++;
+		return;
+	}
+
+	for(psec = &config->secondaries; *psec != (PSECONDARY) NULL;
+	    psec = &(*psec)->next) {
+		if(name_same((*psec)->origin, sec->origin) == TRUE) {
+			config_error(
+				line,
+				"secondary zone '%s' is already given",
+				origin);
+			(*errors)++;
+			return;
+		}
+	}
+	*psec = sec;
+}
+
+
+/*
+ * Process a ZONE_FILE command, or the end of a VIEW_ZONE_FILE command.
+ * The new zone file is added to the end of the chain at 'chain'.
+ *
+ */
+
+static VOID process_zonefile(PZONEFILE *chain, PUCHAR origin, PUCHAR file,
+				PUCHAR dir, INT line, PINT errors)
+{	INT len;
+	PZONEFILE zf;
+
+	if(origin == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no zone name in zone file command");
+		(*errors)++;
+		return;
+	}
+
+	if(file == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no file name after zone name");
+		(*errors)++;
+		return;
+	}
+
+	if(strtok(NULL, " \t") != NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	zf = (PZONEFILE) malloc(sizeof(ZONEFILE));
+	if(zf != (PZONEFILE) NULL) {
+		zf->origin = malloc(strlen(origin)+1);
+		zf->filename = make_path(dir, file);
+	}
+	if(zf == (PZONEFILE) NULL ||
+	   zf->origin == (PUCHAR) NULL ||
+	   zf->filename == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+
+	strcpy(zf->origin, origin);
+	len = strlen(zf->origin);
+	if(len > 0 && zf->origin[len-1] == '.')
+		zf->origin[len-1] = '\0';	/* Remove any trailing dot */
+
+	/* Add to the end of the chain, so that files are loaded in
+	   the order given */
+
+	zf->next = (PZONEFILE) NULL;
+	while(*chain != (PZONEFILE) NULL) chain = &(*chain)->next;
+	*chain = zf;
+}
+
+
+/*
+ * Process a VIEW command. This defines a view if it is not already
+ * defined, and adds a client address prefix to it.
+ *
+ */
+
+static VOID process_view(PCONFIG config, PUCHAR name, PUCHAR network,
+				INT line, PINT errors)
+{	INT len;
+	PUCHAR p;
+	PVIEW v;
+	INADDR addr, mask;
+
+	if(name == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no view name after VIEW command");
+		(*errors)++;
+		return;
+	}
+
+	p = strtok(NULL, " \t");		/* Mask */
+	if(network == (PUCHAR) NULL || p == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"missing network address or mask");
+		(*errors)++;
+		return;
+	}
+
+	addr.s_addr = inet_addr(network);
+	if(addr.s_addr == INADDR_NONE) {
+		config_error(
+			line,
+			"malformed network address %s",
+			network);
+		(*errors)++;
+		return;
+	}
+
+	mask.s_addr = inet_addr(p);
+	len = radix_masklen(mask);
+	if(len < 0) {
+		config_error(
+			line,
+			"malformed network mask %s",
+			p);
+		(*errors)++;
+		return;
+	}
+
+	if(strtok(NULL, " \t") != NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	/* Find the view, or make a new one */
+
+	for(v = config->views; v != (PVIEW) NULL; v = v->next)
+		if(stricmp(v->name, name) == 0) break;
+
+	if(v == (PVIEW) NULL) {
+		v = (PVIEW) calloc(1, sizeof(VIEW));
+		if(v != (PVIEW) NULL) v->name = malloc(strlen(name)+1);
+		if(v == (PVIEW) NULL || v->name == (PUCHAR) NULL) {
+			config_error(
+				line,
+				"cannot allocate memory");
+			(*errors)++;
+			return;
+		}
+		strcpy(v->name, name);
+		v->index = config->nviews++;
+		v->next = config->views;
+		config->views = v;
+	}
+
+	if(config->viewtab == (PRADIX) NULL)
+		config->viewtab = radix_new();
+	if(config->viewtab == (PRADIX) NULL ||
+	   radix_add(config->viewtab, addr, len, (PVOID) v) == FALSE) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+		return;
+	}
+}
+
+
+/*
+ * Process a VIEW_HOSTS command.
+ *
+ */
+
+static VOID process_view_hosts(PCONFIG config, PUCHAR name, PUCHAR file,
+				PUCHAR dir, INT line, PINT errors)
+{	PVIEW v;
+
+	v = find_view(config, name, line, errors);
+	if(v == (PVIEW) NULL) return;
+
+	if(file == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no file name after view name");
+		(*errors)++;
+		return;
+	}
+
+	if(strtok(NULL, " \t") != NULL) {
+		config_error(
+			line,
+			"syntax error (extra on end)");
+		(*errors)++;
+		return;
+	}
+
+	if(v->hostsfile != (PUCHAR) NULL) {
+		config_error(
+			line,
+			"only one VIEW_HOSTS command permitted for each view");
+		(*errors)++;
+		return;
+	}
+
+	v->hostsfile = make_path(dir, file);
+	if(v->hostsfile == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"cannot allocate memory");
+		(*errors)++;
+	}
+}
+
+
+/*
+ * Find a view that has already been defined by a VIEW command.
+ *
+ * Returns a pointer to the view, or NULL (after issuing an error message)
+ * if it has not been defined.
+ *
+ */
+
+static PVIEW find_view(PCONFIG config, PUCHAR name, INT line, PINT errors)
+{	PVIEW v;
+
+	if(name == (PUCHAR) NULL) {
+		config_error(
+			line,
+			"no view name given");
+		(*errors)++;
+		return(PVIEW) NULL;
+	}
+
+	for(v = config->views; v != (PVIEW) NULL; v = v->next)
+		if(stricmp(v->name, name) == 0) return(v);
+
+	config_error(
+		line,
+		"view '%s' has not been defined by a VIEW command",
+		name);
+	(*errors)++;
+
+	return(PVIEW) NULL;
+}
+
+
+/*
+ * Build the full name of a file. A relative file name is taken to be in
+ * the directory 'dir' (which ends with a path separator).
+ *
+ * Returns a pointer to the full name, or NULL if memory ran out.
+ *
+ */
+
+static PUCHAR make_path(PUCHAR dir, PUCHAR file)
+{	PUCHAR p = malloc(strlen(dir)+strlen(file)+1);
+
+	if(p == (PUCHAR) NULL) return(PUCHAR) NULL;
+
+	if(file[0] == '\\' || file[0] == '/' || file[1] == ':')
+		p[0] = '\0';		/* Already a full path */
+	else
+		strcpy(p, dir);
+	strcat(p, file);
+
+	return(p);
+}
+
+
 /*
  * Check command in 's' for validity, and return command code.
  * Case is immaterial.
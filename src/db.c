@@ -9,46 +9,202 @@
  *
  */
 
+/*
+ * Names are held in a tree of labels, rooted at the DNS root, so that
+ * 'www.abc.com' is the node 'www' below the node 'abc' below the node
+ * 'com'. Nodes are not linked to their children; instead, every node is
+ * entered in a single hash table, keyed on its parent node and its label.
+ * Looking up a name is then one hash probe per label, working from the
+ * rightmost label leftwards.
+ *
+ * A node whose label is '*' is a wildcard, and is also linked from its
+ * parent. If a lookup runs out of nodes before the whole name has been
+ * matched, the last node found is the closest enclosing name; if that
+ * has a wildcard child, the wildcard entries are the answer.
+ *
+ * Host entries do not hold a copy of their name; each points to its node
+ * in the tree, and the name is rebuilt from the labels when it is needed
+ * for a reply. Since most names in a HOSTS file end in the same domain,
+ * the labels for that domain are then only stored once, rather than once
+ * for every entry.
+ *
+ * Names given as text may contain escapes, as made by 'dn_expand': '\.'
+ * is a '.' within a label, '\\' is a '\', and '\DDD' is the byte with
+ * decimal value DDD. Labels are held in the tree without the escapes, as
+ * they are in a packet, and escapes are put back when a name is rebuilt.
+ *
+ * IPv4 addresses are indexed for reverse lookups by a hash table, with
+ * open addressing, that holds the latest entry for each address.
+ *
+ * IPv6 addresses are indexed for reverse lookups by a tree with one level
+ * per nibble (half byte) of the address, which is also the order of the
+ * labels in an ip6.arpa name. Each node holds only the children that are
+ * actually present, with a bit map showing which they are, so addresses
+ * that share a prefix (as most local ones will) share nodes too.
+ *
+ */
+
 #pragma	strings(readonly)
 
 #include "named.h"
 #include "log.h"
 
-#pragma	alloc_text(init_seg, db_init)
-#pragma	alloc_text(init_seg, db_add_host)
+#define	INITIAL_HASHSIZE	256	/* Initial size of node hash table */
+#define	INITIAL_ADDRSIZE	64	/* Initial size of address table */
+#define	NIBBLES			(IN6ADDRSZ*2)	/* Nibbles in IPv6 address */
+
+/* Get nibble 'i' of an IPv6 address, counting from the most significant */
+
+#define	NIBBLE_OF(a, i)	(((a)[(i)/2] >> (((i) & 1) ? 0 : 4)) & 0x0f)
+
+/* Combine the hash of a label with its parent node, to give the hash of a
+   node in the tree */
+
+#define	NODE_HASH(parent, lhash)	(((lhash) ^ (ULONG) (parent)) * 16777619UL)
+
+/* Hash of an IPv4 address, for the address table */
+
+#define	ADDR_HASH(a)	(((a) ^ ((a) >> 16)) * 0x45d9f3bUL)
+
+/* Forward references */
+
+static	BOOL		addr_add(PDB, PDBENT, BOOL);
+static	PDBENT		addr_find(PDB, INADDR);
+static	PNAMENODE	find_node(PDB, PNAMENODE, PUCHAR, INT, ULONG);
+static	VOID		free_nibble(PNIBBLE);
+static	VOID		free_rrs(PRR);
+static	INT		get_label(PUCHAR, PUCHAR *, PUCHAR, PUCHAR *);
+static	BOOL		grow_hash(PDB);
+static	PNAMENODE	lookup(PDB, PUCHAR);
+static	PNIBBLE		new_nibble(VOID);
+static	PNAMENODE	new_node(PDB, PNAMENODE, PUCHAR, INT);
+static	PUCHAR		name_end(PUCHAR);
+static	INT		nibble_index(USHORT, INT);
+static	PNAMENODE	qlookup(PDB, PQNAME);
+static	BOOL		rev6_add(PDB, PDBENT);
+static	PNIBBLE		rev6_find(PNIBBLE, PUCHAR);
+static	BOOL		same_entries(PDBENT, PDBENT);
+static	BOOL		same_name(PNAMENODE, PNAMENODE);
+
+/* Local storage */
+
+static	const UCHAR	bitcount[16] =	/* Number of bits set in a nibble */
+	{ 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
 
 
 /*
- * Initialise the in-memory database.
+ * Create and initialise an in-memory database. If 'parent' is not NULL,
+ * the new database is an overlay on it; anything not found in the new
+ * database is looked for in the parent.
  *
- * Returns:
- *	TRUE		initialised OK
- *	FALSE		failed to initialise
+ * Returns a pointer to the new database, or NULL if it could not be
+ * created.
  *
  */
 
-BOOL db_init(PCONFIG config)
-{	config->dbhead = (PDBENT) NULL;
-	return(TRUE);
+PDB db_init(PDB parent)
+{	PDB db;
+
+	db = (PDB) malloc(sizeof(DB));
+	if(db == (PDB) NULL) return(PDB) NULL;
+
+	db->parent = parent;
+	db->head = (PDBENT) NULL;
+	db->nnodes = 0;
+	db->rev6 = (PNIBBLE) NULL;
+	db->addrtab = (PDBENT *) NULL;
+	db->addrsize = 0;
+	db->naddrs = 0;
+	db->namebytes = 0;
+	db->nodebytes = 0;
+	db->self = (PDBENT) NULL;
+	db->inherit = FALSE;
+	db->hashsize = INITIAL_HASHSIZE;
+	db->hashtab = (PNAMENODE *) calloc(db->hashsize, sizeof(PNAMENODE));
+	if(db->hashtab == (PNAMENODE *) NULL) return(PDB) NULL;
+
+	db->root = (PNAMENODE) calloc(1, sizeof(NAMENODE));
+	if(db->root == (PNAMENODE) NULL) return(PDB) NULL;
+
+	return(db);
+}
+
+
+/*
+ * Free an in-memory database, and everything in it. Entries that an
+ * overlay database shares with its parent belong to the parent, so they
+ * are not touched.
+ *
+ */
+
+VOID db_free(PDB db)
+{	ULONG i;
+	PNAMENODE node, next;
+	PDBENT p, pnext;
+
+	for(p = db->head; p != (PDBENT) NULL; p = pnext) {
+		pnext = p->next;
+		free(p->ptr);
+		free(p);
+	}
+
+	for(i = 0; i < db->hashsize; i++) {
+		for(node = db->hashtab[i]; node != (PNAMENODE) NULL; node = next) {
+			next = node->hnext;
+			free_rrs(node->rrs);
+			free(node->answers[0]);
+			free(node->answers[1]);
+			free(node);
+		}
+	}
+
+	free_rrs(db->root->rrs);
+	free(db->root);
+	free(db->hashtab);
+	free(db->addrtab);
+	free_nibble(db->rev6);
+	free(db);
 }
 
 
 /*
- * Add a new host entry to the in-memory database.
+ * Add a new host entry, with the given name, to the in-memory database.
  *
  * Returns TRUE if the addition succeeded, and FALSE if it failed.
  *
  */
 
-BOOL db_add_host(PCONFIG config, PDBENT entry)
-{	entry->next = config->dbhead;
-	config->dbhead = entry;
+BOOL db_add_host(PDB db, PUCHAR name, PDBENT entry)
+{	PNAMENODE node;
+	PDBENT *pp;
+
+	node = db_add_name(db, name);
+	if(node == (PNAMENODE) NULL) return(FALSE);
+	entry->node = node;
+	db->namebytes += strlen(name) + 1;
+
+	/* Add to the end of the list for this name, so that entries
+	   are given out in the order they appear in the HOSTS file */
+
+	for(pp = &node->entries; *pp != (PDBENT) NULL; pp = &(*pp)->same) ;
+	*pp = entry;
+	entry->same = (PDBENT) NULL;
+
+	if(entry->type == ENT_TYPE_PRIMARY6 && rev6_add(db, entry) == FALSE)
+		return(FALSE);
+	if(entry->type == ENT_TYPE_PRIMARY &&
+	   addr_add(db, entry, TRUE) == FALSE)
+		return(FALSE);
+
+	entry->next = db->head;
+	db->head = entry;
 #ifdef	DEBUG
 	trace(
 		"add host: at %08x; %s; type: %s",
 		(ULONG) entry,
-		entry->name,
+		name,
 		entry->type == ENT_TYPE_PRIMARY     ? "primary" :
+		entry->type == ENT_TYPE_PRIMARY6    ? "primary (IPv6)" :
 		entry->type == ENT_TYPE_ALIAS       ? "alias"   :
 						      "????");
 	if(entry->type == ENT_TYPE_PRIMARY)
@@ -65,21 +221,199 @@ BOOL db_add_host(PCONFIG config, PDBENT entry)
 }
 
 
+/*
+ * Add a resource record from a zone file to the in-memory database.
+ * Records of the same type are kept together, in the order in which
+ * they were added.
+ *
+ * Returns TRUE if the addition succeeded, and FALSE if it failed.
+ *
+ */
+
+BOOL db_add_rr(PDB db, PUCHAR owner, PRR rr)
+{	PNAMENODE node;
+	PRR *pp, *last;
+
+	node = db_add_name(db, owner);
+	if(node == (PNAMENODE) NULL) return(FALSE);
+
+	last = (PRR *) NULL;
+	for(pp = &node->rrs; *pp != (PRR) NULL; pp = &(*pp)->next)
+		if((*pp)->type == rr->type) last = &(*pp)->next;
+	if(last == (PRR *) NULL) last = pp;
+
+	rr->next = *last;
+	*last = rr;
+#ifdef	DEBUG
+	trace(
+		"add rr: %s; type %d; rdlength %d",
+		owner,
+		rr->type,
+		rr->rdlength);
+#endif
+	return(TRUE);
+}
+
+
+/*
+ * Remove from an overlay database any names whose entries are exactly
+ * the same as those for the same name in the parent database. Lookups
+ * will then find the parent's entries instead, so that records which are
+ * the same in every view are only stored once.
+ *
+ * Returns the number of entries removed.
+ *
+ */
+
+INT db_share(PDB db)
+{	ULONG i;
+	INT n = 0;
+	PNAMENODE node, pnode;
+	PNIBBLE nib;
+	PDBENT p, next, *pp;
+	UCHAR name[MAXDNAME+1];
+
+	/* Find the names to share, and mark their entries */
+
+	for(i = 0; i < db->hashsize; i++) {
+		for(node = db->hashtab[i];
+		    node != (PNAMENODE) NULL;
+		    node = node->hnext) {
+			if(node->entries == (PDBENT) NULL) continue;
+			pnode = db_find_node(
+					db->parent,
+					db_node_name(node, name));
+			if(pnode == (PNAMENODE) NULL ||
+			   pnode->entries == (PDBENT) NULL ||
+			   same_name(pnode, node) == FALSE ||
+			   same_entries(node->entries, pnode->entries) == FALSE ||
+			   same_entries(pnode->entries, node->entries) == FALSE)
+				continue;
+			for(p = node->entries; p != (PDBENT) NULL; p = p->same)
+				p->type |= ENT_TYPE_SHARED;
+			node->entries = (PDBENT) NULL;
+		}
+	}
+
+	/* Point any remaining aliases for shared names at the parent's
+	   entries instead */
+
+	for(p = db->head; p != (PDBENT) NULL; p = p->next) {
+		if(p->type != ENT_TYPE_ALIAS) continue;
+		if((p->primary->type & ENT_TYPE_SHARED) == 0) continue;
+		p->primary = db_find_name(
+				db->parent,
+				db_node_name(p->primary->node, name));
+	}
+
+	/* Now remove the marked entries, taking IPv6 ones out of the
+	   reverse index so that the parent's are found instead; the IPv4
+	   address table is built again afterwards */
+
+	pp = &db->head;
+	for(p = db->head; p != (PDBENT) NULL; p = next) {
+		next = p->next;
+		if((p->type & ENT_TYPE_SHARED) == 0) {
+			*pp = p;
+			pp = &p->next;
+			continue;
+		}
+		if(p->type == (ENT_TYPE_PRIMARY6 | ENT_TYPE_SHARED)) {
+			nib = rev6_find(db->rev6, p->address6);
+			if(nib != (PNIBBLE) NULL && nib->entry == p)
+				nib->entry = (PDBENT) NULL;
+		}
+		free(p);
+		n++;
+	}
+	*pp = (PDBENT) NULL;
+
+	if(n != 0 && db->addrtab != (PDBENT *) NULL) {
+		memset(db->addrtab, 0, db->addrsize*sizeof(PDBENT));
+		db->naddrs = 0;
+		for(p = db->head; p != (PDBENT) NULL; p = p->next)
+			if(p->type == ENT_TYPE_PRIMARY)
+				(VOID) addr_add(db, p, FALSE);
+	}
+
+	return(n);
+}
+
+
 /*
  * Search the in-memory database for a record that matches a name.
+ * If there is no exact match, a wildcard entry at the closest enclosing
+ * name is used if there is one.
+ *
+ * Further records for the same name are found using 'db_find_next_name'.
+ *
+ */
+
+PDBENT db_find_name(PDB db, PUCHAR name)
+{	PNAMENODE node = db_find_node(db, name);
+
+	return(node == (PNAMENODE) NULL ? (PDBENT) NULL : node->entries);
+}
+
+
+/*
+ * Search the name tree for the node that matches a name. If there is no
+ * exact match, the wildcard node at the closest enclosing name is
+ * returned if there is one.
+ *
+ * For an overlay database, the first node found that has any data is
+ * used, working back through the parent databases. If none has data,
+ * a node with no data (one that only exists because it encloses other
+ * names) may be returned.
  *
  */
 
-PDBENT db_find_name(PCONFIG config, PUCHAR name)
-{	PDBENT p = config->dbhead;
+PNAMENODE db_find_node(PDB db, PUCHAR name)
+{	PNAMENODE node, found = (PNAMENODE) NULL;
 
-	while(p != (PDBENT) NULL) {
-		if(stricmp(p->name, name) == 0)
-			return(p);
-		p = p->next;
+	for(; db != (PDB) NULL; db = db->parent) {
+		node = lookup(db, name);
+		if(node == (PNAMENODE) NULL) continue;
+		if(node->entries != (PDBENT) NULL || node->rrs != (PRR) NULL)
+			return(node);
+		if(found == (PNAMENODE) NULL) found = node;
 	}
 
-	return(PDBENT) NULL;
+	return(found);
+}
+
+
+/*
+ * Search the name tree for the node that matches a name from a query,
+ * already split into labels. This works in the same way as 'db_find_node',
+ * but uses the labels where they are in the packet, and their hashes.
+ *
+ */
+
+PNAMENODE db_find_qname(PDB db, PQNAME qn)
+{	PNAMENODE node, found = (PNAMENODE) NULL;
+
+	for(; db != (PDB) NULL; db = db->parent) {
+		node = qlookup(db, qn);
+		if(node == (PNAMENODE) NULL) continue;
+		if(node->entries != (PDBENT) NULL || node->rrs != (PRR) NULL)
+			return(node);
+		if(found == (PNAMENODE) NULL) found = node;
+	}
+
+	return(found);
+}
+
+
+/*
+ * Continue a search of the in-memory database for records that match a
+ * name; 'prev' is the record previously found. There may be several,
+ * since the same name can appear on more than one line of the HOSTS file.
+ *
+ */
+
+PDBENT db_find_next_name(PDBENT prev)
+{	return(prev->same);
 }
 
 
@@ -88,19 +422,593 @@ PDBENT db_find_name(PCONFIG config, PUCHAR name)
  *
  */
 
-PDBENT db_find_address(PCONFIG config, INADDR address)
-{	PDBENT p = config->dbhead;
+PDBENT db_find_address(PDB db, INADDR address)
+{	PDBENT p;
+
+	for(; db != (PDB) NULL; db = db->parent) {
+		p = addr_find(db, address);
+		if(p != (PDBENT) NULL) return(p);
+	}
+
+	return(PDBENT) NULL;
+}
+
+
+/*
+ * Search the in-memory database for a record that matches an IPv6
+ * address, using the reverse index.
+ *
+ */
+
+PDBENT db_find_address6(PDB db, PUCHAR address)
+{	PNIBBLE node;
 
-	while(p != (PDBENT) NULL) {
-		if(p->type == ENT_TYPE_PRIMARY &&
-		   p->address.s_addr == address.s_addr)
-			return(p);
-		p = p->next;
+	for(; db != (PDB) NULL; db = db->parent) {
+		node = rev6_find(db->rev6, address);
+		if(node != (PNIBBLE) NULL && node->entry != (PDBENT) NULL)
+			return(node->entry);
 	}
 
 	return(PDBENT) NULL;
 }
 
+
+/*
+ * Build the full name of a node in the name tree, without a trailing
+ * dot; the root is an empty string. Any '.' or '\' in a label is escaped.
+ * 'buf' must have room for MAXDNAME+1 characters.
+ *
+ * Returns 'buf'.
+ *
+ */
+
+PUCHAR db_node_name(PNAMENODE node, PUCHAR buf)
+{	INT i;
+	UCHAR c;
+	PUCHAR p = buf;
+
+	for(; node != (PNAMENODE) NULL && node->parent != (PNAMENODE) NULL;
+	    node = node->parent) {
+		if(p + node->len + 1 > buf + MAXDNAME) break;
+		if(p != buf) *p++ = '.';
+		for(i = 0; i < node->len; i++) {
+			c = node->label[i];
+			if(c == '.' || c == '\\') {
+				if(p + node->len - i + 1 > buf + MAXDNAME) break;
+				*p++ = '\\';
+			}
+			*p++ = c;
+		}
+	}
+	*p = '\0';
+
+	return(buf);
+}
+
+
+/*
+ * Check that a name given as text can be entered in the name tree: that
+ * each label, without its escapes, is between 1 and MAXLABEL characters
+ * long. This should be used on names read from files, so that bad ones
+ * can be reported, before 'db_add_name' or 'db_add_host'.
+ *
+ * Returns TRUE if the name is valid, FALSE if not.
+ *
+ */
+
+BOOL db_check_name(PUCHAR name)
+{	PUCHAR end, label;
+	UCHAR buf[MAXLABEL];
+
+	end = name_end(name);
+	while(end > name) {
+		if(get_label(name, &end, buf, &label) < 0) return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Find the node for a name in the name tree, creating it (and any
+ * enclosing names) if necessary.
+ *
+ * Returns a pointer to the node, or NULL if the name is malformed (see
+ * 'db_check_name') or memory ran out.
+ *
+ */
+
+PNAMENODE db_add_name(PDB db, PUCHAR name)
+{	INT len;
+	PNAMENODE node, child;
+	PUCHAR end, label;
+	UCHAR buf[MAXLABEL];
+
+	end = name_end(name);
+	node = db->root;
+	while(end > name) {
+		len = get_label(name, &end, buf, &label);
+		if(len < 0) return(PNAMENODE) NULL;
+		child = find_node(db, node, label, len, name_hash(label, len));
+		if(child == (PNAMENODE) NULL) {
+			child = new_node(db, node, label, len);
+			if(child == (PNAMENODE) NULL) return(PNAMENODE) NULL;
+		}
+		node = child;
+	}
+
+	return(node);
+}
+
+
+/*
+ * Look up a name in the name tree of a single database. If there is no
+ * exact match, the wildcard node at the closest enclosing name is
+ * returned if there is one.
+ *
+ */
+
+static PNAMENODE lookup(PDB db, PUCHAR name)
+{	INT len;
+	PNAMENODE node, child;
+	PUCHAR end, label;
+	UCHAR buf[MAXLABEL];
+
+	end = name_end(name);
+	node = db->root;
+	while(end > name) {
+		len = get_label(name, &end, buf, &label);
+		if(len < 0) return(PNAMENODE) NULL;
+		child = find_node(db, node, label, len, name_hash(label, len));
+		if(child == (PNAMENODE) NULL) return(node->wild);
+		node = child;
+	}
+
+	return(node);
+}
+
+
+/*
+ * Find the end of a name given as text, leaving out any trailing dot
+ * (but not an escaped one).
+ *
+ */
+
+static PUCHAR name_end(PUCHAR name)
+{	INT n;
+	PUCHAR end = name + strlen(name);
+
+	if(end > name && end[-1] == '.') {
+		for(n = 0; end - 1 - n > name && end[-2-n] == '\\'; n++) ;
+		if(n % 2 == 0) end--;
+	}
+
+	return(end);
+}
+
+
+/*
+ * Get the last label of a name given as text, working leftwards from
+ * '*pend', which is moved back past the label and the dot before it.
+ * If the label has no escapes it is used where it is; otherwise, it is
+ * copied without them into 'buf', which has room for MAXLABEL characters.
+ *
+ *	name	points to the start of the name
+ *	pend	points to the end of the part of the name still to be used
+ *	buf	points to a buffer for the label, if needed
+ *	plabel	points to where to store a pointer to the label
+ *
+ * Returns the length of the label, or -1 if it is empty or longer than
+ * MAXLABEL.
+ *
+ */
+
+static INT get_label(PUCHAR name, PUCHAR *pend, PUCHAR buf, PUCHAR *plabel)
+{	INT n, len;
+	BOOL escapes = FALSE;
+	PUCHAR p, q, end = *pend;
+	UCHAR c;
+
+	/* Find the dot before the label; a dot preceded by an odd number of
+	   backslashes is part of the label */
+
+	for(p = end; p > name; p--) {
+		if(p[-1] == '\\') escapes = TRUE;
+		if(p[-1] != '.') continue;
+		for(n = 0; p - 1 - n > name && p[-2-n] == '\\'; n++) ;
+		if(n % 2 == 0) break;
+	}
+	*pend = p > name ? p - 1 : p;		/* Skip the dot */
+
+	if(escapes == FALSE) {
+		len = end - p;
+		*plabel = p;
+		return(len == 0 || len > MAXLABEL ? -1 : len);
+	}
+
+	for(len = 0, q = p; q < end; len++) {
+		c = *q++;
+		if(c == '\\' && q < end) {
+			if(q + 2 < end && isdigit(q[0]) &&
+			   isdigit(q[1]) && isdigit(q[2])) {
+				n = (q[0] - '0')*100 + (q[1] - '0')*10 + q[2] - '0';
+				if(n > 255) return(-1);
+				c = (UCHAR) n;
+				q += 3;
+			} else {
+				c = *q++;
+			}
+		}
+		if(len >= MAXLABEL) return(-1);
+		buf[len] = c;
+	}
+	*plabel = buf;
+
+	return(len == 0 ? -1 : len);
+}
+
+
+/*
+ * Look up a name from a query in the name tree of a single database, in
+ * the same way as 'lookup'.
+ *
+ */
+
+static PNAMENODE qlookup(PDB db, PQNAME qn)
+{	INT i;
+	PNAMENODE node, child;
+
+	node = db->root;
+	for(i = qn->nlabels - 1; i >= 0; i--) {
+		child = find_node(
+				db,
+				node,
+				qn->label[i] + 1,
+				qn->label[i][0],
+				qn->hash[i]);
+		if(child == (PNAMENODE) NULL) return(node->wild);
+		node = child;
+	}
+
+	return(node);
+}
+
+
+/*
+ * Find the child of 'parent' with the given label, if it exists; 'lhash'
+ * is the hash of the label.
+ *
+ */
+
+static PNAMENODE find_node(PDB db, PNAMENODE parent, PUCHAR label, INT len,
+				ULONG lhash)
+{	ULONG hash = NODE_HASH(parent, lhash);
+	PNAMENODE node;
+
+	for(node = db->hashtab[hash & (db->hashsize - 1)];
+	    node != (PNAMENODE) NULL;
+	    node = node->hnext) {
+		if(node->hash == hash &&
+		   node->parent == parent &&
+		   node->len == len &&
+		   name_equal(node->label, label, len) == TRUE)
+			return(node);
+	}
+
+	return(PNAMENODE) NULL;
+}
+
+
+/*
+ * Create a new child node of 'parent', with the given label.
+ *
+ * Returns a pointer to the node, or NULL if memory ran out.
+ *
+ */
+
+static PNAMENODE new_node(PDB db, PNAMENODE parent, PUCHAR label, INT len)
+{	PNAMENODE node;
+	ULONG slot;
+
+	if(db->nnodes >= db->hashsize*2) {	/* Keep chains short */
+		if(grow_hash(db) == FALSE) return(PNAMENODE) NULL;
+	}
+
+	node = (PNAMENODE) calloc(1, sizeof(NAMENODE) + len);
+	if(node == (PNAMENODE) NULL) return(PNAMENODE) NULL;
+
+	node->parent = parent;
+	node->len = (UCHAR) len;
+	memcpy(node->label, label, len);
+	node->hash = NODE_HASH(parent, name_hash(label, len));
+	db->nodebytes += sizeof(NAMENODE) + len;
+
+	slot = node->hash & (db->hashsize - 1);
+	node->hnext = db->hashtab[slot];
+	db->hashtab[slot] = node;
+	db->nnodes++;
+
+	if(len == 1 && label[0] == '*') parent->wild = node;
+
+	return(node);
+}
+
+
+/*
+ * Double the size of the node hash table.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL grow_hash(PDB db)
+{	ULONG i, newsize, slot;
+	PNAMENODE *newtab;
+	PNAMENODE node, next;
+
+	newsize = db->hashsize*2;
+	newtab = (PNAMENODE *) calloc(newsize, sizeof(PNAMENODE));
+	if(newtab == (PNAMENODE *) NULL) return(FALSE);
+
+	for(i = 0; i < db->hashsize; i++) {
+		for(node = db->hashtab[i]; node != (PNAMENODE) NULL; node = next) {
+			next = node->hnext;
+			slot = node->hash & (newsize - 1);
+			node->hnext = newtab[slot];
+			newtab[slot] = node;
+		}
+	}
+
+	free(db->hashtab);
+	db->hashtab = newtab;
+	db->hashsize = newsize;
+
+	return(TRUE);
+}
+
+
+/*
+ * Check that every entry in list 'a' has an exact counterpart in list 'b'.
+ *
+ */
+
+static BOOL same_entries(PDBENT a, PDBENT b)
+{	PDBENT p;
+
+	for(; a != (PDBENT) NULL; a = a->same) {
+		for(p = b; p != (PDBENT) NULL; p = p->same) {
+			if(p->type != a->type) continue;
+			if(a->type == ENT_TYPE_PRIMARY &&
+			   p->address.s_addr == a->address.s_addr) break;
+			if(a->type == ENT_TYPE_PRIMARY6 &&
+			   memcmp(p->address6, a->address6, IN6ADDRSZ) == 0)
+				break;
+			if(a->type == ENT_TYPE_ALIAS &&
+			   same_name(p->primary->node, a->primary->node) == TRUE)
+				break;
+		}
+		if(p == (PDBENT) NULL) return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Check whether two nodes, which may be in different databases, have the
+ * same name. The labels are compared working up towards the root.
+ *
+ */
+
+static BOOL same_name(PNAMENODE a, PNAMENODE b)
+{	for(; a != b; a = a->parent, b = b->parent) {
+		if(a == (PNAMENODE) NULL || b == (PNAMENODE) NULL) return(FALSE);
+		if(a->len != b->len ||
+		   name_equal(a->label, b->label, a->len) == FALSE)
+			return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Add an IPv4 entry to the address table. If the address is already
+ * there, the earlier entry is replaced if 'replace' is TRUE, and kept
+ * otherwise. The table is doubled in size when it becomes half full.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL addr_add(PDB db, PDBENT entry, BOOL replace)
+{	ULONG i, slot, oldsize;
+	ULONG a = entry->address.s_addr;
+	PDBENT *oldtab;
+
+	if((db->naddrs + 1)*2 > db->addrsize) {
+		oldtab = db->addrtab;
+		oldsize = db->addrsize;
+		db->addrsize = oldsize == 0 ? INITIAL_ADDRSIZE : oldsize*2;
+		db->addrtab = (PDBENT *) calloc(db->addrsize, sizeof(PDBENT));
+		if(db->addrtab == (PDBENT *) NULL) {
+			db->addrtab = oldtab;
+			db->addrsize = oldsize;
+			return(FALSE);
+		}
+		db->naddrs = 0;
+		for(i = 0; i < oldsize; i++)
+			if(oldtab[i] != (PDBENT) NULL)
+				(VOID) addr_add(db, oldtab[i], FALSE);
+		free(oldtab);
+	}
+
+	for(slot = ADDR_HASH(a) & (db->addrsize - 1);
+	    db->addrtab[slot] != (PDBENT) NULL;
+	    slot = (slot + 1) & (db->addrsize - 1)) {
+		if(db->addrtab[slot]->address.s_addr != a) continue;
+		if(replace == TRUE) db->addrtab[slot] = entry;
+		return(TRUE);
+	}
+	db->addrtab[slot] = entry;
+	db->naddrs++;
+
+	return(TRUE);
+}
+
+
+/*
+ * Find the entry for an IPv4 address in the address table.
+ *
+ * Returns a pointer to the entry, or NULL if there is none.
+ *
+ */
+
+static PDBENT addr_find(PDB db, INADDR address)
+{	ULONG slot;
+	PDBENT p;
+
+	if(db->addrtab == (PDBENT *) NULL) return(PDBENT) NULL;
+
+	for(slot = ADDR_HASH(address.s_addr) & (db->addrsize - 1);
+	    (p = db->addrtab[slot]) != (PDBENT) NULL;
+	    slot = (slot + 1) & (db->addrsize - 1))
+		if(p->address.s_addr == address.s_addr) return(p);
+
+	return(PDBENT) NULL;
+}
+
+
+/*
+ * Add an IPv6 entry to the reverse index. If the address is already
+ * there, the earlier entry is kept.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL rev6_add(PDB db, PDBENT entry)
+{	INT i, nib, idx, count;
+	PNIBBLE node, *pp;
+
+	pp = &db->rev6;
+	if(*pp == (PNIBBLE) NULL) {
+		*pp = new_nibble();
+		if(*pp == (PNIBBLE) NULL) return(FALSE);
+	}
+
+	for(i = 0; i < NIBBLES; i++) {
+		node = *pp;
+		nib = NIBBLE_OF(entry->address6, i);
+		idx = nibble_index(node->map, nib);
+
+		if((node->map & (1 << nib)) == 0) {
+
+			/* Make room for the new child, keeping the children
+			   in order of nibble value */
+
+			count = nibble_index(node->map, 16);
+			node = (PNIBBLE) realloc(
+					node,
+					sizeof(NIBBLE) + count*sizeof(PNIBBLE));
+			if(node == (PNIBBLE) NULL) return(FALSE);
+			*pp = node;
+			memmove(
+				&node->child[idx+1],
+				&node->child[idx],
+				(count - idx)*sizeof(PNIBBLE));
+			node->child[idx] = new_nibble();
+			if(node->child[idx] == (PNIBBLE) NULL) return(FALSE);
+			node->map |= 1 << nib;
+		}
+		pp = &node->child[idx];
+	}
+
+	if((*pp)->entry == (PDBENT) NULL) (*pp)->entry = entry;
+
+	return(TRUE);
+}
+
+
+/*
+ * Find the reverse index node for a complete IPv6 address.
+ *
+ * Returns a pointer to the node, or NULL if there is none.
+ *
+ */
+
+static PNIBBLE rev6_find(PNIBBLE node, PUCHAR address)
+{	INT i, nib;
+
+	for(i = 0; i < NIBBLES && node != (PNIBBLE) NULL; i++) {
+		nib = NIBBLE_OF(address, i);
+		if((node->map & (1 << nib)) == 0) return(PNIBBLE) NULL;
+		node = node->child[nibble_index(node->map, nib)];
+	}
+
+	return(node);
+}
+
+
+/*
+ * Given the map of children present in a reverse index node, find the
+ * position of the child for nibble value 'nib'; this is the number of
+ * children with lower values.
+ *
+ */
+
+static INT nibble_index(USHORT map, INT nib)
+{	map &= (USHORT) ((1UL << nib) - 1);
+
+	return(bitcount[map & 0x0f] + bitcount[(map >> 4) & 0x0f] +
+	       bitcount[(map >> 8) & 0x0f] + bitcount[(map >> 12) & 0x0f]);
+}
+
+
+/*
+ * Free a reverse index node, and all the nodes below it.
+ *
+ */
+
+static VOID free_nibble(PNIBBLE node)
+{	INT i, count;
+
+	if(node == (PNIBBLE) NULL) return;
+
+	count = nibble_index(node->map, 16);
+	for(i = 0; i < count; i++)
+		free_nibble(node->child[i]);
+	free(node);
+}
+
+
+/*
+ * Free a chain of resource records.
+ *
+ */
+
+static VOID free_rrs(PRR rr)
+{	PRR next;
+
+	for(; rr != (PRR) NULL; rr = next) {
+		next = rr->next;
+		free(rr);
+	}
+}
+
+
+/*
+ * Create a new, empty, reverse index node.
+ *
+ * Returns a pointer to the node, or NULL if memory ran out.
+ *
+ */
+
+static PNIBBLE new_nibble(VOID)
+{	return((PNIBBLE) calloc(1, sizeof(NIBBLE)));
+}
+
+
 /*
  * End of file: db.c
  *
@@ -0,0 +1,392 @@
+/*
+ * File: health.c
+ *
+ * Name server for OS/2.
+ *
+ * Background health checker for host addresses.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Every distinct address in the host database is probed at regular
+ * intervals, either by attempting a TCP connection to a given port or by
+ * sending a small datagram to a UDP port and waiting for any reply.
+ *
+ * The results are written into a snapshot buffer which is then published
+ * by a single atomic pointer exchange. Query threads simply read the
+ * current pointer and never wait for the prober. Snapshot buffers are used
+ * in rotation; a buffer is only rewritten two probe rounds after it was
+ * replaced, by which time no query thread can still be looking at it.
+ *
+ * The table of addresses is built when the checker starts, with room for
+ * HEALTH_SPARE more. When a new version of the databases is loaded, its
+ * entries are given the indexes of the same addresses, and new addresses
+ * are added to the end of the table, where the prober finds them on its
+ * next round. Addresses are never removed, so once the table is full,
+ * further new addresses are not probed (until the next restart).
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, health_start)
+
+#define	PROBE_STACK	16384		/* Stack size for prober thread */
+#define	NSNAPS		3		/* Number of snapshot buffers */
+#define	HEALTH_SPARE	256		/* Room for addresses added later */
+
+/* Type definitions */
+
+typedef struct _HEALTHSNAP {		/* Published health state */
+ULONG		round;			/* Probe round that built this */
+INT		naddrs;			/* Number of entries probed */
+UCHAR		up[1];			/* TRUE if address is up */
+} HEALTHSNAP, *PHEALTHSNAP;
+
+/* Forward references */
+
+static	VOID	index_db(PDB);
+static	ULONG	msclock(VOID);
+static	VOID	probe_batch(INT, INT, PUCHAR);
+static	VOID	prober(PVOID);
+
+/* Local storage */
+
+static	PCONFIG		hconfig;	/* Configuration information */
+static	INT volatile	naddrs;		/* Number of addresses to probe */
+static	INT		maxaddrs;	/* Room in table below */
+static	PINADDR		addrs;		/* Addresses to probe */
+static	PHEALTHSNAP	snaps[NSNAPS];	/* Snapshot buffers */
+static	PHEALTHSNAP volatile current;	/* Currently published snapshot */
+static	UCHAR		logmsg[MAXLOG];	/* Logging buffer */
+
+
+/*
+ * Set up the health checker and start the prober thread. Each primary
+ * entry in the default database, and in the database for each view, is
+ * given an index into the table of distinct addresses being probed. The
+ * current version of the databases is used.
+ *
+ * Returns:
+ *	TRUE		health checker started, or not configured
+ *	FALSE		failed to start
+ *
+ */
+
+BOOL health_start(PCONFIG config)
+{	INT i, n, rc;
+	PDBENT p;
+	PDBVERSION ver = config->current;
+
+	if(config->health_type == HEALTH_NONE) return(TRUE);
+
+	hconfig = config;
+	current = (PHEALTHSNAP) NULL;	/* Everything is up until probed */
+
+	n = HEALTH_SPARE;
+	for(p = ver->db->head; p != (PDBENT) NULL; p = p->next)
+		if(p->type == ENT_TYPE_PRIMARY) n++;
+	for(i = 0; i < config->nviews; i++)
+		for(p = ver->viewdbs[i]->head; p != (PDBENT) NULL; p = p->next)
+			if(p->type == ENT_TYPE_PRIMARY) n++;
+
+	/* Allocate everything first, so that the table is never seen
+	   without its snapshot buffers */
+
+	for(i = 0; i < NSNAPS; i++) {
+		snaps[i] = (PHEALTHSNAP) malloc(sizeof(HEALTHSNAP) + n);
+		if(snaps[i] == (PHEALTHSNAP) NULL) {
+			dolog("failed to allocate health snapshot");
+			return(FALSE);
+		}
+		snaps[i]->naddrs = 0;
+	}
+
+	naddrs = 0;
+	maxaddrs = n;
+	addrs = (PINADDR) malloc(n*sizeof(INADDR));
+	if(addrs == (PINADDR) NULL) {
+		dolog("failed to allocate health address table");
+		return(FALSE);
+	}
+
+	/* Build the table of distinct addresses; later versions of the
+	   databases may add to it */
+
+	health_index(ver);
+
+	rc = _beginthread(prober, NULL, PROBE_STACK, (PVOID) NULL);
+	if(rc == -1) {
+		dolog("failed to create health prober thread");
+		return(FALSE);
+	}
+
+	sprintf(
+		logmsg,
+		"health checking %d address%s every %d seconds",
+		naddrs,
+		naddrs == 1 ? "" : "es",
+		config->health_interval);
+	dolog(logmsg);
+
+	return(TRUE);
+}
+
+
+/*
+ * Set the health table indexes in the entries of a version of the
+ * databases. This is called for each new version before it is used.
+ *
+ */
+
+VOID health_index(PDBVERSION ver)
+{	INT i;
+
+	if(addrs == (PINADDR) NULL) return;	/* Not checking health */
+
+	index_db(ver->db);
+	for(i = 0; i < hconfig->nviews; i++)
+		index_db(ver->viewdbs[i]);
+}
+
+
+/*
+ * Set the index in each primary entry in a database, adding the address
+ * to the table of distinct addresses if it is new and there is room.
+ * The address is stored before the count is raised, so the prober never
+ * sees an entry that is not filled in.
+ *
+ */
+
+static VOID index_db(PDB db)
+{	INT i;
+	PDBENT p;
+
+	for(p = db->head; p != (PDBENT) NULL; p = p->next) {
+		if(p->type != ENT_TYPE_PRIMARY) continue;
+		for(i = 0; i < naddrs; i++)
+			if(addrs[i].s_addr == p->address.s_addr) break;
+		if(i == naddrs) {
+			if(naddrs < maxaddrs) {
+				addrs[i] = p->address;
+				(VOID) __lxchg((volatile LONG *) &naddrs,
+						(LONG) (i + 1));
+			} else {
+				i = -1;		/* Not probed */
+			}
+		}
+		p->hindex = i;
+	}
+}
+
+
+/*
+ * Determine whether the address in a database entry is believed to be up.
+ * Entries that are not being probed, or have not been probed yet, and all
+ * entries before the first probe round completes, are treated as up.
+ *
+ * This is called on the query path, and takes no locks.
+ *
+ */
+
+BOOL health_is_up(PDBENT entry)
+{	PHEALTHSNAP snap = current;
+
+	if(snap == (PHEALTHSNAP) NULL || entry->hindex < 0 ||
+	   entry->hindex >= snap->naddrs) return(TRUE);
+
+	return(snap->up[entry->hindex] != 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * The prober thread. Probes all addresses, in batches, then publishes
+ * the results and sleeps until the next round. Addresses added to the
+ * table during a round are left for the next one.
+ *
+ */
+
+static VOID prober(PVOID param)
+{	INT i, n, count;
+	ULONG round;
+	PHEALTHSNAP snap, prev;
+	UCHAR temp[16];
+
+	prev = (PHEALTHSNAP) NULL;
+
+	for(round = 1; ; round++) {
+		snap = snaps[round % NSNAPS];
+		count = naddrs;
+		for(i = 0; i < count; i += MAXPROBES) {
+			n = count - i;
+			if(n > MAXPROBES) n = MAXPROBES;
+			probe_batch(i, n, &snap->up[i]);
+		}
+		snap->round = round;
+		snap->naddrs = count;
+
+		/* Log any changes of state */
+
+		for(i = 0; i < count; i++) {
+			if(snap->up[i] == (prev == (PHEALTHSNAP) NULL ||
+					   i >= prev->naddrs ?
+					   TRUE : prev->up[i]))
+				continue;
+			strcpy(temp, inet_ntoa(addrs[i]));
+			sprintf(
+				logmsg,
+				"health: %s is %s",
+				temp,
+				snap->up[i] != 0 ? "up" : "down");
+			dolog(logmsg);
+		}
+
+		/* Publish the new snapshot */
+
+		(VOID) __lxchg((volatile LONG *) &current, (LONG) snap);
+		prev = snap;
+
+		DosSleep(hconfig->health_interval*1000);
+	}
+}
+
+
+/*
+ * Probe a batch of addresses in parallel.
+ *
+ *	first	is the index of the first address in the batch
+ *	n	is the number of addresses in the batch
+ *	up	points to the result flags for the batch
+ *
+ * A TCP probe succeeds if the connection completes; a UDP probe succeeds
+ * if any reply arrives. Everything is given HEALTH_TIMEOUT seconds.
+ *
+ */
+
+static VOID probe_batch(INT first, INT n, PUCHAR up)
+{	INT i, j, rc, npend, err, len;
+	INT on = 1;
+	INT socks[MAXPROBES];
+	INT sockset[MAXPROBES];
+	ULONG start, elapsed;
+	SOCK sa;
+	HEADER *h;
+	UCHAR pkt[PACKETSZ];
+
+	/* A UDP probe is a standard query header with no questions; any
+	   name server will answer it (if only with FORMERR), and so will
+	   a simple echo responder. */
+
+	memset(pkt, 0, sizeof(HEADER));
+	h = (HEADER *) pkt;
+	h->opcode = QUERY;
+
+	memset((PUCHAR) &sa, 0, sizeof(SOCK));
+	sa.sin_family = AF_INET;
+	sa.sin_port = hconfig->health_port;
+
+	/* Start all the probes */
+
+	for(i = 0; i < n; i++) {
+		up[i] = FALSE;
+		socks[i] = socket(
+				AF_INET,
+				hconfig->health_type == HEALTH_TCP ?
+					SOCK_STREAM : SOCK_DGRAM,
+				0);
+		if(socks[i] < 0) continue;
+
+		ioctl(socks[i], FIONBIO, (PUCHAR) &on, sizeof(on));
+		sa.sin_addr = addrs[first+i];
+		rc = connect(socks[i], (PSOCKG) &sa, sizeof(SOCK));
+		if(hconfig->health_type == HEALTH_TCP) {
+			if(rc == 0) {
+				up[i] = TRUE;	/* Connected at once */
+			} else if(sock_errno() == SOCEINPROGRESS) {
+				continue;	/* Leave socket open */
+			}
+		} else if(rc == 0) {
+			h->id = htons((USHORT) (first + i));
+			if(send(socks[i], pkt, sizeof(HEADER), 0) > 0)
+				continue;	/* Leave socket open */
+		}
+		soclose(socks[i]);
+		socks[i] = -1;
+	}
+
+	/* Wait for the probes to complete */
+
+	start = msclock();
+	for(;;) {
+		npend = 0;
+		for(i = 0; i < n; i++)
+			if(socks[i] >= 0) sockset[npend++] = socks[i];
+		if(npend == 0) break;
+
+		elapsed = msclock() - start;
+		if(elapsed >= HEALTH_TIMEOUT*1000) break;
+
+		rc = select(
+			sockset,
+			hconfig->health_type == HEALTH_UDP ? npend : 0,
+			hconfig->health_type == HEALTH_TCP ? npend : 0,
+			0,
+			HEALTH_TIMEOUT*1000 - elapsed);
+		if(rc <= 0) {
+			if(rc < 0 && sock_errno() == SOCEINTR) continue;
+			break;			/* Timeout or failure */
+		}
+
+		for(j = 0; j < npend; j++) {
+			if(sockset[j] == -1) continue;
+			for(i = 0; i < n; i++)
+				if(socks[i] == sockset[j]) break;
+			if(hconfig->health_type == HEALTH_TCP) {
+				err = 0;
+				len = sizeof(err);
+				rc = getsockopt(
+					socks[i],
+					SOL_SOCKET,
+					SO_ERROR,
+					(PUCHAR) &err,
+					&len);
+				up[i] = (rc == 0 && err == 0) ? TRUE : FALSE;
+			} else {
+				rc = recv(socks[i], pkt, sizeof(pkt), 0);
+				up[i] = rc > 0 ? TRUE : FALSE;
+			}
+			soclose(socks[i]);
+			socks[i] = -1;
+		}
+	}
+
+	/* Anything left over has timed out */
+
+	for(i = 0; i < n; i++)
+		if(socks[i] >= 0) soclose(socks[i]);
+}
+
+
+/*
+ * Return a millisecond clock value, for measuring intervals.
+ *
+ */
+
+static ULONG msclock(VOID)
+{	ULONG ms;
+
+	DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof(ms));
+
+	return(ms);
+}
+
+/*
+ * End of file: health.c
+ *
+ */
+
\ No newline at end of file
@@ -18,6 +18,35 @@
  *	1.3	Fix problem with getting IP address on non
  *		point to point interfaces.
  *	1.4	Corrected handling of part line comments in config file.
+ *	1.5	Added HEALTH_CHECK command; background probing of host
+ *		addresses, and multiple addresses per name.
+ *	1.6	Added wildcard names; faster name lookup.
+ *	1.7	Added ZONE_FILE command; answers for all common record
+ *		types from zone files.
+ *	1.8	Added VIEW, VIEW_HOSTS and VIEW_ZONE_FILE commands.
+ *	1.9	Allow multiple AUTH_NETWORK and AUTH_DOMAIN commands.
+ *	1.10	IPv6 addresses in the HOSTS file; AAAA and ip6.arpa queries.
+ *	1.11	Authoritative negative answers for names in local domains.
+ *	1.12	Added EMPTY_ZONE and NO_EMPTY_ZONE commands; built in empty
+ *		zones for private address space and special use names.
+ *	1.13	Added REPLICA and RELOAD_INTERVAL commands; zone transfers
+ *		(AXFR and IXFR) and NOTIFY; reloading of changed files.
+ *	1.14	Added SECONDARY command; zones copied from a primary server.
+ *	1.15	Host names held once per label, to save memory.
+ *	1.16	Replies for names in the HOSTS file built in advance.
+ *	1.17	Query names parsed and looked up straight from the packet.
+ *	1.18	Names in replies compressed more quickly, without 'dn_comp'.
+ *	1.19	Records in replies written by one routine per kind of record.
+ *	1.20	Names folded, compared and hashed a word at a time.
+ *	1.21	Replies sent in pieces, without copying records built in advance.
+ *	1.22	Referred queries sent from shared sockets, with random IDs.
+ *	1.23	Referral interface watched in the background, not checked per query.
+ *	1.24	Identical referred queries share one referral; retransmissions dropped.
+ *	1.25	Slow referrals hedged to the next name server; HEDGE_BUDGET command.
+ *	1.26	Referrals go to the name server with the lowest smoothed reply time first.
+ *	1.27	Referral timeouts worked out from measured reply times (RFC 6298).
+ *	1.28	Name servers not responding are skipped and probed; failed referrals give SERVFAIL.
+ *	1.29	Each referral given up after a total deadline; REFER_DEADLINE command.
  *
  */
 
@@ -71,6 +100,12 @@ INT main(INT argc, UCHAR *argv[])
 #ifdef	DEBUG
 	INT n;
 	PSERVERS ps;
+	PZONEFILE zf;
+	PVIEW v;
+	PAUTHNET an;
+	PAUTHDOM ad;
+	PREPLICA rp;
+	PSECONDARY sec;
 #endif
 
 	progname = strrchr(argv[0], '\\');
@@ -152,10 +187,55 @@ INT main(INT argc, UCHAR *argv[])
 
 #ifdef	DEBUG
 	trace("config: using port:            %d", ntohs(config.port));
-	trace("config: authority for network: %s", inet_ntoa(config.network));
-	trace("config: authority netmask:     %s", inet_ntoa(config.netmask));
-	trace("config: authority domain:      %s", config.domain);
+	for(an = config.authnets; an != (PAUTHNET) NULL; an = an->next)
+		trace("config: authority for network: %s/%d",
+			inet_ntoa(an->network),
+			an->masklen);
+	trace("config: default netmask:       %s", inet_ntoa(config.netmask));
+	for(ad = config.authdoms; ad != (PAUTHDOM) NULL; ad = ad->next)
+		trace("config: authority domain:      %s", ad->name);
+	trace("config: default domain:        %s", config.domain);
+	trace("config: built in empty zones:  %s",
+		config.empty_builtin == TRUE ? "yes" : "no");
+	for(ad = config.emptyzones; ad != (PAUTHDOM) NULL; ad = ad->next)
+		trace("config: empty zone:            %s", ad->name);
+	for(ad = config.emptyoff; ad != (PAUTHDOM) NULL; ad = ad->next)
+		trace("config: no empty zone:         %s", ad->name);
 	trace("config: referral interface:    %s", config.refer_interface);
+	trace("config: hosts file:            %s", config.hostsfile);
+	for(zf = config.zonefiles; zf != (PZONEFILE) NULL; zf = zf->next)
+		trace("config: zone file:             %s from %s",
+			zf->origin,
+			zf->filename);
+	for(v = config.views; v != (PVIEW) NULL; v = v->next) {
+		trace("config: view:                  %s", v->name);
+		if(v->hostsfile != (PUCHAR) NULL)
+			trace("config:   hosts file:          %s", v->hostsfile);
+		for(zf = v->zonefiles; zf != (PZONEFILE) NULL; zf = zf->next)
+			trace("config:   zone file:           %s from %s",
+				zf->origin,
+				zf->filename);
+	}
+	if(config.health_type != HEALTH_NONE)
+		trace("config: health check:          %s port %d every %d seconds",
+			config.health_type == HEALTH_TCP ? "TCP" : "UDP",
+			ntohs(config.health_port),
+			config.health_interval);
+	for(rp = config.replicas; rp != (PREPLICA) NULL; rp = rp->next)
+		trace("config: replica:               %s", inet_ntoa(rp->address));
+	for(sec = config.secondaries;
+	    sec != (PSECONDARY) NULL;
+	    sec = sec->next) {
+		UCHAR temp[16];
+
+		strcpy(temp, inet_ntoa(sec->primary));
+		trace("config: secondary zone:        %s from %s",
+			sec->origin,
+			temp);
+	}
+	if(config.reload_interval != 0)
+		trace("config: reload check every:    %d seconds",
+			config.reload_interval);
 
 	trace("Server list chain:");
 	n = 0;
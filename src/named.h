@@ -9,6 +9,7 @@
  *
  */
 
+#define	INCL_DOSPROFILE			/* For high resolution timer */
 #include <os2.h>
 
 #include <time.h>
@@ -19,6 +20,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys\types.h>
+#include <sys\stat.h>
 #ifdef	DEBUG
 #include <stddef.h>
 #endif
@@ -29,6 +32,7 @@
 #include <utils.h>
 #include <netinet\in.h>
 #include <sys\socket.h>
+#include <sys\uio.h>
 #include <sys\ioctl.h>
 #include <net\if.h>
 #include <arpa\nameser.h>
@@ -36,7 +40,7 @@
 #include <nerrno.h>
 
 #define	VERSION			1	/* Major version number */
-#define	EDIT			4	/* Edit number within major version */
+#define	EDIT			29	/* Edit number within major version */
 
 #define	FALSE			0
 #define	TRUE			1
@@ -50,17 +54,69 @@
 #define	DEFAULT_AUTH_NETMASK	"255.255.255.255"
 #define	DEFAULT_REFER_INTERFACE	"sl0"
 
-#define	INITIAL_REFER_TIMEOUT	5	/* For referral calls (seconds) */
 #define	REFER_RETRY_LIMIT	4	/* Number of retries per name server */
 #define	LOCAL_TTL		86400	/* Local names live for a day */
-#define	MAXDNPTRS		50	/* Maximum number of compressed names */
+#define	NEGATIVE_TTL		300	/* Time to cache local misses */
+#define	MAXCOMP			128	/* Size of name compression table */
+#define	MAXCOMPNAMES		8	/* Recent names kept for compression */
 #define	MAXINTERFACES		15	/* Maximum number of interfaces */
+#define	MAXCNAMES		8	/* Longest CNAME chain followed */
+#define	MAXLABELS		128	/* Most labels in a domain name */
+#ifndef	MAXALIASES
+#define	MAXALIASES		35	/* Maximum aliases on a HOSTS line */
+#endif
 #define	MAXLOG			200	/* Maximum length of a logfile line */
+#define	DEFAULT_HEALTH_INTERVAL	10	/* Seconds between health probes */
+#define	HEALTH_TIMEOUT		2	/* Probe reply timeout (seconds) */
+#define	MAXPROBES		32	/* Probes outstanding at once */
+#define	DEFAULT_RELOAD_INTERVAL	0	/* Don't look for changed files */
+#define	DEFAULT_HEDGE_BUDGET	5	/* Hedged referrals per 100 */
+#define	DEFAULT_REFER_DEADLINE	10	/* Longest referral (seconds) */
+#define	MAX_REFER_DEADLINE	60	/* Longest allowed (seconds) */
+
+/* Resource record types not known to older resolver headers */
+
+#ifndef	T_AAAA
+#define	T_AAAA			28	/* IPv6 address */
+#endif
+#ifndef	T_SRV
+#define	T_SRV			33	/* Service location */
+#endif
+#ifndef	T_IXFR
+#define	T_IXFR			251	/* Incremental zone transfer */
+#endif
+#ifndef	T_AXFR
+#define	T_AXFR			252	/* Zone transfer */
+#endif
+#ifndef	INADDRSZ
+#define	INADDRSZ		4	/* Size of an IPv4 address */
+#endif
+#ifndef	IN6ADDRSZ
+#define	IN6ADDRSZ		16	/* Size of an IPv6 address */
+#endif
+#ifndef	NS_NOTIFY_OP
+#define	NS_NOTIFY_OP		4	/* Opcode for NOTIFY (RFC 1996) */
+#endif
+#ifndef	NOTAUTH
+#define	NOTAUTH			9	/* Not authoritative for zone */
+#endif
+
+/* Starting value for hashes of names and labels (see names.c) */
+
+#define	LABEL_HASH_INIT		2166136261UL
 
 /* Database entry types */
 
 #define	ENT_TYPE_PRIMARY	0	/* Primary name */
 #define	ENT_TYPE_ALIAS		1	/* Alias name */
+#define	ENT_TYPE_PRIMARY6	2	/* Primary name, IPv6 address */
+#define	ENT_TYPE_SHARED		0x8000	/* Flag: being removed as shared */
+
+/* Health check probe types */
+
+#define	HEALTH_NONE		0	/* No health checking */
+#define	HEALTH_TCP		1	/* TCP connect probe */
+#define	HEALTH_UDP		2	/* UDP datagram probe */
 
 /* Type definitions */
 
@@ -68,23 +124,102 @@ typedef	struct hostent		HOST, *PHOST;		/* Host structure */
 typedef	struct ifconf		IFCONF, *PIFCONF;	/* Interface configuration */
 typedef	struct ifreq		IFREQ, *PIFREQ;		/* Interface information */
 typedef struct in_addr		INADDR, *PINADDR;	/* Internet address */
+typedef	struct iovec		IOVEC, *PIOVEC;		/* Piece of a message */
+typedef	struct msghdr		MSGHDR, *PMSGHDR;	/* Message for sendmsg */
 typedef	struct servent		SERV, *PSERV;		/* Service structure */
 typedef	struct sockaddr		SOCKG, *PSOCKG;		/* Generic structure */
 typedef	struct sockaddr_in	SOCK, *PSOCK;		/* Internet structure */
 
 /* Structure definitions */
 
+typedef struct _ANSWER {		/* Reply built in advance */
+struct _DB	*db;			/* Database it was built from */
+USHORT		base;			/* Offset in reply where it goes */
+USHORT		len;			/* Length of data below */
+USHORT		ancount;		/* Records in answer section */
+USHORT		nscount;		/* Records in authority section */
+USHORT		arcount;		/* Records in additional section */
+UCHAR		data[1];		/* Reply sections, in wire format */
+} ANSWER, *PANSWER;
+
 typedef struct _DBENT {			/* Name database entry */
 struct _DBENT	*next;			/* Next entry in chain */
-PUCHAR		name;			/* Host name */
+struct _DBENT	*same;			/* Next entry with same name */
+struct _NAMENODE *node;			/* Node for host name */
 ULONG		ttl;			/* Time to live */
 union info {
  INADDR		address;		/* IP address */
+ UCHAR		address6[IN6ADDRSZ];	/* IPv6 address */
  struct _DBENT	*primary;		/* Entry for primary name */
 };
 USHORT		type;			/* Entry type */
+INT		hindex;			/* Health table index, or -1 */
+PANSWER		ptr;			/* Reply to PTR query, if built */
 } DBENT, *PDBENT;
 
+typedef struct _RR {			/* Resource record from a zone file */
+struct _RR	*next;			/* Next record with same name */
+USHORT		type;			/* Record type */
+USHORT		class;			/* Record class */
+ULONG		ttl;			/* Time to live */
+USHORT		rdlength;		/* Length of RDATA */
+UCHAR		rdata[1];		/* RDATA in wire format, with any
+					   names uncompressed */
+} RR, *PRR;
+
+typedef struct _NAMENODE {		/* Node in the name tree */
+struct _NAMENODE *parent;		/* Node for enclosing name */
+struct _NAMENODE *hnext;		/* Next node in hash chain */
+struct _NAMENODE *wild;			/* Wildcard ('*') child, if any */
+PDBENT		entries;		/* Entries with this name */
+PRR		rrs;			/* Zone file records, by type */
+PANSWER		answers[2];		/* Replies to A and AAAA queries */
+ULONG		hash;			/* Hash of parent and label */
+UCHAR		len;			/* Length of label */
+UCHAR		label[1];		/* Label (not null terminated) */
+} NAMENODE, *PNAMENODE;
+
+typedef struct _QNAME {			/* Name in a query, as labels */
+PUCHAR		text;			/* The name, as text */
+INT		nlabels;		/* Number of labels */
+PUCHAR		label[MAXLABELS];	/* Length byte of each label, in
+					   the packet */
+ULONG		hash[MAXLABELS];	/* Hash of each label */
+} QNAME, *PQNAME;
+
+typedef struct _COMP {			/* Name compression state */
+PUCHAR		msg;			/* Start of message */
+INT		nused;			/* Entries in use */
+USHORT		off[MAXCOMP];		/* Offset of each suffix; 0 if free */
+ULONG		hash[MAXCOMP];		/* Hash of each suffix */
+INT		nnames;			/* Names noted below */
+PUCHAR		name[MAXCOMPNAMES];	/* Names already compressed, as text */
+USHORT		nameoff[MAXCOMPNAMES];	/* Offset of each in the message */
+} COMP, *PCOMP;
+
+typedef struct _NIBBLE {		/* Node in IPv6 reverse index */
+USHORT		map;			/* Bit set for each child present */
+PDBENT		entry;			/* Entry for full address, if any */
+struct _NIBBLE	*child[1];		/* Children present, in order */
+} NIBBLE, *PNIBBLE;
+
+typedef struct _DB {			/* Name database */
+struct _DB	*parent;		/* Database this overlays, if any */
+PDBENT		head;			/* Head of entry chain */
+PNAMENODE	root;			/* Root of name tree */
+PNAMENODE	*hashtab;		/* Hash table of name tree nodes */
+ULONG		hashsize;		/* Size of hash table (power of 2) */
+ULONG		nnodes;			/* Number of nodes in the tree */
+PNIBBLE		rev6;			/* Root of IPv6 reverse index */
+PDBENT		*addrtab;		/* IPv4 entries, hashed by address */
+ULONG		addrsize;		/* Size of above (power of 2) */
+ULONG		naddrs;			/* Number of addresses in above */
+ULONG		namebytes;		/* Length of host names added */
+ULONG		nodebytes;		/* Space taken by tree nodes */
+PDBENT		self;			/* Address entry for our own name */
+BOOL		inherit;		/* Parent's replies usable here */
+} DB, *PDB;
+
 typedef struct _SERVERS {		/* Server address list */
 struct _SERVERS	*next;			/* Next entry in chain */
 INADDR		if_addr;		/* Interface address */
@@ -93,30 +228,117 @@ INT		nservers;		/* Number of servers */
 INADDR		servers[MAXNS];		/* List of servers */
 } SERVERS, *PSERVERS;
 
+typedef struct _ZONEFILE {		/* Zone file to be loaded */
+struct _ZONEFILE *next;			/* Next entry in chain */
+PUCHAR		origin;			/* Name of zone */
+PUCHAR		filename;		/* Full name of master file */
+} ZONEFILE, *PZONEFILE;
+
+typedef struct _RADIX {			/* Node in a binary prefix tree */
+struct _RADIX	*child[2];		/* Children for next bit 0 and 1 */
+PVOID		value;			/* Value for this prefix, if any */
+} RADIX, *PRADIX;
+
+typedef struct _AUTHNET {		/* Network we are authority for */
+struct _AUTHNET	*next;			/* Next entry in chain */
+INADDR		network;		/* Network address */
+INT		masklen;		/* Prefix length; -1 if not given */
+PUCHAR		revdomain;		/* Name of reverse domain */
+PRR		soa;			/* SOA record for negative answers */
+} AUTHNET, *PAUTHNET;
+
+typedef struct _AUTHDOM {		/* Domain we are authority for */
+struct _AUTHDOM	*next;			/* Next entry in chain */
+struct _AUTHDOM	*hnext;			/* Next entry in hash chain */
+ULONG		hash;			/* Hash value of name */
+PUCHAR		name;			/* Name of domain */
+PRR		soa;			/* SOA record for negative answers */
+struct _SECONDARY *sec;			/* Secondary zone, if it is one */
+} AUTHDOM, *PAUTHDOM;
+
+typedef struct _VIEW {			/* View of the database */
+struct _VIEW	*next;			/* Next entry in chain */
+PUCHAR		name;			/* Name of view */
+PUCHAR		hostsfile;		/* Full name of HOSTS file, if any */
+PZONEFILE	zonefiles;		/* Head of zone file chain */
+INT		index;			/* Index of database in versions */
+} VIEW, *PVIEW;
+
+typedef struct _REPLICA {		/* Server that replicates our zones */
+struct _REPLICA	*next;			/* Next entry in chain */
+INADDR		address;		/* Address of server */
+} REPLICA, *PREPLICA;
+
+typedef struct _SECONDARY {		/* Zone copied from a primary server */
+struct _SECONDARY *next;		/* Next entry in chain */
+PUCHAR		origin;			/* Name of zone */
+INADDR		primary;		/* Address of primary server */
+BOOL volatile	current;		/* Has data in current version */
+} SECONDARY, *PSECONDARY;
+
+typedef struct _DBVERSION {		/* Version of all the databases */
+struct _DBVERSION *next;		/* Next older version still held */
+ULONG		number;			/* Version number, from 1 */
+time_t		retired;		/* Time replaced; 0 if current */
+INT		users;			/* Zone transfers using this */
+PDB		db;			/* Default database */
+PDB		*viewdbs;		/* Database for each view */
+struct _XFRIMAGE *images;		/* Zone transfer images (xfr.c) */
+} DBVERSION, *PDBVERSION;
+
 typedef struct _CONFIG {		/* Configuration information */
 PUCHAR		myname;			/* Name of this server */
-PUCHAR		domain;			/* Domain we are authority for */
+PUCHAR		domain;			/* Default domain */
 PUCHAR		refer_interface;	/* Interface to use for referrals */
-INADDR		network;		/* Network we are authority for */
-INADDR		netmask;		/* Mask for above network */
+PUCHAR		hostsfile;		/* Full name of HOSTS file */
+PAUTHNET	authnets;		/* Networks we are authority for */
+INADDR		netmask;		/* Mask for networks given without */
+PRADIX		authtab;		/* Prefix table of above */
+PAUTHDOM	authdoms;		/* Domains we are authority for */
+PAUTHDOM	*domtab;		/* Hash table of above */
+ULONG		domtabsize;		/* Size of above (power of two) */
+PAUTHDOM	emptyzones;		/* Empty zones */
+PAUTHDOM	emptyoff;		/* Built in empty zones not wanted */
+PAUTHDOM	*emptytab;		/* Hash table of empty zones */
+ULONG		emptytabsize;		/* Size of above (power of two) */
+BOOL		empty_builtin;		/* TRUE to use built in empty zones */
 PUCHAR		pktbuf;			/* Packet buffer */
-PDBENT		dbhead;			/* Head of name chain */
+PDBVERSION volatile current;		/* Current version of databases */
 PSERVERS	servlist;		/* Head of server chain */
+PZONEFILE	zonefiles;		/* Head of zone file chain */
+PVIEW		views;			/* Head of view chain */
+INT		nviews;			/* Number of views */
+PRADIX		viewtab;		/* Client prefixes to views */
+PREPLICA	replicas;		/* Servers that may transfer zones */
+PSECONDARY	secondaries;		/* Zones copied from other servers */
+INT		reload_interval;	/* Seconds between checks for changed
+					   files; 0 for none */
+INT		hedge_budget;		/* Referrals in 100 that may be
+					   hedged; 0 for none */
+INT		refer_deadline;		/* Seconds before a referral is
+					   given up */
 INT		sockno;			/* Socket used for all work */
 USHORT		port;			/* Port to listen on */
 USHORT		nsport;			/* Well-known name server port */
+INT		health_type;		/* Type of health probe */
+USHORT		health_port;		/* Port to probe */
+INT		health_interval;	/* Seconds between probe rounds */
 } CONFIG, *PCONFIG;
 
 typedef struct _THREADINFO {		/* Thread information */
 PCONFIG		config;			/* Configuration information */
 PUCHAR		buf;			/* Packet buffer */
+PDB		db;			/* Database for this client */
 INT		pktlen;			/* Length of current packet */
-PUCHAR		dnptrs[MAXDNPTRS];	/* Used by 'dn_compress' */
+COMP		comp;			/* Name compression state */
 SOCK		sa;			/* Source address of packet */
 INT		sockno;			/* Socket for reply */
-INT		rsockno;		/* Socket for queries */
 PUCHAR		qp;			/* Query pointer */
 PUCHAR		rp;			/* Reply pointer */
+PANSWER		answer;			/* Reply records built in advance */
+PUCHAR		rbuf;			/* Buffer for referral replies */
+BOOL		noreply;		/* TRUE if another thread replies */
+PQNAME		qname;			/* Name in current question */
 PSERVERS	ps;			/* List of servers to consult */
 UCHAR		logmsg[MAXLOG];		/* Logging buffer */
 #ifdef	DEBUG
@@ -126,14 +348,76 @@ UINT		thread;			/* Thread identification */
 
 /* External references */
 
-extern	BOOL	db_add_host(PCONFIG, PDBENT);
-extern	PDBENT	db_find_address(PCONFIG, INADDR);
-extern	PDBENT	db_find_name(PCONFIG, PUCHAR);
-extern	BOOL	db_init(PCONFIG);
+extern	PAUTHDOM auth_find_domain(PCONFIG, PUCHAR);
+extern	PAUTHDOM auth_find_empty(PCONFIG, PUCHAR);
+extern	PAUTHNET auth_find_network(PCONFIG, INADDR);
+extern	BOOL	auth_init(PCONFIG);
+extern	VOID	comp_init(PCOMP, PUCHAR, PQNAME);
+extern	INT	comp_name(PCOMP, PUCHAR, PUCHAR, INT);
+extern	VOID	comp_undo(PCOMP, PUCHAR);
+extern	BOOL	db_add_host(PDB, PUCHAR, PDBENT);
+extern	PNAMENODE db_add_name(PDB, PUCHAR);
+extern	BOOL	db_add_rr(PDB, PUCHAR, PRR);
+extern	BOOL	db_check_name(PUCHAR);
+extern	PDBENT	db_find_address(PDB, INADDR);
+extern	PDBENT	db_find_address6(PDB, PUCHAR);
+extern	PDBENT	db_find_name(PDB, PUCHAR);
+extern	PDBENT	db_find_next_name(PDBENT);
+extern	PNAMENODE db_find_node(PDB, PUCHAR);
+extern	PNAMENODE db_find_qname(PDB, PQNAME);
+extern	VOID	db_free(PDB);
+extern	PDB	db_init(PDB);
+extern	PUCHAR	db_node_name(PNAMENODE, PUCHAR);
+extern	INT	db_share(PDB);
 extern	VOID	error(PUCHAR, ...);
+extern	VOID	health_index(PDBVERSION);
+extern	BOOL	health_is_up(PDBENT);
+extern	BOOL	health_start(PCONFIG);
+extern	BOOL	inet6_aton(PUCHAR, PUCHAR);
+extern	BOOL	load_hosts(PCONFIG, PDB, PUCHAR);
+extern	BOOL	make_answers(PCONFIG, PDB);
+extern	BOOL	name_equal(PUCHAR, PUCHAR, INT);
+extern	ULONG	name_hash(PUCHAR, INT);
+extern	VOID	name_lower(PUCHAR, INT);
+extern	BOOL	name_same(PUCHAR, PUCHAR);
+extern	BOOL	radix_add(PRADIX, INADDR, INT, PVOID);
+extern	PVOID	radix_lookup(PRADIX, INADDR);
+extern	INT	radix_masklen(INADDR);
+extern	PRADIX	radix_new(VOID);
 extern	INT	read_config(PUCHAR, PUCHAR, PCONFIG);
 extern	VOID	refer(PTHREADINFO);
+extern	BOOL	refer_start(PCONFIG);
+extern	VOID	secondary_commit(VOID);
+extern	BOOL	secondary_init(PCONFIG);
+extern	BOOL	secondary_load(PCONFIG, PDB);
+extern	BOOL	secondary_start(PCONFIG);
 extern	INT	server(PCONFIG);
+extern	ULONG	upstream_clock(VOID);
+extern	INT	upstream_end(PTHREADINFO, INT);
+extern	BOOL	upstream_hedge(VOID);
+extern	ULONG	upstream_hedge_delay(INADDR);
+extern	VOID	upstream_log(VOID);
+extern	ULONG	upstream_rto(INADDR);
+extern	INT	upstream_select(PSERVERS, INADDR *);
+extern	INT	upstream_send(PTHREADINFO, INADDR, INT);
+extern	BOOL	upstream_start(PCONFIG);
+extern	BOOL	upstream_wait(INT, ULONG);
+extern	PDBVERSION version_get(PCONFIG);
+extern	BOOL	version_load(PCONFIG);
+extern	VOID	version_lock(VOID);
+extern	VOID	version_release(PDBVERSION);
+extern	BOOL	version_start(PCONFIG);
+extern	VOID	version_unlock(VOID);
+extern	BOOL	view_load(PCONFIG, PDBVERSION);
+extern	PDB	view_select(PCONFIG, INADDR);
+extern	VOID	xfr_abort(VOID);
+extern	VOID	xfr_commit(PDBVERSION);
+extern	VOID	xfr_free(PDBVERSION);
+extern	BOOL	xfr_init(PCONFIG);
+extern	VOID	xfr_notify(PCONFIG);
+extern	BOOL	xfr_prepare(PCONFIG, PDBVERSION);
+extern	BOOL	xfr_start(PCONFIG);
+extern	BOOL	zone_load(PDB, PZONEFILE);
 
 /*
  * End of file: named.h
@@ -0,0 +1,157 @@
+/*
+ * File: names.c
+ *
+ * Name server for OS/2.
+ *
+ * Case folding, comparison and hashing of domain names.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Domain names are compared without regard to the case of ASCII letters
+ * (RFC 4343), and no other characters are folded. That makes it possible
+ * to work on a whole 32 bit word of a name at a time, instead of calling
+ * 'tolower' on every character; the upper case letters in a word are
+ * found with a few additions and masks, and have the 0x20 bit set to make
+ * them lower case. This relies on the processor allowing words to be
+ * fetched from any address, which all the Intel ones do.
+ *
+ * When names are compared, any odd bytes at the end are taken as part of
+ * a word that overlaps the one before; elsewhere, and for names shorter
+ * than a word, they are dealt with one at a time.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+
+#define	WORD(p)		(*(ULONG *) (p))
+#define	ONES		0x01010101UL
+#define	HIGHBITS	0x80808080UL
+
+/* Fold a single character */
+
+#define	LOWER(c)	((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+/* The 0x20 bit of each byte of a word that is an upper case letter. Each
+   byte is reduced to seven bits, so that the additions cannot carry into
+   the next one; a byte gets its top bit from the first if it is at least
+   'A', and from the second if it is more than 'Z'. Bytes that had their
+   own top bit set are not letters. */
+
+#define	UPPER_BITS(w)	(((((w) & ~HIGHBITS) + (0x80 - 'A')*ONES) & \
+			  ~(((w) & ~HIGHBITS) + (0x7F - 'Z')*ONES) & \
+			  ~(w) & HIGHBITS) >> 2)
+
+
+/*
+ * Convert a name to lower case, in place.
+ *
+ *	name	points to the name
+ *	len	is the length of the name
+ *
+ */
+
+VOID name_lower(PUCHAR name, INT len)
+{	ULONG w;
+
+	for(; len >= 4; len -= 4, name += 4) {
+		w = WORD(name);
+		WORD(name) = w | UPPER_BITS(w);
+	}
+	for(; len > 0; len--, name++)
+		*name = (UCHAR) LOWER(*name);
+}
+
+
+/*
+ * Compare two names, or parts of names, of the same length, ignoring
+ * case.
+ *
+ * Returns TRUE if they are the same, FALSE if not.
+ *
+ */
+
+BOOL name_equal(PUCHAR a, PUCHAR b, INT len)
+{	ULONG wa, wb;
+
+	if(len < 4) {
+		for(; len > 0; len--, a++, b++)
+			if(*a != *b && LOWER(*a) != LOWER(*b)) return(FALSE);
+		return(TRUE);
+	}
+
+	/* The last word is taken to end at the last byte; it may overlap the
+	   one before, which does no harm */
+
+	for(;;) {
+		wa = WORD(a);
+		wb = WORD(b);
+		if(wa != wb && (wa | UPPER_BITS(wa)) != (wb | UPPER_BITS(wb)))
+			return(FALSE);
+		if(len <= 4) return(TRUE);
+		len -= 4;
+		if(len < 4) {
+			a += len - 4;
+			b += len - 4;
+			len = 4;
+		}
+		a += 4;
+		b += 4;
+	}
+}
+
+
+/*
+ * Compare two null terminated names, ignoring case. This gives the same
+ * result as "stricmp(a, b) == 0".
+ *
+ * Returns TRUE if they are the same, FALSE if not.
+ *
+ */
+
+BOOL name_same(PUCHAR a, PUCHAR b)
+{	INT len = strlen(a);
+
+	if(strlen(b) != len) return(FALSE);
+
+	return(name_equal(a, b, len));
+}
+
+
+/*
+ * Compute a hash of a name, or of a label, ignoring case (FNV-1a, taking
+ * a word at a time). Setting the 0x20 bit of every byte folds the case of
+ * letters, which is all that is needed; anything else this makes alike is
+ * told apart when the names are compared.
+ *
+ *	name	points to the name
+ *	len	is the length of the name
+ *
+ */
+
+ULONG name_hash(PUCHAR name, INT len)
+{	INT i;
+	ULONG w;
+	ULONG hash = LABEL_HASH_INIT;
+
+	for(; len >= 4; len -= 4, name += 4)
+		hash = (hash ^ (WORD(name) | 0x20*ONES)) * 16777619UL;
+	if(len > 0) {
+		w = 0;
+		for(i = 0; i < len; i++)
+			w |= (ULONG) name[i] << (i*8);
+		hash = (hash ^ (w | 0x20*ONES)) * 16777619UL;
+	}
+
+	return(hash);
+}
+
+/*
+ * End of file: names.c
+ *
+ */
+
\ No newline at end of file
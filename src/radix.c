@@ -0,0 +1,118 @@
+/*
+ * File: radix.c
+ *
+ * Name server for OS/2.
+ *
+ * Binary prefix tree, for longest prefix matching of IP addresses.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Each level of the tree corresponds to one bit of the address, starting
+ * with the most significant bit. A prefix of length n is stored at depth
+ * n. A lookup walks down the tree, following the bits of the address,
+ * and remembers the last value it passed; this is the value for the
+ * longest matching prefix. The cost is at most one step per bit of the
+ * longest prefix in the tree.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, radix_add)
+#pragma	alloc_text(init_seg, radix_masklen)
+#pragma	alloc_text(init_seg, radix_new)
+
+
+/*
+ * Create a new, empty, prefix tree.
+ *
+ * Returns a pointer to the root node, or NULL if memory ran out.
+ *
+ */
+
+PRADIX radix_new(VOID)
+{	return((PRADIX) calloc(1, sizeof(RADIX)));
+}
+
+
+/*
+ * Add a prefix to a tree. 'addr' is the prefix (only the first 'len'
+ * bits are significant), and 'value' is the value to be associated with
+ * it. A later value for the same prefix replaces an earlier one.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+BOOL radix_add(PRADIX root, INADDR addr, INT len, PVOID value)
+{	INT i, bit;
+	ULONG a = ntohl(addr.s_addr);
+	PRADIX node = root;
+
+	for(i = 0; i < len; i++) {
+		bit = (a & (0x80000000UL >> i)) != 0 ? 1 : 0;
+		if(node->child[bit] == (PRADIX) NULL) {
+			node->child[bit] = radix_new();
+			if(node->child[bit] == (PRADIX) NULL) return(FALSE);
+		}
+		node = node->child[bit];
+	}
+	node->value = value;
+
+	return(TRUE);
+}
+
+
+/*
+ * Find the value for the longest prefix in the tree that matches an
+ * address.
+ *
+ * Returns the value, or NULL if no prefix matches.
+ *
+ */
+
+PVOID radix_lookup(PRADIX root, INADDR addr)
+{	ULONG a = ntohl(addr.s_addr);
+	PRADIX node = root;
+	PVOID value = (PVOID) NULL;
+
+	while(node != (PRADIX) NULL) {
+		if(node->value != (PVOID) NULL) value = node->value;
+		node = node->child[(a & 0x80000000UL) != 0 ? 1 : 0];
+		a <<= 1;
+	}
+
+	return(value);
+}
+
+
+/*
+ * Convert a network mask to a prefix length.
+ *
+ * Returns the length, or -1 if the mask has non-contiguous bits.
+ *
+ */
+
+INT radix_masklen(INADDR mask)
+{	ULONG m = ntohl(mask.s_addr);
+	INT len = 0;
+
+	while((m & 0x80000000UL) != 0) {
+		len++;
+		m <<= 1;
+	}
+
+	return(m == 0 ? len : -1);
+}
+
+/*
+ * End of file: radix.c
+ *
+ */
+
\ No newline at end of file
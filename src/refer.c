@@ -14,24 +14,161 @@
 #include "named.h"
 #include "log.h"
 
+#pragma	alloc_text(init_seg, refer_start)
+
+#define	WATCH_STACK	16384		/* Stack size for watcher thread */
+#define	WATCH_INTERVAL	5		/* Seconds between interface checks */
+#define	FLIGHTHASH	64		/* Size of table of referrals; power of 2 */
+#define	STATS_INTERVAL	3600		/* Seconds between server statistics */
+#define	HDR_CD		0x10		/* 'Checking disabled' bit in flags */
+#ifndef	T_OPT
+#define	T_OPT		41		/* EDNS OPT pseudo-record */
+#endif
+
+/* Flags in the key of a referral, besides its question */
+
+#define	KEY_RD		0x01		/* Recursion desired */
+#define	KEY_CD		0x02		/* Checking disabled */
+#define	KEY_OPT		0x04		/* Query has an OPT record */
+#define	KEY_DO		0x08		/* OPT record asks for DNSSEC data */
+
+/* Type definitions */
+
+typedef struct _WAITER {		/* Client waiting for a referral */
+struct _WAITER	*next;			/* Next for the same referral */
+SOCK		sa;			/* Address of client */
+USHORT		id;			/* ID of client's query */
+} WAITER, *PWAITER;
+
+typedef struct _FLIGHT {		/* Referral in progress */
+struct _FLIGHT	*next;			/* Next in hash chain */
+ULONG		hash;			/* Hash of question */
+INT		qlen;			/* Length of question */
+UCHAR		key;			/* Flags of query (KEY_xxx) */
+PWAITER		waiters;		/* Clients waiting for the reply */
+INT		nrefs;			/* Threads still using this */
+PUCHAR		reply;			/* Copy of the reply, once done */
+INT		pktlen;			/* Length of reply */
+HEV		hev;			/* Posted when the reply is ready */
+UCHAR		question[1];		/* Question, in wire format */
+} FLIGHT, *PFLIGHT;
+
 /* Forward references */
 
-static	BOOL	consult_nameserver(PTHREADINFO, INT, INADDR);
-static	BOOL	referral_interface_up(PTHREADINFO);
+static	PSERVERS check_interface(PCONFIG);
+static	BOOL	consult_nameservers(PTHREADINFO, PSERVERS, ULONG);
+static	PFLIGHT	find_flight(ULONG, PUCHAR, INT, UCHAR);
+static	VOID	leave_flight(PFLIGHT);
+static	VOID	note_servers(PCONFIG, PSERVERS);
+static	INT	query_key(PTHREADINFO);
+static	VOID	refer_query(PTHREADINFO);
+static	VOID	take_reply(PTHREADINFO, PFLIGHT, INT);
+static	VOID	watcher(PVOID);
 
 /* Local storage */
 
+static	PSERVERS volatile servers;	/* Servers to use; NULL if none */
+static	PFLIGHT		flights[FLIGHTHASH];/* Referrals in progress */
+static	HMTX		flightsem;	/* Semaphore for referrals */
 static	UCHAR		logmsg[MAXLOG];
 
 
+/*
+ * Find out whether the referral interface is up, and start the thread
+ * that keeps watching it.
+ *
+ * The state of the interface, in the form of the list of name servers
+ * to use (if any), is kept in 'servers', and is read by each query that
+ * is referred; the watcher thread looks at the interface every few
+ * seconds, and publishes any change with an atomic pointer exchange.
+ * Referring a query therefore needs no interface checks of its own.
+ *
+ * Returns:
+ *	TRUE		watcher started
+ *	FALSE		failed to start
+ *
+ */
+
+BOOL refer_start(PCONFIG config)
+{	INT rc;
+
+	if(DosCreateMutexSem((PSZ) NULL, &flightsem, 0, FALSE) != 0) {
+		dolog("failed to create referral semaphore");
+		return(FALSE);
+	}
+
+	servers = (PSERVERS) NULL;
+	note_servers(config, check_interface(config));
+
+	rc = _beginthread(watcher, NULL, WATCH_STACK, (PVOID) config);
+	if(rc == -1) {
+		dolog("failed to create referral interface watcher thread");
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * The watcher thread. Checks the referral interface every WATCH_INTERVAL
+ * seconds, and logs the name server statistics every STATS_INTERVAL
+ * seconds.
+ *
+ */
+
+static VOID watcher(PVOID param)
+{	PCONFIG config = (PCONFIG) param;
+	INT ticks = 0;
+
+	for(;;) {
+		DosSleep(WATCH_INTERVAL*1000);
+		note_servers(config, check_interface(config));
+		if(++ticks >= STATS_INTERVAL/WATCH_INTERVAL) {
+			upstream_log();
+			ticks = 0;
+		}
+	}
+}
+
+
+/*
+ * Publish the list of servers to use, if it has changed, and log the
+ * change.
+ *
+ */
+
+static VOID note_servers(PCONFIG config, PSERVERS ps)
+{	if(ps == servers) return;
+
+	(VOID) __lxchg((volatile LONG *) &servers, (LONG) ps);
+
+	if(ps == (PSERVERS) NULL) {
+		sprintf(
+			logmsg,
+			"no name servers available through interface %.40s",
+			config->refer_interface);
+	} else {
+		sprintf(
+			logmsg,
+			"interface %.40s up; referring to %d name server%s",
+			config->refer_interface,
+			ps->nservers,
+			ps->nservers == 1 ? "" : "s");
+	}
+	dolog(logmsg);
+}
+
+
 /*
  * Refer a query to the ISP's name server(s), if we currently have a
  * connection.
  *
- * The retry algorithm used is the same as that used by BIND 4.9.3;
- * the same number of retries are always done, but the second and
- * subsequent timeout values depend on the number of name servers
- * configured.
+ * If the same question is already being referred for another query with
+ * the same flags (see 'query_key'), no new referral is made; the reply to that one is shared, with the ID of
+ * this query. If this query is a retransmission of that one (the same
+ * client and ID), it is dropped, as the other thread will reply to it;
+ * 'noreply' is set in the thread information structure.
  *
  * On return, the packet is ready for sending back to the client, apart
  * from the packet length field in the thread information structure.
@@ -40,18 +177,240 @@ static	UCHAR		logmsg[MAXLOG];
  */
 
 VOID refer(PTHREADINFO ti)
-{	INT i, retries, rc;
-	INT timeout = INITIAL_REFER_TIMEOUT;
-	INT itimeout;
-	SOCK sa;
+{	INT i, qlen, key;
+	ULONG hash;
 	HEADER *h = (HEADER *) ti->buf;
-	PSERVERS ps;
+	PUCHAR question = ti->buf + sizeof(HEADER);
+	PFLIGHT f, *pf;
+	PWAITER w;
+	WAITER me;
+
+	/* Only a query with a single question, just parsed, is shared */
+
+	qlen = ti->qp - question;
+	key = query_key(ti);
+	if(ntohs(h->qdcount) != 1 || qlen <= QFIXEDSZ || key < 0) {
+		refer_query(ti);
+		return;
+	}
+	hash = name_hash(question, qlen - QFIXEDSZ);
+	memcpy((PUCHAR) &me.sa, (PUCHAR) &ti->sa, sizeof(SOCK));
+	me.id = h->id;
+
+	(VOID) DosRequestMutexSem(flightsem, SEM_INDEFINITE_WAIT);
+
+	f = find_flight(hash, question, qlen, (UCHAR) key);
+	if(f != (PFLIGHT) NULL) {
+		for(w = f->waiters; w != (PWAITER) NULL; w = w->next)
+			if(w->id == me.id &&
+			   w->sa.sin_addr.s_addr == me.sa.sin_addr.s_addr &&
+			   w->sa.sin_port == me.sa.sin_port)
+				break;
+		if(w != (PWAITER) NULL) {	/* Retransmission */
+			(VOID) DosReleaseMutexSem(flightsem);
+			ti->noreply = TRUE;
+			return;
+		}
+		me.next = f->waiters;
+		f->waiters = &me;
+		f->nrefs++;
+		(VOID) DosReleaseMutexSem(flightsem);
 #ifdef	DEBUG
-	INT namelen;
+		trace("thread %d; sharing referral in progress", ti->thread);
 #endif
+		(VOID) DosWaitEventSem(f->hev, SEM_INDEFINITE_WAIT);
+		take_reply(ti, f, qlen);
+		leave_flight(f);
+		return;
+	}
+
+	/* None in progress, so start one */
+
+	f = (PFLIGHT) malloc(sizeof(FLIGHT) + qlen);
+	if(f == (PFLIGHT) NULL ||
+	   DosCreateEventSem((PSZ) NULL, &f->hev, 0, FALSE) != 0) {
+		(VOID) DosReleaseMutexSem(flightsem);
+		if(f != (PFLIGHT) NULL) free(f);
+		refer_query(ti);
+		return;
+	}
+	f->hash = hash;
+	f->qlen = qlen;
+	f->key = (UCHAR) key;
+	memcpy(f->question, question, qlen);
+	me.next = (PWAITER) NULL;
+	f->waiters = &me;
+	f->nrefs = 1;
+	f->reply = (PUCHAR) NULL;
+	f->pktlen = 0;
+	i = hash & (FLIGHTHASH-1);
+	f->next = flights[i];
+	flights[i] = f;
+
+	(VOID) DosReleaseMutexSem(flightsem);
+
+	refer_query(ti);
+
+	/* Take the referral out of the table, so that nothing more joins it,
+	   and keep a copy of the reply for any that have */
+
+	(VOID) DosRequestMutexSem(flightsem, SEM_INDEFINITE_WAIT);
+	for(pf = &flights[i]; *pf != f; pf = &(*pf)->next)
+		;
+	*pf = f->next;
+	(VOID) DosReleaseMutexSem(flightsem);
+
+	if(f->nrefs > 1) {
+		f->pktlen = ti->rp - ti->buf;
+		f->reply = (PUCHAR) malloc(f->pktlen);
+		if(f->reply != (PUCHAR) NULL)
+			memcpy(f->reply, ti->buf, f->pktlen);
+	}
+	(VOID) DosPostEventSem(f->hev);
+	leave_flight(f);
+}
+
+
+/*
+ * Work out the flags of a query that decide whether it may share a
+ * referral with another: the 'recursion desired' and 'checking disabled'
+ * bits, whether there is an OPT record, and whether that asks for DNSSEC
+ * data (the DO bit). The whole query is sent on, so queries that differ
+ * in any of these can get different replies. 'ti->qp' points just past
+ * the question.
+ *
+ * Returns the flags, or -1 if the query has records other than a single
+ * OPT record after the question, and should not be shared.
+ *
+ */
+
+static INT query_key(PTHREADINFO ti)
+{	INT n, key;
+	HEADER *h = (HEADER *) ti->buf;
+	PUCHAR p = ti->qp;
+	PUCHAR end = ti->buf + ti->pktlen;
+
+	key = h->rd != 0 ? KEY_RD : 0;
+	if((ti->buf[3] & HDR_CD) != 0) key |= KEY_CD;
+
+	if(ntohs(h->ancount) != 0 || ntohs(h->nscount) != 0 ||
+	   ntohs(h->arcount) > 1)
+		return(-1);
+	if(ntohs(h->arcount) == 0) return(key);
+
+	n = dn_skipname(p, end);
+	if(n < 0 || p + n + RRFIXEDSZ > end) return(-1);
+	p += n;
+	if(((p[0] << 8) | p[1]) != T_OPT) return(-1);
+	key |= KEY_OPT;
+	if((p[6] & 0x80) != 0) key |= KEY_DO;	/* Top bit of EDNS flags */
+
+	return(key);
+}
+
+
+/*
+ * Find a referral in progress for the same question, ignoring case in
+ * the name, and with the same flags (see 'query_key'). The caller owns
+ * the referral semaphore.
+ *
+ * Returns a pointer to the referral, or NULL if there is none.
+ *
+ */
+
+static PFLIGHT find_flight(ULONG hash, PUCHAR question, INT qlen, UCHAR key)
+{	INT n = qlen - QFIXEDSZ;
+	PFLIGHT f;
+
+	for(f = flights[hash & (FLIGHTHASH-1)];
+	    f != (PFLIGHT) NULL;
+	    f = f->next) {
+		if(f->hash == hash &&
+		   f->qlen == qlen &&
+		   f->key == key &&
+		   name_equal(f->question, question, n) == TRUE &&
+		   memcmp(f->question + n, question + n, QFIXEDSZ) == 0)
+			return(f);
+	}
+
+	return((PFLIGHT) NULL);
+}
+
+
+/*
+ * Make the reply to a shared referral the reply to this query. The
+ * header and everything after the question are copied; the question is
+ * left as the client sent it, as it may differ in case, and the ID is
+ * kept.
+ *
+ */
+
+static VOID take_reply(PTHREADINFO ti, PFLIGHT f, INT qlen)
+{	USHORT id;
+	INT n = sizeof(HEADER) + qlen;
+	HEADER *h = (HEADER *) ti->buf;
+
+	if(f->reply == (PUCHAR) NULL || f->pktlen < n) {
+		h->rcode = SERVFAIL;		/* As for failed referral */
+		return;
+	}
+
+	id = h->id;
+	memcpy(ti->buf, f->reply, sizeof(HEADER));
+	memcpy(ti->buf + n, f->reply + n, f->pktlen - n);
+	h->id = id;
+	ti->rp = ti->buf + f->pktlen;
+}
+
+
+/*
+ * Stop using a shared referral, and free it if nothing else is.
+ *
+ */
+
+static VOID leave_flight(PFLIGHT f)
+{	INT n;
+
+	(VOID) DosRequestMutexSem(flightsem, SEM_INDEFINITE_WAIT);
+	n = --f->nrefs;
+	(VOID) DosReleaseMutexSem(flightsem);
+	if(n != 0) return;
+
+	(VOID) DosCloseEventSem(f->hev);
+	if(f->reply != (PUCHAR) NULL) free(f->reply);
+	free(f);
+}
+
+
+/*
+ * Refer a query to the name servers, with retries.
+ *
+ * Each round tries every name server, as in BIND 4.9.3, and the same
+ * number of rounds are always done. The time to wait for each server is
+ * worked out from its own recent reply times, and grows each time it
+ * fails to reply (see upstream.c). Within each round, a query may be
+ * hedged (see 'consult_nameservers'). However many rounds are left, the
+ * referral is given up once the configured deadline has passed, so that
+ * a thread is not kept waiting long after the client has stopped.
+ *
+ * On return, the packet is ready for sending back to the client, apart
+ * from the packet length field in the thread information structure.
+ * However, the 'rp' field is set to the next free byte in the reply area.
+ * If a reply was received, the packet buffer is now the one it was
+ * received into, and the buffer that held the query is kept as the
+ * referral buffer.
+ *
+ */
 
-	if(referral_interface_up(ti) == TRUE) {
-		ps = ti->ps;
+static VOID refer_query(PTHREADINFO ti)
+{	INT i, retries;
+	ULONG deadline;
+	HEADER *h = (HEADER *) ti->buf;
+	PSERVERS ps;
+
+	ps = servers;
+	ti->ps = ps;
+	if(ps != (PSERVERS) NULL) {
 #ifdef	DEBUG
 		trace("nservers = %d", ps->nservers);
 		for(i = 0; i < ps->nservers; i++) {
@@ -61,214 +420,126 @@ VOID refer(PTHREADINFO ti)
 				inet_ntoa(ps->servers[i]));
 		}
 #endif
-		/* Create a socket for doing the queries */
-
-		ti->rsockno = socket(AF_INET, SOCK_DGRAM, 0);
-		if(ti->rsockno < 0) {
-			sprintf(
-				ti->logmsg,
-				"failed to allocate socket for refer: rc = %d",
-				sock_errno());
-			dolog(ti->logmsg);
-			h->rcode = NXDOMAIN;
-			return;
-		}	
-
-		/* Bind the socket to an arbitrary port */
-
-		memset((PUCHAR) &sa, 0, sizeof(SOCK));
-		sa.sin_family = AF_INET;
-		sa.sin_port = 0;		/* Let system select port */
-		sa.sin_addr.s_addr = INADDR_ANY;
-
-		rc = bind(ti->rsockno, (PSOCKG) &sa, sizeof(SOCK));
-		if(rc < 0) {
-			sprintf(
-				ti->logmsg,
-				"failed to bind referral socket: rc = %d",
-				sock_errno());
-			dolog(ti->logmsg);
-			h->rcode = NXDOMAIN;
-			return;
+		/* Get a buffer for the reply, if there is not one already */
+
+		if(ti->rbuf == (PUCHAR) NULL) {
+			ti->rbuf = (PUCHAR) malloc(PACKETSZ);
+			if(ti->rbuf == (PUCHAR) NULL) {
+				dolog("failed to allocate referral buffer");
+				h->rcode = SERVFAIL;
+				return;
+			}
 		}
 
+		deadline = upstream_clock() +
+				(ULONG) ti->config->refer_deadline*1000;
+		for(retries = 0; retries < REFER_RETRY_LIMIT; retries++) {
+			if(consult_nameservers(ti, ps, deadline) == TRUE)
+				return;
+			if((LONG) (deadline - upstream_clock()) <= 0) {
 #ifdef	DEBUG
-		namelen = sizeof(SOCK);
-		rc = getsockname(ti->rsockno, (PSOCKG) &sa, &namelen);
-		if(rc < 0) {
-			sprintf(
-				ti->logmsg,
-				"getsockname failed on referral socket: "
-				"rc = %d",
-				sock_errno());
-			dolog(ti->logmsg);
-		} else {
-			trace(
-				"referral socket bound to port %hu",
-				ntohs(sa.sin_port));
-		}
+				trace(
+					"thread %d; referral deadline passed",
+					ti->thread);
 #endif
-
-		if(ps->nservers == 1) {		/* Algorithm differs */
-			for(retries = 0;
-			    retries < REFER_RETRY_LIMIT;
-			    retries++) {
-				if(consult_nameserver(
-					ti,
-					timeout,
-					ps->servers[0]) == TRUE) {
-						soclose(ti->rsockno);
-						return;
-				}
-				timeout *= 2;	/* Double timeout each time */
-			}
-		} else {
-			itimeout = timeout;
-			for(retries = 0;
-			    retries < REFER_RETRY_LIMIT;
-			    retries++) {
-				for(i = 0; i < ps->nservers; i++) {
-					if(consult_nameserver(
-						ti,
-						itimeout,
-						ps->servers[i]) == TRUE) {
-							soclose(ti->rsockno);
-							return;
-					}
-				}
-				timeout *= 2;	/* Double and reduce */
-				itimeout = timeout/ps->nservers;
+				break;
 			}
 		}
 	}
 
-	soclose(ti->rsockno);
-	h->rcode = NXDOMAIN;	/* Name server(s) not accessible or responding */
+	h->rcode = SERVFAIL;	/* Name server(s) not accessible or responding */
 }
 
 
 /*
- * Refer a query to a specified name server.
+ * Refer a query to each of a list of name servers in turn, waiting for a
+ * reply from each before going on to the next. The servers are tried
+ * fastest first, and any that are down are skipped (see
+ * 'upstream_select'). The query is sent from
+ * one of the shared sockets (see upstream.c), and the reply is received
+ * into the referral buffer. Once its ID has been made the same as that
+ * of the query, it is sent back to the client from there; the two
+ * buffers are simply exchanged, and the reply is not copied.
+ *
+ * If a name server is slower to reply than it usually is, the query is
+ * hedged: it is sent to the next server as well, without giving up on
+ * the first, and whichever reply arrives first is used. This cuts the
+ * time taken when a server has lost a packet or is busy, but is limited
+ * to a configured proportion of queries so that it adds little load.
+ *
+ *	ti	points to the thread information structure
+ *	ps	points to the list of name servers
+ *	until	is the time (see 'upstream_clock') by which to give up
  *
- * Returns TRUE if the name server responds, regardless of whether the actual
- * query succeeds; returns FALSE if the name server is not responding or there
+ * Returns TRUE if a name server responds, regardless of whether the actual
+ * query succeeds; returns FALSE if no name server is responding or there
  * is some other error.
  *
  */
 
-static BOOL consult_nameserver(PTHREADINFO ti, INT timeout, INADDR addr)
-{	INT rc, pktlen, namelen;
-	INT sockset[2];
-	SOCK nsa;
-	SOCK sa;
-	UCHAR rbuf[PACKETSZ];
-
-	memset((PUCHAR) &nsa, 0, sizeof(SOCK));
-	nsa.sin_family = AF_INET;
-	nsa.sin_port = ti->config->nsport;
-	nsa.sin_addr = addr;
-
+static BOOL consult_nameservers(PTHREADINFO ti, PSERVERS ps, ULONG until)
+{	INT i, n, rc, pktlen;
+	INT group = -1;
+	INADDR addrs[MAXNS];
+	ULONG wait, delay;
+	LONG left;
+	BOOL replied = FALSE;
+	PUCHAR p;
+
+	n = upstream_select(ps, addrs);
+	for(i = 0; i < n && replied == FALSE; i++) {
+		left = (LONG) (until - upstream_clock());
+		if(left <= 0) break;
+		wait = upstream_rto(addrs[i]);
+		if(wait > (ULONG) left) wait = (ULONG) left;
 #ifdef	DEBUG
-	trace(
-		"thread %d; referring to nameserver %s:%hu (family %d), timeout %d seconds",
-		ti->thread,
-		inet_ntoa(nsa.sin_addr),
-		ntohs(nsa.sin_port),
-		nsa.sin_family,
-		timeout);
+		trace(
+			"thread %d; referring to nameserver %s:%hu, "
+			"timeout %lu ms",
+			ti->thread,
+			inet_ntoa(addrs[i]),
+			ntohs(ti->config->nsport),
+			wait);
 #endif
-
-	/* Send the query to the specified name server */
-
-	rc = sendto(
-		ti->rsockno,
-		ti->buf,
-		ti->pktlen,
-		0,			/* No flags */
-		(PSOCKG) &nsa,
-		sizeof(SOCK));
-	if(rc == -1) {
-		sprintf(
-			ti->logmsg,
-			"failed to send referral packet: rc = %d",
-			sock_errno());
-		dolog(ti->logmsg);
-		return(FALSE);
-	}
-
-	/* Now wait for a reply, an exception or a timeout */
-
-	sockset[0] = ti->rsockno;		/* Read waiting */
-	sockset[1] = ti->rsockno;		/* Exception */
-
-	if(select(
-		sockset,			/* List of sockets */
-		1,				/* Sockets for read check */
-		0,				/* Sockets for write check */
-		1,				/* Sockets for exception check */
-		timeout*1000) == -1) {		/* Timeout in milliseconds */
-		sprintf(
-			ti->logmsg,
-			"referral select failed: rc = %d",
-			sock_errno());
-		dolog(ti->logmsg);
-		return(FALSE);
-	}
-
-	if(sockset[1] != -1) {			/* Exception */
+		rc = upstream_send(ti, addrs[i], group);
+		if(rc < 0) continue;
+		group = rc;
+
+		/* Wait for the usual reply time first, if there is another
+		   server to hedge to */
+
+		if(i < n - 1) {
+			delay = upstream_hedge_delay(addrs[i]);
+			if(delay != 0 && delay < wait) {
+				replied = upstream_wait(group, delay);
+				if(replied == TRUE) break;
+				if(upstream_hedge() == TRUE) {
 #ifdef	DEBUG
-		sprintf(
-			ti->logmsg,
-			"thread %d; exception on referral socket: rc = %d",
-			ti->thread,
-			errno);
-#else
-		sprintf(
-			ti->logmsg,
-			"exception on referral socket: rc = %d",
-			errno);
+					trace(
+						"thread %d; hedging after %lu ms",
+						ti->thread,
+						delay);
 #endif
-		dolog(ti->logmsg);
-		return(FALSE);
+					continue;
+				}
+				wait -= delay;
+			}
+		}
+		replied = upstream_wait(group, wait);
 	}
 
-	if(sockset[0] == -1) return(FALSE);	/* Should not happen */
-
-	namelen = sizeof(SOCK);
-	pktlen = recvfrom(
-		ti->rsockno,
-		rbuf,
-		PACKETSZ,
-		0,				/* No flags */
-		(PSOCKG) &sa,
-		&namelen);
-	if(pktlen <= 0) {
-		sprintf(
-			ti->logmsg,
-			"referral recvfrom failed: rc = %d",
-			sock_errno());
-			dolog(ti->logmsg);
-			return(FALSE);
-	}
-	if(pktlen > PACKETSZ) {
-		sprintf(
-			ti->logmsg,
-			"dropped referral reply packet (pktlen=%d, "
-			"pktbuflen=%d)",
-			pktlen,
-			PACKETSZ);
-		dolog(ti->logmsg);
-		return(FALSE);
-	}
+	pktlen = upstream_end(ti, group);
+	if(pktlen < 0) return(FALSE);
 
 #ifdef	DEBUG
-	trace(
-		"packet received from %s",
-		inet_ntoa(sa.sin_addr));
+	trace("packet received");
 #endif
 
-	memcpy(ti->buf, rbuf, pktlen);		/* Copy reply */
-	memset(ti->buf + pktlen, '\0', PACKETSZ - pktlen);	/* Clean up rest */
+	((HEADER *) ti->rbuf)->id = ((HEADER *) ti->buf)->id;
+
+	p = ti->buf;			/* Exchange buffers */
+	ti->buf = ti->rbuf;
+	ti->rbuf = p;
 	ti->rp = ti->buf + pktlen;	/* Packet length set later */
 
 	return(TRUE);
@@ -278,16 +549,14 @@ static BOOL consult_nameserver(PTHREADINFO ti, INT timeout, INADDR addr)
 /*
  * Check the status of the referral interface.
  *
- * Returns TRUE if the interface is up, and FALSE if it is down (or if
- * there is an error).
- *
- * Has the side effect (if the interface is up) of setting the 'servers' field
- * in the thread information block to a SERVERS structure containing the
- * addresses of the name servers to which the referral is to be made.
+ * Returns a pointer to the SERVERS structure containing the addresses of
+ * the name servers to which referrals are to be made, or NULL if the
+ * interface is down, if no list of servers matches it, or if there is
+ * an error.
  *
  */
 
-static BOOL referral_interface_up(PTHREADINFO ti)
+static PSERVERS check_interface(PCONFIG config)
 {	INT rc, i;
 	INT sockno;
 	IFCONF ifc;
@@ -300,8 +569,8 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 	if(getenv("REFER_INTERFACE_UP") != (PUCHAR) NULL) {
 		trace(
 			"interface %s is deemed to be up",
-			ti->config->refer_interface);
-		return(TRUE);
+			config->refer_interface);
+		return(config->servlist);
 	}
 #endif
 
@@ -310,12 +579,12 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 	sockno = socket(AF_INET, SOCK_DGRAM, 0);	/* Type is immaterial */
 	if(sockno < 0) {
 		sprintf(
-			ti->logmsg,
+			logmsg,
 			"failed to allocate socket for interface check: "
 			"rc = %d",
 			sock_errno());
-		dolog(ti->logmsg);
-		return(FALSE);
+		dolog(logmsg);
+		return((PSERVERS) NULL);
 	}
 
 	/* Get the interface configuration */
@@ -326,12 +595,12 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 	rc = ioctl(sockno, SIOCGIFCONF, (PUCHAR) &ifc, sizeof(ifc));
 	if(rc < 0) {
 		sprintf(
-			ti->logmsg,
+			logmsg,
 			"get interface configuration failed: rc = %d",
 			sock_errno());
-		dolog(ti->logmsg);
+		dolog(logmsg);
 		soclose(sockno);
-		return(FALSE);
+		return((PSERVERS) NULL);
 	}
 
 	/* Search for the referral interface and determine if it is up */
@@ -345,7 +614,9 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 
 		/* See if this is the interface we want */
 
-		if(stricmp(ti->config->refer_interface, ifr->ifr_name) != 0)
+		if(name_same(
+			config->refer_interface,
+			ifr->ifr_name) == FALSE)
 			continue;
 
 		/* Now get the interface flags and see if it is up */
@@ -357,11 +628,11 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 			sizeof(IFREQ));
 		if(rc < 0) {
 			sprintf(
-				ti->logmsg,
+				logmsg,
 				"get interface flags for %s failed: rc = %d",
-				ti->config->refer_interface,
+				config->refer_interface,
 				sock_errno());
-			dolog(ti->logmsg);
+			dolog(logmsg);
 			break;
 		}
 		if((ifr->ifr_flags & IFF_UP) != 0) {
@@ -378,34 +649,31 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 				sizeof(IFREQ));
 			if(rc < 0) {
 				sprintf(
-					ti->logmsg,
+					logmsg,
 					"get interface destination address "
 					"for %s failed: rc = %d",
-					ti->config->refer_interface,
+					config->refer_interface,
 					sock_errno());
-				dolog(ti->logmsg);
+				dolog(logmsg);
 				break;
 			}
 			memcpy(&ppsa, &ifr->ifr_dstaddr, sizeof(SOCK));
 #ifdef	DEBUG
 			trace(
 				"destination address for %s is %s",
-				ti->config->refer_interface,
+				config->refer_interface,
 				inet_ntoa(ppsa.sin_addr));
 #endif
-			ti->ps = (PSERVERS) NULL;	/* In case of error */
-			for(ps = ti->config->servlist;
+			for(ps = config->servlist;
 			    ps != (PSERVERS) NULL;
 			    ps = ps->next) {
 				if((ps->if_addr.s_addr & ps->if_mask.s_addr) ==
-				   (ppsa.sin_addr.s_addr & ps->if_mask.s_addr)) {
-					ti->ps = ps;
+				   (ppsa.sin_addr.s_addr & ps->if_mask.s_addr))
 					break;
-				}
 			}
 
 			soclose(sockno);
-			return(TRUE);
+			return(ps);
 		}
 #ifdef	DEBUG
 		trace("interface %s is down", ifr->ifr_name);
@@ -414,7 +682,7 @@ static BOOL referral_interface_up(PTHREADINFO ti)
 	}
 
 	soclose(sockno);
-	return(FALSE);
+	return((PSERVERS) NULL);
 }
 
 /*
@@ -0,0 +1,1054 @@
+/*
+ * File: secondary.c
+ *
+ * Name server for OS/2.
+ *
+ * Secondary zones, copied from a primary server by zone transfer.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Each zone given by a SECONDARY command is copied from its primary
+ * server by a zone transfer over TCP. The first copy is made by an AXFR
+ * when the server starts. After that, a background thread asks the
+ * primary for the zone's SOA record at the refresh interval given in
+ * that record, and if the serial number has gone up, makes an IXFR; the
+ * primary may answer with just the changes, or with the whole zone. If
+ * the primary cannot be reached, the check is tried again at the retry
+ * interval; if nothing has been heard from it for the expire interval,
+ * the zone's data is dropped.
+ *
+ * The records for each zone are kept here as a simple chain, which is
+ * never changed once it has been built; a transfer builds a new chain.
+ * The new chain is put in place of the old one, and a new version of
+ * the databases is then loaded (see version.c), which copies the records
+ * of all the zones into it. Queries therefore go on being answered from
+ * the old version while a transfer is going on, and see the new data all
+ * at once. An old chain is freed after the new version has been loaded;
+ * loads never overlap, so by then no load can still be reading it.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, secondary_init)
+#pragma	alloc_text(init_seg, secondary_start)
+
+#define	SEC_STACK	32768		/* Stack size for refresh thread */
+#define	SEC_TICK	10		/* Seconds between looks at zones */
+#define	XFR_TIMEOUT	30		/* Transfer timeout (seconds) */
+#define	SOA_TIMEOUT	5		/* SOA query timeout (seconds) */
+#define	SOA_RETRIES	3		/* Times to send SOA query */
+#define	MIN_REFRESH	30		/* Shortest refresh or retry time */
+#define	DEFAULT_RETRY	600		/* Retry time before first transfer */
+#define	XFR_BUFSIZE	65536L		/* Largest transfer message */
+
+/* Results from 'transfer' */
+
+#define	TR_FAILED	0		/* Transfer failed */
+#define	TR_CURRENT	1		/* Copy is up to date */
+#define	TR_NEW		2		/* New copy transferred */
+#define	TR_AXFR		3		/* Whole zone must be asked for */
+
+/* Type definitions */
+
+typedef struct _SECREC {		/* Record in a secondary zone */
+struct _SECREC	*next;			/* Next record in chain */
+PUCHAR		name;			/* Owner name */
+PRR		rr;			/* The record */
+} SECREC, *PSECREC;
+
+typedef struct _SECZONE {		/* State of a secondary zone */
+struct _SECZONE	*next;			/* Next entry in chain */
+PSECONDARY	sec;			/* Configuration information */
+PSECREC volatile recs;			/* Current records; NULL if none */
+PRR		soa;			/* SOA record in above */
+ULONG		serial;			/* Serial number of above */
+ULONG		refresh;		/* Refresh interval (seconds) */
+ULONG		retry;			/* Retry interval (seconds) */
+ULONG		expire;			/* Expire interval (seconds) */
+time_t		checked;		/* Time primary last answered */
+time_t		due;			/* Time of next check */
+BOOL		loaded;			/* Has data in version being loaded */
+} SECZONE, *PSECZONE;
+
+/* Forward references */
+
+static	BOOL		add_rec(PSECREC **, PUCHAR, PRR);
+static	VOID		apply_del(PSECREC *, PUCHAR, PRR);
+static	PSECREC		copy_recs(PSECREC);
+static	VOID		free_recs(PSECREC);
+static	BOOL		get_msg(INT, PUCHAR, PINT);
+static	PRR		get_rr(PUCHAR, PUCHAR, PUCHAR *, PUCHAR);
+static	BOOL		in_zone(PUCHAR, PUCHAR);
+static	BOOL		newer(ULONG, ULONG);
+static	INT		open_conn(PSECZONE);
+static	INT		put_query(PUCHAR, PSECZONE, INT);
+static	BOOL		recv_all(INT, PUCHAR, INT);
+static	VOID		refresher(PVOID);
+static	PUCHAR		skip_name(PUCHAR, PUCHAR);
+static	BOOL		soa_serial(PSECZONE, PULONG);
+static	VOID		soa_times(PSECZONE, PRR);
+static	INT		transfer(PSECZONE, INT, PSECREC *, PRR *);
+
+/* Local storage */
+
+static	PCONFIG		sconfig;	/* Configuration information */
+static	PSECZONE	zones;		/* Secondary zones */
+static	USHORT		nextid;		/* Next query ID */
+static	UCHAR		logmsg[MAXLOG];	/* Logging buffer (refresh thread
+					   and startup only) */
+
+
+/*
+ * Set up the secondary zones, and make the first transfer of each one.
+ * This is called before the first version of the databases is loaded.
+ * A zone that cannot be transferred is tried again later, by the refresh
+ * thread; until then it has no records.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+BOOL secondary_init(PCONFIG config)
+{	time_t now;
+	PSECONDARY sec;
+	PSECZONE z, *pz;
+	PSECREC recs;
+	PRR soa;
+
+	sconfig = config;
+	nextid = (USHORT) time((time_t *) NULL);
+
+	pz = &zones;
+	for(sec = config->secondaries;
+	    sec != (PSECONDARY) NULL;
+	    sec = sec->next) {
+		z = (PSECZONE) calloc(1, sizeof(SECZONE));
+		if(z == (PSECZONE) NULL) {
+			dolog("failed to allocate secondary zone information");
+			return(FALSE);
+		}
+		z->sec = sec;
+		z->retry = DEFAULT_RETRY;
+		*pz = z;
+		pz = &z->next;
+
+		now = time((time_t *) NULL);
+		if(transfer(z, T_AXFR, &recs, &soa) == TR_NEW) {
+			z->recs = recs;
+			z->soa = soa;
+			soa_times(z, soa);
+			z->checked = now;
+			z->due = now + z->refresh;
+		} else {
+			z->due = now + z->retry;
+		}
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Start the thread that keeps the secondary zones up to date, if there
+ * are any.
+ *
+ * Returns:
+ *	TRUE		thread started, or not configured
+ *	FALSE		failed to start
+ *
+ */
+
+BOOL secondary_start(PCONFIG config)
+{	INT rc;
+
+	if(zones == (PSECZONE) NULL) return(TRUE);
+
+	rc = _beginthread(refresher, NULL, SEC_STACK, (PVOID) NULL);
+	if(rc == -1) {
+		dolog("failed to create secondary zone thread");
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Add the records of all the secondary zones to a new version of the
+ * default database.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+BOOL secondary_load(PCONFIG config, PDB db)
+{	PSECZONE z;
+	PSECREC p;
+	PRR rr;
+
+	for(z = zones; z != (PSECZONE) NULL; z = z->next) {
+		z->loaded = z->recs == (PSECREC) NULL ? FALSE : TRUE;
+		for(p = z->recs; p != (PSECREC) NULL; p = p->next) {
+			rr = (PRR) malloc(sizeof(RR) + p->rr->rdlength);
+			if(rr == (PRR) NULL) {
+				dolog("failed to allocate secondary zone record");
+				return(FALSE);
+			}
+			memcpy((PUCHAR) rr, (PUCHAR) p->rr,
+				sizeof(RR) + p->rr->rdlength);
+			rr->next = (PRR) NULL;
+			if(db_add_rr(db, p->name, rr) == FALSE) {
+				dolog("failed to add secondary zone record");
+				return(FALSE);
+			}
+		}
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Note which secondary zones have data in the version of the databases
+ * that has just been published. Queries for names in a zone that has
+ * none, because it has not yet been transferred or has expired, are
+ * answered with SERVFAIL. This is called, with the version lock held,
+ * when a new version is published.
+ *
+ */
+
+VOID secondary_commit(VOID)
+{	PSECZONE z;
+
+	for(z = zones; z != (PSECZONE) NULL; z = z->next)
+		z->sec->current = z->loaded;
+}
+
+
+/*
+ * The refresh thread. Looks at each zone every SEC_TICK seconds, and
+ * checks with the primary for any that are due. If any zone has changed,
+ * a new version of the databases is loaded.
+ *
+ */
+
+static VOID refresher(PVOID param)
+{	INT rc;
+	BOOL changed;
+	time_t now;
+	ULONG serial;
+	PSECZONE z;
+	PSECREC recs, old, dead;
+	PRR soa;
+
+	for(;;) {
+		DosSleep(SEC_TICK*1000);
+
+		changed = FALSE;
+		dead = (PSECREC) NULL;
+		for(z = zones; z != (PSECZONE) NULL; z = z->next) {
+			now = time((time_t *) NULL);
+			if(now < z->due) continue;
+
+			/* If the primary says the serial number has not
+			   gone up, there is nothing to do */
+
+			if(z->recs != (PSECREC) NULL &&
+			   soa_serial(z, &serial) == TRUE &&
+			   newer(serial, z->serial) == FALSE) {
+				z->checked = now;
+				z->due = now + z->refresh;
+				continue;
+			}
+
+			rc = transfer(
+				z,
+				z->recs == (PSECREC) NULL ? T_AXFR : T_IXFR,
+				&recs,
+				&soa);
+			if(rc == TR_AXFR)
+				rc = transfer(z, T_AXFR, &recs, &soa);
+			if(rc == TR_FAILED) {
+				z->due = now + z->retry;
+				if(z->recs == (PSECREC) NULL ||
+				   now - z->checked < z->expire)
+					continue;
+				sprintf(
+					logmsg,
+					"secondary zone %.100s: expired; "
+					"no answer from primary for %lu seconds",
+					z->sec->origin,
+					z->expire);
+				dolog(logmsg);
+				recs = (PSECREC) NULL;
+				soa = (PRR) NULL;
+			} else {
+				z->checked = now;
+				if(rc == TR_NEW) soa_times(z, soa);
+				z->due = now + z->refresh;
+				if(rc == TR_CURRENT) continue;
+			}
+
+			/* Put the new records in place; the old ones are
+			   kept until the new version has been loaded */
+
+			old = z->recs;
+			z->recs = recs;
+			z->soa = soa;
+			if(old != (PSECREC) NULL) {
+				for(recs = old;
+				    recs->next != (PSECREC) NULL;
+				    recs = recs->next) ;
+				recs->next = dead;
+				dead = old;
+			}
+			changed = TRUE;
+		}
+
+		if(changed == FALSE) continue;
+
+		if(version_load(sconfig) == FALSE)
+			dolog("database version not loaded; still using old one");
+		free_recs(dead);
+	}
+}
+
+
+/*
+ * Transfer a zone from its primary server.
+ *
+ *	z	points to the zone
+ *	qtype	is T_AXFR for the whole zone, or T_IXFR for the changes
+ *		since the current copy, which must exist
+ *	precs	points to where to store the new chain of records
+ *	psoa	points to where to store a pointer to the SOA record in it
+ *
+ * Returns:
+ *	TR_NEW		new copy transferred
+ *	TR_CURRENT	copy is already up to date
+ *	TR_AXFR		(IXFR only) the primary sent only a newer SOA record,
+ *			so the whole zone must be asked for
+ *	TR_FAILED	transfer failed; the error has been logged
+ *
+ */
+
+static INT transfer(PSECZONE z, INT qtype, PSECREC *precs, PRR *psoa)
+{	INT i, n, len, sockno, nrrs = 0;
+	BOOL ixfr = FALSE, adding = FALSE, done = FALSE, kept = FALSE;
+	BOOL ok = TRUE, whole = FALSE;
+	ULONG newserial = 0, serial;
+	USHORT id;
+	PUCHAR buf, p, end;
+	PSECREC recs = (PSECREC) NULL;
+	PSECREC *tail = &recs;
+	PRR rr, soa = (PRR) NULL;
+	HEADER *h;
+	UCHAR name[MAXDNAME+1];
+
+	buf = (PUCHAR) malloc(XFR_BUFSIZE);
+	if(buf == (PUCHAR) NULL) {
+		dolog("failed to allocate zone transfer buffer");
+		return(TR_FAILED);
+	}
+
+	sockno = open_conn(z);
+	if(sockno < 0) {
+		free(buf);
+		return(TR_FAILED);
+	}
+
+	id = nextid++;
+	len = put_query(buf + 2, z, qtype);
+	putshort(len, buf);
+	((HEADER *) (buf + 2))->id = htons(id);
+	if(len < 0 || send(sockno, buf, len + 2, 0) != len + 2) {
+		sprintf(
+			logmsg,
+			"secondary zone %.100s: failed to send request",
+			z->sec->origin);
+		dolog(logmsg);
+		soclose(sockno);
+		free(buf);
+		return(TR_FAILED);
+	}
+
+	/* Read messages until the closing SOA record */
+
+	while(done == FALSE && ok == TRUE) {
+		ok = get_msg(sockno, buf, &len);
+		if(ok == FALSE) break;
+		h = (HEADER *) buf;
+		end = buf + len;
+		if(h->qr == 0 || ntohs(h->id) != id || h->rcode != NOERROR) {
+			sprintf(
+				logmsg,
+				"secondary zone %.100s: transfer refused, rcode %d",
+				z->sec->origin,
+				h->rcode);
+			dolog(logmsg);
+			ok = FALSE;
+			break;
+		}
+
+		p = buf + sizeof(HEADER);
+		for(i = ntohs(h->qdcount); i > 0 && p != (PUCHAR) NULL; i--) {
+			p = skip_name(p, end);
+			if(p != (PUCHAR) NULL) p += QFIXEDSZ;
+		}
+
+		for(i = ntohs(h->ancount); i > 0 && done == FALSE; i--) {
+			rr = p == (PUCHAR) NULL ? (PRR) NULL :
+				get_rr(buf, end, &p, name);
+			if(rr == (PRR) NULL) {
+				ok = FALSE;
+				break;
+			}
+			serial = rr->type == T_SOA ?
+				_getlong(rr->rdata + rr->rdlength - 20) : 0;
+
+			if(nrrs++ == 0) {	/* Opening SOA record */
+				if(rr->type != T_SOA ||
+				   name_same(name, z->sec->origin) == FALSE) {
+					free(rr);
+					ok = FALSE;
+					break;
+				}
+				soa = rr;
+				newserial = serial;
+				if(qtype == T_IXFR &&
+				   newer(newserial, z->serial) == FALSE)
+					done = TRUE;	/* Up to date */
+				continue;
+			}
+
+			/* The second record shows what kind of answer this
+			   is. For an incremental one, it is the SOA record
+			   of our copy, starting the first set of changes;
+			   the changes are made to a copy of our records. */
+
+			if(nrrs == 2) {
+				if(qtype == T_IXFR &&
+				   rr->type == T_SOA &&
+				   serial == z->serial) {
+					ixfr = TRUE;
+					recs = copy_recs(z->recs);
+					for(tail = &recs;
+					    *tail != (PSECREC) NULL;
+					    tail = &(*tail)->next) ;
+					free(rr);
+					if(recs == (PSECREC) NULL) ok = FALSE;
+					continue;
+				}
+				if(add_rec(&tail, z->sec->origin, soa) == FALSE) {
+					free(rr);
+					ok = FALSE;
+					break;
+				}
+				kept = TRUE;
+			}
+
+			/* In a whole zone, an SOA record is the end. In a set
+			   of changes, one separates the deletions from the
+			   additions, and one with the new serial number after
+			   the additions is the end. */
+
+			if(rr->type == T_SOA) {
+				if(ixfr == FALSE ||
+				   (adding == TRUE && serial == newserial))
+					done = TRUE;
+				else
+					adding = !adding;
+				free(rr);
+				continue;
+			}
+
+			if(rr->class != C_IN ||
+			   in_zone(name, z->sec->origin) == FALSE) {
+				free(rr);		/* Ignore */
+				continue;
+			}
+
+			if(ixfr == TRUE && adding == FALSE) {
+				apply_del(&recs, name, rr);
+				for(tail = &recs;
+				    *tail != (PSECREC) NULL;
+				    tail = &(*tail)->next) ;
+				free(rr);
+			} else if(add_rec(&tail, name, rr) == FALSE) {
+				free(rr);
+				ok = FALSE;
+			}
+		}
+
+		/* A reply to an IXFR that is only an SOA record newer than
+		   our copy means that the primary cannot send the changes;
+		   as BIND does, the whole zone is then asked for */
+
+		if(ok == TRUE && qtype == T_IXFR && nrrs == 1 && done == FALSE) {
+			whole = TRUE;
+			break;
+		}
+	}
+
+	soclose(sockno);
+	free(buf);
+
+	if(whole == TRUE) {
+		sprintf(
+			logmsg,
+			"secondary zone %.100s: IXFR from %s gave no changes "
+			"for serial %lu; asking for whole zone",
+			z->sec->origin,
+			inet_ntoa(z->sec->primary),
+			newserial);
+		dolog(logmsg);
+		free(soa);
+		return(TR_AXFR);
+	}
+
+	if(ok == FALSE) {
+		sprintf(
+			logmsg,
+			"secondary zone %.100s: %s from %s failed",
+			z->sec->origin,
+			qtype == T_AXFR ? "AXFR" : "IXFR",
+			inet_ntoa(z->sec->primary));
+		dolog(logmsg);
+		free_recs(recs);
+		if(kept == FALSE) free(soa);
+		return(TR_FAILED);
+	}
+
+	if(nrrs == 1) {				/* Up to date */
+		free(soa);
+		return(TR_CURRENT);
+	}
+
+	/* After an IXFR, the old SOA record is replaced by the new one */
+
+	if(ixfr == TRUE) {
+		apply_del(&recs, z->sec->origin, z->soa);
+		for(tail = &recs; *tail != (PSECREC) NULL; tail = &(*tail)->next) ;
+		if(add_rec(&tail, z->sec->origin, soa) == FALSE) {
+			free_recs(recs);
+			free(soa);
+			return(TR_FAILED);
+		}
+	}
+
+	n = 0;
+	for(*precs = recs; recs != (PSECREC) NULL; recs = recs->next)
+		n++;
+	*psoa = soa;
+
+	sprintf(
+		logmsg,
+		"secondary zone %.100s: %s from %s, serial %lu, %d records",
+		z->sec->origin,
+		ixfr == TRUE ? "IXFR" : "AXFR",
+		inet_ntoa(z->sec->primary),
+		newserial,
+		n);
+	dolog(logmsg);
+
+	return(TR_NEW);
+}
+
+
+/*
+ * Ask the primary server for a zone for its SOA record, over UDP.
+ *
+ * Returns TRUE if the serial number was obtained, FALSE if not.
+ *
+ */
+
+static BOOL soa_serial(PSECZONE z, PULONG serial)
+{	INT i, len, rc, namelen, sockno;
+	USHORT id;
+	PUCHAR p;
+	PRR rr;
+	HEADER *h;
+	SOCK sa;
+	INT sockset[1];
+	UCHAR pkt[PACKETSZ];
+	UCHAR name[MAXDNAME+1];
+
+	sockno = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sockno < 0) return(FALSE);
+
+	id = nextid++;
+	for(i = 0; i < SOA_RETRIES; i++) {
+		len = put_query(pkt, z, T_SOA);
+		if(len < 0) break;
+		((HEADER *) pkt)->id = htons(id);
+		memset((PUCHAR) &sa, 0, sizeof(SOCK));
+		sa.sin_family = AF_INET;
+		sa.sin_port = sconfig->nsport;
+		sa.sin_addr = z->sec->primary;
+		(VOID) sendto(sockno, pkt, len, 0, (PSOCKG) &sa, sizeof(SOCK));
+
+		sockset[0] = sockno;
+		rc = select(sockset, 1, 0, 0, SOA_TIMEOUT*1000L);
+		if(rc <= 0) continue;
+		namelen = sizeof(SOCK);
+		len = recvfrom(sockno, pkt, sizeof(pkt), 0, (PSOCKG) &sa,
+				&namelen);
+		h = (HEADER *) pkt;
+		if(len < 0 || len < sizeof(HEADER) ||
+		   h->qr == 0 ||
+		   ntohs(h->id) != id ||
+		   sa.sin_addr.s_addr != z->sec->primary.s_addr)
+			continue;
+		if(h->rcode != NOERROR ||
+		   ntohs(h->qdcount) != 1 ||
+		   ntohs(h->ancount) < 1)
+			break;
+
+		/* The question and the answer must both be for the zone */
+
+		p = pkt + sizeof(HEADER);
+		if(dn_expand(pkt, pkt + len, p, name, sizeof(name)) < 0 ||
+		   name_same(name, z->sec->origin) == FALSE)
+			break;
+		p = skip_name(p, pkt + len);
+		if(p == (PUCHAR) NULL) break;
+		p += QFIXEDSZ;
+		rr = get_rr(pkt, pkt + len, &p, name);
+		if(rr == (PRR) NULL) break;
+		if(rr->type != T_SOA ||
+		   name_same(name, z->sec->origin) == FALSE) {
+			free(rr);
+			break;
+		}
+		*serial = _getlong(rr->rdata + rr->rdlength - 20);
+		free(rr);
+		soclose(sockno);
+		return(TRUE);
+	}
+
+	soclose(sockno);
+	sprintf(
+		logmsg,
+		"secondary zone %.100s: no SOA record from %s",
+		z->sec->origin,
+		inet_ntoa(z->sec->primary));
+	dolog(logmsg);
+
+	return(FALSE);
+}
+
+
+/*
+ * Build a query for a zone. For an IXFR, the SOA record of the current
+ * copy goes in the authority section.
+ *
+ * Returns the length of the query, or -1 if it could not be built.
+ *
+ */
+
+static INT put_query(PUCHAR buf, PSECZONE z, INT qtype)
+{	INT n, i;
+	PUCHAR p = buf + sizeof(HEADER);
+	HEADER *h = (HEADER *) buf;
+
+	memset(buf, 0, sizeof(HEADER));
+	h->opcode = QUERY;
+	h->qdcount = htons(1);
+
+	for(i = 0; i < (qtype == T_IXFR ? 2 : 1); i++) {
+		n = dn_comp(z->sec->origin, p, MAXCDNAME, (PUCHAR *) NULL,
+				(PUCHAR *) NULL);
+		if(n < 0) return(-1);
+		p += n;
+		putshort(i == 0 ? qtype : T_SOA, p);
+		p += 2;
+		putshort(C_IN, p);
+		p += 2;
+	}
+
+	if(qtype == T_IXFR) {
+		putlong(z->soa->ttl, p);
+		p += 4;
+		putshort(z->soa->rdlength, p);
+		p += 2;
+		memcpy(p, z->soa->rdata, z->soa->rdlength);
+		p += z->soa->rdlength;
+		h->nscount = htons(1);
+	}
+
+	return(p - buf);
+}
+
+
+/*
+ * Open a TCP connection to the primary server for a zone.
+ *
+ * Returns the socket number, or -1 if the connection failed (the error
+ * has been logged).
+ *
+ */
+
+static INT open_conn(PSECZONE z)
+{	INT sockno, rc, err, len;
+	INT on = 1;
+	INT sockset[1];
+	SOCK sa;
+
+	sockno = socket(AF_INET, SOCK_STREAM, 0);
+	if(sockno < 0) return(-1);
+
+	memset((PUCHAR) &sa, 0, sizeof(SOCK));
+	sa.sin_family = AF_INET;
+	sa.sin_port = sconfig->nsport;
+	sa.sin_addr = z->sec->primary;
+
+	/* Connect without blocking, so that the wait can be limited */
+
+	ioctl(sockno, FIONBIO, (PUCHAR) &on, sizeof(on));
+	rc = connect(sockno, (PSOCKG) &sa, sizeof(SOCK));
+	if(rc != 0 && sock_errno() == SOCEINPROGRESS) {
+		sockset[0] = sockno;
+		rc = select(sockset, 0, 1, 0, XFR_TIMEOUT*1000L);
+		if(rc > 0) {
+			err = 0;
+			len = sizeof(err);
+			rc = getsockopt(sockno, SOL_SOCKET, SO_ERROR,
+					(PUCHAR) &err, &len);
+			if(rc == 0 && err != 0) rc = -1;
+		} else {
+			rc = -1;
+		}
+	}
+	on = 0;
+	ioctl(sockno, FIONBIO, (PUCHAR) &on, sizeof(on));
+
+	if(rc != 0) {
+		sprintf(
+			logmsg,
+			"secondary zone %.100s: cannot connect to %s",
+			z->sec->origin,
+			inet_ntoa(z->sec->primary));
+		dolog(logmsg);
+		soclose(sockno);
+		return(-1);
+	}
+
+	return(sockno);
+}
+
+
+/*
+ * Read one message from a transfer connection.
+ *
+ * Returns TRUE if a message was read, FALSE if the connection failed or
+ * timed out.
+ *
+ */
+
+static BOOL get_msg(INT sockno, PUCHAR buf, PINT len)
+{	UCHAR temp[2];
+
+	if(recv_all(sockno, temp, 2) == FALSE) return(FALSE);
+	*len = _getshort(temp);
+	if(*len < sizeof(HEADER)) return(FALSE);
+
+	return(recv_all(sockno, buf, *len));
+}
+
+
+/*
+ * Read a given number of bytes from a connection.
+ *
+ * Returns TRUE if successful, FALSE if the connection was closed, failed,
+ * or was idle for more than XFR_TIMEOUT seconds.
+ *
+ */
+
+static BOOL recv_all(INT sockno, PUCHAR p, INT n)
+{	INT rc;
+	INT sockset[1];
+
+	while(n > 0) {
+		sockset[0] = sockno;
+		rc = select(sockset, 1, 0, 0, XFR_TIMEOUT*1000L);
+		if(rc <= 0) return(FALSE);
+		rc = recv(sockno, p, n, 0);
+		if(rc <= 0) return(FALSE);
+		p += rc;
+		n -= rc;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Extract a resource record from a message, in the same form as one
+ * from a zone file; that is, with any names in the RDATA uncompressed.
+ *
+ *	msg	points to the message
+ *	end	points just past the end of the message
+ *	pp	points to a pointer to the record; this is moved past it
+ *	name	points to where the owner name is to go
+ *
+ * Returns a pointer to the record, or NULL if it is malformed or memory
+ * ran out.
+ *
+ */
+
+static PRR get_rr(PUCHAR msg, PUCHAR end, PUCHAR *pp, PUCHAR name)
+{	INT i, n, type, rdlength, prefix, names;
+	PUCHAR p = *pp, rdp, rdend, q;
+	PRR rr;
+	UCHAR temp[MAXDNAME+1];
+
+	n = dn_expand(msg, end, p, name, MAXDNAME+1);
+	if(n < 0) return(PRR) NULL;
+	p += n;
+	if(p + RRFIXEDSZ > end) return(PRR) NULL;
+	type = _getshort(p);
+	rdlength = _getshort(p + 8);
+	rdp = p + RRFIXEDSZ;
+	rdend = rdp + rdlength;
+	if(rdend > end) return(PRR) NULL;
+
+	switch(type) {
+		case T_NS:
+		case T_CNAME:
+		case T_PTR:
+			prefix = 0;
+			names = 1;
+			break;
+
+		case T_MX:
+			prefix = 2;
+			names = 1;
+			break;
+
+		case T_SRV:
+			prefix = 6;
+			names = 1;
+			break;
+
+		case T_SOA:
+			prefix = 0;
+			names = 2;
+			break;
+
+		default:
+			prefix = 0;
+			names = 0;
+			break;
+	}
+	if(rdp + prefix > rdend) return(PRR) NULL;
+
+	rr = (PRR) malloc(sizeof(RR) + rdlength + names*MAXCDNAME);
+	if(rr == (PRR) NULL) return(PRR) NULL;
+	rr->next = (PRR) NULL;
+	rr->type = (USHORT) type;
+	rr->class = _getshort(p + 2);
+	rr->ttl = _getlong(p + 4);
+
+	q = rr->rdata;
+	memcpy(q, rdp, prefix);
+	q += prefix;
+	rdp += prefix;
+	for(i = 0; i < names; i++) {
+		n = dn_expand(msg, rdend, rdp, temp, sizeof(temp));
+		if(n < 0) break;
+		rdp += n;
+		n = dn_comp(temp, q, MAXCDNAME, (PUCHAR *) NULL,
+				(PUCHAR *) NULL);
+		if(n < 0) break;
+		q += n;
+	}
+	if(i < names) {
+		free(rr);
+		return(PRR) NULL;
+	}
+	memcpy(q, rdp, rdend - rdp);		/* The rest, as it is */
+	q += rdend - rdp;
+	rr->rdlength = (USHORT) (q - rr->rdata);
+	if(type == T_SOA && rr->rdlength < 20) {
+		free(rr);
+		return(PRR) NULL;
+	}
+
+	*pp = rdend;
+
+	return(rr);
+}
+
+
+/*
+ * Skip over an uncompressed (or compressed) name in wire format.
+ *
+ *	p	points to the name
+ *	end	points to the end of the message
+ *
+ * Returns a pointer to the byte after the name, or NULL if the name is
+ * malformed or runs past the end of the message.
+ *
+ */
+
+static PUCHAR skip_name(PUCHAR p, PUCHAR end)
+{	INT n = dn_skipname(p, end);
+
+	return(n < 0 ? (PUCHAR) NULL : p + n);
+}
+
+
+/*
+ * Set the refresh, retry and expire times for a zone from its SOA record.
+ * Very short times are lengthened, to protect the primary server.
+ *
+ */
+
+static VOID soa_times(PSECZONE z, PRR soa)
+{	PUCHAR p = soa->rdata + soa->rdlength - 20;
+
+	z->serial = _getlong(p);
+	z->refresh = _getlong(p + 4);
+	z->retry = _getlong(p + 8);
+	z->expire = _getlong(p + 12);
+	if(z->refresh < MIN_REFRESH) z->refresh = MIN_REFRESH;
+	if(z->retry < MIN_REFRESH) z->retry = MIN_REFRESH;
+	if(z->expire < z->refresh) z->expire = z->refresh;
+}
+
+
+/*
+ * Compare two serial numbers, using the arithmetic in RFC 1982.
+ *
+ * Returns TRUE if 'a' is later than 'b', otherwise FALSE.
+ *
+ */
+
+static BOOL newer(ULONG a, ULONG b)
+{	return(a != b && a - b < 0x80000000UL ? TRUE : FALSE);
+}
+
+
+/*
+ * Determine whether a name is in a zone.
+ *
+ */
+
+static BOOL in_zone(PUCHAR name, PUCHAR zone)
+{	INT n = strlen(name) - strlen(zone);
+
+	if(n < 0 || (n > 0 && name[n-1] != '.')) return(FALSE);
+
+	return(name_same(name + n, zone));
+}
+
+
+/*
+ * Add a record to the end of a chain. The record itself is not copied.
+ *
+ *	ptail	points to a pointer to the end of the chain; this is moved
+ *		to the new end
+ *	name	is the owner name
+ *	rr	points to the record
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL add_rec(PSECREC **ptail, PUCHAR name, PRR rr)
+{	PSECREC p = (PSECREC) malloc(sizeof(SECREC) + strlen(name) + 1);
+
+	if(p == (PSECREC) NULL) return(FALSE);
+
+	p->next = (PSECREC) NULL;
+	p->name = (PUCHAR) (p + 1);
+	strcpy(p->name, name);
+	p->rr = rr;
+	**ptail = p;
+	*ptail = &p->next;
+
+	return(TRUE);
+}
+
+
+/*
+ * Remove a record from a chain, as part of an IXFR; the TTL does not have
+ * to match.
+ *
+ */
+
+static VOID apply_del(PSECREC *precs, PUCHAR name, PRR rr)
+{	PSECREC p;
+
+	for(; *precs != (PSECREC) NULL; precs = &(*precs)->next) {
+		p = *precs;
+		if(p->rr->type == rr->type &&
+		   p->rr->class == rr->class &&
+		   p->rr->rdlength == rr->rdlength &&
+		   memcmp(p->rr->rdata, rr->rdata, rr->rdlength) == 0 &&
+		   name_same(p->name, name) == TRUE) {
+			*precs = p->next;
+			free(p->rr);
+			free(p);
+			return;
+		}
+	}
+}
+
+
+/*
+ * Make a copy of a chain of records.
+ *
+ * Returns a pointer to the copy, or NULL if memory ran out.
+ *
+ */
+
+static PSECREC copy_recs(PSECREC recs)
+{	PSECREC copy = (PSECREC) NULL;
+	PSECREC *tail = &copy;
+	PRR rr;
+
+	for(; recs != (PSECREC) NULL; recs = recs->next) {
+		rr = (PRR) malloc(sizeof(RR) + recs->rr->rdlength);
+		if(rr != (PRR) NULL)
+			memcpy((PUCHAR) rr, (PUCHAR) recs->rr,
+				sizeof(RR) + recs->rr->rdlength);
+		if(rr == (PRR) NULL || add_rec(&tail, recs->name, rr) == FALSE) {
+			free(rr);
+			free_recs(copy);
+			return(PSECREC) NULL;
+		}
+	}
+
+	return(copy);
+}
+
+
+/*
+ * Free a chain of records.
+ *
+ */
+
+static VOID free_recs(PSECREC recs)
+{	PSECREC p;
+
+	while(recs != (PSECREC) NULL) {
+		p = recs;
+		recs = p->next;
+		free(p->rr);
+		free(p);
+	}
+}
+
+/*
+ * End of file: secondary.c
+ *
+ */
+
\ No newline at end of file
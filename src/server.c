@@ -14,26 +14,43 @@
 #include "named.h"
 #include "log.h"
 
-#pragma	alloc_text(init_seg, readhosts)
-#pragma	alloc_text(init_seg, process_entry)
-#pragma	alloc_text(init_seg, fix_domain)
-
 #define	THREAD_STACK	16384		/* Stack size for worker threads */
 
 /* Forward references */
 
+static	BOOL	add_ptr_answer(PTHREADINFO, PUCHAR, PUCHAR);
+static	BOOL	add_zone_rr(PTHREADINFO, PUCHAR, PRR);
 static	VOID	catch_signal(INT);
 static	BOOL	checkrp(PTHREADINFO, INT);
+static	BOOL	domain_negative(PTHREADINFO, PUCHAR);
+static	BOOL	drop_rr(PTHREADINFO, PUCHAR);
+static	PDBENT	find_self(PCONFIG, PDB);
 static	VOID	fix_domain(PCONFIG, PUCHAR);
 static	VOID	handle_packet(PVOID);
 static	VOID	handle_packet_worker(PTHREADINFO);
+static	VOID	held_elsewhere(PTHREADINFO, PUCHAR);
+static	BOOL	inherits(PDB);
+static	BOOL	loopback_answer(PTHREADINFO, INT, PUCHAR);
 static	PUCHAR	makepktbuf(VOID);
-static	VOID	process_address_query(PTHREADINFO, PUCHAR);
-static	BOOL	process_entry(PCONFIG, PHOST);
+static	BOOL	may_build(PCONFIG, PDB, PDBENT, INT);
+static	VOID	negative_answer(PTHREADINFO, PUCHAR, PUCHAR, PRR);
+static	INT	parse_name(PTHREADINFO, PUCHAR, PQNAME, PUCHAR);
+static	VOID	pointer_answer(PTHREADINFO, PUCHAR, PDBENT, PAUTHNET);
+static	VOID	process_address_query(PTHREADINFO, INT, PUCHAR);
+static	BOOL	process_entry(PCONFIG, PDB, PHOST);
 static	VOID	process_pointer_query(PTHREADINFO, PUCHAR);
+static	VOID	process_pointer6_query(PTHREADINFO, PUCHAR);
 static	VOID	process_query(PTHREADINFO);
 static	VOID	process_standard_query(PTHREADINFO, INT, INT, PUCHAR);
-static	BOOL	readhosts(PCONFIG);
+static	BOOL	process_zone_query(PTHREADINFO, INT, PUCHAR);
+static	BOOL	put_addr_rr(PTHREADINFO, PUCHAR, ULONG, PDBENT);
+static	BOOL	put_name_rr(PTHREADINFO, PUCHAR, INT, ULONG, PUCHAR);
+static	PUCHAR	put_rr(PTHREADINFO, PUCHAR, INT, INT, ULONG, INT);
+static	BOOL	qname_address(PQNAME, INADDR *);
+static	BOOL	save_answer(PTHREADINFO, PANSWER *);
+static	BOOL	start_answer(PTHREADINFO, PUCHAR, INT);
+static	BOOL	use_answer(PTHREADINFO, PANSWER);
+static	BOOL	write_rr(PTHREADINFO, PUCHAR, PRR, ULONG);
 
 /* Local storage */
 
@@ -57,13 +74,46 @@ INT server(PCONFIG config)
 	PTHREADINFO ti;
 	UCHAR logmsg[MAXLOG];
 
-	/* Initialise the in-memory database */
+	/* Build the tables of networks and domains we are authority for */
+
+	if(auth_init(config) == FALSE) return(FALSE);
+
+	/* Set up the zones that replicas may transfer */
+
+	if(xfr_init(config) == FALSE) return(FALSE);
+
+	/* Make the first copies of any secondary zones */
+
+	if(secondary_init(config) == FALSE) return(FALSE);
+
+	/* Load the first version of the in-memory databases, from the local
+	   HOSTS file, any zone files, and the files for any views */
+
+	if(version_load(config) == FALSE) return(FALSE);
+
+	/* Start health checking of host addresses, if configured */
+
+	if(health_start(config) == FALSE) return(FALSE);
+
+	/* Start looking for changed files, if configured */
+
+	if(version_start(config) == FALSE) return(FALSE);
+
+	/* Start keeping secondary zones up to date, if there are any */
+
+	if(secondary_start(config) == FALSE) return(FALSE);
+
+	/* Start serving zone transfers, if there are any replicas */
+
+	if(xfr_start(config) == FALSE) return(FALSE);
 
-	if(db_init(config) == FALSE) return(FALSE);
+	/* Open the shared sockets for referring queries */
 
-	/* Add local HOSTS file to database */
+	if(upstream_start(config) == FALSE) return(FALSE);
 
-	if(readhosts(config) == FALSE) return(FALSE);
+	/* Start watching the interface used for referrals */
+
+	if(refer_start(config) == FALSE) return(FALSE);
 
 	/* Allocate a packet buffer */
 
@@ -184,6 +234,9 @@ INT server(PCONFIG config)
 			ti->buf = config->pktbuf;
 			ti->pktlen = pktlen;
 			ti->sockno = config->sockno;
+			ti->answer = (PANSWER) NULL;
+			ti->rbuf = (PUCHAR) NULL;
+			ti->noreply = FALSE;
 			memcpy((PUCHAR) &ti->sa, (PUCHAR) &csa, sizeof(SOCK));
 			config->pktbuf = makepktbuf();
 			if(config->pktbuf == (PUCHAR) NULL) {
@@ -206,6 +259,7 @@ INT server(PCONFIG config)
 
 	soclose(config->sockno);
 
+	upstream_log();				/* Final server statistics */
 	dolog("shutdown complete");
 
 	return(TRUE);
@@ -256,6 +310,7 @@ static VOID handle_packet(PVOID param)
 	/* Free resources */
 
 	free(ti->buf);
+	if(ti->rbuf != (PUCHAR) NULL) free(ti->rbuf);
 	free((PUCHAR) ti);
 }
 
@@ -266,9 +321,11 @@ static VOID handle_packet(PVOID param)
  */
 
 static VOID handle_packet_worker(PTHREADINFO ti)
-{	INT i, rc;
+{	INT i, rc, niov;
 	HEADER *h;
 	PUCHAR qp;
+	IOVEC iov[2];
+	MSGHDR msg;
 
 	h = (HEADER *) ti->buf;
 
@@ -303,27 +360,44 @@ static VOID handle_packet_worker(PTHREADINFO ti)
 		return;			/* Drop packet */
 	}
 
+	ti->db = view_select(ti->config, ti->sa.sin_addr);
 	ti->rp = ti->buf + ti->pktlen;		/* Start of reply space */
 	ti->qp = ti->buf + sizeof(HEADER);	/* Start of query area */
 	h->rcode = NOERROR;			/* Assume success */
 
 	for(i = 0; i < ntohs(h->qdcount); i++) {
 		process_query(ti);
+		h = (HEADER *) ti->buf;		/* May be a referral reply */
 		if(h->rcode != NOERROR) break;
 	}
+	if(ti->noreply == TRUE) return;	/* Retransmission of a query */
 
-	/* Now send the reply */
+	/* Now send the reply. The header, the question and any records
+	   built for this query are in the packet buffer; records built in
+	   advance are sent from where they are kept, without copying. */
 
 	h->qr = 1;			/* This is a response */
 	h->ra = 1;			/* Recursion available */
 
-	rc = sendto(
+	iov[0].iov_base = (PVOID) ti->buf;
+	iov[0].iov_len = ti->pktlen;
+	niov = 1;
+	if(ti->answer != (PANSWER) NULL) {
+		iov[1].iov_base = (PVOID) ti->answer->data;
+		iov[1].iov_len = ti->answer->len;
+		niov++;
+	}
+
+	memset((PUCHAR) &msg, 0, sizeof(MSGHDR));
+	msg.msg_name = (PVOID) &ti->sa;
+	msg.msg_namelen = sizeof(SOCK);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+
+	rc = sendmsg(
 		ti->sockno,
-		ti->buf,
-		ti->pktlen,
-		0,			/* No flags */
-		(PSOCKG) &ti->sa,
-		sizeof(SOCK));
+		&msg,
+		0);			/* No flags */
 	if(rc == -1) {
 		sprintf(
 			ti->logmsg,
@@ -351,19 +425,15 @@ static VOID process_query(PTHREADINFO ti)
 {	INT n;
 	USHORT qtype, qclass;
 	HEADER *h = (HEADER *) ti->buf;
+	QNAME qn;
 	UCHAR namebuf[MAXDNAME+1];
 
-	n = dn_expand(			/* Length of compressed name */
-		ti->buf,
-		ti->buf+ti->pktlen,
-		ti->qp,
-		namebuf,
-		sizeof(namebuf));
+	n = parse_name(ti, ti->qp, &qn, namebuf);
 	if(n < 0) {
-		dolog("dn_expand failed");
+		dolog("malformed name in query");
 		return;
 	}
-	strlwr(namebuf);		/* To make matches easier */
+	ti->qname = &qn;
 	ti->qp += n;			/* Move past name */
 	qtype = _getshort(ti->qp);	/* Query type */
 	ti->qp += 2;
@@ -384,6 +454,75 @@ static VOID process_query(PTHREADINFO ti)
 }
 
 
+/*
+ * Parse a name in a query, working straight from the packet. The labels
+ * are noted, with a hash of each that ignores case, so that the name can
+ * be looked up without going through it again. The name is also copied
+ * out as text, in lower case, for other uses; as with 'dn_expand', any
+ * '.' or '\' in a label is escaped.
+ *
+ *	ti	points to the thread information structure
+ *	cp	points to the name in the packet
+ *	qn	points to the structure to receive the labels
+ *	text	points to a buffer of MAXDNAME+1 characters for the text
+ *
+ * Returns the length of the name in the packet, or -1 if it is
+ * malformed or its text would be longer than MAXDNAME characters.
+ *
+ */
+
+static INT parse_name(PTHREADINFO ti, PUCHAR cp, PQNAME qn, PUCHAR text)
+{	INT n, len = -1, total = 0;
+	PUCHAR start = cp;
+	PUCHAR end = ti->buf + ti->pktlen;
+	PUCHAR tp = text;
+	PUCHAR tend = text + MAXDNAME;
+	UCHAR c;
+
+	qn->text = text;
+	qn->nlabels = 0;
+	for(;;) {
+		if(cp >= end) return(-1);
+		n = *cp;
+		if((n & INDIR_MASK) == INDIR_MASK) {	/* Compressed */
+			if(cp + 1 >= end) return(-1);
+			if(len < 0) len = cp + 2 - start;
+			n = ((n & ~INDIR_MASK) << 8) | cp[1];
+			if(ti->buf + n >= cp) return(-1);	/* Must go back */
+			if(n < sizeof(HEADER)) return(-1);	/* Not the header */
+			cp = ti->buf + n;
+			continue;
+		}
+		if((n & INDIR_MASK) != 0) return(-1);	/* Unknown type */
+		if(n == 0) break;			/* Root; end of name */
+
+		total += n + 1;
+		if(cp + n >= end || total >= MAXCDNAME ||
+		   qn->nlabels >= MAXLABELS)
+			return(-1);
+		qn->label[qn->nlabels] = cp;
+		qn->hash[qn->nlabels++] = name_hash(cp + 1, n);
+		if(tp != text) {
+			if(tp >= tend) return(-1);
+			*tp++ = '.';
+		}
+		for(cp++; n > 0; n--, cp++) {
+			c = *cp;
+			if(c == '.' || c == '\\') {
+				if(tp >= tend) return(-1);
+				*tp++ = '\\';
+			}
+			if(tp >= tend) return(-1);
+			*tp++ = c;
+		}
+	}
+	name_lower(text, tp - text);
+	*tp = '\0';
+
+	return(len < 0 ? cp + 1 - start : len);
+}
+
+
 /*
  * Process a standard query
  *
@@ -400,6 +539,7 @@ static VOID process_standard_query(PTHREADINFO ti, INT qtype, INT qclass,
 					PUCHAR name)
 {	INT i;
 	HEADER *h = (HEADER *) ti->buf;
+	PAUTHDOM ad;
 
 #ifdef	DEBUG
 	trace(
@@ -407,13 +547,28 @@ static VOID process_standard_query(PTHREADINFO ti, INT qtype, INT qclass,
 		qtype, qclass, name);
 #endif
 
+	/* A secondary zone with no data, because it has not yet been
+	   transferred or has expired, must not be answered from (RFC 1035,
+	   section 4.3.5) */
+
+	if(ti->config->secondaries != (PSECONDARY) NULL) {
+		ad = auth_find_domain(ti->config, name);
+		if(ad != (PAUTHDOM) NULL &&
+		   ad->sec != (PSECONDARY) NULL &&
+		   ad->sec->current == FALSE) {
+			h->rcode = SERVFAIL;
+			return;
+		}
+	}
+
 	switch(qtype) {
 		case T_PTR:			/* Domain name pointer */
 			process_pointer_query(ti, name);
 			break;
 
 		case T_A:			/* Host address */
-			process_address_query(ti, name);
+		case T_AAAA:			/* IPv6 address */
+			process_address_query(ti, qtype, name);
 			break;
 
 		case T_NS:			/* Authoritative server */
@@ -425,179 +580,460 @@ static VOID process_standard_query(PTHREADINFO ti, INT qtype, INT qclass,
 		case T_HINFO:			/* Host information */
 		case T_MINFO:			/* Mailbox information */
 		case T_MX:			/* Mail routing information */
+		case T_TXT:			/* Text strings */
+		case T_SRV:			/* Service location */
+		case T_ANY:			/* All records */
+			if(process_zone_query(ti, qtype, name) == TRUE)
+				break;
+
+			/* ANY for a name in the HOSTS file gets its address
+			   records; otherwise, a miss in one of our own domains
+			   gets a negative answer */
+
+			if(qtype == T_ANY &&
+			   db_find_name(ti->db, name) != (PDBENT) NULL) {
+				process_address_query(ti, qtype, name);
+				break;
+			}
+			if(domain_negative(ti, name) == FALSE)
+				held_elsewhere(ti, name);
+			break;
 
 		case T_NULL:			/* Null resource record */
 		default:
-			h->rcode = NOTIMP;	/* Not implemented */
+
+			/* No other type of data is held, so a name in one of
+			   our domains simply has none; meta types (such as
+			   AXFR) cannot be asked for in this way */
+
+			if(qtype >= 128)
+				h->rcode = NOTIMP;
+			else if(domain_negative(ti, name) == FALSE)
+				held_elsewhere(ti, name);
 			break;
 	}
 }
 
 
 /*
- * Process an address (A) pointer query. In this type of query,
- * the domain name is input, and an IP address is requested.
+ * Answer a query from records loaded from zone files. If there are no
+ * records of the requested type, but there is a CNAME, the CNAME is
+ * returned and followed.
  *
  *	ti	points to the thread information structure
+ *	qtype	is the query type
  *	name	is the domain name being queried
  *
- * On return, the response code in the header has been updated.
+ * Returns TRUE if the query was answered (in which case the header has
+ * been updated), or FALSE if there were no suitable records.
+ *
+ */
+
+static BOOL process_zone_query(PTHREADINFO ti, INT qtype, PUCHAR name)
+{	INT i, n, matched;
+	HEADER *h = (HEADER *) ti->buf;
+	PNAMENODE node;
+	PRR rr;
+	UCHAR cname[MAXDNAME+1];
+
+	/* Initialise for loading the reply packet */
+
+	comp_init(&ti->comp, ti->buf, ti->qname);
+
+	n = 0;
+	for(i = 0; i < MAXCNAMES; i++) {
+		node = db_find_node(ti->db, name);
+		if(node == (PNAMENODE) NULL) break;
+
+		matched = 0;
+		for(rr = node->rrs; rr != (PRR) NULL; rr = rr->next) {
+			if(rr->type != qtype && qtype != T_ANY) continue;
+			if(add_zone_rr(ti, name, rr) == FALSE) return(TRUE);
+			matched++;
+		}
+		n += matched;
+		if(matched != 0 || qtype == T_CNAME || qtype == T_ANY) break;
+
+		/* Nothing of the right type; look for a CNAME to follow */
+
+		for(rr = node->rrs; rr != (PRR) NULL; rr = rr->next)
+			if(rr->type == T_CNAME) break;
+		if(rr == (PRR) NULL) break;
+		if(add_zone_rr(ti, name, rr) == FALSE) return(TRUE);
+		n++;
+		if(dn_expand(
+			rr->rdata,
+			rr->rdata + rr->rdlength,
+			rr->rdata,
+			cname,
+			sizeof(cname)) < 0) break;
+		name = cname;
+	}
+
+	if(n == 0) return(FALSE);
+
+	h->aa = 1;			/* Authoritative answer */
+
+	return(TRUE);
+}
+
+
+/*
+ * Add a record loaded from a zone file to the answer section of the
+ * reply.
+ *
+ *	ti	points to the thread information structure
+ *	owner	is the owner name to use for the record
+ *	rr	points to the record
+ *
+ * Returns TRUE if the record was added, or FALSE if there was no room
+ * (in which case the truncation flag has been set).
+ *
+ */
+
+static BOOL add_zone_rr(PTHREADINFO ti, PUCHAR owner, PRR rr)
+{	HEADER *h = (HEADER *) ti->buf;
+
+	if(write_rr(ti, owner, rr, rr->ttl) == FALSE) return(FALSE);
+	h->ancount = ntohs(htons(h->ancount) + 1);
+
+	return(TRUE);
+}
+
+
+/*
+ * Write a record to the reply; the caller counts it in the appropriate
+ * section.
+ *
+ *	ti	points to the thread information structure
+ *	owner	is the owner name to use for the record
+ *	rr	points to the record
+ *	ttl	is the time to live to give the record
+ *
+ * Names in the RDATA of the older record types are compressed as they
+ * are copied; all other RDATA is copied as it is (see RFC 3597).
+ *
+ * Returns TRUE if the record was written, or FALSE if there was no room
+ * (in which case the truncation flag has been set, and nothing of the
+ * record is left in the reply).
+ *
+ */
+
+static BOOL write_rr(PTHREADINFO ti, PUCHAR owner, PRR rr, ULONG ttl)
+{	INT i, n, prefix, names;
+	HEADER *h = (HEADER *) ti->buf;
+	PUCHAR p, rdp, start;
+	PUCHAR rrstart = ti->rp;
+	UCHAR temp[MAXDNAME+1];
+
+	p = put_rr(ti, owner, rr->type, rr->class, ttl, 0);
+	if(p == (PUCHAR) NULL) return(FALSE);
+	start = ti->rp;
+
+	/* Work out where the compressible names are */
+
+	switch(rr->type) {
+		case T_NS:
+		case T_CNAME:
+		case T_PTR:
+			prefix = 0;
+			names = 1;
+			break;
+
+		case T_MX:
+			prefix = 2;	/* Preference */
+			names = 1;
+			break;
+
+		case T_SOA:
+			prefix = 0;
+			names = 2;
+			break;
+
+		default:
+			prefix = 0;
+			names = 0;
+			break;
+	}
+
+	rdp = rr->rdata;
+	if(checkrp(ti, prefix) == FALSE) return(drop_rr(ti, rrstart));
+	memcpy(ti->rp, rdp, prefix);
+	ti->rp += prefix;
+	rdp += prefix;
+
+	for(i = 0; i < names; i++) {
+		n = dn_expand(
+			rr->rdata,
+			rr->rdata + rr->rdlength,
+			rdp,
+			temp,
+			sizeof(temp));
+		if(n < 0) return(drop_rr(ti, rrstart));
+		rdp += n;
+		n = comp_name(&ti->comp,
+			temp,
+			ti->rp,
+			PACKETSZ - (ti->rp - (PUCHAR) h));
+		if(n < 0) {
+			h->tc = 1;	/* Truncation */
+			return(drop_rr(ti, rrstart));
+		}
+		ti->rp += n;
+	}
+
+	n = rr->rdata + rr->rdlength - rdp;	/* The rest, as it is */
+	if(checkrp(ti, n) == FALSE) return(drop_rr(ti, rrstart));
+	memcpy(ti->rp, rdp, n);
+	ti->rp += n;
+
+	putshort(ti->rp - start, p);	/* Fill in RDLENGTH */
+
+	return(TRUE);
+}
+
+
+/*
+ * Write the owner name and the fixed part of a resource record into the
+ * reply. The room needed for the fixed part, and for 'rdlen' bytes of
+ * RDATA, is checked once, here; the caller then stores the RDATA without
+ * further checks.
+ *
+ *	ti	points to the thread information structure
+ *	owner	is the owner name of the record
+ *	type	is the record type
+ *	class	is the record class
+ *	ttl	is the time to live to give the record
+ *	rdlen	is the length of the RDATA, or 0 if it is a name that the
+ *		caller will compress (and check for itself)
+ *
+ * Returns a pointer to the RDLENGTH field, which has been set to 'rdlen',
+ * or NULL if there was no room (in which case the truncation flag has
+ * been set, and the reply is as it was). The reply pointer is left at the
+ * RDATA field.
  *
  */
 
-static VOID process_address_query(PTHREADINFO ti, PUCHAR name)
+static PUCHAR put_rr(PTHREADINFO ti, PUCHAR owner, INT type, INT class,
+			ULONG ttl, INT rdlen)
 {	INT n;
 	HEADER *h = (HEADER *) ti->buf;
 	PUCHAR p;
-	PDBENT dbent;
+	PUCHAR end = ti->buf + PACKETSZ;
+
+	n = comp_name(&ti->comp, owner, ti->rp, end - ti->rp);
+	if(n < 0 || ti->rp + n + RRFIXEDSZ + rdlen > end) {
+		h->tc = 1;		/* Truncation */
+		(VOID) drop_rr(ti, ti->rp);
+		return((PUCHAR) NULL);
+	}
+	p = ti->rp + n;			/* TYPE field */
+	putshort(type, p);
+	putshort(class, p + 2);
+	putlong(ttl, p + 4);
+	putshort(rdlen, p + 8);
+	ti->rp = p + RRFIXEDSZ;		/* RDATA field */
+
+	return(p + 8);
+}
+
 
-	dbent = db_find_name(ti->config, name);
+/*
+ * Write a record whose RDATA is a single domain name (CNAME, NS or PTR)
+ * into the reply.
+ *
+ *	ti	points to the thread information structure
+ *	owner	is the owner name of the record
+ *	type	is the record type
+ *	ttl	is the time to live to give the record
+ *	target	is the domain name for the RDATA
+ *
+ * Returns TRUE if the record was written, or FALSE if there was no room
+ * (in which case the truncation flag has been set, and nothing of the
+ * record is left in the reply).
+ *
+ */
+
+static BOOL put_name_rr(PTHREADINFO ti, PUCHAR owner, INT type, ULONG ttl,
+			PUCHAR target)
+{	INT n;
+	HEADER *h = (HEADER *) ti->buf;
+	PUCHAR p;
+	PUCHAR rrstart = ti->rp;
+
+	p = put_rr(ti, owner, type, C_IN, ttl, 0);
+	if(p == (PUCHAR) NULL) return(FALSE);
+	n = comp_name(&ti->comp,
+		target,
+		ti->rp,
+		PACKETSZ - (ti->rp - (PUCHAR) h));
+	if(n < 0) {
+		h->tc = 1;		/* Truncation */
+		return(drop_rr(ti, rrstart));
+	}
+	putshort(n, p);			/* Fill in RDLENGTH */
+	ti->rp += n;
+
+	return(TRUE);
+}
+
+
+/*
+ * Write an address record for a HOSTS file entry into the reply; this is
+ * an A or AAAA record, according to the type of the entry.
+ *
+ *	ti	points to the thread information structure
+ *	owner	is the owner name of the record
+ *	ttl	is the time to live to give the record
+ *	dbent	is the entry holding the address
+ *
+ * Returns TRUE if the record was written, or FALSE if there was no room
+ * (in which case the truncation flag has been set).
+ *
+ */
+
+static BOOL put_addr_rr(PTHREADINFO ti, PUCHAR owner, ULONG ttl,
+			PDBENT dbent)
+{	if(dbent->type == ENT_TYPE_PRIMARY6) {
+		if(put_rr(ti, owner, T_AAAA, C_IN, ttl, IN6ADDRSZ) ==
+		   (PUCHAR) NULL)
+			return(FALSE);
+		memcpy(ti->rp, dbent->address6, IN6ADDRSZ);
+		ti->rp += IN6ADDRSZ;
+	} else {
+		if(put_rr(ti, owner, T_A, C_IN, ttl, INADDRSZ) == (PUCHAR) NULL)
+			return(FALSE);
+		putlong(htonl(dbent->address.s_addr), ti->rp);
+		ti->rp += INADDRSZ;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Process an address (A or AAAA) query. In this type of query,
+ * the domain name is input, and an IP address is requested. If the
+ * reply has been built in advance, it is simply copied into place.
+ * An ANY query for a name in the HOSTS file is also answered here, with
+ * both kinds of address.
+ *
+ *	ti	points to the thread information structure
+ *	qtype	is the query type (T_A, T_AAAA or T_ANY)
+ *	name	is the domain name being queried
+ *
+ * On return, the response code in the header has been updated.
+ *
+ */
+
+static VOID process_address_query(PTHREADINFO ti, INT qtype, PUCHAR name)
+{	INT healthy, found;
+	INT etype = qtype == T_AAAA ? ENT_TYPE_PRIMARY6 : ENT_TYPE_PRIMARY;
+	ULONG ttl;
+	HEADER *h = (HEADER *) ti->buf;
+	PUCHAR p, domain;
+	PNAMENODE node;
+	PDBENT dbent, ap;
+	PAUTHDOM ad;
+	UCHAR cname[MAXDNAME+1];
+
+	node = db_find_qname(ti->db, ti->qname);
+	dbent = node == (PNAMENODE) NULL ? (PDBENT) NULL : node->entries;
 	if(dbent == (PDBENT) NULL) {
-		refer(ti);
+		if(process_zone_query(ti, qtype, name) == FALSE &&
+		   loopback_answer(ti, qtype, name) == FALSE &&
+		   domain_negative(ti, name) == FALSE)
+			refer(ti);
 		return;
 	}
+	if(qtype != T_ANY &&
+	   use_answer(ti, node->answers[qtype == T_AAAA ? 1 : 0]) == TRUE)
+		return;
+
+	ad = auth_find_domain(ti->config, name);
+	domain = ad == (PAUTHDOM) NULL ? ti->config->domain : ad->name;
 
 	/* Initialise for loading the reply packet */
 
-	ti->dnptrs[0] = ti->buf;	/* Set up for 'dn_comp' */
-	ti->dnptrs[1] = (PUCHAR) NULL;
+	comp_init(&ti->comp, ti->buf, ti->qname);
 
 	/* If this is an alias name, insert a CNAME record to indicate
 	   the canonical name */
 
 	if(dbent->type == ENT_TYPE_ALIAS) {
-		n = dn_comp(name,
-			ti->rp,
-			PACKETSZ - (ti->rp - (PUCHAR) h),
-			ti->dnptrs,
-			&ti->dnptrs[MAXDNPTRS-1]);
-		if(n < 0) {
-			h->tc = 1;		/* Truncation */
-			return;
-		}
-		ti->rp += n;		/* Point past the name to TYPE field */
-		if(checkrp(ti, RRFIXEDSZ) == FALSE) return;
-		putshort(T_CNAME, ti->rp);	/* Store RR type code */
-		ti->rp += 2;			/* Move to CLASS field */
-		putshort(C_IN, ti->rp);		/* Store class */
-		ti->rp += 2;			/* Move to TTL field */
-		putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-		ti->rp += 4;			/* Move to RDLENGTH field */
-		p = ti->rp;			/* Save for filling in length */
-		putshort(0, p);			/* In case of failure */
-		ti->rp += 2;			/* Move to RDATA field */
-		n = dn_comp(dbent->primary->name,
-			ti->rp,
-			PACKETSZ - (ti->rp - (PUCHAR) h),
-			ti->dnptrs,
-			&ti->dnptrs[MAXDNPTRS-1]);
-		if(n < 0) {
-			h->tc = 1;		/* Truncation */
+		p = db_node_name(dbent->primary->node, cname);
+		if(put_name_rr(ti, name, T_CNAME, LOCAL_TTL, p) == FALSE)
 			return;
-		}
-		putshort(n, p);			/* Fill in RDLENGTH */
 		h->ancount = ntohs(htons(h->ancount) + 1);
-		ti->rp += n;			/* Move past stored name */
-		dbent = dbent->primary;		/* Use type A record now */
-		name = dbent->name;
+		name = p;
+		dbent = db_find_name(ti->db, name);	/* Use type A records
+							   for it now */
 	}
 
-	/* Insert a type A record for the name (if an alias, this is the
-	   canonical name) */
+	/* Insert address records for the name (if an alias, this is the
+	   canonical name). The name may appear on several lines of the
+	   HOSTS file; addresses that have failed their health check are
+	   left out, as long as at least one healthy address remains. */
+
+	found = healthy = 0;
+	for(ap = dbent;
+	    ap != (PDBENT) NULL;
+	    ap = db_find_next_name(ap)) {
+		if(ap->type != etype &&
+		   (qtype != T_ANY || ap->type != ENT_TYPE_PRIMARY6)) continue;
+		found++;
+		if(health_is_up(ap) == TRUE) healthy++;
+	}
 
-	n = dn_comp(name,
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
+	/* If the HOSTS file has no addresses of this type for the name,
+	   a zone file may have some (unless a CNAME has already been
+	   given); otherwise the answer is empty if the name is in one of
+	   our domains, since only then is there an SOA record to go with
+	   it. A name outside them is referred, as if it were not in the
+	   HOSTS file at all. */
+
+	if(found == 0 && h->ancount == 0 &&
+	   process_zone_query(ti, qtype, name) == TRUE) return;
+	if(found == 0 && domain_negative(ti, name) == TRUE) return;
+	if(found == 0 && h->ancount == 0) {
+		refer(ti);
 		return;
 	}
-	ti->rp += n;			/* Point past the name to TYPE field */
-	if(checkrp(ti, RRFIXEDSZ + sizeof(dbent->address.s_addr)) == FALSE)
-		return;
-	putshort(T_A, ti->rp);		/* Store RR type code */
-	ti->rp += 2;			/* Move to CLASS field */
-	putshort(C_IN, ti->rp);		/* Store class */
-	ti->rp += 2;			/* Move to TTL field */
-	putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-	ti->rp += 4;			/* Move to RDLENGTH field */
-	putshort(sizeof(dbent->address.s_addr), ti->rp);/* Set length */
-	ti->rp += 2;			/* Move to RDATA field */
-	putlong(htonl(dbent->address.s_addr), ti->rp);	/* Set IP address */
-	ti->rp += sizeof(dbent->address.s_addr);/* Point past this entry */
-	h->ancount = ntohs(htons(h->ancount) + 1);
+
+	for(ap = dbent;
+	    ap != (PDBENT) NULL;
+	    ap = db_find_next_name(ap)) {
+		if(ap->type != etype &&
+		   (qtype != T_ANY || ap->type != ENT_TYPE_PRIMARY6)) continue;
+		if(healthy != 0 && health_is_up(ap) == FALSE) continue;
+
+		/* A health checked address may disappear from the answer at
+		   any time, so don't let clients cache it for long */
+
+		ttl = ap->hindex >= 0 ? ti->config->health_interval : LOCAL_TTL;
+
+		if(put_addr_rr(ti, name, ttl, ap) == FALSE) return;
+		h->ancount = ntohs(htons(h->ancount) + 1);
+	}
 	h->aa = 1;			/* Authoritative answer */
 
-	/* Now fill in the authority part. This is the domain name for the
-	   query, and an NS record giving the domain name of the
+	/* Now fill in the authority part. This is the domain containing the
+	   name, and an NS record giving the domain name of the
 	   nameserver */
 
-	n = dn_comp(ti->config->domain,
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
-		return;
-	}
-	ti->rp += n;			/* Point past the name to TYPE field */
-	if(checkrp(ti, RRFIXEDSZ) == FALSE) return;
-	putshort(T_NS, ti->rp);		/* Store RR type code */
-	ti->rp += 2;			/* Move to CLASS field */
-	putshort(C_IN, ti->rp);		/* Store class */
-	ti->rp += 2;			/* Move to TTL field */
-	putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-	ti->rp += 4;			/* Move to RDLENGTH field */
-	p = ti->rp;			/* Save for filling in length */
-	putshort(0, p);			/* In case of failure */
-	ti->rp += 2;			/* Move to RDATA field */
-	n = dn_comp(ti->config->myname,	/* Fill in our own name */
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
+	if(put_name_rr(ti, domain, T_NS, LOCAL_TTL, ti->config->myname) == FALSE)
 		return;
-	}
-	putshort(n, p);			/* Fill in RDLENGTH */
 	h->nscount = ntohs(htons(h->nscount) + 1);
-	ti->rp += n;			/* Point past this entry */
 
 	/* Now fill in the additional part. This is the domain name given
-	   in the authority part, as an A record. */
+	   in the authority part, as an A record; the entry for it was found
+	   when the database was loaded. If there is none, the additional
+	   part is left empty. */
 
-	dbent = db_find_name(ti->config, ti->config->myname);
-	if(dbent == (PDBENT) NULL) {
-		dolog("cannot find own name!");
-		h->rcode = SERVFAIL;
-		return;
-	}
-	n = dn_comp(dbent->name,
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
-		return;
-	}
-	ti->rp += n;			/* Point past the name to TYPE field */
-	if(checkrp(ti, RRFIXEDSZ + sizeof(dbent->address.s_addr)) == FALSE)
+	dbent = ti->db->self;
+	if(dbent == (PDBENT) NULL) return;
+	if(put_addr_rr(ti, ti->config->myname, LOCAL_TTL, dbent) == FALSE)
 		return;
-	putshort(T_A, ti->rp);		/* Store RR type code */
-	ti->rp += 2;			/* Move to CLASS field */
-	putshort(C_IN, ti->rp);		/* Store class */
-	ti->rp += 2;			/* Move to TTL field */
-	putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-	ti->rp += 4;			/* Move to RDLENGTH field */
-	putshort(sizeof(dbent->address.s_addr), ti->rp);/* Set length */
-	ti->rp += 2;			/* Move to RDATA field */
-	putlong(htonl(dbent->address.s_addr), ti->rp);	/* Set IP address */
-	ti->rp += sizeof(dbent->address.s_addr);/* Point past this entry */
 	h->arcount = ntohs(htons(h->arcount) + 1);
 }
 
@@ -607,7 +1043,8 @@ static VOID process_address_query(PTHREADINFO ti, PUCHAR name)
  * input, and is of the form:
  *	ddd.ccc.bbb.aaa.in-addr.arpa
  * where aaa.bbb.ccc.ddd is the dotted quad IP address for which the
- * domain name is required.
+ * domain name is required. Names in ip6.arpa are passed on to
+ * 'process_pointer6_query'.
  *
  *	ti	points to the thread information structure
  *	name	is the domain name being queried
@@ -621,12 +1058,37 @@ static VOID process_pointer_query(PTHREADINFO ti, PUCHAR name)
 	HEADER *h = (HEADER *) ti->buf;
 	PUCHAR p;
 	PUCHAR revdom = ".in-addr.arpa";
+	PUCHAR revdom6 = ".ip6.arpa";
 	INADDR ad;
 	PDBENT dbent;
-	UCHAR temp[MAXDNAME+1];
+	PAUTHNET an;
+	PNAMENODE node;
+
+	/* Most queries are for addresses in the HOSTS file, whose replies
+	   have been built in advance; such a reply is used straight away,
+	   unless a zone file has records for the name */
+
+	if(qname_address(ti->qname, &ad) == TRUE) {
+		node = db_find_qname(ti->db, ti->qname);
+		dbent = db_find_address(ti->db, ad);
+		if((node == (PNAMENODE) NULL || node->rrs == (PRR) NULL) &&
+		   dbent != (PDBENT) NULL &&
+		   use_answer(ti, dbent->ptr) == TRUE)
+			return;
+	}
+
+	/* Explicit PTR records in zone files take precedence */
+
+	if(process_zone_query(ti, T_PTR, name) == TRUE) return;
 
 	/* Check that name ends in the correct domain */
 
+	n = strlen(name) - strlen(revdom6);
+	if(n >= 0 && strcmp(name + n, revdom6) == 0) {
+		process_pointer6_query(ti, name);
+		return;
+	}
+
 	p = strstr(name, revdom);
 	if((p == (PUCHAR) NULL) ||
 	   (p != (name + strlen(name) - strlen(revdom)))) {
@@ -638,144 +1100,424 @@ static VOID process_pointer_query(PTHREADINFO ti, PUCHAR name)
 	ad.s_addr = lswap(inet_addr(name));	/* Extract IP address */
 	*p = '.';		/* Restore name */
 
+	an = auth_find_network(ti->config, ad);
 #ifdef	DEBUG
 	trace(
-		"address match check: query=%08x; net=%08x; mask=%08x",
+		"address match check: query=%08x; network=%s",
 		ad.s_addr,
-		ti->config->network.s_addr,
-		ti->config->netmask.s_addr);
+		an == (PAUTHNET) NULL ? (PUCHAR) "none" : an->revdomain);
 #endif
-
-	if((ad.s_addr & ti->config->netmask.s_addr) != ti->config->network.s_addr) {
-		refer(ti);
+	if(an == (PAUTHNET) NULL) {
+		if(domain_negative(ti, name) == FALSE) refer(ti);
 		return;
 	}
 
-	dbent = db_find_address(ti->config, ad);
-	if(dbent == (PDBENT) NULL) {
-		refer(ti);
+	dbent = db_find_address(ti->db, ad);
+	if(dbent == (PDBENT) NULL) {	/* One of ours, but not known */
+		negative_answer(ti, name, an->revdomain, an->soa);
 		return;
 	}
 
-#ifdef	DEBUG
-	trace("address lookup succeeded, name = |%s|", dbent->name);
-#endif
-	/* Initialise for loading the reply packet */
+	if(use_answer(ti, dbent->ptr) == TRUE) return;
 
-	ti->dnptrs[0] = ti->buf;	/* Set up for 'dn_comp' */
-	ti->dnptrs[1] = (PUCHAR) NULL;
+	pointer_answer(ti, name, dbent, an);
+}
 
-	/* First, the answer part. This is the input name, and the domain name
-	   to which it refers. */
 
-	n = dn_comp(name,
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
-		return;
-	}
-	ti->rp += n;			/* Point past the name to TYPE field */
-	if(checkrp(ti, RRFIXEDSZ) == FALSE) return;
-	putshort(T_PTR, ti->rp);	/* Store RR type code */
-	ti->rp += 2;			/* Move to CLASS field */
-	putshort(C_IN, ti->rp);		/* Store class */
-	ti->rp += 2;			/* Move to TTL field */
-	putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-	ti->rp += 4;			/* Move to RDLENGTH field */
-	p = ti->rp;			/* Save for filling in length */
-	putshort(0, p);			/* In case of failure */
-	ti->rp += 2;			/* Move to RDATA field */
-	n = dn_comp(dbent->name,	/* Fill in the required name */
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
-		return;
-	}
-	putshort(n, p);			/* Fill in RDLENGTH */
-	h->ancount = ntohs(htons(h->ancount) + 1);
-	ti->rp += n;			/* Move past stored name */
-	h->aa = 1;			/* This answer is authoritative */
-	
-	/* Now fill in the authority part. This is the reverse domain name
-	   for the network, and an NS record giving the domain name of the
-	   nameserver */
+/*
+ * Get the IPv4 address from the name in a pointer query, working from
+ * its labels in the packet; the name must be exactly four decimal
+ * numbers, without leading zeros, followed by 'in-addr.arpa'.
+ *
+ *	qn	points to the labels of the name
+ *	pad	points to where the address is to be stored
+ *
+ * Returns TRUE if the address was found, FALSE if the name is not of the
+ * right form.
+ *
+ */
 
-	ad.s_addr = lswap(ti->config->network.s_addr & ti->config->netmask.s_addr);
-	strcpy(temp, inet_ntoa(ad));
-	while(temp[0] == '0' && temp[1] == '.')
-		memccpy(&temp[0], &temp[2], '\0', MAXDNAME);
-	strcat(temp, revdom);
-#ifdef	DEBUG
-	trace("reverse domain for network = |%s|", temp);
-#endif
-	n = dn_comp(temp,
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
+static BOOL qname_address(PQNAME qn, INADDR *pad)
+{	INT i, j, n;
+	ULONG a = 0, b;
+	PUCHAR p;
+
+	if(qn->nlabels != 6 ||
+	   qn->label[4][0] != 7 ||
+	   name_equal(qn->label[4] + 1, "in-addr", 7) == FALSE ||
+	   qn->label[5][0] != 4 ||
+	   name_equal(qn->label[5] + 1, "arpa", 4) == FALSE)
+		return(FALSE);
+
+	for(i = 3; i >= 0; i--) {
+		p = qn->label[i];
+		n = *p++;
+		if(n < 1 || n > 3 || (n > 1 && p[0] == '0')) return(FALSE);
+		b = 0;
+		for(j = 0; j < n; j++) {
+			if(!isdigit(p[j])) return(FALSE);
+			b = b*10 + p[j] - '0';
+		}
+		if(b > 255) return(FALSE);
+		a = (a << 8) | b;
+	}
+	pad->s_addr = htonl(a);
+
+	return(TRUE);
+}
+
+
+/*
+ * Process a pointer (PTR) query for an IPv6 address. The domain name is of
+ * the form:
+ *	b.a.9.8.7.6.5.0.4.0.0.0.3.0.0.0.2.0.0.0.1.0.0.0.0.0.0.0.1.2.3.4.ip6.arpa
+ * with one label for each nibble (hexadecimal digit) of the address, least
+ * significant first. The address is looked up in the reverse index; if it
+ * is not there (or the name is not a complete address), the query is
+ * referred.
+ *
+ *	ti	points to the thread information structure
+ *	name	is the domain name being queried
+ *
+ * On return, the response code in the header has been updated.
+ *
+ */
+
+static VOID process_pointer6_query(PTHREADINFO ti, PUCHAR name)
+{	INT i, nib;
+	HEADER *h = (HEADER *) ti->buf;
+	PUCHAR p = name;
+	PDBENT dbent;
+	UCHAR addr[IN6ADDRSZ];
+
+	memset(addr, 0, sizeof(addr));
+	for(i = 2*IN6ADDRSZ - 1; i >= 0; i--) {
+		if(!isxdigit(p[0]) || p[1] != '.') {
+			if(domain_negative(ti, name) == FALSE)
+				refer(ti);	/* Not a complete address */
+			return;
+		}
+		nib = isdigit(p[0]) ? p[0] - '0' : tolower(p[0]) - 'a' + 10;
+		addr[i/2] |= (UCHAR) ((i & 1) ? nib : nib << 4);
+		p += 2;
+	}
+	if(strcmp(p, "ip6.arpa") != 0) {
+		if(domain_negative(ti, name) == FALSE) refer(ti);
 		return;
 	}
-	ti->rp += n;			/* Point past the name to TYPE field */
-	if(checkrp(ti, RRFIXEDSZ) == FALSE) return;
-	putshort(T_NS, ti->rp);		/* Store RR type code */
-	ti->rp += 2;			/* Move to CLASS field */
-	putshort(C_IN, ti->rp);		/* Store class */
-	ti->rp += 2;			/* Move to TTL field */
-	putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-	ti->rp += 4;			/* Move to RDLENGTH field */
-	p = ti->rp;			/* Save for filling in length */
-	putshort(0, p);			/* In case of failure */
-	ti->rp += 2;			/* Move to RDATA field */
-	n = dn_comp(ti->config->myname,	/* Fill in our own name */
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
+
+	dbent = db_find_address6(ti->db, addr);
+	if(dbent == (PDBENT) NULL) {
+		if(domain_negative(ti, name) == FALSE) refer(ti);
 		return;
 	}
-	putshort(n, p);			/* Fill in RDLENGTH */
+
+	if(use_answer(ti, dbent->ptr) == TRUE) return;
+
+	pointer_answer(ti, name, dbent, (PAUTHNET) NULL);
+}
+
+
+/*
+ * Give the answer to a PTR query for an address in the HOSTS file. For an
+ * IPv4 address, the authority part gives the reverse domain name for the
+ * network, and the additional part gives our own address.
+ *
+ *	ti	points to the thread information structure
+ *	name	is the domain name being queried
+ *	dbent	is the entry for the address
+ *	an	is the network containing the address, or NULL for an
+ *		IPv6 address
+ *
+ * On return, the response code in the header has been updated.
+ *
+ */
+
+static VOID pointer_answer(PTHREADINFO ti, PUCHAR name, PDBENT dbent,
+				PAUTHNET an)
+{	HEADER *h = (HEADER *) ti->buf;
+	UCHAR hname[MAXDNAME+1];
+
+	(VOID) db_node_name(dbent->node, hname);
+#ifdef	DEBUG
+	trace("address lookup succeeded, name = |%s|", hname);
+#endif
+	if(add_ptr_answer(ti, name, hname) == FALSE) return;
+	if(an == (PAUTHNET) NULL) return;
+
+	/* Now fill in the authority part. This is the reverse domain name
+	   for the network, and an NS record giving the domain name of the
+	   nameserver */
+
+	if(put_name_rr(ti, an->revdomain, T_NS, LOCAL_TTL,
+			ti->config->myname) == FALSE)
+		return;
 	h->nscount = ntohs(htons(h->nscount) + 1);
-	ti->rp += n;			/* Point past this entry */
 
 	/* Now fill in the additional part. This is the domain name given
-	   in the answer, as an A record. */
+	   in the authority part, as an A record, if our own address is
+	   known. */
 
-	n = dn_comp(ti->config->myname,
-		ti->rp,
-		PACKETSZ - (ti->rp - (PUCHAR) h),
-		ti->dnptrs,
-		&ti->dnptrs[MAXDNPTRS-1]);
-	if(n < 0) {
-		h->tc = 1;		/* Truncation */
-		return;
-	}
-	ti->rp += n;			/* Point past the name to TYPE field */
-	if(checkrp(ti, RRFIXEDSZ + sizeof(dbent->address.s_addr)) == FALSE)
+	dbent = ti->db->self;
+	if(dbent == (PDBENT) NULL) return;
+	if(put_addr_rr(ti, ti->config->myname, LOCAL_TTL, dbent) == FALSE)
 		return;
-	putshort(T_A, ti->rp);		/* Store RR type code */
-	ti->rp += 2;			/* Move to CLASS field */
-	putshort(C_IN, ti->rp);		/* Store class */
-	ti->rp += 2;			/* Move to TTL field */
-	putlong(LOCAL_TTL, ti->rp);	/* Time to live */
-	ti->rp += 4;			/* Move to RDLENGTH field */
-	putshort(sizeof(dbent->address.s_addr), ti->rp);/* Set length */
-	ti->rp += 2;			/* Move to RDATA field */
-	putlong(htonl(dbent->address.s_addr), ti->rp);	/* Set IP address */
-	ti->rp += sizeof(dbent->address.s_addr);/* Point past this entry */
 	h->arcount = ntohs(htons(h->arcount) + 1);
 }
 
 
+/*
+ * Add a PTR record to the answer section of the reply, and mark the
+ * answer as authoritative.
+ *
+ *	ti	points to the thread information structure
+ *	name	is the domain name being queried
+ *	target	is the domain name to which it refers
+ *
+ * Returns TRUE if the record was added, or FALSE if there was no room
+ * (in which case the truncation flag has been set).
+ *
+ */
+
+static BOOL add_ptr_answer(PTHREADINFO ti, PUCHAR name, PUCHAR target)
+{	HEADER *h = (HEADER *) ti->buf;
+
+	/* Initialise for loading the reply packet */
+
+	comp_init(&ti->comp, ti->buf, ti->qname);
+
+	/* The answer part is the input name, and the domain name to which
+	   it refers. */
+
+	if(put_name_rr(ti, name, T_PTR, LOCAL_TTL, target) == FALSE)
+		return(FALSE);
+	h->ancount = ntohs(htons(h->ancount) + 1);
+	h->aa = 1;			/* This answer is authoritative */
+
+	return(TRUE);
+}
+
+
+/*
+ * Give a negative answer for a name, if it is in one of our own domains
+ * or in one of the empty zones. This is called when nothing has been
+ * found for the name, instead of referring the query to another server.
+ *
+ *	ti	points to the thread information structure
+ *	name	is the domain name being queried
+ *
+ * Returns TRUE if a negative answer was given, or FALSE if the name is not
+ * in any of our domains or empty zones.
+ *
+ */
+
+static BOOL domain_negative(PTHREADINFO ti, PUCHAR name)
+{	PAUTHDOM ad = auth_find_domain(ti->config, name);
+
+	if(ad == (PAUTHDOM) NULL) ad = auth_find_empty(ti->config, name);
+	if(ad == (PAUTHDOM) NULL) return(FALSE);
+
+	negative_answer(ti, name, ad->name, ad->soa);
+
+	return(TRUE);
+}
+
+
+/*
+ * Deal with a query for data that we do not have, for a name outside our
+ * own domains. If the name is in the HOSTS file or a zone file, the query
+ * is referred to another server, since there is no SOA record to go with
+ * an empty answer; otherwise it is not implemented.
+ *
+ *	ti	points to the thread information structure
+ *	name	is the domain name being queried
+ *
+ */
+
+static VOID held_elsewhere(PTHREADINFO ti, PUCHAR name)
+{	HEADER *h = (HEADER *) ti->buf;
+	PNAMENODE node = db_find_node(ti->db, name);
+
+	if(node != (PNAMENODE) NULL &&
+	   (node->entries != (PDBENT) NULL || node->rrs != (PRR) NULL))
+		refer(ti);
+	else
+		h->rcode = NOTIMP;	/* Not implemented */
+}
+
+
+/*
+ * Answer an address query for 'localhost', or a name within it, that is
+ * not in the HOSTS file, with the loopback address (see RFC 6761). This
+ * is only done while 'localhost' is one of the empty zones.
+ *
+ *	ti	points to the thread information structure
+ *	qtype	is the query type (T_A or T_AAAA)
+ *	name	is the domain name being queried
+ *
+ * Returns TRUE if an answer was given, or FALSE if the name is not in
+ * 'localhost'.
+ *
+ */
+
+static BOOL loopback_answer(PTHREADINFO ti, INT qtype, PUCHAR name)
+{	INT len = strlen(name);
+	HEADER *h = (HEADER *) ti->buf;
+	PAUTHDOM ad;
+	static UCHAR loop6[IN6ADDRSZ] = { 0, 0, 0, 0, 0, 0, 0, 0,
+					  0, 0, 0, 0, 0, 0, 0, 1 };
+
+	if(name_same(name, "localhost") == FALSE &&
+	   (len <= 10 ||
+	    name[len-10] != '.' ||
+	    name_same(name + len - 9, "localhost") == FALSE))
+		return(FALSE);
+	ad = auth_find_empty(ti->config, name);
+	if(ad == (PAUTHDOM) NULL || ad->name == (PUCHAR) NULL) return(FALSE);
+
+	comp_init(&ti->comp, ti->buf, ti->qname);
+	if(qtype == T_AAAA) {
+		if(put_rr(ti, name, T_AAAA, C_IN, LOCAL_TTL, IN6ADDRSZ) ==
+		   (PUCHAR) NULL)
+			return(TRUE);
+		memcpy(ti->rp, loop6, IN6ADDRSZ);
+		ti->rp += IN6ADDRSZ;
+	} else {
+		if(put_rr(ti, name, T_A, C_IN, LOCAL_TTL, INADDRSZ) ==
+		   (PUCHAR) NULL)
+			return(TRUE);
+		putlong(INADDR_LOOPBACK, ti->rp);
+		ti->rp += INADDRSZ;
+	}
+	h->ancount = htons(1);
+	h->aa = 1;			/* Authoritative answer */
+
+	return(TRUE);
+}
+
+
+/*
+ * Give an authoritative negative answer (see RFC 2308). This is NXDOMAIN
+ * if the name does not exist at all, or an empty answer (NODATA) if it
+ * exists but has no records of the type requested. The SOA record for the
+ * zone goes in the authority section, so that the answer can be cached;
+ * the one from the zone file is used if there is one, otherwise the
+ * default one. There is no zone for a single label name; the answer is
+ * then just NXDOMAIN.
+ *
+ *	ti	points to the thread information structure
+ *	name	is the domain name being queried
+ *	zone	is the name of the zone containing it, or NULL
+ *	soa	is the default SOA record for the zone, or NULL
+ *
+ */
+
+static VOID negative_answer(PTHREADINFO ti, PUCHAR name, PUCHAR zone,
+				PRR soa)
+{	ULONG ttl, minimum;
+	HEADER *h = (HEADER *) ti->buf;
+	PNAMENODE node;
+	PRR rr;
+
+	if(db_find_node(ti->db, name) == (PNAMENODE) NULL &&
+	   (zone == (PUCHAR) NULL || name_same(name, zone) == FALSE))
+		h->rcode = NXDOMAIN;
+	h->aa = 1;			/* Authoritative answer */
+	if(zone == (PUCHAR) NULL) return;
+
+	node = db_find_node(ti->db, zone);
+	if(node != (PNAMENODE) NULL) {
+		for(rr = node->rrs; rr != (PRR) NULL; rr = rr->next) {
+			if(rr->type == T_SOA) {
+				soa = rr;
+				break;
+			}
+		}
+	}
+
+	/* The time for which a negative answer may be cached is the lesser
+	   of the TTL of the SOA record and its minimum field */
+
+	minimum = _getlong(soa->rdata + soa->rdlength - 4);
+	ttl = soa->ttl < minimum ? soa->ttl : minimum;
+
+	if(h->ancount == 0)		/* Nothing in the reply yet */
+		comp_init(&ti->comp, ti->buf, ti->qname);
+
+	if(write_rr(ti, zone, soa, ttl) == FALSE) return;
+	h->nscount = ntohs(htons(h->nscount) + 1);
+#ifdef	DEBUG
+	trace(
+		"negative answer for %s (%s) from zone %s",
+		name,
+		h->rcode == NXDOMAIN ? "NXDOMAIN" : "NODATA",
+		zone);
+#endif
+}
+
+
+/*
+ * Use a reply built in advance by 'make_answers', if there is one. It
+ * must have been built from the database in use, or from the one that
+ * this view overlays if the view makes no difference to it. Since names
+ * in the reply refer back to the name in the question, the query must
+ * have just the one question, written out in full.
+ *
+ * The reply is not copied; it is noted in the thread information
+ * structure, and sent from where it is. The database version it belongs
+ * to is kept for much longer than it takes to send it.
+ *
+ * Returns TRUE if the reply was used, or FALSE if it must be built in
+ * the usual way.
+ *
+ */
+
+static BOOL use_answer(PTHREADINFO ti, PANSWER ans)
+{	HEADER *h = (HEADER *) ti->buf;
+	PUCHAR p;
+
+	if(ans == (PANSWER) NULL) return(FALSE);
+	if(ans->db != ti->db &&
+	   (ans->db != ti->db->parent || ti->db->inherit == FALSE))
+		return(FALSE);
+	if(ti->rp != ti->buf + ans->base || ntohs(h->qdcount) != 1)
+		return(FALSE);
+
+	for(p = ti->buf + sizeof(HEADER); *p != 0; p += *p + 1)
+		if((*p & INDIR_MASK) != 0) return(FALSE);
+	if(p + 1 + QFIXEDSZ != ti->rp) return(FALSE);
+
+	ti->answer = ans;
+	h->ancount = htons(ans->ancount);
+	h->nscount = htons(ans->nscount);
+	h->arcount = htons(ans->arcount);
+	h->aa = 1;			/* Authoritative answer */
+
+	return(TRUE);
+}
+
+
+/*
+ * Abandon a record that did not fit in the reply: the reply pointer is
+ * put back to the start of the record, and any names noted for
+ * compression in the part already written are forgotten, as that space
+ * will be used again.
+ *
+ *	ti	points to the thread information structure
+ *	start	points to where the record started
+ *
+ * Returns FALSE, for the convenience of the caller.
+ *
+ */
+
+static BOOL drop_rr(PTHREADINFO ti, PUCHAR start)
+{	ti->rp = start;
+	comp_undo(&ti->comp, start);
+
+	return(FALSE);
+}
+
+
 /*
  * Check that there is sufficient space left in the buffer for
  * the next piece of information.
@@ -801,51 +1543,123 @@ static BOOL checkrp(PTHREADINFO ti, INT nbytes)
 
 
 /*
- * Read the local HOSTS file, and add its contents to the in-memory
- * database.
+ * Read a file in the same format as the HOSTS file, and add its contents
+ * to the specified in-memory database. The file is read directly, rather
+ * than through the resolver library, so that lines giving IPv6 addresses
+ * can be accepted as well as the usual IPv4 ones.
+ *
+ * If the database is an overlay on another one, any names whose entries
+ * are exactly the same as in the other database are removed again, so
+ * that they are only stored once.
+ *
+ * The names are held as labels in the database's name tree, where a
+ * common domain suffix is only stored once; the log message shows the
+ * total length of the names read, and the space taken by the tree nodes
+ * added for them, labels included.
  *
  * Returns TRUE if completed OK; FALSE if there was a fatal error.
  *
  */
 
-static BOOL readhosts(PCONFIG config)
-{	PHOST h;
+BOOL load_hosts(PCONFIG config, PDB db, PUCHAR filename)
+{	INT naliases, nlines, shared;
+	ULONG namebytes, nodebytes;
+	FILE *fp;
 	PUCHAR p;
+	HOST h;
+	INADDR addr4;
+	UCHAR addr[IN6ADDRSZ];
+	PUCHAR addrs[2];
+	PUCHAR aliases[MAXALIASES+1];
+	UCHAR buf[MAXDNAME+1];
+	UCHAR logmsg[MAXLOG];
 
-	sethostent(TRUE);		/* Ensure HOSTS file stays open */
+	fp = fopen(filename, "r");
+	if(fp == (FILE *) NULL) {
+		sprintf(logmsg, "cannot open hosts file %.150s", filename);
+		dolog(logmsg);
+		return(FALSE);
+	}
+
+	h.h_addrtype = AF_INET;
+	h.h_addr_list = (PCHAR *) addrs;
+	h.h_aliases = (PCHAR *) aliases;
+	addrs[0] = addr;
+	addrs[1] = (PUCHAR) NULL;
+	nlines = 0;
+	namebytes = db->namebytes;
+	nodebytes = db->nodebytes;
 
 	for(;;) {
-		h = gethostent();	/* Get next entry in HOSTS file */
-		if(h == (PHOST) NULL) break;	/* Stop if all seen now */
+		if(fgets(buf, sizeof(buf), fp) == NULL) break;
+		p = strchr(buf, '#');		/* Strip comments */
+		if(p != (PUCHAR) NULL) *p = '\0';
+
+		p = strtok(buf, " \t\r\n");
+		if(p == (PUCHAR) NULL) continue;	/* Empty line */
+		if(strchr(p, ':') != NULL) {
+			if(inet6_aton(p, addr) == FALSE) continue;
+			h.h_length = IN6ADDRSZ;
+		} else {
+			addr4.s_addr = inet_addr(p);
+			if(addr4.s_addr == INADDR_NONE) continue;
+			memcpy(addr, (PUCHAR) &addr4, sizeof(INADDR));
+			h.h_length = sizeof(INADDR);
+		}
+
+		h.h_name = strtok(NULL, " \t\r\n");
+		if(h.h_name == (PCHAR) NULL) continue;
 
-		if(process_entry(config, h) == FALSE) {
-			error("failed to allocate memory");
+		for(naliases = 0; naliases < MAXALIASES; naliases++) {
+			aliases[naliases] = strtok(NULL, " \t\r\n");
+			if(aliases[naliases] == (PUCHAR) NULL) break;
+		}
+		aliases[naliases] = (PUCHAR) NULL;
+
+		if(process_entry(config, db, &h) == FALSE) {
 			dolog("failed to allocate memory");
+			fclose(fp);
 			return(FALSE);
 		}
+		nlines++;
 	}
-	
-	sethostent(FALSE);		/* Ensure HOSTS file is closed */
-	endhostent();			/* Close HOSTS file */
+
+	fclose(fp);
+
+	shared = db->parent != (PDB) NULL ? db_share(db) : 0;
+
+	sprintf(
+		logmsg,
+		"hosts file %.100s: %d entr%s, %d shared; "
+		"%lu bytes of names held in %lu bytes of tree nodes",
+		filename,
+		nlines,
+		nlines == 1 ? "y" : "ies",
+		shared,
+		db->namebytes - namebytes,
+		db->nodebytes - nodebytes);
+	dolog(logmsg);
 
 	return(TRUE);
 }
 
 
 /*
- * Process one entry in the local HOSTS file.
+ * Process one entry in the local HOSTS file, adding it to the specified
+ * database. An address length of IN6ADDRSZ indicates an IPv6 address.
  *
  * Returns TRUE if the entry was completely processed and the in-memory
  * database was successfully updated; returns FALSE if failed to allocate
- * memory.
+ * memory. Malformed names are logged and skipped.
  *
  */
 
-static BOOL process_entry(PCONFIG config, PHOST h)
+static BOOL process_entry(PCONFIG config, PDB db, PHOST h)
 {	INT i;
 	PDBENT entry, alias;
 	PUCHAR p;
 	UCHAR temp[MAXDNAME+1];
+	UCHAR logmsg[MAXLOG];
 
 	/* The primary name entry may be malformed on OS/2 (it may include
 	   alias names). Copy the string and pick the first token. The alias
@@ -856,19 +1670,29 @@ static BOOL process_entry(PCONFIG config, PHOST h)
 	p = strtok(temp, " \t");		/* Extract primary name */
 	fix_domain(config, p);
 
+	name_lower(p, strlen(p));		/* For consistent replies */
+
+	if(db_check_name(p) == FALSE) {
+		sprintf(logmsg, "malformed host name '%.60s' ignored", p);
+		dolog(logmsg);
+		return(TRUE);
+	}
+
 	entry = (PDBENT) malloc(sizeof(DBENT));
 	if(entry == (PDBENT) NULL) return(FALSE);
 
-	entry->name = (PUCHAR) malloc(strlen(p)+1);
-	if(entry->name == (PUCHAR) NULL) return(FALSE);
-	strcpy(entry->name, p);
-	strlwr(entry->name);			/* For matching purposes */
-
-	entry->type = ENT_TYPE_PRIMARY;
+	entry->hindex = -1;			/* Not health checked yet */
+	entry->ptr = (PANSWER) NULL;
 	entry->next = (PDBENT) NULL;
-	entry->address = *((PINADDR) h->h_addr);
+	if(h->h_length == IN6ADDRSZ) {
+		entry->type = ENT_TYPE_PRIMARY6;
+		memcpy(entry->address6, h->h_addr, IN6ADDRSZ);
+	} else {
+		entry->type = ENT_TYPE_PRIMARY;
+		entry->address = *((PINADDR) h->h_addr);
+	}
 
-	if(db_add_host(config, entry) == FALSE) return(FALSE);
+	if(db_add_host(db, p, entry) == FALSE) return(FALSE);
 
 	/* Now handle aliases */
 
@@ -878,23 +1702,295 @@ static BOOL process_entry(PCONFIG config, PHOST h)
 		strcpy(temp, p);
 		p = temp;
 		fix_domain(config, p);
+		name_lower(p, strlen(p));
+		if(db_check_name(p) == FALSE) {
+			sprintf(logmsg, "malformed alias name '%.60s' ignored", p);
+			dolog(logmsg);
+			continue;
+		}
 		alias = (PDBENT) malloc(sizeof(DBENT));
 		if(alias == (PDBENT) NULL) return(FALSE);
-		alias->name = (PUCHAR) malloc(strlen(p)+1);
-		if(alias->name == (PUCHAR) NULL) return(FALSE);
-		strcpy(alias->name, p);
-		strlwr(entry->name);		/* For matching purposes */
 		alias->type = ENT_TYPE_ALIAS;
+		alias->hindex = -1;
+		alias->ptr = (PANSWER) NULL;
 		alias->next = (PDBENT) NULL;
 		alias->primary = entry;
 
-		if(db_add_host(config, alias) == FALSE) return(FALSE);
+		if(db_add_host(db, p, alias) == FALSE) return(FALSE);
 	}
 
 	return(TRUE);
 }
 
 
+/*
+ * Build in advance the replies to A, AAAA and PTR queries for the names
+ * and addresses in a database that came from HOSTS files, so that such
+ * a query can be answered by copying its reply into place. Each reply is
+ * made by the usual code, working on a query made up for the purpose;
+ * replies that may change from one query to the next (those that depend
+ * on health checks, for instance) are not built. The entry giving our
+ * own address is also found here, once, rather than for every query.
+ *
+ * The default database must be done before those for the views, since
+ * they may use its replies.
+ *
+ * Returns TRUE if completed OK; FALSE if memory ran out.
+ *
+ */
+
+BOOL make_answers(PCONFIG config, PDB db)
+{	INT i, j, nbuilt;
+	ULONG addr, k;
+	BOOL ok = TRUE;
+	PNAMENODE node;
+	PDBENT p;
+	PAUTHNET an;
+	PTHREADINFO ti;
+	PUCHAR cp;
+	QNAME qn;
+	UCHAR name[MAXDNAME+1];
+	UCHAR logmsg[MAXLOG];
+
+	db->self = find_self(config, db);
+	if(db->self == (PDBENT) NULL) {
+		sprintf(
+			logmsg,
+			"no address for own name %.100s",
+			config->myname);
+		dolog(logmsg);
+	}
+	db->inherit = inherits(db);
+
+	ti = (PTHREADINFO) calloc(1, sizeof(THREADINFO));
+	if(ti == (PTHREADINFO) NULL) return(FALSE);
+	ti->buf = (PUCHAR) malloc(PACKETSZ);
+	if(ti->buf == (PUCHAR) NULL) {
+		free(ti);
+		return(FALSE);
+	}
+	ti->config = config;
+	ti->db = db;
+	ti->qname = &qn;
+	nbuilt = 0;
+
+	/* Replies to address queries, for each name except wildcards */
+
+	for(k = 0; ok == TRUE && k < db->hashsize; k++) {
+		for(node = db->hashtab[k];
+		    ok == TRUE && node != (PNAMENODE) NULL;
+		    node = node->hnext) {
+			if(node->entries == (PDBENT) NULL) continue;
+			if(node->len == 1 && node->label[0] == '*') continue;
+			(VOID) db_node_name(node, name);
+			for(i = 0; i < 2 && ok == TRUE; i++) {
+				j = i == 0 ? T_A : T_AAAA;
+				if(may_build(config, db, node->entries, j) == FALSE ||
+				   start_answer(ti, name, j) == FALSE)
+					continue;
+				process_address_query(ti, j, name);
+				ok = save_answer(ti, &node->answers[i]);
+				if(node->answers[i] != (PANSWER) NULL) nbuilt++;
+			}
+		}
+	}
+
+	/* Replies to pointer queries, for each address */
+
+	for(p = db->head; ok == TRUE && p != (PDBENT) NULL; p = p->next) {
+		if(p->type == ENT_TYPE_PRIMARY) {
+			an = auth_find_network(config, p->address);
+			if(an == (PAUTHNET) NULL) continue;
+			addr = ntohl(p->address.s_addr);
+			sprintf(
+				name,
+				"%lu.%lu.%lu.%lu.in-addr.arpa",
+				addr & 0xff,
+				(addr >> 8) & 0xff,
+				(addr >> 16) & 0xff,
+				(addr >> 24) & 0xff);
+		} else if(p->type == ENT_TYPE_PRIMARY6) {
+			if(db_find_address6(db, p->address6) != p) continue;
+			an = (PAUTHNET) NULL;
+			cp = name;
+			for(i = IN6ADDRSZ - 1; i >= 0; i--) {
+				cp += sprintf(
+					cp,
+					"%x.%x.",
+					p->address6[i] & 0x0f,
+					(p->address6[i] >> 4) & 0x0f);
+			}
+			strcpy(cp, "ip6.arpa");
+		} else {
+			continue;
+		}
+		if(start_answer(ti, name, T_PTR) == FALSE) continue;
+		pointer_answer(ti, name, p, an);
+		ok = save_answer(ti, &p->ptr);
+		if(p->ptr != (PANSWER) NULL) nbuilt++;
+	}
+
+	free(ti->buf);
+	free(ti);
+
+#ifdef	DEBUG
+	trace("%d replies built in advance", nbuilt);
+#endif
+	return(ok);
+}
+
+
+/*
+ * Find the entry giving our own address in a database. Our own name may
+ * be an alias, and may have IPv6 addresses as well.
+ *
+ * Returns a pointer to the entry, or NULL if there is none.
+ *
+ */
+
+static PDBENT find_self(PCONFIG config, PDB db)
+{	PDBENT dbent;
+	UCHAR name[MAXDNAME+1];
+
+	dbent = db_find_name(db, config->myname);
+	if(dbent != (PDBENT) NULL && dbent->type == ENT_TYPE_ALIAS)
+		dbent = db_find_name(
+				db,
+				db_node_name(dbent->primary->node, name));
+	while(dbent != (PDBENT) NULL && dbent->type != ENT_TYPE_PRIMARY)
+		dbent = db_find_next_name(dbent);
+
+	return(dbent);
+}
+
+
+/*
+ * Check whether the replies built for the database that a view overlays
+ * are also right for the view. This is so unless the view has its own
+ * entries for our own name, or for the canonical name of an alias.
+ *
+ */
+
+static BOOL inherits(PDB db)
+{	PDBENT p;
+	UCHAR name[MAXDNAME+1];
+
+	if(db->parent == (PDB) NULL || db->self != db->parent->self)
+		return(FALSE);
+
+	for(p = db->parent->head; p != (PDBENT) NULL; p = p->next) {
+		if(p->type != ENT_TYPE_ALIAS) continue;
+		(VOID) db_node_name(p->primary->node, name);
+		if(db_find_name(db, name) != db_find_name(db->parent, name))
+			return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Check whether the reply to an address query for a name, whose first
+ * entry is 'dbent', can be built in advance. There must be addresses of
+ * the type requested (the reply otherwise comes from elsewhere), and
+ * IPv4 addresses must not be health checked.
+ *
+ */
+
+static BOOL may_build(PCONFIG config, PDB db, PDBENT dbent, INT qtype)
+{	INT etype = qtype == T_AAAA ? ENT_TYPE_PRIMARY6 : ENT_TYPE_PRIMARY;
+	UCHAR name[MAXDNAME+1];
+
+	if(qtype == T_A && config->health_type != HEALTH_NONE) return(FALSE);
+
+	if(dbent->type == ENT_TYPE_ALIAS)
+		dbent = db_find_name(
+				db,
+				db_node_name(dbent->primary->node, name));
+	for(; dbent != (PDBENT) NULL; dbent = db_find_next_name(dbent))
+		if(dbent->type == etype) return(TRUE);
+
+	return(FALSE);
+}
+
+
+/*
+ * Make up a query, with a single question, in the packet buffer of a
+ * thread information structure, ready for its reply to be built.
+ *
+ * Returns TRUE if successful, FALSE if the name is too long.
+ *
+ */
+
+static BOOL start_answer(PTHREADINFO ti, PUCHAR name, INT qtype)
+{	INT n;
+	HEADER *h = (HEADER *) ti->buf;
+	UCHAR temp[MAXDNAME+1];
+
+	memset(ti->buf, 0, sizeof(HEADER));
+	h->qdcount = htons(1);
+	n = dn_comp(name,
+		ti->buf + sizeof(HEADER),
+		PACKETSZ - sizeof(HEADER) - QFIXEDSZ,
+		(PUCHAR *) NULL,
+		(PUCHAR *) NULL);
+	if(n < 0) return(FALSE);
+	ti->rp = ti->buf + sizeof(HEADER) + n;
+	putshort(qtype, ti->rp);
+	ti->rp += 2;
+	putshort(C_IN, ti->rp);
+	ti->rp += 2;
+	ti->pktlen = ti->rp - ti->buf;
+	ti->qp = ti->rp;
+	ti->answer = (PANSWER) NULL;
+
+	if(parse_name(ti, ti->buf + sizeof(HEADER), ti->qname, temp) < 0)
+		return(FALSE);
+	ti->qname->text = name;		/* Outlasts 'temp' */
+
+	return(TRUE);
+}
+
+
+/*
+ * Keep the reply built for a query made up by 'start_answer', if it is
+ * a complete and successful one.
+ *
+ * Returns TRUE if all went well (whether or not the reply was kept), or
+ * FALSE if memory ran out.
+ *
+ */
+
+static BOOL save_answer(PTHREADINFO ti, PANSWER *pans)
+{	INT len, more;
+	HEADER *h = (HEADER *) ti->buf;
+	PANSWER ans;
+
+	*pans = (PANSWER) NULL;
+	if(h->rcode != NOERROR || h->tc != 0 || h->ancount == 0)
+		return(TRUE);
+
+	/* A view may have used a reply built for the database it overlays */
+
+	len = ti->rp - (ti->buf + ti->pktlen);
+	more = ti->answer == (PANSWER) NULL ? 0 : ti->answer->len;
+	ans = (PANSWER) malloc(sizeof(ANSWER) + len + more);
+	if(ans == (PANSWER) NULL) return(FALSE);
+
+	ans->db = ti->db;
+	ans->base = (USHORT) ti->pktlen;
+	ans->len = (USHORT) (len + more);
+	ans->ancount = ntohs(h->ancount);
+	ans->nscount = ntohs(h->nscount);
+	ans->arcount = ntohs(h->arcount);
+	memcpy(ans->data, ti->buf + ti->pktlen, len);
+	if(more != 0) memcpy(ans->data + len, ti->answer->data, more);
+	*pans = ans;
+
+	return(TRUE);
+}
+
+
 /*
  * Allocate the packet buffer.
  *
@@ -914,11 +2010,16 @@ static PUCHAR makepktbuf(VOID)
 
 /*
  * Check for a full domain name; if not present, add default domain name.
+ * A leading wildcard label is not counted, so that (for example)
+ * '*.test' is treated as a short name and becomes '*.test.abc.com'.
  *
  */
 
 static VOID fix_domain(PCONFIG config, PUCHAR name)
-{	if(strchr(name, '.') == NULL) {
+{	PUCHAR p = name;
+
+	if(p[0] == '*' && p[1] == '.') p += 2;
+	if(strchr(p, '.') == NULL) {
 		strcat(name, ".");
 		strcat(name, config->domain);
 	}
@@ -0,0 +1,1208 @@
+/*
+ * File: upstream.c
+ *
+ * Name server for OS/2.
+ *
+ * Shared sockets for queries referred to other name servers.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Referred queries are all sent from a small set of shared sockets,
+ * instead of from a new socket for each query. Each query sent is
+ * entered in a table of outstanding queries, with the address of the
+ * server, a new ID chosen at random, the socket used and a pointer to the
+ * question; the thread that sent it then waits on a semaphore. A single
+ * dispatcher thread receives every reply, finds the query it belongs to
+ * by its ID, and checks that it came from the right server and has the
+ * same question before handing it over and waking the thread. Replies
+ * that match nothing are dropped. However many queries are outstanding,
+ * the number of sockets stays the same.
+ *
+ * A forged reply must match a query's ID and the port it was sent from,
+ * so both are made hard to guess (RFC 5452). IDs are taken from a
+ * ChaCha20 keystream; the key is set from the clocks at startup, and
+ * each block of output replaces it, with the timer reading at each reply
+ * mixed in as well. Each query goes from one of the sockets, chosen at
+ * random, and each socket is bound to a random port. After a socket has
+ * sent PORT_QUERIES queries no more are sent from it, and once the last
+ * of those has finished, the dispatcher opens it again on a new port.
+ *
+ * Replies are received into a spare buffer held by the dispatcher. When
+ * a reply matches, that buffer is given to the waiting thread, and the
+ * thread's own referral buffer becomes the new spare; nothing is copied.
+ *
+ * The same query may be sent to more than one server, for example when
+ * the first is slow to reply. The queries are then entered as a group,
+ * and the thread waits for a reply to any of them; the first to arrive
+ * is used, and any others are dropped.
+ *
+ * The time taken by each server to reply is noted, in a histogram with
+ * buckets for powers of two milliseconds; older times count for less as
+ * new ones arrive. The histogram gives the time within which a server
+ * usually replies, beyond which a query may be hedged by also sending it
+ * to another server. Hedging is limited to a configured proportion of
+ * referrals, by a simple token bucket.
+ *
+ * Each server also has a smoothed reply time and its mean variation,
+ * kept as by TCP (RFC 6298), in units of 1/8 and 1/4 of a millisecond.
+ * Queries go first to the server with the lowest smoothed time; a server
+ * that fails to reply in time is treated as having taken as long as was
+ * waited for it. As in BIND, the smoothed times of the servers that were
+ * not chosen are reduced a little each time, so that a server that was
+ * slow once is tried again now and then, in case it has improved.
+ *
+ * The time to wait for each server before retrying is worked out from
+ * the same figures, again as by TCP: the smoothed time plus four times
+ * the variation, kept within sensible limits, and doubled for each
+ * timeout in a row. Because each query sent has its own ID, a reply is
+ * never confused with one to an earlier attempt, and every reply gives
+ * a good sample. Times are taken from the high resolution timer, so
+ * that a server on the local network that replies in a millisecond or
+ * two is retried promptly if a packet is lost.
+ *
+ * A server that fails to reply to several queries in a row is taken to
+ * be down, and is left out when servers are chosen, so that queries go
+ * straight to the others; if all are down, a query fails at once. A
+ * prober thread sends a small query to each server that is down every
+ * so often, and the server is used again as soon as it replies to
+ * anything.
+ *
+ * The table, the sockets, the spare buffer and the random number state
+ * are protected by a mutex semaphore.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, upstream_start)
+
+#define	DISPATCH_STACK	16384		/* Stack size for dispatcher thread */
+#define	NUPSOCKS	16		/* Number of sockets */
+#define	PORT_QUERIES	200		/* Queries sent before new port */
+#define	PORT_TRIES	10		/* Attempts to bind a random port */
+#define	MINPORT		1024		/* Lowest random port */
+#define	DISPATCH_WAIT	500		/* Check for sockets to reopen (ms) */
+#define	MAXPENDING	2048		/* Most queries outstanding at once */
+#define	PENDHASH	1024		/* Size of hash table; power of 2 */
+#define	NOSLOT		(-1)		/* End of chain */
+#define	NRTTBUCKETS	16		/* Buckets in reply time histogram */
+#define	RTTDECAY	256		/* Samples before histogram is aged */
+#define	MINSAMPLES	16		/* Samples needed before hedging */
+#define	HEDGE_PERCENTILE 95		/* Replies expected before hedging */
+#define	HEDGE_FLOOR	20		/* Minimum hedging delay (ms) */
+#define	HEDGE_BURST	10		/* Most hedges saved up */
+#define	SRTT_DECAY	5		/* Unchosen servers lose 1/32 of time */
+#define	INITIAL_RTO	1000		/* Timeout before any replies (ms) */
+#define	MIN_RTO		50		/* Least timeout (ms) */
+#define	MAX_RTO		5000		/* Greatest timeout (ms) */
+#define	MAXBACKOFF	7		/* Most doublings of timeout */
+#define	FAILURE_LIMIT	3		/* Timeouts in a row before down */
+#define	PROBE_STACK	16384		/* Stack size for prober thread */
+#define	PROBE_INTERVAL	2000		/* Time between probes (ms) */
+#define	PROBE_TIMEOUT	1000		/* Time to wait for probe reply (ms) */
+
+#define	ROTL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define	QROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL(d, 16); \
+	c += d; b ^= c; b = ROTL(b, 12); \
+	a += b; d ^= a; d = ROTL(d, 8); \
+	c += d; b ^= c; b = ROTL(b, 7)
+
+/* Type definitions */
+
+typedef struct _PENDING {		/* Query waiting for a reply */
+INT		next;			/* Next in hash chain or free list */
+INT		group;			/* First entry in group */
+INT		gnext;			/* Next entry in group */
+USHORT		id;			/* ID used for the query */
+INT		sockx;			/* Index of socket used */
+SOCK		sa;			/* Address of server */
+INT		server;			/* Index of server; -1 if not known */
+ULONG		sent;			/* Time sent (ms) */
+PUCHAR		question;		/* Question, in the query */
+INT		qlen;			/* Length of question; 0 if none */
+BOOL		replied;		/* TRUE once this server has replied */
+BOOL		answered;		/* TRUE once a reply has arrived */
+PUCHAR		buf;			/* Buffer for the reply */
+INT		pktlen;			/* Length of reply */
+HEV		hev;			/* Posted when a reply arrives */
+} PENDING, *PPENDING;			/* Last four used in first of group */
+
+typedef struct _UPSERVER {		/* Name server to refer to */
+INADDR		addr;			/* Address of server */
+ULONG		nsamples;		/* Samples since histogram aged */
+ULONG		hist[NRTTBUCKETS];	/* Reply times, by power of two ms */
+ULONG		srtt;			/* Smoothed reply time (ms * 8) */
+ULONG		rttvar;			/* Variation in reply time (ms * 4) */
+ULONG		nreplies;		/* Replies received */
+ULONG		ntimeouts;		/* Queries not replied to in time */
+INT		backoff;		/* Timeouts in a row, up to a limit */
+INT		failures;		/* Timeouts in a row */
+BOOL		down;			/* TRUE if not responding */
+} UPSERVER, *PUPSERVER;
+
+/* Forward references */
+
+static	INT	add_pending(PTHREADINFO, INADDR, INT);
+static	VOID	deliver(INT, PSOCK, INT);
+static	VOID	dispatcher(PVOID);
+static	INT	find_server(INADDR);
+static	USHORT	new_id(VOID);
+static	INT	new_socket(VOID);
+static	VOID	new_key(VOID);
+static	VOID	note_down(PUPSERVER, BOOL);
+static	VOID	note_rtt(INT, ULONG);
+static	VOID	note_timeout(INT, ULONG);
+static	VOID	prober(PVOID);
+static	VOID	remove_pending(INT);
+static	BOOL	renew_sockets(VOID);
+static	ULONG	rto(PUPSERVER);
+static	BOOL	same_question(PPENDING, PUCHAR, INT);
+
+/* Local storage */
+
+static	INT		socks[NUPSOCKS];	/* Shared sockets */
+static	INT		sockuse[NUPSOCKS];	/* Queries outstanding on each */
+static	INT		socksent[NUPSOCKS];	/* Queries sent since opened */
+static	PPENDING	pending;	/* Table of outstanding queries */
+static	INT		hashtab[PENDHASH];/* Chains of queries, by ID */
+static	INT		freeslot;	/* Head of free list */
+static	PUCHAR		spare;		/* Buffer for next reply */
+static	ULONG		rkey[8];	/* Key for random numbers */
+static	ULONG		rcount;		/* Blocks made with this key */
+static	ULONG		noise;		/* Timer readings not yet used */
+static	USHORT		rpool[16];	/* Random numbers made */
+static	INT		rleft;		/* Random numbers not yet used */
+static	PUPSERVER	upservers;	/* Name servers */
+static	INT		nupservers;	/* Number of name servers */
+static	INT		budget;		/* Hedges allowed per 100 referrals */
+static	LONG		tokens;		/* Hedges saved up, times 100 */
+static	ULONG		tmrfreq;	/* Timer frequency; 0 if no timer */
+static	QWORD		tmrbase;	/* Timer when started */
+static	HMTX		pendsem;	/* Semaphore for all the above */
+static	UCHAR		logmsg[MAXLOG];	/* Logging buffer */
+
+
+/*
+ * Open the shared sockets, set up the table of outstanding queries, and
+ * start the dispatcher and prober threads.
+ *
+ * Returns:
+ *	TRUE		started
+ *	FALSE		failed to start
+ *
+ */
+
+BOOL upstream_start(PCONFIG config)
+{	INT i, j, rc;
+	ULONG ms;
+	QWORD t;
+	PSERVERS ps;
+
+	if(DosCreateMutexSem((PSZ) NULL, &pendsem, 0, FALSE) != 0) {
+		dolog("failed to create referral semaphore");
+		return(FALSE);
+	}
+
+	pending = (PPENDING) calloc(MAXPENDING, sizeof(PENDING));
+	spare = (PUCHAR) malloc(PACKETSZ);
+	if(pending == (PPENDING) NULL || spare == (PUCHAR) NULL) {
+		dolog("failed to allocate referral table");
+		return(FALSE);
+	}
+	for(i = 0; i < MAXPENDING; i++)
+		pending[i].next = i + 1 < MAXPENDING ? i + 1 : NOSLOT;
+	freeslot = 0;
+	for(i = 0; i < PENDHASH; i++)
+		hashtab[i] = NOSLOT;
+
+	/* Make a table of all the name servers that may be used */
+
+	for(ps = config->servlist; ps != (PSERVERS) NULL; ps = ps->next)
+		nupservers += ps->nservers;
+	upservers = (PUPSERVER) calloc(nupservers + 1, sizeof(UPSERVER));
+	if(upservers == (PUPSERVER) NULL) {
+		dolog("failed to allocate referral server table");
+		return(FALSE);
+	}
+	nupservers = 0;
+	for(ps = config->servlist; ps != (PSERVERS) NULL; ps = ps->next)
+		for(j = 0; j < ps->nservers; j++)
+			if(find_server(ps->servers[j]) < 0)
+				upservers[nupservers++].addr = ps->servers[j];
+	budget = config->hedge_budget;
+
+	if(DosTmrQueryFreq(&tmrfreq) != 0 || DosTmrQueryTime(&tmrbase) != 0)
+		tmrfreq = 0;			/* Use the system clock */
+
+	/* Start the random numbers from whatever varies at startup; the
+	   timer readings at each reply are added later */
+
+	DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof(ms));
+	rkey[0] = (ULONG) time((time_t *) NULL);
+	rkey[1] = ms;
+	rkey[2] = tmrbase.ulLo;
+	rkey[3] = tmrbase.ulHi;
+	rkey[4] = (ULONG) pending;
+	rkey[5] = (ULONG) upservers;
+	rkey[6] = (ULONG) &t;
+	if(tmrfreq != 0 && DosTmrQueryTime(&t) == 0) rkey[7] = t.ulLo;
+	new_key();
+
+	/* Create the sockets, each bound to a random port */
+
+	for(i = 0; i < NUPSOCKS; i++) {
+		socks[i] = new_socket();
+		if(socks[i] < 0) return(FALSE);
+	}
+
+	rc = _beginthread(dispatcher, NULL, DISPATCH_STACK, (PVOID) config);
+	if(rc == -1) {
+		dolog("failed to create referral dispatcher thread");
+		return(FALSE);
+	}
+
+	rc = _beginthread(prober, NULL, PROBE_STACK, (PVOID) config);
+	if(rc == -1) {
+		dolog("failed to create referral prober thread");
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Send the query in the packet buffer of a thread to a name server. The
+ * query is sent with a new ID, but is left with its own.
+ *
+ *	ti	points to the thread information structure
+ *	addr	is the address of the name server
+ *	group	is the group returned when the same query was sent to
+ *		another server, or -1 if it has not been sent before
+ *
+ * Returns the group, for 'upstream_wait' and 'upstream_end', or -1 if
+ * the query could not be sent.
+ *
+ */
+
+INT upstream_send(PTHREADINFO ti, INADDR addr, INT group)
+{	INT slot, rc;
+	USHORT id;
+	HEADER *h = (HEADER *) ti->buf;
+	PPENDING p;
+
+	slot = add_pending(ti, addr, group);
+	if(slot == NOSLOT) {
+		dolog("too many referred queries outstanding");
+		return(-1);
+	}
+	p = &pending[slot];
+
+	/* The query is copied when it is sent, so its own ID can be put
+	   straight back */
+
+	id = h->id;
+	h->id = p->id;
+	rc = sendto(
+		socks[p->sockx],
+		ti->buf,
+		ti->pktlen,
+		0,			/* No flags */
+		(PSOCKG) &p->sa,
+		sizeof(SOCK));
+	h->id = id;
+	if(rc == -1) {
+		sprintf(
+			ti->logmsg,
+			"failed to send referral packet: rc = %d",
+			sock_errno());
+		dolog(ti->logmsg);
+		if(group < 0) {
+			(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+			remove_pending(slot);
+			(VOID) DosReleaseMutexSem(pendsem);
+		}
+		return(-1);
+	}
+
+	return(p->group);
+}
+
+
+/*
+ * Wait for a reply to any of a group of queries.
+ *
+ *	group	is the group of queries
+ *	ms	is the most time to wait, in milliseconds
+ *
+ * Returns TRUE if there is a reply, FALSE if not.
+ *
+ */
+
+BOOL upstream_wait(INT group, ULONG ms)
+{	(VOID) DosWaitEventSem(pending[group].hev, ms);
+
+	return(pending[group].answered);
+}
+
+
+/*
+ * Finish with a group of queries, taking the reply if there is one.
+ *
+ *	ti	points to the thread information structure
+ *	group	is the group of queries, or -1 if none was sent
+ *
+ * Returns the length of the reply, which is then in the referral buffer
+ * of the thread, or -1 if there was no reply.
+ *
+ */
+
+INT upstream_end(PTHREADINFO ti, INT group)
+{	INT i, next, pktlen = -1;
+	PPENDING p;
+
+	if(group < 0) return(-1);
+
+	/* A reply may arrive just after the last wait ended, so look at the
+	   group under the semaphore before giving it up */
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	p = &pending[group];
+	if(p->answered == TRUE) {
+		ti->rbuf = p->buf;
+		pktlen = p->pktlen;
+	}
+	for(i = group; i != NOSLOT; i = next) {
+		next = pending[i].gnext;
+		if(pending[i].replied == FALSE && pending[i].server >= 0)
+			note_timeout(
+				pending[i].server,
+				upstream_clock() - pending[i].sent);
+		remove_pending(i);
+	}
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(pktlen);
+}
+
+
+/*
+ * Find out how long to wait for a reply from a name server before
+ * hedging, by also sending the query to another server. This is the time
+ * within which the server has sent most of its recent replies.
+ *
+ * Returns the time in milliseconds, or 0 if the server has not been used
+ * enough to tell, or hedging is not allowed.
+ *
+ */
+
+ULONG upstream_hedge_delay(INADDR addr)
+{	INT i, k;
+	ULONG n, total, delay = 0;
+	PUPSERVER u;
+
+	if(budget == 0) return(0);
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	i = find_server(addr);
+	if(i >= 0) {
+		u = &upservers[i];
+		for(total = 0, k = 0; k < NRTTBUCKETS; k++)
+			total += u->hist[k];
+		if(total >= MINSAMPLES) {
+			n = 0;
+			for(k = 0; k < NRTTBUCKETS - 1; k++) {
+				n += u->hist[k];
+				if(n*100 >= total*HEDGE_PERCENTILE) break;
+			}
+			delay = 1UL << k;
+			if(delay < HEDGE_FLOOR) delay = HEDGE_FLOOR;
+		}
+	}
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(delay);
+}
+
+
+/*
+ * Take one hedge from those allowed by the configured budget.
+ *
+ * Returns TRUE if a query may be hedged, FALSE if the budget has been
+ * used up for the present.
+ *
+ */
+
+BOOL upstream_hedge(VOID)
+{	BOOL ok = FALSE;
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	if(tokens >= 100) {
+		tokens -= 100;
+		ok = TRUE;
+	}
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(ok);
+}
+
+
+/*
+ * Get the time in milliseconds, from an arbitrary starting point. The
+ * high resolution timer is used if there is one; the system millisecond
+ * count only changes on each clock tick, which is too coarse for timing
+ * replies from nearby servers. The result wraps round, like the system
+ * count, so only differences between times are meaningful.
+ *
+ */
+
+ULONG upstream_clock(VOID)
+{	ULONG ms;
+	QWORD t;
+	double d;
+
+	if(tmrfreq == 0 || DosTmrQueryTime(&t) != 0) {
+		DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof(ms));
+		return(ms);
+	}
+
+	d = ((double) t.ulHi - (double) tmrbase.ulHi)*4294967296.0 +
+	    ((double) t.ulLo - (double) tmrbase.ulLo);
+	d = d*1000.0/(double) tmrfreq;
+	ms = (ULONG) (d/4294967296.0);
+
+	return((ULONG) (d - (double) ms*4294967296.0));
+}
+
+
+/*
+ * Find out how long to wait for a reply from a name server before
+ * trying again.
+ *
+ * Returns the time in milliseconds.
+ *
+ */
+
+ULONG upstream_rto(INADDR addr)
+{	INT i;
+	ULONG ms = INITIAL_RTO;
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	i = find_server(addr);
+	if(i >= 0) ms = rto(&upservers[i]);
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(ms);
+}
+
+
+/*
+ * Put a list of name servers in the order in which they should be
+ * tried: those that have not yet been used first, so that their reply
+ * times are learned, and then the rest in order of smoothed reply time.
+ * Servers with the same time are left in their configured order, and
+ * those that are down are left out. The smoothed times of all but the
+ * first chosen are then reduced a little.
+ *
+ *	ps	points to the list of name servers
+ *	addrs	points to an array for the addresses, in order
+ *
+ * Returns the number of servers chosen, which is 0 if all are down.
+ *
+ */
+
+INT upstream_select(PSERVERS ps, INADDR *addrs)
+{	INT i, j, m, n = 0;
+	ULONG key[MAXNS];
+	ULONG k;
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	for(m = 0; m < ps->nservers; m++) {
+		i = find_server(ps->servers[m]);
+		if(i >= 0 && upservers[i].down == TRUE) continue;
+		k = i < 0 ? 0 : upservers[i].srtt;
+
+		/* Insert, after any with the same time */
+
+		for(j = n; j > 0 && key[j-1] > k; j--) {
+			key[j] = key[j-1];
+			addrs[j] = addrs[j-1];
+		}
+		key[j] = k;
+		addrs[j] = ps->servers[m];
+		n++;
+	}
+	for(j = 1; j < n; j++) {
+		i = find_server(addrs[j]);
+		if(i >= 0) upservers[i].srtt -= upservers[i].srtt >> SRTT_DECAY;
+	}
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(n);
+}
+
+
+/*
+ * Write the reply time statistics for each name server to the logfile.
+ *
+ */
+
+VOID upstream_log(VOID)
+{	INT i;
+	UPSERVER u;
+	UCHAR msg[MAXLOG];
+
+	for(i = 0; i < nupservers; i++) {
+		(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+		u = upservers[i];
+		(VOID) DosReleaseMutexSem(pendsem);
+		if(u.nreplies == 0 && u.ntimeouts == 0) continue;
+
+		sprintf(
+			msg,
+			"name server %s: srtt %lu ms, rttvar %lu ms, "
+			"%lu replies, %lu timeouts%s",
+			inet_ntoa(u.addr),
+			u.srtt >> 3,
+			u.rttvar >> 2,
+			u.nreplies,
+			u.ntimeouts,
+			u.down == TRUE ? ", down" : "");
+		dolog(msg);
+	}
+}
+
+
+/*
+ * Enter a query in the table of outstanding queries, giving it an ID
+ * not in use for the same server. If it starts a new group, the budget
+ * for hedging grows a little.
+ *
+ * Returns the index of the entry, or NOSLOT if the table is full or a
+ * semaphore could not be created.
+ *
+ */
+
+static INT add_pending(PTHREADINFO ti, INADDR addr, INT group)
+{	INT slot, i, n, qlen;
+	ULONG count;
+	PUCHAR cp, end, question;
+	PPENDING p;
+
+	/* Find the extent of the (first) question, if it is in full */
+
+	question = ti->buf + sizeof(HEADER);
+	qlen = 0;
+	if(ntohs(((HEADER *) ti->buf)->qdcount) != 0) {
+		end = ti->buf + ti->pktlen;
+		for(cp = question; cp < end && *cp != 0; cp += n + 1) {
+			n = *cp;
+			if((n & INDIR_MASK) != 0) break;
+		}
+		if(cp < end && *cp == 0 && cp + 1 + QFIXEDSZ <= end)
+			qlen = cp + 1 + QFIXEDSZ - question;
+	}
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+
+	slot = freeslot;
+	if(slot == NOSLOT) {
+		(VOID) DosReleaseMutexSem(pendsem);
+		return(NOSLOT);
+	}
+	p = &pending[slot];
+	if(group < 0) {
+		if(p->hev == 0 &&
+		   DosCreateEventSem((PSZ) NULL, &p->hev, 0, FALSE) != 0) {
+			p->hev = 0;
+			(VOID) DosReleaseMutexSem(pendsem);
+			return(NOSLOT);
+		}
+		(VOID) DosResetEventSem(p->hev, &count);
+		tokens += budget;
+		if(tokens > HEDGE_BURST*100) tokens = HEDGE_BURST*100;
+	}
+	freeslot = p->next;
+
+	memset((PUCHAR) &p->sa, 0, sizeof(SOCK));
+	p->sa.sin_family = AF_INET;
+	p->sa.sin_port = ti->config->nsport;
+	p->sa.sin_addr = addr;
+
+	/* Choose an ID that is not already waiting for the same server */
+
+	do {
+		p->id = new_id();
+		for(i = hashtab[p->id & (PENDHASH-1)];
+		    i != NOSLOT;
+		    i = pending[i].next)
+			if(pending[i].id == p->id &&
+			   pending[i].sa.sin_addr.s_addr == addr.s_addr)
+				break;
+	} while(i != NOSLOT);
+
+	p->next = hashtab[p->id & (PENDHASH-1)];
+	hashtab[p->id & (PENDHASH-1)] = slot;
+	if(group < 0) {
+		p->group = slot;
+		p->gnext = NOSLOT;
+	} else {
+		p->group = group;
+		p->gnext = pending[group].gnext;
+		pending[group].gnext = slot;
+	}
+	p->replied = FALSE;
+	p->answered = FALSE;
+
+	/* Choose a socket at random, from those not waiting to be opened
+	   on a new port */
+
+	p->sockx = new_id() % NUPSOCKS;
+	for(i = 0; i < NUPSOCKS && socksent[p->sockx] >= PORT_QUERIES; i++)
+		p->sockx = (p->sockx + 1) % NUPSOCKS;
+	sockuse[p->sockx]++;
+	socksent[p->sockx]++;
+	p->server = find_server(addr);
+	p->sent = upstream_clock();
+	p->buf = ti->rbuf;
+	p->pktlen = 0;
+	p->question = question;
+	p->qlen = qlen;
+
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(slot);
+}
+
+
+/*
+ * Take an entry out of the table of outstanding queries, and put it on
+ * the free list. The caller owns the semaphore.
+ *
+ */
+
+static VOID remove_pending(INT slot)
+{	INT *pi;
+
+	for(pi = &hashtab[pending[slot].id & (PENDHASH-1)];
+	    *pi != NOSLOT;
+	    pi = &pending[*pi].next) {
+		if(*pi == slot) {
+			*pi = pending[slot].next;
+			break;
+		}
+	}
+	sockuse[pending[slot].sockx]--;
+	pending[slot].next = freeslot;
+	freeslot = slot;
+}
+
+
+/*
+ * The dispatcher thread. Receives the replies arriving on all the shared
+ * sockets, and hands each to the thread waiting for it.
+ *
+ */
+
+static VOID dispatcher(PVOID param)
+{	INT i, rc, pktlen, namelen;
+	BOOL waiting;
+	INT sockset[NUPSOCKS];
+	SOCK sa;
+
+	for(;;) {
+		waiting = renew_sockets();
+		for(i = 0; i < NUPSOCKS; i++)
+			sockset[i] = socks[i];
+
+		rc = select(
+			sockset,		/* List of sockets */
+			NUPSOCKS,		/* Sockets for read check */
+			0,			/* Sockets for write check */
+			0,			/* Sockets for exception check */
+			waiting == TRUE ? (LONG) DISPATCH_WAIT : -1L);
+		if(rc == -1) {
+			if(sock_errno() != SOCEINTR) {
+				sprintf(
+					logmsg,
+					"referral select failed: rc = %d",
+					sock_errno());
+				dolog(logmsg);
+				DosSleep(1000);
+			}
+			continue;
+		}
+		if(rc == 0) continue;		/* Timed out */
+
+		for(i = 0; i < NUPSOCKS; i++) {
+			if(sockset[i] == -1) continue;
+
+			/* Only the dispatcher changes 'spare', so it can be
+			   used here without the semaphore */
+
+			namelen = sizeof(SOCK);
+			pktlen = recvfrom(
+				socks[i],
+				spare,
+				PACKETSZ,
+				0,		/* No flags */
+				(PSOCKG) &sa,
+				&namelen);
+			if(pktlen <= 0) {
+				sprintf(
+					logmsg,
+					"referral recvfrom failed: rc = %d",
+					sock_errno());
+				dolog(logmsg);
+				continue;
+			}
+			if(pktlen < sizeof(HEADER)) continue;
+
+			deliver(i, &sa, pktlen);
+		}
+	}
+}
+
+
+/*
+ * The prober thread. Every PROBE_INTERVAL milliseconds, sends a query
+ * for the root name servers to each name server that is down. Any reply
+ * at all shows that the server is back (see 'note_rtt'); a timeout
+ * leaves it down.
+ *
+ */
+
+static VOID prober(PVOID param)
+{	INT i, group;
+	INADDR addr;
+	PTHREADINFO ti;
+
+	ti = (PTHREADINFO) calloc(1, sizeof(THREADINFO));
+	if(ti != (PTHREADINFO) NULL) {
+		ti->buf = (PUCHAR) malloc(PACKETSZ);
+		ti->rbuf = (PUCHAR) malloc(PACKETSZ);
+	}
+	if(ti == (PTHREADINFO) NULL ||
+	   ti->buf == (PUCHAR) NULL ||
+	   ti->rbuf == (PUCHAR) NULL) {
+		dolog("failed to allocate referral probe buffers");
+		return;
+	}
+	ti->config = (PCONFIG) param;
+	ti->pktlen = res_mkquery(
+			QUERY,
+			".",
+			C_IN,
+			T_NS,
+			(PUCHAR) NULL,
+			0,
+			(PUCHAR) NULL,
+			ti->buf,
+			PACKETSZ);
+	if(ti->pktlen <= 0) {
+		dolog("failed to build referral probe");
+		return;
+	}
+
+	for(;;) {
+		DosSleep(PROBE_INTERVAL);
+
+		for(i = 0; i < nupservers; i++) {
+			(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+			addr = upservers[i].addr;
+			if(upservers[i].down == FALSE) addr.s_addr = INADDR_ANY;
+			(VOID) DosReleaseMutexSem(pendsem);
+			if(addr.s_addr == INADDR_ANY) continue;
+
+#ifdef	DEBUG
+			trace("probing name server %s", inet_ntoa(addr));
+#endif
+			group = upstream_send(ti, addr, -1);
+			if(group < 0) continue;
+			(VOID) upstream_wait(group, PROBE_TIMEOUT);
+			(VOID) upstream_end(ti, group);
+		}
+	}
+}
+
+
+/*
+ * Hand a reply in the spare buffer to the thread waiting for it, if
+ * there is one. Its referral buffer becomes the new spare.
+ *
+ *	sockx	is the index of the socket the reply arrived on
+ *	psa	points to the address it came from
+ *	pktlen	is the length of the reply
+ *
+ */
+
+static VOID deliver(INT sockx, PSOCK psa, INT pktlen)
+{	INT i;
+	USHORT id = ((HEADER *) spare)->id;
+	PUCHAR temp;
+	PPENDING p, g;
+	QWORD t;
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+
+	/* The low bits of the time a reply arrives cannot be known to anyone
+	   else, so they are saved for the next key */
+
+	if(tmrfreq != 0 && DosTmrQueryTime(&t) == 0)
+		noise = ROTL(noise, 7) ^ t.ulLo;
+
+	for(i = hashtab[id & (PENDHASH-1)]; i != NOSLOT; i = p->next) {
+		p = &pending[i];
+		if(p->id == id &&
+		   p->sockx == sockx &&
+		   p->sa.sin_addr.s_addr == psa->sin_addr.s_addr &&
+		   p->sa.sin_port == psa->sin_port &&
+		   same_question(p, spare, pktlen) == TRUE)
+			break;
+	}
+
+	if(i != NOSLOT) {
+		if(p->server >= 0 && p->replied == FALSE)
+			note_rtt(p->server, upstream_clock() - p->sent);
+		p->replied = TRUE;
+		g = &pending[p->group];
+		if(g->answered == FALSE) {
+			temp = g->buf;
+			g->buf = spare;
+			g->pktlen = pktlen;
+			g->answered = TRUE;
+			spare = temp;
+			(VOID) DosPostEventSem(g->hev);
+		}
+	}
+#ifdef	DEBUG
+	else {
+		trace(
+			"dropped unexpected referral reply from %s",
+			inet_ntoa(psa->sin_addr));
+	}
+#endif
+
+	(VOID) DosReleaseMutexSem(pendsem);
+}
+
+
+/*
+ * Check that a reply has the same question as the query it appears to
+ * answer. Case is ignored in the name, as some servers change it.
+ *
+ * Returns TRUE if the questions match, or if the query had none.
+ *
+ */
+
+static BOOL same_question(PPENDING p, PUCHAR reply, INT pktlen)
+{	INT n;
+
+	if(p->qlen == 0) return(TRUE);
+	if(ntohs(((HEADER *) reply)->qdcount) == 0 ||
+	   pktlen < sizeof(HEADER) + p->qlen)
+		return(FALSE);
+
+	reply += sizeof(HEADER);
+	n = p->qlen - QFIXEDSZ;
+	if(name_equal(reply, p->question, n) == FALSE ||
+	   memcmp(reply + n, p->question + n, QFIXEDSZ) != 0)
+		return(FALSE);
+
+	return(TRUE);
+}
+
+
+/*
+ * Note the time taken by a name server to reply. The caller owns the
+ * semaphore.
+ *
+ */
+
+static VOID note_rtt(INT server, ULONG rtt)
+{	INT k;
+	LONG err;
+	PUPSERVER u = &upservers[server];
+
+	u->nreplies++;
+	u->backoff = 0;
+	u->failures = 0;
+	if(u->down == TRUE) note_down(u, FALSE);
+	if(u->srtt == 0) {			/* First time */
+		u->srtt = rtt << 3;
+		u->rttvar = rtt << 1;
+	} else {
+		err = (LONG) rtt - (LONG) (u->srtt >> 3);
+		u->srtt += err;
+		if(err < 0) err = -err;
+		u->rttvar += err - (LONG) (u->rttvar >> 2);
+		if(u->srtt < 8) u->srtt = 8;	/* Never quite nothing */
+	}
+
+	for(k = 0; k < NRTTBUCKETS - 1 && (1UL << k) <= rtt; k++)
+		;
+	u->hist[k]++;
+
+	if(++u->nsamples >= RTTDECAY) {		/* Age the histogram */
+		for(k = 0; k < NRTTBUCKETS; k++)
+			u->hist[k] /= 2;
+		u->nsamples = 0;
+	}
+}
+
+
+/*
+ * Note that a name server did not reply to a query. If it was given its
+ * full timeout, the next timeout is doubled. If it has been given longer
+ * than it usually takes, the time waited is taken as its reply time, so
+ * that it becomes less likely to be chosen; if not, the query was
+ * probably answered by another server first, and nothing is learned.
+ * The caller owns the semaphore.
+ *
+ */
+
+static VOID note_timeout(INT server, ULONG waited)
+{	PUPSERVER u = &upservers[server];
+
+	if(waited >= rto(u)) {
+		u->ntimeouts++;
+		if(u->backoff < MAXBACKOFF) u->backoff++;
+		if(++u->failures >= FAILURE_LIMIT && u->down == FALSE)
+			note_down(u, TRUE);
+	}
+
+	if(waited <= (u->srtt >> 3)) return;
+
+	if(u->srtt == 0) {			/* Never replied */
+		u->srtt = waited << 3;
+		u->rttvar = waited << 1;
+	} else {
+		u->srtt += (LONG) waited - (LONG) (u->srtt >> 3);
+	}
+}
+
+
+/*
+ * Mark a name server as up or down, and log the change. The caller owns
+ * the semaphore.
+ *
+ */
+
+static VOID note_down(PUPSERVER u, BOOL down)
+{	UCHAR msg[MAXLOG];
+
+	u->down = down;
+	sprintf(
+		msg,
+		down == TRUE ?	"name server %s not responding" :
+				"name server %s responding again",
+		inet_ntoa(u->addr));
+	dolog(msg);
+}
+
+
+/*
+ * Find a name server in the table.
+ *
+ * Returns its index, or -1 if it is not there.
+ *
+ */
+
+static INT find_server(INADDR addr)
+{	INT i;
+
+	for(i = 0; i < nupservers; i++)
+		if(upservers[i].addr.s_addr == addr.s_addr) return(i);
+
+	return(-1);
+}
+
+
+/*
+ * Work out the time to wait for a reply from a name server (RFC 6298).
+ * The smoothed time is kept in eighths, and the variation in quarters,
+ * of a millisecond, so the variation is already multiplied by four. The
+ * caller owns the semaphore.
+ *
+ * Returns the time in milliseconds.
+ *
+ */
+
+static ULONG rto(PUPSERVER u)
+{	ULONG ms;
+
+	if(u->srtt == 0)
+		ms = INITIAL_RTO;
+	else
+		ms = (u->srtt >> 3) + (u->rttvar > 0 ? u->rttvar : 1);
+	if(ms < MIN_RTO) ms = MIN_RTO;
+
+	ms <<= u->backoff;
+	if(ms > MAX_RTO) ms = MAX_RTO;
+
+	return(ms);
+}
+
+
+/*
+ * Choose an ID for a query, or anything else that must not be guessed,
+ * at random. The caller owns the semaphore, except at startup.
+ *
+ */
+
+static USHORT new_id(VOID)
+{	if(rleft == 0) new_key();
+
+	return(rpool[--rleft]);
+}
+
+
+/*
+ * Make a block of ChaCha20 keystream (RFC 8439) from the current key,
+ * with the timer readings saved since the last block as the nonce. Half
+ * of the block becomes the next key, so that earlier numbers cannot be
+ * worked out from the state; the other half gives 16 random numbers.
+ *
+ */
+
+static VOID new_key(VOID)
+{	INT i;
+	ULONG x[16], in[16];
+
+	in[0] = 0x61707865UL;			/* "expand 32-byte k" */
+	in[1] = 0x3320646eUL;
+	in[2] = 0x79622d32UL;
+	in[3] = 0x6b206574UL;
+	for(i = 0; i < 8; i++)
+		in[4+i] = rkey[i];
+	in[12] = rcount++;
+	in[13] = noise;
+	in[14] = in[15] = 0;
+	noise = 0;
+
+	memcpy(x, in, sizeof(x));
+	for(i = 0; i < 10; i++) {
+		QROUND(x[0], x[4], x[8], x[12]);
+		QROUND(x[1], x[5], x[9], x[13]);
+		QROUND(x[2], x[6], x[10], x[14]);
+		QROUND(x[3], x[7], x[11], x[15]);
+		QROUND(x[0], x[5], x[10], x[15]);
+		QROUND(x[1], x[6], x[11], x[12]);
+		QROUND(x[2], x[7], x[8], x[13]);
+		QROUND(x[3], x[4], x[9], x[14]);
+	}
+	for(i = 0; i < 16; i++)
+		x[i] += in[i];
+
+	for(i = 0; i < 8; i++) {
+		rkey[i] = x[i];
+		rpool[2*i] = (USHORT) x[8+i];
+		rpool[2*i+1] = (USHORT) (x[8+i] >> 16);
+	}
+	rleft = 16;
+}
+
+
+/*
+ * Open a socket for referred queries, bound to a random port; if no free
+ * port is found after a few tries, the system chooses one. The caller owns
+ * the semaphore, except at startup.
+ *
+ * Returns the socket, or -1 if it could not be opened.
+ *
+ */
+
+static INT new_socket(VOID)
+{	INT i, sockno, rc;
+	SOCK sa;
+#ifdef	DEBUG
+	INT namelen;
+#endif
+
+	sockno = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sockno < 0) {
+		sprintf(
+			logmsg,
+			"failed to allocate socket for refer: rc = %d",
+			sock_errno());
+		dolog(logmsg);
+		return(-1);
+	}
+
+	memset((PUCHAR) &sa, 0, sizeof(SOCK));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = INADDR_ANY;
+	for(i = 0; i <= PORT_TRIES; i++) {
+		if(i < PORT_TRIES)
+			sa.sin_port = htons(MINPORT + new_id()%(65536 - MINPORT));
+		else
+			sa.sin_port = 0;	/* Let system select port */
+		rc = bind(sockno, (PSOCKG) &sa, sizeof(SOCK));
+		if(rc == 0) break;
+	}
+	if(rc < 0) {
+		sprintf(
+			logmsg,
+			"failed to bind referral socket: rc = %d",
+			sock_errno());
+		dolog(logmsg);
+		soclose(sockno);
+		return(-1);
+	}
+#ifdef	DEBUG
+	namelen = sizeof(SOCK);
+	if(getsockname(sockno, (PSOCKG) &sa, &namelen) == 0)
+		trace("referral socket bound to port %hu", ntohs(sa.sin_port));
+#endif
+
+	return(sockno);
+}
+
+
+/*
+ * Open again, on new ports, any sockets that have sent PORT_QUERIES
+ * queries and have none left outstanding. This is called only by the
+ * dispatcher, so a socket can be changed without disturbing its 'select'.
+ * If a new socket cannot be opened, the old one is kept for another
+ * PORT_QUERIES queries.
+ *
+ * Returns TRUE if any sockets are still waiting for their last queries
+ * to finish, FALSE if not.
+ *
+ */
+
+static BOOL renew_sockets(VOID)
+{	INT i, sockno;
+	BOOL waiting = FALSE;
+
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	for(i = 0; i < NUPSOCKS; i++) {
+		if(socksent[i] < PORT_QUERIES) continue;
+		if(sockuse[i] != 0) {
+			waiting = TRUE;
+			continue;
+		}
+		sockno = new_socket();
+		if(sockno >= 0) {
+			soclose(socks[i]);
+			socks[i] = sockno;
+		}
+		socksent[i] = 0;
+	}
+	(VOID) DosReleaseMutexSem(pendsem);
+
+	return(waiting);
+}
+
+/*
+ * End of file: upstream.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,392 @@
+/*
+ * File: version.c
+ *
+ * Name server for OS/2.
+ *
+ * Versions of the databases, and reloading when files change.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * The default database and the databases for all the views are loaded
+ * together, as one version, with the records of any secondary zones. The
+ * current version is published through a single pointer, which a query
+ * thread reads once, when it selects the database to use; query threads
+ * take no locks. If RELOAD_INTERVAL is set, a background thread looks at
+ * the HOSTS and zone files at that interval, and if any has changed it
+ * loads a complete new version and publishes it with an atomic pointer
+ * exchange. A query therefore sees either the old data or the new, never
+ * a mixture of the two. A new version is also loaded when a secondary
+ * zone changes; a semaphore makes sure that only one version is being
+ * loaded at a time.
+ *
+ * An old version is kept for RETIRE_TIME seconds after it is replaced,
+ * which is much longer than any query can take (even a referral, which
+ * is limited to MAX_REFER_DEADLINE), and it is then freed.
+ * Old versions are looked at whenever a new one is loaded, and by the
+ * reload thread (if any) at each interval. Zone transfers may last longer
+ * than that, so they count themselves as users of the version they are
+ * sending from, and a version is not freed while it has any users. The
+ * counts, the chain of versions, and the zone transfer journals are
+ * protected by a simple lock.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, version_start)
+
+#define	RELOAD_STACK	32768		/* Stack size for reload thread */
+#define	RETIRE_TIME	600		/* Seconds an old version is kept */
+
+/* Forward references */
+
+static	ULONG	file_stamp(PUCHAR);
+static	ULONG	files_stamp(PCONFIG);
+static	VOID	free_version(PCONFIG, PDBVERSION);
+static	BOOL	load_version(PCONFIG);
+static	VOID	reloader(PVOID);
+static	VOID	retire(PCONFIG);
+
+/* Local storage */
+
+static	ULONG		nversions;	/* Number of versions loaded */
+static	ULONG		stamp;		/* Stamp of files last loaded */
+static	LONG volatile	lock;		/* Lock for versions and journals */
+static	HMTX		loadsem;	/* Semaphore for loading */
+
+
+/*
+ * Load a new version of the databases from the files, and make it the
+ * current version. This is used for the first version, at startup, and
+ * whenever the files or a secondary zone change. If anything goes wrong,
+ * the current version (if any) stays in use. If another version is being
+ * loaded, this waits until it has finished.
+ *
+ * Returns TRUE if the new version was loaded, FALSE if not. Any error
+ * messages have already been logged.
+ *
+ */
+
+BOOL version_load(PCONFIG config)
+{	BOOL rc;
+
+	/* The first call is made at startup, before there are any other
+	   threads */
+
+	if(loadsem == 0 &&
+	   DosCreateMutexSem((PSZ) NULL, &loadsem, 0, FALSE) != 0) {
+		dolog("failed to create load semaphore");
+		return(FALSE);
+	}
+
+	(VOID) DosRequestMutexSem(loadsem, SEM_INDEFINITE_WAIT);
+	rc = load_version(config);
+	(VOID) DosReleaseMutexSem(loadsem);
+
+	return(rc);
+}
+
+
+/*
+ * Load and publish a new version of the databases; the caller owns the
+ * load semaphore.
+ *
+ * Returns TRUE if the new version was loaded, FALSE if not.
+ *
+ */
+
+static BOOL load_version(PCONFIG config)
+{	INT i;
+	BOOL ok;
+	PDBVERSION ver, old;
+	UCHAR logmsg[MAXLOG];
+
+	/* Note the state of the files first, so that a change made while
+	   they are being read is picked up next time */
+
+	stamp = files_stamp(config);
+
+	ver = (PDBVERSION) calloc(1, sizeof(DBVERSION));
+	if(ver == (PDBVERSION) NULL) {
+		dolog("failed to allocate database version");
+		return(FALSE);
+	}
+	ver->number = nversions + 1;
+	ver->viewdbs = (PDB *) calloc(config->nviews + 1, sizeof(PDB));
+	ver->db = db_init((PDB) NULL);
+	if(ver->viewdbs == (PDB *) NULL || ver->db == (PDB) NULL) {
+		dolog("failed to allocate database");
+		free_version(config, ver);
+		return(FALSE);
+	}
+
+	if(load_hosts(config, ver->db, config->hostsfile) == FALSE ||
+	   zone_load(ver->db, config->zonefiles) == FALSE ||
+	   secondary_load(config, ver->db) == FALSE ||
+	   view_load(config, ver) == FALSE ||
+	   xfr_prepare(config, ver) == FALSE) {
+		free_version(config, ver);
+		return(FALSE);
+	}
+
+	/* Build the replies to common queries in advance; the default
+	   database first, as the views may use its replies */
+
+	ok = make_answers(config, ver->db);
+	for(i = 0; ok == TRUE && i < config->nviews; i++)
+		ok = make_answers(config, ver->viewdbs[i]);
+	if(ok == FALSE) {
+		dolog("failed to allocate prebuilt replies");
+		xfr_abort();
+		free_version(config, ver);
+		return(FALSE);
+	}
+	health_index(ver);
+
+	/* Publish the new version */
+
+	version_lock();
+	old = config->current;
+	ver->next = old;
+	(VOID) __lxchg((volatile LONG *) &config->current, (LONG) ver);
+	if(old != (PDBVERSION) NULL) old->retired = time((time_t *) NULL);
+	xfr_commit(ver);
+	secondary_commit();
+	version_unlock();
+	nversions++;
+
+	sprintf(
+		logmsg,
+		"database version %lu loaded: %lu names",
+		ver->number,
+		ver->db->nnodes);
+	dolog(logmsg);
+
+	/* Tell any replicas about changed zones, and free any old versions
+	   that are no longer needed */
+
+	xfr_notify(config);
+	retire(config);
+
+	return(TRUE);
+}
+
+
+/*
+ * Start the thread that looks for changed files, if a reload interval
+ * has been set.
+ *
+ * Returns:
+ *	TRUE		thread started, or not configured
+ *	FALSE		failed to start
+ *
+ */
+
+BOOL version_start(PCONFIG config)
+{	INT rc;
+	UCHAR logmsg[MAXLOG];
+
+	if(config->reload_interval == 0) return(TRUE);
+
+	rc = _beginthread(reloader, NULL, RELOAD_STACK, (PVOID) config);
+	if(rc == -1) {
+		dolog("failed to create reload thread");
+		return(FALSE);
+	}
+
+	sprintf(
+		logmsg,
+		"checking for changed files every %d seconds",
+		config->reload_interval);
+	dolog(logmsg);
+
+	return(TRUE);
+}
+
+
+/*
+ * Get the current version of the databases for a zone transfer, and
+ * count the caller as a user of it. 'version_release' must be called
+ * when it is no longer needed.
+ *
+ */
+
+PDBVERSION version_get(PCONFIG config)
+{	PDBVERSION ver;
+
+	version_lock();
+	ver = config->current;
+	ver->users++;
+	version_unlock();
+
+	return(ver);
+}
+
+
+/*
+ * Stop using a version of the databases obtained by 'version_get'.
+ *
+ */
+
+VOID version_release(PDBVERSION ver)
+{	version_lock();
+	ver->users--;
+	version_unlock();
+}
+
+
+/*
+ * Take the lock for the chain of versions and the zone transfer journals.
+ * It is only ever held briefly, so a waiter just sleeps and tries again.
+ *
+ */
+
+VOID version_lock(VOID)
+{	while(__lxchg(&lock, 1) != 0)
+		DosSleep(1);
+}
+
+
+/*
+ * Release the lock taken by 'version_lock'.
+ *
+ */
+
+VOID version_unlock(VOID)
+{	(VOID) __lxchg(&lock, 0);
+}
+
+
+/*
+ * The reload thread. Looks for changed files every 'reload_interval'
+ * seconds, and loads a new version if there are any. Old versions are
+ * freed when they are no longer needed.
+ *
+ */
+
+static VOID reloader(PVOID param)
+{	PCONFIG config = (PCONFIG) param;
+
+	for(;;) {
+		DosSleep(config->reload_interval*1000);
+
+		if(files_stamp(config) != stamp) {
+			dolog("files changed; loading new database version");
+			if(version_load(config) == FALSE)
+				dolog("database version not loaded; "
+				      "still using old one");
+		}
+
+		retire(config);
+	}
+}
+
+
+/*
+ * Free any old versions that have been out of use for long enough.
+ * They are taken off the chain under the lock, but freed outside it.
+ *
+ */
+
+static VOID retire(PCONFIG config)
+{	time_t now = time((time_t *) NULL);
+	PDBVERSION ver, *pver;
+	PDBVERSION dead = (PDBVERSION) NULL;
+
+	version_lock();
+	pver = &config->current->next;
+	while(*pver != (PDBVERSION) NULL) {
+		ver = *pver;
+		if(ver->users == 0 && now - ver->retired >= RETIRE_TIME) {
+			*pver = ver->next;
+			ver->next = dead;
+			dead = ver;
+		} else {
+			pver = &ver->next;
+		}
+	}
+	version_unlock();
+
+	while(dead != (PDBVERSION) NULL) {
+		ver = dead;
+		dead = ver->next;
+#ifdef	DEBUG
+		trace("freeing database version %lu", ver->number);
+#endif
+		free_version(config, ver);
+	}
+}
+
+
+/*
+ * Free a version of the databases, which may only be partly built.
+ * View databases are freed first, as they are overlays on the default
+ * one.
+ *
+ */
+
+static VOID free_version(PCONFIG config, PDBVERSION ver)
+{	INT i;
+
+	if(ver->viewdbs != (PDB *) NULL) {
+		for(i = 0; i < config->nviews; i++)
+			if(ver->viewdbs[i] != (PDB) NULL)
+				db_free(ver->viewdbs[i]);
+		free(ver->viewdbs);
+	}
+	if(ver->db != (PDB) NULL) db_free(ver->db);
+	xfr_free(ver);
+	free(ver);
+}
+
+
+/*
+ * Compute a stamp for the files that make up the databases, from their
+ * modification times and sizes. If any file changes, so does the stamp.
+ *
+ */
+
+static ULONG files_stamp(PCONFIG config)
+{	ULONG s;
+	PZONEFILE zf;
+	PVIEW v;
+
+	s = file_stamp(config->hostsfile);
+	for(zf = config->zonefiles; zf != (PZONEFILE) NULL; zf = zf->next)
+		s = s*31 + file_stamp(zf->filename);
+	for(v = config->views; v != (PVIEW) NULL; v = v->next) {
+		if(v->hostsfile != (PUCHAR) NULL)
+			s = s*31 + file_stamp(v->hostsfile);
+		for(zf = v->zonefiles; zf != (PZONEFILE) NULL; zf = zf->next)
+			s = s*31 + file_stamp(zf->filename);
+	}
+
+	return(s);
+}
+
+
+/*
+ * Compute the stamp for a single file; this is zero if the file cannot
+ * be found.
+ *
+ */
+
+static ULONG file_stamp(PUCHAR filename)
+{	struct stat st;
+
+	if(stat(filename, &st) != 0) return(0);
+
+	return((ULONG) st.st_mtime ^ ((ULONG) st.st_size << 16));
+}
+
+/*
+ * End of file: version.c
+ *
+ */
+
\ No newline at end of file
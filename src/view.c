@@ -0,0 +1,93 @@
+/*
+ * File: view.c
+ *
+ * Name server for OS/2.
+ *
+ * Views of the database, selected by client address.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * A view has its own database, loaded from its own HOSTS file and zone
+ * files. This is an overlay on the default database; anything not found
+ * in the view's database is looked for in the default one. Clients are
+ * mapped to views by the longest matching prefix of their address, using
+ * a binary prefix tree; clients that match no view use the default
+ * database.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+
+/*
+ * Load the databases for all the configured views, as part of a new
+ * version of the databases; the default database has already been loaded.
+ *
+ * Returns TRUE if all went well, FALSE if there was a fatal error. Any
+ * error messages have already been logged.
+ *
+ */
+
+BOOL view_load(PCONFIG config, PDBVERSION ver)
+{	PVIEW v;
+	PDB db;
+	UCHAR logmsg[MAXLOG];
+
+	for(v = config->views; v != (PVIEW) NULL; v = v->next) {
+		db = db_init(ver->db);
+		if(db == (PDB) NULL) {
+			dolog("failed to allocate database for view");
+			return(FALSE);
+		}
+		ver->viewdbs[v->index] = db;
+
+		if(v->hostsfile != (PUCHAR) NULL &&
+		   load_hosts(config, db, v->hostsfile) == FALSE)
+			return(FALSE);
+
+		if(zone_load(db, v->zonefiles) == FALSE) return(FALSE);
+
+		sprintf(
+			logmsg,
+			"view %.50s: %lu names",
+			v->name,
+			db->nnodes);
+		dolog(logmsg);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Select the database to use for a client, given its address. The
+ * current version of the databases is only looked at once, so that all
+ * of a query is answered from the same version.
+ *
+ * Returns a pointer to the database for the client's view, or to the
+ * default database if the client is not in any view.
+ *
+ */
+
+PDB view_select(PCONFIG config, INADDR addr)
+{	PDBVERSION ver = config->current;
+	PVIEW v;
+
+	if(config->viewtab == (PRADIX) NULL) return(ver->db);
+
+	v = (PVIEW) radix_lookup(config->viewtab, addr);
+
+	return(v == (PVIEW) NULL ? ver->db : ver->viewdbs[v->index]);
+}
+
+/*
+ * End of file: view.c
+ *
+ */
+
\ No newline at end of file
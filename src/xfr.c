@@ -0,0 +1,1877 @@
+/*
+ * File: xfr.c
+ *
+ * Name server for OS/2.
+ *
+ * Zone transfers (AXFR and IXFR) to replica servers, and NOTIFY.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Each of our domains and networks is a zone, which the servers given by
+ * REPLICA commands may transfer. The records in a zone are those that
+ * queries would be answered with: addresses, aliases and (for a network)
+ * pointers from the HOSTS file, and records from zone files and secondary
+ * zones. Only the
+ * default database is used; views are not transferred. Every zone is
+ * given SOA and NS records at its apex, if a zone file does not supply
+ * them.
+ *
+ * When a new version of the databases is loaded, the records in each zone
+ * are collected, put into wire format, and sorted; they are then compared
+ * with those in the previous version. If anything has changed, the zone
+ * gets a new serial number, and the differences are added to the zone's
+ * journal, which holds the last JOURNAL_SIZE sets of changes. Otherwise
+ * the serial number stays the same.
+ *
+ * At the same time, the whole zone is written out as the complete series
+ * of compressed response messages for an AXFR, each preceded by its TCP
+ * length field. This image belongs to the version, and an AXFR is sent
+ * straight from it; only the message ID (and, for an IXFR answered with
+ * the whole zone, the query type) is changed, in a copy of each message
+ * as it is sent. An IXFR (RFC 1995) is built from the journal, and holds
+ * only the changes since the replica's serial number; if the journal does
+ * not go back that far, the whole zone is sent instead.
+ *
+ * When zones change, a NOTIFY (RFC 1996) is sent to each replica, so that
+ * it knows to ask for a transfer.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#pragma	alloc_text(init_seg, xfr_init)
+#pragma	alloc_text(init_seg, xfr_start)
+#pragma	alloc_text(init_seg, add_zone)
+
+#define	XFR_STACK	32768		/* Stack size for transfer threads */
+#define	XFR_MSGSIZE	16384		/* Largest transfer message sent */
+#define	XFR_TIMEOUT	30		/* Client timeout (seconds) */
+#define	XFR_BACKLOG	5		/* Queue length for connections */
+#define	JOURNAL_SIZE	20		/* Sets of changes kept per zone */
+#define	NOTIFY_TIMEOUT	2		/* NOTIFY reply timeout (seconds) */
+#define	NOTIFY_RETRIES	3		/* Times to send each NOTIFY */
+
+/* Offset of the serial number field from the end of SOA RDATA */
+
+#define	SOA_SERIAL_OFF	20
+
+/* Type definitions */
+
+typedef struct _XRR {			/* Record in transfer form */
+USHORT		len;			/* Length of data */
+UCHAR		data[1];		/* Owner name (not compressed),
+					   fixed part, and RDATA */
+} XRR, *PXRR;
+
+typedef struct _ZSTATE {		/* Contents of a zone */
+BOOL		changed;		/* TRUE if new serial number */
+ULONG		serial;			/* Serial number */
+PXRR		filesoa;		/* SOA record as loaded */
+PXRR		soa;			/* SOA record as sent */
+INT		nrrs;			/* Number of other records */
+PXRR		*rrs;			/* Other records, sorted */
+} ZSTATE, *PZSTATE;
+
+typedef struct _DELTA {			/* One set of changes to a zone */
+struct _DELTA	*next;			/* Next older set */
+ULONG		oldserial;		/* Serial number before */
+ULONG		newserial;		/* Serial number after */
+PXRR		oldsoa;			/* SOA record before */
+PXRR		newsoa;			/* SOA record after */
+INT		ndel;			/* Number of records deleted */
+INT		nadd;			/* Number of records added */
+PXRR		*rrs;			/* Deleted, then added, records */
+} DELTA, *PDELTA;
+
+typedef struct _XFRZONE {		/* Zone that may be transferred */
+struct _XFRZONE	*next;			/* Next entry in chain */
+INT		index;			/* Index of image in each version */
+PUCHAR		name;			/* Name of zone */
+INT		len;			/* Length of name */
+PRR		soa;			/* Default SOA record */
+BOOL		network;		/* TRUE if reverse zone for network */
+BOOL		notify;			/* TRUE if NOTIFY is due */
+BOOL		secondary;		/* TRUE if copied from a primary */
+ZSTATE		cur;			/* Contents in current version */
+ZSTATE		loading;		/* Contents in version being loaded */
+PDELTA		pending;		/* Changes in version being loaded */
+PDELTA		journal;		/* Changes, newest first */
+} XFRZONE, *PXFRZONE;
+
+typedef struct _XFRIMAGE {		/* Transfer image of a zone */
+ULONG		serial;			/* Serial number */
+PXRR		soa;			/* SOA record */
+INT		qtypeoff;		/* Offset of QTYPE in first message */
+ULONG		len;			/* Length of messages */
+PUCHAR		msgs;			/* Messages, each with length */
+} XFRIMAGE, *PXFRIMAGE;
+
+typedef struct _XBUF {			/* Transfer messages being built */
+PUCHAR		qname;			/* Question name */
+INT		qtype;			/* Question type */
+INT		qtypeoff;		/* Offset of QTYPE in first message */
+PUCHAR		out;			/* Complete messages */
+ULONG		outlen;			/* Length of above */
+ULONG		outsize;		/* Space allocated for above */
+USHORT		count;			/* Records in current message */
+PUCHAR		rp;			/* Next free byte in message */
+COMP		comp;			/* Name compression state */
+UCHAR		msg[XFR_MSGSIZE];	/* Current message */
+} XBUF, *PXBUF;
+
+typedef struct _XLIST {			/* Growing list of records */
+INT		n;			/* Number of records */
+INT		size;			/* Room in list */
+PXRR		*rrs;			/* The records */
+} XLIST, *PXLIST;
+
+typedef struct _PTRENT {		/* Address for reverse zone */
+ULONG		addr;			/* Address, host byte order */
+INT		seq;			/* Position in entry chain */
+PDBENT		entry;			/* Entry for address */
+} PTRENT, *PPTRENT;
+
+typedef struct _XFRCONN {		/* Transfer connection */
+INT		sockno;			/* Socket for connection */
+SOCK		sa;			/* Address of client */
+INT		len;			/* Length of request */
+UCHAR		frame[2+XFR_MSGSIZE];	/* Length field and message */
+UCHAR		logmsg[MAXLOG];		/* Logging buffer */
+} XFRCONN, *PXFRCONN;
+
+typedef struct _NOTIFYJOB {		/* Zones to send NOTIFY for */
+INT		nzones;			/* Number of zones */
+PXFRZONE	zones[1];		/* The zones */
+} NOTIFYJOB, *PNOTIFYJOB;
+
+/* Forward references */
+
+static	BOOL		add_list(PXLIST, PXRR);
+static	BOOL		add_zone(PUCHAR, PRR, BOOL);
+static	BOOL		collect(PXFRZONE, PDB, PZSTATE);
+static	BOOL		collect_ptrs(PXFRZONE, PDB, PXLIST);
+static	PRR		copy_rr(PRR);
+static	BOOL		do_request(PXFRCONN);
+static	PXRR		dup_xrr(PXRR);
+static	PXFRZONE	find_zone(PUCHAR);
+static	VOID		free_delta(PDELTA);
+static	VOID		free_state(PZSTATE);
+static	BOOL		get_request(PXFRCONN);
+static	BOOL		get_serial(PUCHAR, PUCHAR, PUCHAR, PULONG);
+static	BOOL		hidden(PDBENT, INT);
+static	VOID		listener(PVOID);
+static	PXRR		make_xrr(PUCHAR, INT, INT, ULONG, PUCHAR, INT);
+static	INT		merge(PZSTATE, PZSTATE, PXRR *);
+static	VOID		notifier(PVOID);
+static	BOOL		prepare_zone(PXFRZONE, PDBVERSION);
+static	INT		ptr_sort(const VOID *, const VOID *);
+static	BOOL		put_xrr(PXBUF, PXRR);
+static	VOID		rdata_names(INT, PINT, PINT);
+static	BOOL		recv_all(PXFRCONN, PUCHAR, INT);
+static	BOOL		send_all(PXFRCONN, PUCHAR, INT);
+static	BOOL		send_error(PXFRCONN, PUCHAR, INT);
+static	BOOL		send_ixfr(PXFRCONN, PXFRZONE, PXFRIMAGE, PUCHAR,
+					ULONG);
+static	BOOL		send_msgs(PXFRCONN, PUCHAR, ULONG, PUCHAR, INT, INT);
+static	VOID		serve_conn(PVOID);
+static	BOOL		xb_add(PXBUF, PXRR);
+static	VOID		xb_begin(PXBUF);
+static	BOOL		xb_end(PXBUF);
+static	PXBUF		xb_new(PUCHAR, INT);
+static	INT		xrr_compare(PXRR, PXRR);
+static	INT		xrr_sort(const VOID *, const VOID *);
+static	PXFRZONE	zone_of(PUCHAR);
+
+/* Local storage */
+
+static	PCONFIG		xconfig;	/* Configuration information */
+static	PXFRZONE	zones;		/* Zones that may be transferred */
+static	INT		nzones;		/* Number of above */
+static	PRR		nsrr;		/* NS record naming this server */
+static	INT		lsockno;	/* Socket for transfer connections */
+
+
+/*
+ * Set up the list of zones; these are the authoritative domains and
+ * networks. This is called after the authoritative tables have been
+ * built, and before the first version of the databases is loaded.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+BOOL xfr_init(PCONFIG config)
+{	INT n;
+	PAUTHDOM ad;
+	PAUTHNET an;
+	PSECONDARY sec;
+	PXFRZONE z;
+	UCHAR rdata[MAXCDNAME];
+
+	xconfig = config;
+
+	for(ad = config->authdoms; ad != (PAUTHDOM) NULL; ad = ad->next)
+		if(add_zone(ad->name, ad->soa, FALSE) == FALSE) return(FALSE);
+
+	/* The default network (used if none is configured) is not a real
+	   one, so it has no zone */
+
+	for(an = config->authnets; an != (PAUTHNET) NULL; an = an->next) {
+		if(an->network.s_addr == 0) continue;
+		if(add_zone(an->revdomain, an->soa, TRUE) == FALSE)
+			return(FALSE);
+	}
+
+	/* Secondary zones are among the domains */
+
+	for(sec = config->secondaries;
+	    sec != (PSECONDARY) NULL;
+	    sec = sec->next) {
+		z = find_zone(sec->origin);
+		if(z != (PXFRZONE) NULL) z->secondary = TRUE;
+	}
+
+	/* The NS record added to zones without one */
+
+	n = dn_comp(config->myname, rdata, sizeof(rdata), (PUCHAR *) NULL,
+			(PUCHAR *) NULL);
+	if(n < 0) n = dn_comp("", rdata, sizeof(rdata), (PUCHAR *) NULL,
+			(PUCHAR *) NULL);
+	nsrr = (PRR) malloc(sizeof(RR) + n);
+	if(nsrr == (PRR) NULL) {
+		dolog("failed to allocate zone transfer information");
+		return(FALSE);
+	}
+	nsrr->next = (PRR) NULL;
+	nsrr->type = T_NS;
+	nsrr->class = C_IN;
+	nsrr->ttl = LOCAL_TTL;
+	nsrr->rdlength = (USHORT) n;
+	memcpy(nsrr->rdata, rdata, n);
+
+	return(TRUE);
+}
+
+
+/*
+ * Add a zone to the list, unless it is already there (two networks may
+ * have the same reverse domain).
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+static BOOL add_zone(PUCHAR name, PRR soa, BOOL network)
+{	PXFRZONE z, *pz;
+
+	for(pz = &zones; *pz != (PXFRZONE) NULL; pz = &(*pz)->next)
+		if(name_same((*pz)->name, name) == TRUE) return(TRUE);
+
+	z = (PXFRZONE) calloc(1, sizeof(XFRZONE));
+	if(z == (PXFRZONE) NULL) {
+		dolog("failed to allocate zone transfer information");
+		return(FALSE);
+	}
+	z->index = nzones++;
+	z->name = name;
+	z->len = strlen(name);
+	z->soa = soa;
+	z->network = network;
+	*pz = z;
+
+	return(TRUE);
+}
+
+
+/*
+ * Prepare the zones in a new version of the databases: add any missing
+ * SOA and NS records, set the serial numbers, and (if there are any
+ * replicas) build the transfer images and find the changes. Nothing is
+ * changed that transfers from the current version can see; that is done
+ * by 'xfr_commit' when the new version is published.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+BOOL xfr_prepare(PCONFIG config, PDBVERSION ver)
+{	PXFRZONE z;
+
+	if(config->replicas != (PREPLICA) NULL && nzones != 0) {
+		ver->images = (PXFRIMAGE) calloc(nzones, sizeof(XFRIMAGE));
+		if(ver->images == (PXFRIMAGE) NULL) {
+			dolog("failed to allocate zone transfer images");
+			return(FALSE);
+		}
+	}
+
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next) {
+		if(prepare_zone(z, ver) == FALSE) break;
+	}
+	if(z == (PXFRZONE) NULL) return(TRUE);
+
+	/* Failed; throw away everything done so far */
+
+	dolog("failed to allocate memory for zone transfers");
+	xfr_abort();
+
+	return(FALSE);
+}
+
+
+/*
+ * Throw away the prepared contents of the zones, and their changes, when
+ * a new version of the databases is not going to be published after all.
+ *
+ */
+
+VOID xfr_abort(VOID)
+{	PXFRZONE z;
+
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next) {
+		free_state(&z->loading);
+		free_delta(z->pending);
+		z->pending = (PDELTA) NULL;
+	}
+}
+
+
+/*
+ * Prepare one zone in a new version of the databases.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+static BOOL prepare_zone(PXFRZONE z, PDBVERSION ver)
+{	INT i, ndel, nadd;
+	ULONG loaded, now;
+	BOOL hasns = FALSE;
+	PZSTATE next = &z->loading;
+	PNAMENODE apex;
+	PRR rr, soa = (PRR) NULL;
+	PDELTA d;
+	PXBUF xb;
+	PXFRIMAGE img;
+	UCHAR logmsg[MAXLOG];
+
+	/* Make sure that the zone has SOA and NS records */
+
+	apex = db_add_name(ver->db, z->name);
+	if(apex == (PNAMENODE) NULL) return(FALSE);
+	for(rr = apex->rrs; rr != (PRR) NULL; rr = rr->next) {
+		if(rr->type == T_SOA && soa == (PRR) NULL) soa = rr;
+		if(rr->type == T_NS) hasns = TRUE;
+	}
+	if(soa == (PRR) NULL) {
+		soa = copy_rr(z->soa);
+		if(soa == (PRR) NULL ||
+		   db_add_rr(ver->db, z->name, soa) == FALSE) return(FALSE);
+	}
+	if(hasns == FALSE) {
+		rr = copy_rr(nsrr);
+		if(rr == (PRR) NULL ||
+		   db_add_rr(ver->db, z->name, rr) == FALSE) return(FALSE);
+	}
+
+	/* Collect the records, and compare them with the previous version */
+
+	next->filesoa = make_xrr(
+			z->name,
+			soa->type,
+			soa->class,
+			soa->ttl,
+			soa->rdata,
+			soa->rdlength);
+	if(next->filesoa == (PXRR) NULL) return(FALSE);
+	if(collect(z, ver->db, next) == FALSE) return(FALSE);
+
+	ndel = merge(&z->cur, next, (PXRR *) NULL);
+	nadd = merge(next, &z->cur, (PXRR *) NULL);
+	next->changed = z->cur.filesoa == (PXRR) NULL ||
+			ndel != 0 ||
+			nadd != 0 ||
+			xrr_compare(z->cur.filesoa, next->filesoa) != 0;
+
+	/* A new serial number is later than the old one, the time, and the
+	   one in the zone file. A secondary zone keeps the serial number
+	   given by its primary server. */
+
+	loaded = _getlong(soa->rdata + soa->rdlength - SOA_SERIAL_OFF);
+	next->serial = z->cur.serial;
+	if(z->secondary == TRUE) {
+		next->serial = loaded;
+	} else if(next->changed == TRUE) {
+		next->serial++;
+		now = (ULONG) time((time_t *) NULL);
+		if(now > next->serial) next->serial = now;
+		if(loaded > next->serial) next->serial = loaded;
+	}
+	putlong(next->serial, soa->rdata + soa->rdlength - SOA_SERIAL_OFF);
+	next->soa = make_xrr(
+			z->name,
+			soa->type,
+			soa->class,
+			soa->ttl,
+			soa->rdata,
+			soa->rdlength);
+	if(next->soa == (PXRR) NULL) return(FALSE);
+
+	if(next->changed == TRUE) {
+		if(z->cur.filesoa == (PXRR) NULL)
+			sprintf(
+				logmsg,
+				"zone %.100s: serial %lu, %d records",
+				z->name,
+				next->serial,
+				next->nrrs);
+		else
+			sprintf(
+				logmsg,
+				"zone %.100s: serial %lu, %d records, "
+				"%d added, %d deleted",
+				z->name,
+				next->serial,
+				next->nrrs,
+				nadd,
+				ndel);
+		dolog(logmsg);
+	}
+
+	if(ver->images == (PXFRIMAGE) NULL) return(TRUE);
+
+	/* Record the changes in the journal */
+
+	if(next->changed == TRUE && z->cur.soa != (PXRR) NULL) {
+		d = (PDELTA) calloc(1, sizeof(DELTA));
+		if(d == (PDELTA) NULL) return(FALSE);
+		z->pending = d;
+		d->oldserial = z->cur.serial;
+		d->newserial = next->serial;
+		d->oldsoa = dup_xrr(z->cur.soa);
+		d->newsoa = dup_xrr(next->soa);
+		d->rrs = (PXRR *) calloc(ndel + nadd + 1, sizeof(PXRR));
+		if(d->oldsoa == (PXRR) NULL ||
+		   d->newsoa == (PXRR) NULL ||
+		   d->rrs == (PXRR *) NULL) return(FALSE);
+		d->ndel = merge(&z->cur, next, d->rrs);
+		d->nadd = merge(next, &z->cur, d->rrs + d->ndel);
+		for(i = 0; i < d->ndel + d->nadd; i++)
+			if(d->rrs[i] == (PXRR) NULL) return(FALSE);
+	}
+
+	/* Build the image for an AXFR; the SOA record comes first and last */
+
+	xb = xb_new(z->name, T_AXFR);
+	if(xb == (PXBUF) NULL) return(FALSE);
+	if(xb_add(xb, next->soa) == TRUE) {
+		for(i = 0; i < next->nrrs; i++)
+			if(xb_add(xb, next->rrs[i]) == FALSE) break;
+	} else {
+		i = -1;
+	}
+	if(i != next->nrrs ||
+	   xb_add(xb, next->soa) == FALSE ||
+	   xb_end(xb) == FALSE) {
+		free(xb->out);
+		free(xb);
+		return(FALSE);
+	}
+
+	img = &ver->images[z->index];
+	img->serial = next->serial;
+	img->soa = dup_xrr(next->soa);
+	img->qtypeoff = xb->qtypeoff;
+	img->msgs = xb->out;
+	img->len = xb->outlen;
+	free(xb);
+
+	return(img->soa == (PXRR) NULL ? FALSE : TRUE);
+}
+
+
+/*
+ * Make the prepared contents of the zones current, and add any changes
+ * to the journals. This is called, with the version lock held, when a new
+ * version of the databases is published.
+ *
+ */
+
+VOID xfr_commit(PDBVERSION ver)
+{	INT n;
+	PXFRZONE z;
+	PDELTA d, *pd;
+
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next) {
+		if(z->loading.changed == TRUE) z->notify = TRUE;
+		free_state(&z->cur);
+		z->cur = z->loading;
+		memset((PUCHAR) &z->loading, 0, sizeof(ZSTATE));
+
+		if(z->pending == (PDELTA) NULL) continue;
+		z->pending->next = z->journal;
+		z->journal = z->pending;
+		z->pending = (PDELTA) NULL;
+
+		/* Drop the oldest changes if there are too many */
+
+		n = 0;
+		for(pd = &z->journal;
+		    *pd != (PDELTA) NULL && n < JOURNAL_SIZE;
+		    pd = &(*pd)->next)
+			n++;
+		while(*pd != (PDELTA) NULL) {
+			d = *pd;
+			*pd = d->next;
+			free_delta(d);
+		}
+	}
+}
+
+
+/*
+ * Free the zone transfer images belonging to a version of the databases.
+ *
+ */
+
+VOID xfr_free(PDBVERSION ver)
+{	INT i;
+
+	if(ver->images == (PXFRIMAGE) NULL) return;
+
+	for(i = 0; i < nzones; i++) {
+		free(ver->images[i].msgs);
+		free(ver->images[i].soa);
+	}
+	free(ver->images);
+}
+
+
+/*
+ * Collect the records in a zone, as it is in a database, sorted and with
+ * any duplicates removed. SOA records are left out.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+static BOOL collect(PXFRZONE z, PDB db, PZSTATE state)
+{	INT i, j, n, type;
+	PNAMENODE node;
+	PDBENT p;
+	PRR rr;
+	XLIST list;
+	UCHAR rdata[IN6ADDRSZ];
+	UCHAR cname[MAXCDNAME];
+	UCHAR name[MAXDNAME+1];
+	UCHAR pname[MAXDNAME+1];
+
+	list.n = list.size = 0;
+	list.rrs = (PXRR *) NULL;
+
+	/* Records from zone files (and the SOA and NS records added to
+	   them). Records hidden by entries from the HOSTS file are left
+	   out, as they are never given in answers. */
+
+	for(i = 0; i < db->hashsize; i++) {
+		for(node = db->hashtab[i];
+		    node != (PNAMENODE) NULL;
+		    node = node->hnext) {
+			if(node->rrs == (PRR) NULL) continue;
+			if(zone_of(db_node_name(node, name)) != z) continue;
+			for(rr = node->rrs; rr != (PRR) NULL; rr = rr->next) {
+				if(rr->type == T_SOA) continue;
+				if(hidden(node->entries, rr->type) == TRUE)
+					continue;
+				if(add_list(&list, make_xrr(
+						name,
+						rr->type,
+						rr->class,
+						rr->ttl,
+						rr->rdata,
+						rr->rdlength)) == FALSE)
+					break;
+			}
+			if(rr != (PRR) NULL) break;
+		}
+		if(node != (PNAMENODE) NULL) break;
+	}
+
+	/* Records from the HOSTS file */
+
+	for(p = db->head;
+	    p != (PDBENT) NULL && i == db->hashsize;
+	    p = p->next) {
+		if(zone_of(db_node_name(p->node, name)) != z) continue;
+		switch(p->type) {
+			case ENT_TYPE_PRIMARY:
+				type = T_A;
+				n = sizeof(INADDR);
+				memcpy(rdata, (PUCHAR) &p->address, n);
+				break;
+
+			case ENT_TYPE_PRIMARY6:
+				type = T_AAAA;
+				n = IN6ADDRSZ;
+				memcpy(rdata, p->address6, n);
+				break;
+
+			case ENT_TYPE_ALIAS:
+				type = T_CNAME;
+				n = dn_comp(
+					db_node_name(p->primary->node, pname),
+					cname,
+					sizeof(cname),
+					(PUCHAR *) NULL,
+					(PUCHAR *) NULL);
+				break;
+
+			default:
+				continue;
+		}
+		if(n < 0) continue;
+		if(add_list(&list, make_xrr(
+				name,
+				type,
+				C_IN,
+				LOCAL_TTL,
+				type == T_CNAME ? cname : rdata,
+				n)) == FALSE)
+			break;
+	}
+
+	if(i != db->hashsize ||
+	   p != (PDBENT) NULL ||
+	   (z->network == TRUE && collect_ptrs(z, db, &list) == FALSE)) {
+		for(i = 0; i < list.n; i++)
+			free(list.rrs[i]);
+		free(list.rrs);
+		return(FALSE);
+	}
+
+	/* Sort, and remove duplicates */
+
+	qsort(list.rrs, list.n, sizeof(PXRR), xrr_sort);
+	for(i = j = 0; i < list.n; i++) {
+		if(j > 0 && xrr_compare(list.rrs[i], list.rrs[j-1]) == 0)
+			free(list.rrs[i]);
+		else
+			list.rrs[j++] = list.rrs[i];
+	}
+
+	state->nrrs = j;
+	state->rrs = list.rrs;
+
+	return(TRUE);
+}
+
+
+/*
+ * Add PTR records for the addresses in the HOSTS file to the records for
+ * the reverse zone of a network. Where an address appears more than once,
+ * the name used is the one that a query would be answered with; this is
+ * the entry that comes first in the entry chain. Addresses with a PTR
+ * record in a zone file are left out, as that record is used instead.
+ *
+ * Returns TRUE if all went well, FALSE if memory ran out.
+ *
+ */
+
+static BOOL collect_ptrs(PXFRZONE z, PDB db, PXLIST list)
+{	INT i, n, seq;
+	BOOL ok = TRUE;
+	PDBENT p;
+	PPTRENT ptrs;
+	PAUTHNET an;
+	PNAMENODE node;
+	PRR rr;
+	INADDR addr;
+	UCHAR target[MAXCDNAME];
+	UCHAR name[MAXDNAME+1];
+	UCHAR hname[MAXDNAME+1];
+
+	n = 0;
+	for(p = db->head; p != (PDBENT) NULL; p = p->next)
+		if(p->type == ENT_TYPE_PRIMARY) n++;
+	ptrs = (PPTRENT) malloc((n + 1)*sizeof(PTRENT));
+	if(ptrs == (PPTRENT) NULL) return(FALSE);
+
+	n = seq = 0;
+	for(p = db->head; p != (PDBENT) NULL; p = p->next) {
+		if(p->type != ENT_TYPE_PRIMARY) continue;
+		ptrs[n].addr = ntohl(p->address.s_addr);
+		ptrs[n].seq = seq++;
+		ptrs[n++].entry = p;
+	}
+	qsort(ptrs, n, sizeof(PTRENT), ptr_sort);
+
+	for(i = 0; i < n && ok == TRUE; i++) {
+		if(i > 0 && ptrs[i].addr == ptrs[i-1].addr) continue;
+		addr.s_addr = htonl(ptrs[i].addr);
+		an = auth_find_network(xconfig, addr);
+		if(an == (PAUTHNET) NULL || name_same(an->revdomain, z->name) == FALSE)
+			continue;
+
+		sprintf(
+			name,
+			"%lu.%lu.%lu.%lu.in-addr.arpa",
+			ptrs[i].addr & 0xff,
+			(ptrs[i].addr >> 8) & 0xff,
+			(ptrs[i].addr >> 16) & 0xff,
+			(ptrs[i].addr >> 24) & 0xff);
+		node = db_find_node(db, name);
+		if(node != (PNAMENODE) NULL) {
+			for(rr = node->rrs; rr != (PRR) NULL; rr = rr->next)
+				if(rr->type == T_PTR) break;
+			if(rr != (PRR) NULL) continue;
+		}
+
+		seq = dn_comp(
+			db_node_name(ptrs[i].entry->node, hname),
+			target,
+			sizeof(target),
+			(PUCHAR *) NULL,
+			(PUCHAR *) NULL);
+		if(seq < 0) continue;
+		ok = add_list(list, make_xrr(
+				name,
+				T_PTR,
+				C_IN,
+				LOCAL_TTL,
+				target,
+				seq));
+	}
+
+	free(ptrs);
+
+	return(ok);
+}
+
+
+/*
+ * Decide whether a record from a zone file is hidden by the entries from
+ * the HOSTS file for the same name. An alias hides everything, and
+ * addresses hide addresses of the same type.
+ *
+ */
+
+static BOOL hidden(PDBENT entries, INT type)
+{	PDBENT p;
+
+	for(p = entries; p != (PDBENT) NULL; p = p->same) {
+		if(p->type == ENT_TYPE_ALIAS) return(TRUE);
+		if(p->type == ENT_TYPE_PRIMARY && type == T_A) return(TRUE);
+		if(p->type == ENT_TYPE_PRIMARY6 && type == T_AAAA) return(TRUE);
+	}
+
+	return(FALSE);
+}
+
+
+/*
+ * Find the zone that a name is in; this is the longest zone name that is
+ * a suffix of the name.
+ *
+ * Returns a pointer to the zone, or NULL if the name is in none of them.
+ *
+ */
+
+static PXFRZONE zone_of(PUCHAR name)
+{	INT n, len = strlen(name);
+	PXFRZONE z, best = (PXFRZONE) NULL;
+
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next) {
+		n = len - z->len;
+		if(n < 0 || (n > 0 && name[n-1] != '.')) continue;
+		if(name_same(name + n, z->name) == FALSE) continue;
+		if(best == (PXFRZONE) NULL || z->len > best->len) best = z;
+	}
+
+	return(best);
+}
+
+
+/*
+ * Find a zone by name.
+ *
+ * Returns a pointer to the zone, or NULL if there is no such zone.
+ *
+ */
+
+static PXFRZONE find_zone(PUCHAR name)
+{	PXFRZONE z;
+
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next)
+		if(name_same(z->name, name) == TRUE) break;
+
+	return(z);
+}
+
+
+/*
+ * Find the records that are in one zone state but not in another. Both
+ * lists are sorted, so this is a simple merge. If 'out' is not NULL,
+ * copies of the records are stored there.
+ *
+ * Returns the number of records found.
+ *
+ */
+
+static INT merge(PZSTATE a, PZSTATE b, PXRR *out)
+{	INT i = 0, j = 0, n = 0, c;
+
+	while(i < a->nrrs) {
+		c = j < b->nrrs ? xrr_compare(a->rrs[i], b->rrs[j]) : -1;
+		if(c > 0) {
+			j++;
+			continue;
+		}
+		if(c < 0) {
+			if(out != (PXRR *) NULL) out[n] = dup_xrr(a->rrs[i]);
+			n++;
+		} else {
+			j++;
+		}
+		i++;
+	}
+
+	return(n);
+}
+
+
+/*
+ * Build a record in transfer form.
+ *
+ * Returns a pointer to the record, or NULL if memory ran out or the name
+ * is malformed.
+ *
+ */
+
+static PXRR make_xrr(PUCHAR owner, INT type, INT class, ULONG ttl,
+			PUCHAR rdata, INT rdlength)
+{	INT n;
+	PXRR rr;
+	PUCHAR p;
+	UCHAR temp[MAXDNAME+1];
+	UCHAR wire[MAXCDNAME];
+
+	strncpy(temp, owner, MAXDNAME);
+	temp[MAXDNAME] = '\0';
+	name_lower(temp, strlen(temp));	/* So that names sort properly */
+	n = dn_comp(temp, wire, sizeof(wire), (PUCHAR *) NULL,
+			(PUCHAR *) NULL);
+	if(n < 0) return(PXRR) NULL;
+
+	rr = (PXRR) malloc(sizeof(XRR) + n + RRFIXEDSZ + rdlength);
+	if(rr == (PXRR) NULL) return(PXRR) NULL;
+	rr->len = (USHORT) (n + RRFIXEDSZ + rdlength);
+
+	p = rr->data;
+	memcpy(p, wire, n);
+	p += n;
+	putshort(type, p);
+	p += 2;
+	putshort(class, p);
+	p += 2;
+	putlong(ttl, p);
+	p += 4;
+	putshort(rdlength, p);
+	p += 2;
+	memcpy(p, rdata, rdlength);
+
+	return(rr);
+}
+
+
+/*
+ * Make a copy of a record in transfer form.
+ *
+ * Returns a pointer to the copy, or NULL if memory ran out.
+ *
+ */
+
+static PXRR dup_xrr(PXRR rr)
+{	PXRR p = (PXRR) malloc(sizeof(XRR) + rr->len);
+
+	if(p != (PXRR) NULL) memcpy((PUCHAR) p, (PUCHAR) rr, sizeof(XRR) + rr->len);
+
+	return(p);
+}
+
+
+/*
+ * Make a copy of a resource record.
+ *
+ * Returns a pointer to the copy, or NULL if memory ran out.
+ *
+ */
+
+static PRR copy_rr(PRR rr)
+{	PRR p = (PRR) malloc(sizeof(RR) + rr->rdlength);
+
+	if(p != (PRR) NULL) {
+		memcpy((PUCHAR) p, (PUCHAR) rr, sizeof(RR) + rr->rdlength);
+		p->next = (PRR) NULL;
+	}
+
+	return(p);
+}
+
+
+/*
+ * Add a record to a list, making more room if necessary. The record is
+ * passed straight from 'make_xrr', so it may be NULL.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL add_list(PXLIST list, PXRR rr)
+{	PXRR *p;
+
+	if(rr == (PXRR) NULL) return(FALSE);
+
+	if(list->n == list->size) {
+		list->size = list->size == 0 ? 256 : list->size*2;
+		p = (PXRR *) realloc(list->rrs, list->size*sizeof(PXRR));
+		if(p == (PXRR *) NULL) {
+			free(rr);
+			return(FALSE);
+		}
+		list->rrs = p;
+	}
+	list->rrs[list->n++] = rr;
+
+	return(TRUE);
+}
+
+
+/*
+ * Compare two records in transfer form; the order is not significant,
+ * as long as it is consistent.
+ *
+ */
+
+static INT xrr_compare(PXRR a, PXRR b)
+{	INT rc = memcmp(a->data, b->data, a->len < b->len ? a->len : b->len);
+
+	return(rc != 0 ? rc : (INT) a->len - (INT) b->len);
+}
+
+
+/*
+ * Comparison function for sorting records with 'qsort'.
+ *
+ */
+
+static INT xrr_sort(const VOID *a, const VOID *b)
+{	return(xrr_compare(*(PXRR *) a, *(PXRR *) b));
+}
+
+
+/*
+ * Comparison function for sorting addresses for a reverse zone with
+ * 'qsort'; entries for the same address are kept in chain order.
+ *
+ */
+
+static INT ptr_sort(const VOID *a, const VOID *b)
+{	PPTRENT pa = (PPTRENT) a;
+	PPTRENT pb = (PPTRENT) b;
+
+	if(pa->addr != pb->addr) return(pa->addr < pb->addr ? -1 : 1);
+
+	return(pa->seq - pb->seq);
+}
+
+
+/*
+ * Free the records held for a zone state.
+ *
+ */
+
+static VOID free_state(PZSTATE state)
+{	INT i;
+
+	for(i = 0; i < state->nrrs; i++)
+		free(state->rrs[i]);
+	free(state->rrs);
+	free(state->filesoa);
+	free(state->soa);
+	memset((PUCHAR) state, 0, sizeof(ZSTATE));
+}
+
+
+/*
+ * Free a set of changes.
+ *
+ */
+
+static VOID free_delta(PDELTA d)
+{	INT i;
+
+	if(d == (PDELTA) NULL) return;
+
+	if(d->rrs != (PXRR *) NULL) {
+		for(i = 0; i < d->ndel + d->nadd; i++)
+			free(d->rrs[i]);
+		free(d->rrs);
+	}
+	free(d->oldsoa);
+	free(d->newsoa);
+	free(d);
+}
+
+
+/*
+ * Start building a series of transfer messages. The question goes in the
+ * first message only.
+ *
+ *	qname	is the name for the question (the zone name)
+ *	qtype	is the type for the question
+ *
+ * Returns a pointer to the message buffer, or NULL if memory ran out.
+ *
+ */
+
+static PXBUF xb_new(PUCHAR qname, INT qtype)
+{	PXBUF xb = (PXBUF) calloc(1, sizeof(XBUF));
+
+	if(xb == (PXBUF) NULL) return(PXBUF) NULL;
+
+	xb->qname = qname;
+	xb->qtype = qtype;
+	xb_begin(xb);
+
+	return(xb);
+}
+
+
+/*
+ * Start a new transfer message.
+ *
+ */
+
+static VOID xb_begin(PXBUF xb)
+{	INT n;
+	HEADER *h = (HEADER *) xb->msg;
+
+	memset(xb->msg, 0, sizeof(HEADER));
+	h->qr = 1;			/* This is a response */
+	h->opcode = QUERY;
+	h->aa = 1;			/* Authoritative answer */
+
+	comp_init(&xb->comp, xb->msg, (PQNAME) NULL);
+	xb->rp = xb->msg + sizeof(HEADER);
+	xb->count = 0;
+
+	if(xb->outlen != 0) return;	/* Not the first message */
+
+	n = comp_name(&xb->comp, xb->qname, xb->rp, MAXCDNAME);
+	if(n < 0) return;
+	xb->rp += n;
+	xb->qtypeoff = xb->rp - xb->msg;
+	putshort(xb->qtype, xb->rp);
+	xb->rp += 2;
+	putshort(C_IN, xb->rp);
+	xb->rp += 2;
+	h->qdcount = htons(1);
+}
+
+
+/*
+ * Add a record to the transfer messages being built, starting a new
+ * message if the current one is full.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out or the record is
+ * malformed.
+ *
+ */
+
+static BOOL xb_add(PXBUF xb, PXRR rr)
+{	if(put_xrr(xb, rr) == TRUE) return(TRUE);
+	if(xb->count == 0) return(FALSE);	/* Will never fit */
+
+	if(xb_end(xb) == FALSE) return(FALSE);
+	xb_begin(xb);
+
+	return(put_xrr(xb, rr));
+}
+
+
+/*
+ * Finish the current transfer message, and add it (with its length) to
+ * the complete messages.
+ *
+ * Returns TRUE if successful, FALSE if memory ran out.
+ *
+ */
+
+static BOOL xb_end(PXBUF xb)
+{	ULONG len = xb->rp - xb->msg;
+	ULONG size;
+	PUCHAR p;
+	HEADER *h = (HEADER *) xb->msg;
+
+	h->ancount = htons(xb->count);
+
+	if(xb->outlen + len + 2 > xb->outsize) {
+		size = xb->outsize == 0 ? 4*XFR_MSGSIZE : xb->outsize*2;
+		p = (PUCHAR) realloc(xb->out, size);
+		if(p == (PUCHAR) NULL) return(FALSE);
+		xb->out = p;
+		xb->outsize = size;
+	}
+
+	putshort(len, xb->out + xb->outlen);
+	memcpy(xb->out + xb->outlen + 2, xb->msg, len);
+	xb->outlen += len + 2;
+
+	return(TRUE);
+}
+
+
+/*
+ * Write a record into the current transfer message, compressing names.
+ * The rules for which names in the RDATA may be compressed are the same
+ * as for answers to queries.
+ *
+ * Returns TRUE if the record was written, or FALSE if there was no room
+ * (or the record is malformed).
+ *
+ */
+
+static BOOL put_xrr(PXBUF xb, PXRR rr)
+{	INT i, n, prefix, names;
+	PUCHAR p, rp, lenp, start, rdp, rdend;
+	PUCHAR end = xb->msg + XFR_MSGSIZE;
+	UCHAR name[MAXDNAME+1];
+
+	n = dn_expand(rr->data, rr->data + rr->len, rr->data, name,
+			sizeof(name));
+	if(n < 0) return(FALSE);
+	p = rr->data + n;			/* Fixed part */
+	rdp = p + RRFIXEDSZ;
+	rdend = rdp + _getshort(p + RRFIXEDSZ - 2);
+
+	rp = xb->rp;
+	n = comp_name(&xb->comp, name, rp, end - rp);
+	if(n < 0) return(FALSE);
+	rp += n;
+	if(rp + RRFIXEDSZ > end) return(FALSE);
+	memcpy(rp, p, RRFIXEDSZ);		/* Type, class, TTL, length */
+	lenp = rp + RRFIXEDSZ - 2;
+	rp += RRFIXEDSZ;
+	start = rp;
+
+	rdata_names(_getshort(p), &prefix, &names);
+	if(rp + prefix > end) return(FALSE);
+	memcpy(rp, rdp, prefix);
+	rp += prefix;
+	rdp += prefix;
+
+	for(i = 0; i < names; i++) {
+		n = dn_expand(rr->data, rdend, rdp, name, sizeof(name));
+		if(n < 0) return(FALSE);
+		rdp += n;
+		n = comp_name(&xb->comp, name, rp, end - rp);
+		if(n < 0) return(FALSE);
+		rp += n;
+	}
+
+	n = rdend - rdp;			/* The rest, as it is */
+	if(rp + n > end) return(FALSE);
+	memcpy(rp, rdp, n);
+	rp += n;
+
+	putshort(rp - start, lenp);		/* Fill in RDLENGTH */
+	xb->rp = rp;
+	xb->count++;
+
+	return(TRUE);
+}
+
+
+/*
+ * Work out where the compressible names are in the RDATA of a record of
+ * the given type: after 'prefix' bytes, there are 'names' names.
+ *
+ */
+
+static VOID rdata_names(INT type, PINT prefix, PINT names)
+{	*prefix = 0;
+
+	switch(type) {
+		case T_NS:
+		case T_CNAME:
+		case T_PTR:
+			*names = 1;
+			break;
+
+		case T_MX:
+			*prefix = 2;	/* Preference */
+			*names = 1;
+			break;
+
+		case T_SOA:
+			*names = 2;
+			break;
+
+		default:
+			*names = 0;
+			break;
+	}
+}
+
+
+/*
+ * Start listening for zone transfer connections, if there are any
+ * replicas.
+ *
+ * Returns:
+ *	TRUE		listening, or not configured
+ *	FALSE		failed to start
+ *
+ */
+
+BOOL xfr_start(PCONFIG config)
+{	INT n, rc;
+	INT on = 1;
+	PREPLICA rp;
+	SOCK sa;
+	UCHAR logmsg[MAXLOG];
+
+	if(config->replicas == (PREPLICA) NULL) return(TRUE);
+
+	lsockno = socket(AF_INET, SOCK_STREAM, 0);
+	if(lsockno < 0) {
+		sprintf(
+			logmsg,
+			"failed to allocate zone transfer socket: rc = %d",
+			sock_errno());
+		dolog(logmsg);
+		return(FALSE);
+	}
+	setsockopt(lsockno, SOL_SOCKET, SO_REUSEADDR, (PCHAR) &on, sizeof(on));
+
+	memset((PUCHAR) &sa, 0, sizeof(SOCK));
+	sa.sin_family = AF_INET;
+	sa.sin_port = config->port;
+	sa.sin_addr.s_addr = INADDR_ANY;
+
+	rc = bind(lsockno, (PSOCKG) &sa, sizeof(SOCK));
+	if(rc == 0) rc = listen(lsockno, XFR_BACKLOG);
+	if(rc < 0) {
+		sprintf(
+			logmsg,
+			"failed to set up zone transfer socket: rc = %d",
+			sock_errno());
+		dolog(logmsg);
+		return(FALSE);
+	}
+
+	rc = _beginthread(listener, NULL, XFR_STACK, (PVOID) NULL);
+	if(rc == -1) {
+		dolog("failed to create zone transfer thread");
+		return(FALSE);
+	}
+
+	n = 0;
+	for(rp = config->replicas; rp != (PREPLICA) NULL; rp = rp->next)
+		n++;
+	sprintf(
+		logmsg,
+		"serving transfers of %d zone%s to %d replica%s",
+		nzones,
+		nzones == 1 ? "" : "s",
+		n,
+		n == 1 ? "" : "s");
+	dolog(logmsg);
+
+	return(TRUE);
+}
+
+
+/*
+ * The listening thread. Accepts connections from replicas, and starts a
+ * thread to serve each one. Connections from anywhere else are closed at
+ * once.
+ *
+ */
+
+static VOID listener(PVOID param)
+{	INT sockno, namelen, rc;
+	PREPLICA rp;
+	PXFRCONN conn;
+	SOCK sa;
+	UCHAR logmsg[MAXLOG];
+
+	for(;;) {
+		namelen = sizeof(SOCK);
+		sockno = accept(lsockno, (PSOCKG) &sa, &namelen);
+		if(sockno < 0) {
+			if(sock_errno() == SOCEINTR) continue;
+			sprintf(
+				logmsg,
+				"accept failed on zone transfer socket: rc = %d",
+				sock_errno());
+			dolog(logmsg);
+			DosSleep(1000);
+			continue;
+		}
+
+		for(rp = xconfig->replicas;
+		    rp != (PREPLICA) NULL;
+		    rp = rp->next)
+			if(rp->address.s_addr == sa.sin_addr.s_addr) break;
+		if(rp == (PREPLICA) NULL) {
+			sprintf(
+				logmsg,
+				"zone transfer connection from %s refused",
+				inet_ntoa(sa.sin_addr));
+			dolog(logmsg);
+			soclose(sockno);
+			continue;
+		}
+
+		conn = (PXFRCONN) malloc(sizeof(XFRCONN));
+		if(conn == (PXFRCONN) NULL) {
+			dolog("failed to allocate zone transfer connection");
+			soclose(sockno);
+			continue;
+		}
+		conn->sockno = sockno;
+		memcpy((PUCHAR) &conn->sa, (PUCHAR) &sa, sizeof(SOCK));
+
+		rc = _beginthread(serve_conn, NULL, XFR_STACK, (PVOID) conn);
+		if(rc == -1) {
+			dolog("failed to create zone transfer thread");
+			soclose(sockno);
+			free(conn);
+		}
+	}
+}
+
+
+/*
+ * Serve the requests on one zone transfer connection, until the replica
+ * closes it or goes quiet.
+ *
+ */
+
+static VOID serve_conn(PVOID param)
+{	PXFRCONN conn = (PXFRCONN) param;
+
+	while(get_request(conn) == TRUE) {
+		if(do_request(conn) == FALSE) break;
+	}
+
+	soclose(conn->sockno);
+	free(conn);
+}
+
+
+/*
+ * Read the next request on a connection. The message goes after the
+ * length field in the connection's frame buffer.
+ *
+ * Returns TRUE if a request was read, FALSE if the connection was closed,
+ * timed out, or sent something unreasonable.
+ *
+ */
+
+static BOOL get_request(PXFRCONN conn)
+{	if(recv_all(conn, conn->frame, 2) == FALSE) return(FALSE);
+	conn->len = _getshort(conn->frame);
+	if(conn->len < sizeof(HEADER) || conn->len > XFR_MSGSIZE)
+		return(FALSE);
+
+	return(recv_all(conn, conn->frame + 2, conn->len));
+}
+
+
+/*
+ * Answer one request on a connection. Only AXFR and IXFR queries for our
+ * own zones are accepted.
+ *
+ * Returns TRUE if the connection may be used again, FALSE if not.
+ *
+ */
+
+static BOOL do_request(PXFRCONN conn)
+{	INT n, qtype;
+	ULONG serial;
+	BOOL ok;
+	PUCHAR msg = conn->frame + 2;
+	PUCHAR end = msg + conn->len;
+	PUCHAR p;
+	HEADER *h = (HEADER *) msg;
+	PXFRZONE z;
+	PDBVERSION ver;
+	PXFRIMAGE img;
+	UCHAR id[2];
+	UCHAR name[MAXDNAME+1];
+
+	if(h->qr != 0 || h->opcode != QUERY || ntohs(h->qdcount) != 1)
+		return(send_error(conn, (PUCHAR) NULL, FORMERR));
+
+	n = dn_expand(msg, end, msg + sizeof(HEADER), name, sizeof(name));
+	p = msg + sizeof(HEADER) + n;
+	if(n < 0 || p + QFIXEDSZ > end)
+		return(send_error(conn, (PUCHAR) NULL, FORMERR));
+	qtype = _getshort(p);
+	p += QFIXEDSZ;
+
+	if(qtype != T_AXFR && qtype != T_IXFR)
+		return(send_error(conn, p, NOTIMP));
+
+	z = find_zone(name);
+	if(z == (PXFRZONE) NULL) {
+		sprintf(
+			conn->logmsg,
+			"zone transfer of %.100s for %s refused: "
+			"not one of our zones",
+			name,
+			inet_ntoa(conn->sa.sin_addr));
+		dolog(conn->logmsg);
+		return(send_error(conn, p, NOTAUTH));
+	}
+
+	if(qtype == T_IXFR && get_serial(msg, end, p, &serial) == FALSE)
+		return(send_error(conn, p, FORMERR));
+
+	memcpy(id, msg, 2);		/* The message is overwritten */
+
+	ver = version_get(xconfig);
+	img = &ver->images[z->index];
+	if(qtype == T_IXFR) {
+		ok = send_ixfr(conn, z, img, id, serial);
+	} else {
+		ok = send_msgs(conn, img->msgs, img->len, id, img->qtypeoff,
+				T_AXFR);
+		sprintf(
+			conn->logmsg,
+			"zone %.100s: AXFR to %s, serial %lu",
+			z->name,
+			inet_ntoa(conn->sa.sin_addr),
+			img->serial);
+	}
+	version_release(ver);
+
+	dolog(conn->logmsg);
+
+	return(ok);
+}
+
+
+/*
+ * Answer an IXFR request. If the replica is already up to date, the
+ * answer is just the SOA record. If the journal holds all the changes
+ * since the replica's serial number, they are sent; otherwise, the whole
+ * zone is.
+ *
+ *	conn	points to the connection information
+ *	z	points to the zone
+ *	img	points to the image of the zone in the version in use
+ *	id	is the message ID
+ *	serial	is the replica's serial number
+ *
+ * Returns TRUE if the answer was sent, FALSE if not.
+ *
+ */
+
+static BOOL send_ixfr(PXFRCONN conn, PXFRZONE z, PXFRIMAGE img, PUCHAR id,
+			ULONG serial)
+{	INT i, j, n;
+	BOOL ok, found = FALSE;
+	PDELTA d;
+	PXBUF xb;
+	PDELTA list[JOURNAL_SIZE];
+
+	/* Find the changes from the replica's serial number to that of
+	   this version; the journal may already have newer ones */
+
+	version_lock();
+	n = 0;
+	if(serial - img->serial >= 0x80000000UL) {	/* Replica is behind */
+		for(d = z->journal; d != (PDELTA) NULL; d = d->next) {
+			if(n == 0 && d->newserial != img->serial) continue;
+			list[n++] = d;
+			if(d->oldserial == serial) {
+				found = TRUE;
+				break;
+			}
+			if(n == JOURNAL_SIZE) break;
+		}
+	} else {
+		found = TRUE;		/* Up to date */
+	}
+
+	if(found == FALSE) {
+		version_unlock();
+		sprintf(
+			conn->logmsg,
+			"zone %.100s: IXFR to %s from serial %lu, "
+			"whole zone sent, serial %lu",
+			z->name,
+			inet_ntoa(conn->sa.sin_addr),
+			serial,
+			img->serial);
+		return(send_msgs(conn, img->msgs, img->len, id, img->qtypeoff,
+				T_IXFR));
+	}
+
+	/* Build the answer; the changes go oldest first, each as the old
+	   SOA record, the deleted records, the new SOA record, and the
+	   added records */
+
+	xb = xb_new(z->name, T_IXFR);
+	ok = xb != (PXBUF) NULL ? xb_add(xb, img->soa) : FALSE;
+	for(i = n - 1; i >= 0 && ok == TRUE; i--) {
+		d = list[i];
+		ok = xb_add(xb, d->oldsoa);
+		for(j = 0; j < d->ndel && ok == TRUE; j++)
+			ok = xb_add(xb, d->rrs[j]);
+		if(ok == TRUE) ok = xb_add(xb, d->newsoa);
+		for(j = d->ndel; j < d->ndel + d->nadd && ok == TRUE; j++)
+			ok = xb_add(xb, d->rrs[j]);
+	}
+	if(ok == TRUE && n != 0) ok = xb_add(xb, img->soa);
+	if(ok == TRUE) ok = xb_end(xb);
+	version_unlock();
+
+	if(ok == TRUE) {
+		sprintf(
+			conn->logmsg,
+			"zone %.100s: IXFR to %s from serial %lu, "
+			"%d change%s sent, serial %lu",
+			z->name,
+			inet_ntoa(conn->sa.sin_addr),
+			serial,
+			n,
+			n == 1 ? "" : "s",
+			img->serial);
+		ok = send_msgs(conn, xb->out, xb->outlen, id, xb->qtypeoff,
+				T_IXFR);
+	} else {
+		sprintf(
+			conn->logmsg,
+			"zone %.100s: IXFR to %s failed: out of memory",
+			z->name,
+			inet_ntoa(conn->sa.sin_addr));
+	}
+
+	if(xb != (PXBUF) NULL) {
+		free(xb->out);
+		free(xb);
+	}
+
+	return(ok);
+}
+
+
+/*
+ * Extract the serial number from the SOA record in the authority section
+ * of an IXFR request.
+ *
+ *	msg	points to the request
+ *	end	points just past the end of the request
+ *	p	points to the authority section
+ *	serial	points to where the serial number is to go
+ *
+ * Returns TRUE if successful, FALSE if the request is malformed.
+ *
+ */
+
+static BOOL get_serial(PUCHAR msg, PUCHAR end, PUCHAR p, PULONG serial)
+{	INT i, n;
+	HEADER *h = (HEADER *) msg;
+	UCHAR name[MAXDNAME+1];
+
+	if(ntohs(h->nscount) < 1) return(FALSE);
+
+	for(i = 0; i < 3; i++) {	/* Owner, MNAME, RNAME */
+		n = dn_expand(msg, end, p, name, sizeof(name));
+		if(n < 0) return(FALSE);
+		p += n;
+		if(i != 0) continue;
+		if(p + RRFIXEDSZ > end || _getshort(p) != T_SOA) return(FALSE);
+		p += RRFIXEDSZ;
+	}
+	if(p + 4 > end) return(FALSE);
+
+	*serial = _getlong(p);
+
+	return(TRUE);
+}
+
+
+/*
+ * Send a series of transfer messages, each preceded by its length. Each
+ * message is copied into the connection's frame buffer and given the ID
+ * of the request; the first also gets the query type.
+ *
+ * Returns TRUE if successful, FALSE if the connection failed.
+ *
+ */
+
+static BOOL send_msgs(PXFRCONN conn, PUCHAR msgs, ULONG len, PUCHAR id,
+			INT qtypeoff, INT qtype)
+{	INT n;
+	PUCHAR p;
+
+	for(p = msgs; p < msgs + len; p += n + 2) {
+		n = _getshort(p);
+		memcpy(conn->frame, p, n + 2);
+		memcpy(conn->frame + 2, id, 2);
+		if(p == msgs) putshort(qtype, conn->frame + 2 + qtypeoff);
+		if(send_all(conn, conn->frame, n + 2) == FALSE) return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Send an error response to a request. The question is copied if 'qend'
+ * (the end of the question) is not NULL.
+ *
+ * Returns TRUE if the connection may be used again, FALSE if not.
+ *
+ */
+
+static BOOL send_error(PXFRCONN conn, PUCHAR qend, INT rcode)
+{	INT len;
+	HEADER *h = (HEADER *) (conn->frame + 2);
+
+	h->qr = 1;			/* This is a response */
+	h->rcode = rcode;
+	h->ancount = h->nscount = h->arcount = 0;
+	if(qend == (PUCHAR) NULL) {
+		h->qdcount = 0;
+		len = sizeof(HEADER);
+	} else {
+		len = qend - (PUCHAR) h;
+	}
+	putshort(len, conn->frame);
+
+	if(send_all(conn, conn->frame, len + 2) == FALSE) return(FALSE);
+
+	return(rcode == FORMERR ? FALSE : TRUE);
+}
+
+
+/*
+ * Read a given number of bytes from a connection.
+ *
+ * Returns TRUE if successful, FALSE if the connection was closed, failed,
+ * or was idle for more than XFR_TIMEOUT seconds.
+ *
+ */
+
+static BOOL recv_all(PXFRCONN conn, PUCHAR p, INT n)
+{	INT rc;
+	INT sockset[1];
+
+	while(n > 0) {
+		sockset[0] = conn->sockno;
+		rc = select(sockset, 1, 0, 0, XFR_TIMEOUT*1000L);
+		if(rc <= 0) return(FALSE);
+		rc = recv(conn->sockno, p, n, 0);
+		if(rc <= 0) return(FALSE);
+		p += rc;
+		n -= rc;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Send a given number of bytes on a connection.
+ *
+ * Returns TRUE if successful, FALSE if the connection failed, or the
+ * other end stopped accepting data for more than XFR_TIMEOUT seconds.
+ *
+ */
+
+static BOOL send_all(PXFRCONN conn, PUCHAR p, INT n)
+{	INT rc;
+	INT sockset[1];
+
+	while(n > 0) {
+		sockset[0] = conn->sockno;
+		rc = select(sockset, 0, 1, 0, XFR_TIMEOUT*1000L);
+		if(rc <= 0) return(FALSE);
+		rc = send(conn->sockno, p, n, 0);
+		if(rc <= 0) return(FALSE);
+		p += rc;
+		n -= rc;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Send NOTIFY messages to the replicas for any zones that have changed.
+ * This is done by a separate thread, so that loading is not held up.
+ *
+ */
+
+VOID xfr_notify(PCONFIG config)
+{	INT n, rc;
+	PXFRZONE z;
+	PNOTIFYJOB job;
+
+	if(config->replicas == (PREPLICA) NULL) return;
+
+	n = 0;
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next)
+		if(z->notify == TRUE) n++;
+	if(n == 0) return;
+
+	job = (PNOTIFYJOB) malloc(sizeof(NOTIFYJOB) + n*sizeof(PXFRZONE));
+	if(job == (PNOTIFYJOB) NULL) {
+		dolog("failed to allocate NOTIFY information");
+		return;
+	}
+	job->nzones = 0;
+	for(z = zones; z != (PXFRZONE) NULL; z = z->next) {
+		if(z->notify == FALSE) continue;
+		job->zones[job->nzones++] = z;
+		z->notify = FALSE;
+	}
+
+	rc = _beginthread(notifier, NULL, XFR_STACK, (PVOID) job);
+	if(rc == -1) {
+		dolog("failed to create NOTIFY thread");
+		free(job);
+	}
+}
+
+
+/*
+ * The NOTIFY thread. Sends a NOTIFY for each changed zone to each replica,
+ * all at once, and collects the replies. Any that are not answered within
+ * NOTIFY_TIMEOUT seconds are sent again, up to NOTIFY_RETRIES times in
+ * all.
+ *
+ */
+
+static VOID notifier(PVOID param)
+{	INT i, n, nreps, npend, tries, rc, len, namelen, sockno;
+	USHORT base;
+	PNOTIFYJOB job = (PNOTIFYJOB) param;
+	PREPLICA rp;
+	PREPLICA *reps;
+	PUCHAR done, p;
+	HEADER *h;
+	SOCK sa;
+	INT sockset[1];
+	UCHAR pkt[PACKETSZ];
+	UCHAR logmsg[MAXLOG];
+
+	nreps = 0;
+	for(rp = xconfig->replicas; rp != (PREPLICA) NULL; rp = rp->next)
+		nreps++;
+	n = job->nzones*nreps;
+
+	reps = (PREPLICA *) malloc(nreps*sizeof(PREPLICA));
+	done = (PUCHAR) calloc(n, 1);
+	sockno = socket(AF_INET, SOCK_DGRAM, 0);
+	if(reps == (PREPLICA *) NULL || done == (PUCHAR) NULL || sockno < 0) {
+		dolog("failed to set up for sending NOTIFY");
+		if(sockno >= 0) soclose(sockno);
+		free(reps);
+		free(done);
+		free(job);
+		return;
+	}
+	nreps = 0;
+	for(rp = xconfig->replicas; rp != (PREPLICA) NULL; rp = rp->next)
+		reps[nreps++] = rp;
+
+	/* Message 'i' is for zone 'i/nreps' and replica 'i%nreps', and has
+	   ID 'base+i' */
+
+	base = (USHORT) time((time_t *) NULL);
+	npend = n;
+	for(tries = 0; tries < NOTIFY_RETRIES && npend > 0; tries++) {
+		for(i = 0; i < n; i++) {
+			if(done[i] != 0) continue;
+			memset(pkt, 0, sizeof(HEADER));
+			h = (HEADER *) pkt;
+			h->id = htons((USHORT) (base + i));
+			h->opcode = NS_NOTIFY_OP;
+			h->aa = 1;
+			h->qdcount = htons(1);
+			p = pkt + sizeof(HEADER);
+			len = dn_comp(job->zones[i/nreps]->name, p, MAXCDNAME,
+					(PUCHAR *) NULL, (PUCHAR *) NULL);
+			if(len < 0) continue;
+			p += len;
+			putshort(T_SOA, p);
+			p += 2;
+			putshort(C_IN, p);
+			p += 2;
+
+			memset((PUCHAR) &sa, 0, sizeof(SOCK));
+			sa.sin_family = AF_INET;
+			sa.sin_port = xconfig->nsport;
+			sa.sin_addr = reps[i%nreps]->address;
+			(VOID) sendto(sockno, pkt, p - pkt, 0, (PSOCKG) &sa,
+					sizeof(SOCK));
+		}
+
+		/* Collect replies until none arrive for a while */
+
+		while(npend > 0) {
+			sockset[0] = sockno;
+			rc = select(sockset, 1, 0, 0, NOTIFY_TIMEOUT*1000L);
+			if(rc <= 0) break;
+			namelen = sizeof(SOCK);
+			len = recvfrom(sockno, pkt, sizeof(pkt), 0, (PSOCKG) &sa,
+					&namelen);
+			if(len < 0 || len < sizeof(HEADER)) continue;
+			h = (HEADER *) pkt;
+			i = (USHORT) (ntohs(h->id) - base);
+			if(h->qr == 0 || h->opcode != NS_NOTIFY_OP || i >= n ||
+			   done[i] != 0 ||
+			   sa.sin_addr.s_addr != reps[i%nreps]->address.s_addr)
+				continue;
+			done[i] = 1;
+			npend--;
+		}
+	}
+
+	for(i = 0; i < n; i++) {
+		if(done[i] != 0) continue;
+		sprintf(
+			logmsg,
+			"zone %.100s: NOTIFY not answered by %s",
+			job->zones[i/nreps]->name,
+			inet_ntoa(reps[i%nreps]->address));
+		dolog(logmsg);
+	}
+#ifdef	DEBUG
+	trace("NOTIFY sent for %d zones, %d not answered", job->nzones, npend);
+#endif
+
+	soclose(sockno);
+	free(reps);
+	free(done);
+	free(job);
+}
+
+/*
+ * End of file: xfr.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,667 @@
+/*
+ * File: zone.c
+ *
+ * Name server for OS/2.
+ *
+ * Zone (master) file loader.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * Master files are in the standard format described in RFC 1035,
+ * section 5. The $ORIGIN and $TTL directives are supported, as are
+ * parentheses, comments, quoted strings, and TTL values with unit
+ * suffixes (e.g. 1h30m). $INCLUDE is not supported.
+ *
+ * Only the IN class is supported. Records are converted to wire format as
+ * they are read, and added to the in-memory database against their owner
+ * names.
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include "named.h"
+#include "log.h"
+
+#define	MAXZLINE	512		/* Maximum length of a physical line */
+#define	MAXTOKENS	64		/* Maximum tokens in a logical line */
+#define	TOKBUFSZ	4096		/* Size of token text buffer */
+#define	MAXTTL		0x7FFFFFFFUL	/* Largest time value (RFC 2181) */
+
+/* Type definitions */
+
+typedef struct _ZLINE {			/* A logical line of a master file */
+BOOL		inherit;		/* Owner is same as previous line */
+INT		ntokens;		/* Number of tokens */
+PUCHAR		tokens[MAXTOKENS];	/* The tokens */
+UCHAR		buf[TOKBUFSZ];		/* Text of the tokens */
+} ZLINE, *PZLINE;
+
+/* Forward references */
+
+static	BOOL	get_line(FILE *, PZLINE);
+static	BOOL	get_number(PUCHAR, PULONG);
+static	BOOL	get_ttl(PUCHAR, PULONG);
+static	INT	get_type(PUCHAR);
+static	BOOL	load_file(PDB, PZONEFILE);
+static	BOOL	make_name(PUCHAR, PUCHAR, PUCHAR);
+static	VOID	process_record(PDB, PZLINE);
+static	INT	put_name(PUCHAR, PUCHAR, INT);
+static	INT	put_string(PUCHAR, PUCHAR, INT);
+static	VOID	zone_error(PUCHAR, ...);
+
+/* Table of supported record types */
+
+static	struct {
+	PUCHAR	name;			/* Type mnemonic */
+	INT	type;			/* Type code */
+} typetab[] = {
+	{ "A",		T_A },
+	{ "NS",		T_NS },
+	{ "CNAME",	T_CNAME },
+	{ "SOA",	T_SOA },
+	{ "PTR",	T_PTR },
+	{ "HINFO",	T_HINFO },
+	{ "MX",		T_MX },
+	{ "TXT",	T_TXT },
+	{ "AAAA",	T_AAAA },
+	{ "SRV",	T_SRV },
+	{ "",		0 }		/* End of table marker */
+};
+
+/* Local storage (only used while loading; loads never overlap) */
+
+static	PUCHAR	zfile;			/* Name of file being read */
+static	INT	zline;			/* Current line number */
+static	INT	zerrors;		/* Errors in this file */
+static	UCHAR	origin[MAXDNAME+1];	/* Current origin */
+static	UCHAR	owner[MAXDNAME+1];	/* Current owner name */
+static	ULONG	defttl;			/* Current default TTL */
+
+
+/*
+ * Load a chain of zone files into an in-memory database.
+ *
+ * Returns TRUE if all the files were loaded without error; FALSE
+ * otherwise. Any error messages have already been logged.
+ *
+ */
+
+BOOL zone_load(PDB db, PZONEFILE zonefiles)
+{	PZONEFILE zf;
+	BOOL ok = TRUE;
+
+	for(zf = zonefiles; zf != (PZONEFILE) NULL; zf = zf->next) {
+		if(load_file(db, zf) == FALSE) ok = FALSE;
+	}
+
+	return(ok);
+}
+
+
+/*
+ * Load one zone file.
+ *
+ * Returns TRUE if the file was loaded without error, otherwise FALSE.
+ *
+ */
+
+static BOOL load_file(PDB db, PZONEFILE zf)
+{	FILE *fp;
+	PZLINE zl;
+	INT nrecs = 0;
+	UCHAR logmsg[MAXLOG];
+
+	zfile = zf->filename;
+	zline = 0;
+	zerrors = 0;
+	strcpy(origin, zf->origin);
+	strcpy(owner, origin);
+	defttl = LOCAL_TTL;
+
+	fp = fopen(zfile, "r");
+	if(fp == (FILE *) NULL) {
+		zone_error("cannot open file");
+		return(FALSE);
+	}
+
+	zl = (PZLINE) malloc(sizeof(ZLINE));
+	if(zl == (PZLINE) NULL) {
+		zone_error("cannot allocate memory");
+		fclose(fp);
+		return(FALSE);
+	}
+
+	while(get_line(fp, zl) == TRUE) {
+		if(zl->ntokens == 0) continue;
+		if(zl->tokens[0][0] != '$') nrecs++;
+		process_record(db, zl);
+	}
+
+	free(zl);
+	fclose(fp);
+
+	sprintf(
+		logmsg,
+		"zone %.60s: %d record%s read from %.60s, %d error%s",
+		zf->origin,
+		nrecs,
+		nrecs == 1 ? "" : "s",
+		zfile,
+		zerrors,
+		zerrors == 1 ? "" : "s");
+	dolog(logmsg);
+
+	return(zerrors == 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Read one logical line from a master file, and split it into tokens.
+ * A logical line may extend over several physical lines if there are
+ * parentheses. Comments are removed, and quoted strings are returned
+ * as single tokens (with the quotes removed).
+ *
+ * Returns TRUE if a line was read, or FALSE at end of file.
+ *
+ */
+
+static BOOL get_line(FILE *fp, PZLINE zl)
+{	PUCHAR p, q;
+	INT parens = 0;
+	BOOL first = TRUE;
+	UCHAR line[MAXZLINE];
+
+	zl->ntokens = 0;
+	zl->inherit = FALSE;
+	q = zl->buf;
+
+	do {
+		if(fgets(line, sizeof(line), fp) == NULL)
+			return(first == TRUE ? FALSE : TRUE);
+		zline++;
+		if(first == TRUE) {
+			zl->inherit = (line[0] == ' ' || line[0] == '\t');
+			first = FALSE;
+		}
+
+		p = line;
+		for(;;) {
+			while(*p == ' ' || *p == '\t' ||
+			      *p == '\r' || *p == '\n') p++;
+			if(*p == '\0' || *p == ';') break;
+
+			if(*p == '(') { parens++; p++; continue; }
+			if(*p == ')') { parens--; p++; continue; }
+
+			if(zl->ntokens >= MAXTOKENS ||
+			   q + MAXZLINE > zl->buf + TOKBUFSZ) {
+				zone_error("line too long");
+				zl->ntokens = 0;
+				return(TRUE);
+			}
+			zl->tokens[zl->ntokens++] = q;
+
+			if(*p == '"') {		/* Quoted string */
+				p++;
+				while(*p != '"' && *p != '\0' && *p != '\n') {
+					if(*p == '\\' && p[1] != '\0') p++;
+					*q++ = *p++;
+				}
+				if(*p == '"') p++;
+			} else {
+				while(*p != '\0' && strchr(" \t\r\n;()", *p) == NULL)
+					*q++ = *p++;
+			}
+			*q++ = '\0';
+		}
+	} while(parens > 0);
+
+	return(TRUE);
+}
+
+
+/*
+ * Process one logical line from a master file; either a directive or
+ * a resource record.
+ *
+ */
+
+static VOID process_record(PDB db, PZLINE zl)
+{	INT i, n, len, type;
+	ULONG ttl, num;
+	BOOL ttl_seen = FALSE;
+	BOOL class_seen = FALSE;
+	PUCHAR p, tok, tname;
+	PRR rr;
+	UCHAR temp[MAXDNAME+1];
+	UCHAR rdata[PACKETSZ];
+
+	i = 0;
+
+	/* Directives */
+
+	tok = zl->tokens[0];
+	if(zl->inherit == FALSE && tok[0] == '$') {
+		if(stricmp(tok, "$ORIGIN") == 0) {
+			if(zl->ntokens != 2 ||
+			   make_name(zl->tokens[1], origin, temp) == FALSE) {
+				zone_error("malformed $ORIGIN directive");
+				return;
+			}
+			strcpy(origin, temp);
+		} else if(stricmp(tok, "$TTL") == 0) {
+			if(zl->ntokens != 2 ||
+			   get_ttl(zl->tokens[1], &defttl) == FALSE) {
+				zone_error("malformed $TTL directive");
+				return;
+			}
+		} else {
+			zone_error("unsupported directive '%.60s'", tok);
+		}
+		return;
+	}
+
+	/* Owner name */
+
+	if(zl->inherit == FALSE) {
+		if(make_name(zl->tokens[i++], origin, owner) == FALSE) {
+			zone_error("malformed owner name");
+			return;
+		}
+	}
+
+	/* TTL and class may appear in either order, and are optional */
+
+	ttl = defttl;
+	for(; i < zl->ntokens; i++) {
+		tok = zl->tokens[i];
+		if(ttl_seen == FALSE && isdigit(tok[0])) {
+			if(get_ttl(tok, &ttl) == FALSE) {
+				zone_error("malformed TTL '%.60s'", tok);
+				return;
+			}
+			ttl_seen = TRUE;
+		} else if(class_seen == FALSE && stricmp(tok, "IN") == 0) {
+			class_seen = TRUE;
+		} else break;
+	}
+
+	if(i >= zl->ntokens) {
+		zone_error("missing record type");
+		return;
+	}
+	tname = zl->tokens[i++];
+	type = get_type(tname);
+	if(type == 0) {
+		zone_error("unsupported record type '%.60s'", tname);
+		return;
+	}
+
+	/* Check that the owner is in the zone */
+
+	n = strlen(owner) - strlen(origin);
+	if(origin[0] != '\0' &&
+	   (n < 0 ||
+	    stricmp(&owner[n], origin) != 0 ||
+	    (n > 0 && owner[n-1] != '.'))) {
+		zone_error("owner '%.60s' is outside the zone", owner);
+		return;
+	}
+
+	/* Now build the RDATA */
+
+	len = 0;
+	p = rdata;
+
+#define	NEED(k)	if(zl->ntokens - i != (k)) goto bad_rdata
+
+	switch(type) {
+		case T_A:
+			NEED(1);
+			num = inet_addr(zl->tokens[i]);
+			if(num == INADDR_NONE &&
+			   strcmp(zl->tokens[i], "255.255.255.255") != 0)
+				goto bad_rdata;
+			memcpy(p, (PUCHAR) &num, 4);	/* Network order */
+			len = 4;
+			break;
+
+		case T_AAAA:
+			NEED(1);
+			if(inet6_aton(zl->tokens[i], p) == FALSE)
+				goto bad_rdata;
+			len = 16;
+			break;
+
+		case T_NS:
+		case T_CNAME:
+		case T_PTR:
+			NEED(1);
+			len = put_name(zl->tokens[i], p, sizeof(rdata));
+			if(len < 0) goto bad_rdata;
+			break;
+
+		case T_MX:
+			NEED(2);
+			if(get_number(zl->tokens[i], &num) == FALSE ||
+			   num > 0xffff) goto bad_rdata;
+			putshort((USHORT) num, p);
+			n = put_name(zl->tokens[i+1], p+2, sizeof(rdata)-2);
+			if(n < 0) goto bad_rdata;
+			len = 2 + n;
+			break;
+
+		case T_SRV:
+			NEED(4);
+			for(n = 0; n < 3; n++) {
+				if(get_number(zl->tokens[i+n], &num) == FALSE ||
+				   num > 0xffff) goto bad_rdata;
+				putshort((USHORT) num, p + 2*n);
+			}
+			n = put_name(zl->tokens[i+3], p+6, sizeof(rdata)-6);
+			if(n < 0) goto bad_rdata;
+			len = 6 + n;
+			break;
+
+		case T_SOA:
+			NEED(7);
+			n = put_name(zl->tokens[i], p, sizeof(rdata));
+			if(n < 0) goto bad_rdata;
+			len = n;
+			n = put_name(zl->tokens[i+1], p+len, sizeof(rdata)-len);
+			if(n < 0) goto bad_rdata;
+			len += n;
+			for(n = 2; n < 7; n++) {
+				if((n == 2 ?			/* Serial */
+				    get_number(zl->tokens[i+n], &num) :
+				    get_ttl(zl->tokens[i+n], &num)) == FALSE)
+					goto bad_rdata;
+				putlong(num, p+len);
+				len += 4;
+			}
+			break;
+
+		case T_HINFO:
+			NEED(2);
+			/* Fall through */
+
+		case T_TXT:
+			if(zl->ntokens - i < 1) goto bad_rdata;
+			for(; i < zl->ntokens; i++) {
+				n = put_string(
+					zl->tokens[i],
+					p+len,
+					sizeof(rdata)-len);
+				if(n < 0) goto bad_rdata;
+				len += n;
+			}
+			break;
+	}
+
+#undef	NEED
+
+	rr = (PRR) malloc(sizeof(RR) + len);
+	if(rr == (PRR) NULL) {
+		zone_error("cannot allocate memory");
+		return;
+	}
+	rr->type = type;
+	rr->class = C_IN;
+	rr->ttl = ttl;
+	rr->rdlength = len;
+	memcpy(rr->rdata, rdata, len);
+
+	if(db_add_rr(db, owner, rr) == FALSE) {
+		zone_error("cannot allocate memory");
+		free(rr);
+	}
+	return;
+
+bad_rdata:
+	zone_error("malformed data for %.20s record", tname);
+}
+
+
+/*
+ * Convert a name in a master file into a full domain name (without a
+ * trailing dot), using 'org' as the origin for relative names.
+ *
+ * Returns TRUE if successful, FALSE if the name is too long or has an
+ * empty or overlong label.
+ *
+ */
+
+static BOOL make_name(PUCHAR name, PUCHAR org, PUCHAR result)
+{	INT len = strlen(name);
+
+	if(strcmp(name, "@") == 0) {
+		strcpy(result, org);
+		return(TRUE);
+	}
+
+	if(len > 0 && name[len-1] == '.') {	/* Absolute */
+		if(len > MAXDNAME) return(FALSE);
+		strcpy(result, name);
+		result[len-1] = '\0';
+		return(db_check_name(result));
+	}
+
+	if(len + 1 + strlen(org) > MAXDNAME) return(FALSE);
+	strcpy(result, name);
+	if(org[0] != '\0') {
+		strcat(result, ".");
+		strcat(result, org);
+	}
+
+	return(db_check_name(result));
+}
+
+
+/*
+ * Store a name from a master file in uncompressed wire format.
+ *
+ * Returns the number of bytes stored, or -1 on error.
+ *
+ */
+
+static INT put_name(PUCHAR name, PUCHAR p, INT space)
+{	UCHAR temp[MAXDNAME+1];
+
+	if(make_name(name, origin, temp) == FALSE) return(-1);
+
+	return(dn_comp(temp, p, space, (PUCHAR *) NULL, (PUCHAR *) NULL));
+}
+
+
+/*
+ * Store a character string (as in TXT or HINFO records).
+ *
+ * Returns the number of bytes stored, or -1 on error.
+ *
+ */
+
+static INT put_string(PUCHAR s, PUCHAR p, INT space)
+{	INT len = strlen(s);
+
+	if(len > 255 || len + 1 > space) return(-1);
+	*p++ = (UCHAR) len;
+	memcpy(p, s, len);
+
+	return(len + 1);
+}
+
+
+/*
+ * Convert an unsigned decimal number.
+ *
+ * Returns TRUE if successful, otherwise FALSE.
+ *
+ */
+
+static BOOL get_number(PUCHAR s, PULONG result)
+{	ULONG n = 0;
+
+	if(*s == '\0') return(FALSE);
+	while(*s != '\0') {
+		if(!isdigit(*s)) return(FALSE);
+		if(n > (0xFFFFFFFFUL - (*s - '0'))/10) return(FALSE);
+		n = n*10 + (*s++ - '0');
+	}
+	*result = n;
+
+	return(TRUE);
+}
+
+
+/*
+ * Convert a TTL or other time value. This may be a plain number of
+ * seconds, or a sequence of numbers each followed by a unit (s, m, h, d
+ * or w) as in '1h30m'. The value must not be more than MAXTTL.
+ *
+ * Returns TRUE if successful, otherwise FALSE.
+ *
+ */
+
+static BOOL get_ttl(PUCHAR s, PULONG result)
+{	ULONG n, unit, total = 0;
+
+	if(!isdigit(*s)) return(FALSE);
+
+	while(*s != '\0') {
+		if(!isdigit(*s)) return(FALSE);
+		for(n = 0; isdigit(*s); s++) {
+			if(n > (MAXTTL - (*s - '0'))/10) return(FALSE);
+			n = n*10 + (*s - '0');
+		}
+		switch(tolower(*s)) {
+			case '\0':		unit = 1; break;
+			case 's':		unit = 1; s++; break;
+			case 'm':		unit = 60; s++; break;
+			case 'h':		unit = 3600; s++; break;
+			case 'd':		unit = 86400; s++; break;
+			case 'w':		unit = 604800; s++; break;
+			default:		return(FALSE);
+		}
+		if(n > MAXTTL/unit || n*unit > MAXTTL - total) return(FALSE);
+		total += n*unit;
+	}
+	*result = total;
+
+	return(TRUE);
+}
+
+
+/*
+ * Look up a record type mnemonic.
+ *
+ * Returns the type code, or zero if it is not supported.
+ *
+ */
+
+static INT get_type(PUCHAR s)
+{	INT i;
+
+	for(i = 0; typetab[i].type != 0; i++)
+		if(stricmp(s, typetab[i].name) == 0) break;
+
+	return(typetab[i].type);
+}
+
+
+/*
+ * Convert a textual IPv6 address, in any of the forms described in
+ * RFC 4291, to its 16 byte binary form.
+ *
+ * Returns TRUE if successful, otherwise FALSE.
+ *
+ */
+
+BOOL inet6_aton(PUCHAR s, PUCHAR addr)
+{	INT i, n, gap = -1;
+	ULONG v4;
+	UCHAR temp[16];
+	PUCHAR p;
+
+	memset(temp, 0, sizeof(temp));
+	n = 0;					/* Bytes stored so far */
+
+	if(s[0] == ':') {
+		if(s[1] != ':') return(FALSE);
+		s++;				/* Leading '::' */
+	}
+
+	while(*s != '\0') {
+		if(*s == ':') {			/* '::' */
+			if(gap >= 0) return(FALSE);
+			gap = n;
+			s++;
+			continue;
+		}
+
+		/* Check for a trailing dotted quad */
+
+		for(p = s; isxdigit(*p); p++) ;
+		if(*p == '.') {
+			if(n > 12) return(FALSE);
+			v4 = inet_addr(s);
+			if(v4 == INADDR_NONE &&
+			   strcmp(s, "255.255.255.255") != 0) return(FALSE);
+			memcpy(&temp[n], (PUCHAR) &v4, 4);
+			n += 4;
+			break;
+		}
+
+		if(p == s || p - s > 4 || n > 14) return(FALSE);
+		for(i = 0; s < p; s++)
+			i = i*16 + (isdigit(*s) ? *s - '0' : tolower(*s) - 'a' + 10);
+		temp[n++] = (UCHAR) (i >> 8);
+		temp[n++] = (UCHAR) i;
+
+		if(*s == ':') {
+			s++;
+			if(*s == '\0') return(FALSE);	/* Trailing ':' */
+		}
+	}
+
+	if(gap >= 0) {				/* Expand the '::' */
+		i = 16 - n;
+		memmove(&temp[gap+i], &temp[gap], n - gap);
+		memset(&temp[gap], 0, i);
+	} else if(n != 16) return(FALSE);
+
+	memcpy(addr, temp, 16);
+
+	return(TRUE);
+}
+
+
+/*
+ * Log an error in a zone file, in printf style, with the file name and
+ * line number. Text taken from the file must be given a precision
+ * (e.g. '%.60s'), so that the message cannot be longer than MAXLOG.
+ *
+ */
+
+static VOID zone_error(PUCHAR mes, ...)
+{	va_list ap;
+	UCHAR buf[MAXLOG];
+	UCHAR logmsg[MAXLOG];
+
+	va_start(ap, mes);
+	vsprintf(buf, mes, ap);
+	va_end(ap);
+
+	sprintf(logmsg, "zone file %.60s: line %d: %.100s", zfile, zline, buf);
+	dolog(logmsg);
+	zerrors++;
+}
+
+/*
+ * End of file: zone.c
+ *
+ */
+
\ No newline at end of file
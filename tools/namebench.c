@@ -0,0 +1,387 @@
+/*
+ * File: namebench.c
+ *
+ * Name server for OS/2.
+ *
+ * Timing tests for the handling of domain names.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * This program is not part of the server. It times the code that parses,
+ * folds, compares, hashes and looks up domain names, against the simpler
+ * code that it replaced, so that the figures quoted for those changes can
+ * be checked on any machine. Each test is run for the given number of
+ * iterations, and the average time for one is shown.
+ *
+ * The server's own source is used, so that the times are for the real
+ * code; server.c is included here, so that its static functions can be
+ * called, and the other modules are linked in as usual, apart from the
+ * logging functions, which are replaced here.
+ *
+ * Usage: namebench [iterations]
+ *
+ */
+
+#include "server.c"
+
+#define	DEFAULT_ITERS	1000000L	/* Default iterations per test */
+#define	NHOSTS		2000		/* Names in the test HOSTS file */
+#define	NNAMES		1000		/* Names in the folding tests */
+#define	NWORDS		21		/* Words to make names from */
+#define	HOSTSFILE	"namebench.tmp"	/* Test HOSTS file */
+
+/* Forward references */
+
+static	ULONG	byte_hash(PUCHAR, INT);
+static	INT	byte_stricmp(PUCHAR, PUCHAR);
+static	VOID	byte_lower(PUCHAR);
+static	VOID	make_names(VOID);
+static	VOID	time_lookup(PDB, PUCHAR, LONG);
+static	VOID	time_names(LONG);
+static	double	timer_ns(LONG);
+static	VOID	timer_start(VOID);
+
+/* Local storage */
+
+static	ULONG	tmrfreq;		/* Timer frequency */
+static	QWORD	tmrstart;		/* Time test started */
+static	UCHAR	names[NNAMES][MAXDNAME+1];	/* Names, in lower case */
+static	UCHAR	mixed[NNAMES][MAXDNAME+1];	/* Same, in mixed case */
+static	INT	lens[NNAMES];		/* Lengths of above */
+static	volatile ULONG sink;		/* Keeps results from being
+					   optimised away */
+static	PUCHAR	words[NWORDS] = {
+	"www", "mail", "host", "ns1", "example", "com", "org", "in-addr",
+	"arpa", "internal", "server-042", "Corp", "London", "eu-west-1",
+	"compute", "amazonaws", "a", "b", "1", "168", "192"
+};
+
+
+/*
+ * Main program. Makes a HOSTS file of NHOSTS names, loads it, and runs
+ * the tests.
+ *
+ */
+
+INT main(INT argc, UCHAR *argv[])
+{	INT i;
+	LONG iters = DEFAULT_ITERS;
+	FILE *fp;
+	PDB db;
+	static CONFIG config;
+
+	if(argc > 1) iters = atol(argv[1]);
+	if(iters <= 0) {
+		error("usage: namebench [iterations]");
+		exit(EXIT_FAILURE);
+	}
+	if(DosTmrQueryFreq(&tmrfreq) != 0) {
+		error("no high resolution timer");
+		exit(EXIT_FAILURE);
+	}
+
+	fp = fopen(HOSTSFILE, "w");
+	if(fp == (FILE *) NULL) {
+		error("cannot create %s", HOSTSFILE);
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0; i < NHOSTS; i++)
+		fprintf(fp, "10.%d.%d.1 host%d\n", i/250, i%250, i);
+	fclose(fp);
+
+	config.domain = "example.com";
+	config.myname = "ns.example.com";
+	config.health_type = HEALTH_NONE;
+	db = db_init((PDB) NULL);
+	if(db == (PDB) NULL ||
+	   auth_init(&config) == FALSE ||
+	   load_hosts(&config, db, HOSTSFILE) == FALSE) {
+		error("cannot load %s", HOSTSFILE);
+		remove(HOSTSFILE);
+		exit(EXIT_FAILURE);
+	}
+	remove(HOSTSFILE);
+
+	printf("Parsing and looking up a query name, %d names:\n", NHOSTS);
+	time_lookup(db, "host1234.example.com", iters);
+	time_lookup(db, "Www.Host77.Example.COM", iters);
+
+	make_names();
+	time_names(iters/NNAMES + 1);
+
+	return(EXIT_SUCCESS);
+}
+
+
+/*
+ * Time the parsing and lookup of one name from a query: first with
+ * 'dn_expand', 'strlwr' and a lookup of the text, as was done before
+ * names were parsed in place; then with 'parse_name' and a lookup by
+ * labels, as is done now.
+ *
+ */
+
+static VOID time_lookup(PDB db, PUCHAR name, LONG iters)
+{	LONG i;
+	INT found1, found2;
+	double t1, t2;
+	PUCHAR q, result;
+	THREADINFO ti;
+	QNAME qn;
+	UCHAR buf[PACKETSZ];
+	UCHAR text[MAXDNAME+1];
+
+	memset((PUCHAR) &ti, 0, sizeof(THREADINFO));
+	ti.buf = buf;
+	ti.qname = &qn;
+	if(start_answer(&ti, name, T_A) == FALSE) {
+		error("cannot make query for %s", name);
+		return;
+	}
+	q = buf + sizeof(HEADER);
+
+	timer_start();
+	for(i = 0; i < iters; i++) {
+		(VOID) dn_expand(buf, buf + ti.pktlen, q, text, sizeof(text));
+		strlwr(text);
+		sink += (ULONG) db_find_node(db, text);
+	}
+	t1 = timer_ns(iters);
+	found1 = db_find_node(db, text) != (PNAMENODE) NULL;
+
+	timer_start();
+	for(i = 0; i < iters; i++) {
+		(VOID) parse_name(&ti, q, &qn, text);
+		sink += (ULONG) db_find_qname(db, &qn);
+	}
+	t2 = timer_ns(iters);
+	found2 = db_find_qname(db, &qn) != (PNAMENODE) NULL;
+
+	if(found1 != found2) result = "(DIFF)";
+	else result = found1 != 0 ? "(hit) " : "(miss)";
+	printf(
+		"  %-24s %s: text %.0f ns, labels %.0f ns\n",
+		name,
+		result,
+		t1,
+		t2);
+}
+
+
+/*
+ * Make up NNAMES names of two to five words, like the names in a HOSTS
+ * file, each with a copy in which about a quarter of the letters are in
+ * upper case. The same names are made every time.
+ *
+ */
+
+static VOID make_names(VOID)
+{	INT i, j, n;
+
+	srand(1);
+	for(i = 0; i < NNAMES; i++) {
+		names[i][0] = '\0';
+		n = 2 + rand()%4;
+		for(j = 0; j < n; j++) {
+			if(j != 0) strcat(names[i], ".");
+			strcat(names[i], words[rand()%NWORDS]);
+		}
+		byte_lower(names[i]);
+		lens[i] = strlen(names[i]);
+		strcpy(mixed[i], names[i]);
+		for(j = 0; j < lens[i]; j++)
+			if(rand()%4 == 0) mixed[i][j] = toupper(mixed[i][j]);
+	}
+}
+
+
+/*
+ * Time the folding, comparison and hashing of names, a byte at a time
+ * with 'tolower' as was done before, and a word at a time with the
+ * functions in names.c. Each round goes through all the names.
+ *
+ */
+
+static VOID time_names(LONG rounds)
+{	LONG r;
+	INT i, total = 0;
+	double t1, t2;
+	UCHAR temp[MAXDNAME+1];
+
+	for(i = 0; i < NNAMES; i++) total += lens[i];
+	printf(
+		"Folding, comparing and hashing, average length %.1f:\n",
+		(double) total/NNAMES);
+
+	timer_start();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < NNAMES; i++) {
+			memcpy(temp, mixed[i], lens[i] + 1);
+			byte_lower(temp);
+			sink += temp[0];
+		}
+	t1 = timer_ns(rounds*NNAMES);
+	timer_start();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < NNAMES; i++) {
+			memcpy(temp, mixed[i], lens[i] + 1);
+			name_lower(temp, lens[i]);
+			sink += temp[0];
+		}
+	t2 = timer_ns(rounds*NNAMES);
+	printf("  fold:     byte loop %.0f ns, name_lower %.0f ns\n", t1, t2);
+
+	timer_start();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < NNAMES; i++)
+			sink += byte_stricmp(names[i], mixed[i]);
+	t1 = timer_ns(rounds*NNAMES);
+	timer_start();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < NNAMES; i++)
+			sink += name_same(names[i], mixed[i]);
+	t2 = timer_ns(rounds*NNAMES);
+	printf("  compare:  byte loop %.0f ns, name_same %.0f ns\n", t1, t2);
+
+	timer_start();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < NNAMES; i++)
+			sink += byte_hash(mixed[i], lens[i]);
+	t1 = timer_ns(rounds*NNAMES);
+	timer_start();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < NNAMES; i++)
+			sink += name_hash(mixed[i], lens[i]);
+	t2 = timer_ns(rounds*NNAMES);
+	printf("  hash:     byte loop %.0f ns, name_hash %.0f ns\n", t1, t2);
+}
+
+
+/*
+ * Fold a name to lower case, a byte at a time.
+ *
+ */
+
+static VOID byte_lower(PUCHAR p)
+{	for(; *p != '\0'; p++)
+		*p = tolower(*p);
+}
+
+
+/*
+ * Compare two names ignoring case, a byte at a time.
+ *
+ */
+
+static INT byte_stricmp(PUCHAR a, PUCHAR b)
+{	INT ca, cb;
+
+	do {
+		ca = tolower(*a++);
+		cb = tolower(*b++);
+	} while(ca == cb && ca != '\0');
+
+	return(ca - cb);
+}
+
+
+/*
+ * Hash a name ignoring case, a byte at a time (FNV-1a), as was done
+ * before 'name_hash'.
+ *
+ */
+
+static ULONG byte_hash(PUCHAR p, INT len)
+{	ULONG hash = LABEL_HASH_INIT;
+
+	while(len-- > 0)
+		hash = (hash ^ (UCHAR) tolower(*p++))*16777619UL;
+
+	return(hash);
+}
+
+
+/*
+ * Note the time at the start of a test.
+ *
+ */
+
+static VOID timer_start(VOID)
+{	(VOID) DosTmrQueryTime(&tmrstart);
+}
+
+
+/*
+ * Work out the average time for one of 'n' iterations of a test, in
+ * nanoseconds.
+ *
+ */
+
+static double timer_ns(LONG n)
+{	QWORD t;
+	double d;
+
+	(VOID) DosTmrQueryTime(&t);
+	d = ((double) t.ulHi - (double) tmrstart.ulHi)*4294967296.0 +
+	    ((double) t.ulLo - (double) tmrstart.ulLo);
+
+	return(d*1.0e9/(double) tmrfreq/(double) n);
+}
+
+
+/*
+ * Show a message that the server modules would write to the logfile; it
+ * goes to standard output instead.
+ *
+ */
+
+VOID dolog(PUCHAR s)
+{	fputs(s, stdout);
+	if(s[0] == '\0' || s[strlen(s)-1] != '\n') fputc('\n', stdout);
+}
+
+
+#ifdef	DEBUG
+/*
+ * Show a trace message from the server modules, in printf style.
+ *
+ */
+
+VOID trace(PUCHAR mes, ...)
+{	va_list ap;
+
+	va_start(ap, mes);
+	vprintf(mes, ap);
+	va_end(ap);
+
+	fputc('\n', stdout);
+}
+#endif
+
+
+/*
+ * Print message on standard error in printf style; the server modules
+ * use this too.
+ *
+ */
+
+VOID error(PUCHAR mes, ...)
+{	va_list ap;
+
+	fprintf(stderr, "namebench: ");
+
+	va_start(ap, mes);
+	vfprintf(stderr, mes, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+}
+
+/*
+ * End of file: namebench.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,299 @@
+/*
+ * File: refertest.c
+ *
+ * Name server for OS/2.
+ *
+ * Checks of the referral of queries to other name servers.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * This program is not part of the server. It refers a query to a fake
+ * name server, run by a thread of its own on the loopback address, and
+ * checks the reply that comes back: it must carry the ID of the client's
+ * query, and must be handed over by exchanging the packet buffer with
+ * the referral buffer, not by copying it. Any failed check is reported,
+ * and makes the exit status non-zero.
+ *
+ * The server's own source is used; refer.c is included here, so that the
+ * list of name servers can be set directly, without looking for a real
+ * interface. Only the modules that refer.c needs are linked in, and the
+ * logging functions are replaced here.
+ *
+ * Usage: refertest
+ *
+ */
+
+#include "refer.c"
+
+#define	SERVER_STACK	16384		/* Stack size for fake server thread */
+#define	TESTNAME	"foo.example"	/* Name in test query */
+#define	TESTID		0x1234		/* ID of test query */
+
+/* Forward references */
+
+static	VOID	check_refer(VOID);
+static	VOID	fake_server(PVOID);
+static	INT	loopback_socket(PSOCK);
+static	INT	make_query(PUCHAR, PUCHAR, INT);
+
+/* Local storage */
+
+static	CONFIG	tconfig;		/* Configuration for the tests */
+static	SERVERS	tservers;		/* The fake name server */
+static	INT	failures;		/* Number of failed checks */
+static	INT	fsock;			/* Socket of fake name server */
+
+
+/*
+ * Main program. Starts the fake name server and the referral code, and
+ * runs the tests.
+ *
+ */
+
+INT main(INT argc, UCHAR *argv[])
+{	SOCK sa;
+
+	fsock = loopback_socket(&sa);
+	if(fsock < 0) {
+		error("cannot create socket for fake name server");
+		exit(EXIT_FAILURE);
+	}
+	if(_beginthread(fake_server, NULL, SERVER_STACK, (PVOID) NULL) == -1) {
+		error("cannot start fake name server");
+		exit(EXIT_FAILURE);
+	}
+
+	tconfig.nsport = sa.sin_port;
+	tconfig.refer_interface = "loopback";
+	tconfig.refer_deadline = DEFAULT_REFER_DEADLINE;
+	tconfig.hedge_budget = 0;
+	tservers.nservers = 1;
+	tservers.servers[0] = sa.sin_addr;
+	tconfig.servlist = &tservers;
+
+	/* Start the referral code as 'refer_start' does, but without the
+	   interface watcher */
+
+	if(upstream_start(&tconfig) == FALSE ||
+	   DosCreateMutexSem((PSZ) NULL, &flightsem, 0, FALSE) != 0) {
+		error("cannot start referral code");
+		exit(EXIT_FAILURE);
+	}
+	note_servers(&tconfig, &tservers);
+
+	printf("Referral to a fake name server:\n");
+	check_refer();
+
+	if(failures != 0) {
+		printf(
+			"%d check%s failed\n",
+			failures,
+			failures == 1 ? "" : "s");
+		return(EXIT_FAILURE);
+	}
+	printf("All checks passed\n");
+
+	return(EXIT_SUCCESS);
+}
+
+
+/*
+ * Refer a query, and check the reply. The fake name server returns the
+ * query as an NXDOMAIN reply, so the reply must be the same length as
+ * the query.
+ *
+ */
+
+static VOID check_refer(VOID)
+{	INT n, bad = 0;
+	PTHREADINFO ti;
+	PUCHAR query;
+	HEADER *h;
+
+	ti = (PTHREADINFO) calloc(1, sizeof(THREADINFO));
+	if(ti == (PTHREADINFO) NULL ||
+	   (ti->buf = (PUCHAR) malloc(PACKETSZ)) == (PUCHAR) NULL) {
+		error("cannot allocate thread information");
+		exit(EXIT_FAILURE);
+	}
+	ti->config = &tconfig;
+	n = make_query(ti->buf, TESTNAME, T_A);
+	if(n < 0) {
+		error("cannot make query for %s", TESTNAME);
+		exit(EXIT_FAILURE);
+	}
+	ti->pktlen = n;
+	ti->qp = ti->rp = ti->buf + n;
+	query = ti->buf;
+
+	refer(ti);
+
+	h = (HEADER *) ti->buf;
+	if(ti->buf == query || ti->rbuf != query) {
+		printf("  reply was not handed over in the referral buffer\n");
+		bad++;
+	}
+	if(ntohs(h->id) != TESTID) {
+		printf("  reply has ID %04x, not %04x\n", ntohs(h->id), TESTID);
+		bad++;
+	}
+	if(h->qr != 1 || h->rcode != NXDOMAIN) {
+		printf("  reply is not the fake server's NXDOMAIN\n");
+		bad++;
+	}
+	if(ti->rp != ti->buf + n) {
+		printf("  reply is %d bytes, not %d\n", ti->rp - ti->buf, n);
+		bad++;
+	}
+	printf("  %d wrong\n", bad);
+	failures += bad;
+
+	free(ti->buf);
+	if(ti->rbuf != (PUCHAR) NULL) free(ti->rbuf);
+	free(ti);
+}
+
+
+/*
+ * Make a query with a single question, in the same way as the server
+ * makes up queries for its replies built in advance.
+ *
+ * Returns the length of the query, or -1 if the name is malformed.
+ *
+ */
+
+static INT make_query(PUCHAR buf, PUCHAR name, INT qtype)
+{	INT n;
+	HEADER *h = (HEADER *) buf;
+	PUCHAR p;
+
+	memset(buf, 0, sizeof(HEADER));
+	h->id = htons(TESTID);
+	h->rd = 1;
+	h->qdcount = htons(1);
+	n = dn_comp(name,
+		buf + sizeof(HEADER),
+		PACKETSZ - sizeof(HEADER) - QFIXEDSZ,
+		(PUCHAR *) NULL,
+		(PUCHAR *) NULL);
+	if(n < 0) return(-1);
+	p = buf + sizeof(HEADER) + n;
+	putshort(qtype, p);
+	p += 2;
+	putshort(C_IN, p);
+	p += 2;
+
+	return(p - buf);
+}
+
+
+/*
+ * The fake name server thread. Every query received is sent back as a
+ * reply, with the name error (NXDOMAIN) response code.
+ *
+ */
+
+static VOID fake_server(PVOID param)
+{	INT n, namelen;
+	HEADER *h;
+	SOCK sa;
+	UCHAR buf[PACKETSZ];
+
+	for(;;) {
+		namelen = sizeof(SOCK);
+		n = recvfrom(fsock, buf, sizeof(buf), 0, (PSOCKG) &sa,
+				&namelen);
+		if(n < (INT) sizeof(HEADER)) continue;
+		h = (HEADER *) buf;
+		h->qr = 1;
+		h->rcode = NXDOMAIN;
+		(VOID) sendto(fsock, buf, n, 0, (PSOCKG) &sa, sizeof(SOCK));
+	}
+}
+
+
+/*
+ * Create a UDP socket bound to a port chosen by the system on the
+ * loopback address.
+ *
+ *	psa	points to where to store the address of the socket
+ *
+ * Returns the socket, or -1 on failure.
+ *
+ */
+
+static INT loopback_socket(PSOCK psa)
+{	INT sockno, namelen = sizeof(SOCK);
+
+	sockno = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sockno < 0) return(-1);
+
+	memset((PUCHAR) psa, 0, sizeof(SOCK));
+	psa->sin_family = AF_INET;
+	psa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(sockno, (PSOCKG) psa, sizeof(SOCK)) < 0 ||
+	   getsockname(sockno, (PSOCKG) psa, &namelen) < 0) {
+		soclose(sockno);
+		return(-1);
+	}
+
+	return(sockno);
+}
+
+
+/*
+ * Show a message that the server modules would write to the logfile; it
+ * goes to standard output instead.
+ *
+ */
+
+VOID dolog(PUCHAR s)
+{	fputs(s, stdout);
+	if(s[0] == '\0' || s[strlen(s)-1] != '\n') fputc('\n', stdout);
+}
+
+
+#ifdef	DEBUG
+/*
+ * Show a trace message from the server modules, in printf style.
+ *
+ */
+
+VOID trace(PUCHAR mes, ...)
+{	va_list ap;
+
+	va_start(ap, mes);
+	vprintf(mes, ap);
+	va_end(ap);
+
+	fputc('\n', stdout);
+}
+#endif
+
+
+/*
+ * Print message on standard error in printf style; the server modules
+ * use this too.
+ *
+ */
+
+VOID error(PUCHAR mes, ...)
+{	va_list ap;
+
+	fprintf(stderr, "refertest: ");
+
+	va_start(ap, mes);
+	vfprintf(stderr, mes, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+}
+
+/*
+ * End of file: refertest.c
+ *
+ */
+
\ No newline at end of file
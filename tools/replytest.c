@@ -0,0 +1,1024 @@
+/*
+ * File: replytest.c
+ *
+ * Name server for OS/2.
+ *
+ * Checks and timings for the building of replies.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * This program is not part of the server. It checks that replies built
+ * in advance are the same as those built at query time, and that the
+ * reply to a PTR query names the right host, and it times the building
+ * of replies both ways. It also checks the compression of names in
+ * replies against 'dn_comp', the parsing of compressed names in
+ * queries, and what is left in a reply when a record does not fit.
+ * Finally, replies are sent over a loopback socket, as the server sends
+ * them, and checked as they arrive. Any failed check is reported, and
+ * makes the exit status non-zero.
+ *
+ * The server's own source is used, so that the checks are of the real
+ * code; server.c is included here, so that its static functions can be
+ * called, and the other modules are linked in as usual, apart from the
+ * logging functions, which are replaced here.
+ *
+ * Usage: replytest [iterations]
+ *
+ */
+
+#include "server.c"
+
+#define	DEFAULT_ITERS	200000L		/* Default iterations per timing */
+#define	NPTRHOSTS	5000		/* Hosts in the PTR test */
+#define	HOSTSFILE	"replytest.tmp"	/* Test HOSTS file */
+#define	ZONEFNAME	"replytest.zon"	/* Test zone file */
+#define	ZONEPTR		"zoneptr.x.com"	/* PTR target in the zone file */
+#define	QUESTION	"www.example.com"	/* Question in name tests */
+#define	NREPLY		6		/* Names in a typical reply */
+#define	MAXDNPTRS	50		/* Name pointers for 'dn_comp' */
+#define	LONGSUFFIX	"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa.\
+bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb.example.com"
+					/* Suffix of names that fill a reply */
+#define	FILLROOM	150		/* Space to leave when filling it */
+#define	NEWOWNER	"other.example.com"	/* Owner not yet in reply */
+#define	RECV_WAIT	2000		/* Time to wait for a reply (ms) */
+
+/* Forward references */
+
+static	INT	answer_name(PUCHAR, INT, PUCHAR);
+static	INT	ask(PDB, PUCHAR, INT, PUCHAR);
+static	VOID	check_comp(VOID);
+static	VOID	check_pointers(VOID);
+static	VOID	check_ptrs(VOID);
+static	VOID	check_truncation(VOID);
+static	VOID	check_same(PDB);
+static	VOID	check_send(PDB);
+static	VOID	clear_answers(PDB);
+static	INT	count_names(PUCHAR, INT);
+static	PDB	load_test(PUCHAR, PZONEFILE);
+static	INT	loopback_socket(PSOCK);
+static	PDBENT	scan_address(PDB, INADDR);
+static	VOID	time_comp(LONG);
+static	VOID	time_reply(PDB, PUCHAR, INT, LONG);
+static	double	timer_ns(LONG);
+static	VOID	timer_start(VOID);
+
+/* Local storage */
+
+static	CONFIG	tconfig;		/* Configuration for the tests */
+static	INT	failures;		/* Number of failed checks */
+static	ULONG	tmrfreq;		/* Timer frequency */
+static	QWORD	tmrstart;		/* Time test started */
+static	AUTHNET	nets[2];		/* Networks we are authority for */
+
+/* Queries for the comparisons and timings */
+
+static	struct {
+	PUCHAR	name;			/* Name in query */
+	INT	type;			/* Type of query */
+} queries[] = {
+	{ "a.x.com",			T_A },
+	{ "A.X.com",			T_AAAA },
+	{ "b.x.com",			T_A },
+	{ "b.x.com",			T_AAAA },
+	{ "ns.x.com",			T_A },
+	{ "v4only.x.com",		T_AAAA },
+	{ "1.42.168.192.in-addr.arpa",	T_PTR },
+	{ "5.42.168.192.in-addr.arpa",	T_PTR },
+	{ "1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa",
+					T_PTR },
+	{ "",				0 }	/* End of table marker */
+};
+
+/* Names for the compression check; some share suffixes with the question
+   or with each other, some differ from earlier ones only in case, and one
+   has an escaped dot */
+
+static	PUCHAR	compnames[] = {
+	"www.example.com", "example.com", "ns.example.com", "NS2.Example.COM",
+	"mail.other.org", "other.org", "a.b.c.d.other.org",
+	"x\\.y.example.com", "www.example.com", "ns.example.com", "",
+	"b.c.d.other.org", "com", "org",
+	(PUCHAR) NULL				/* End of table marker */
+};
+
+/* Names in a typical reply: a CNAME and its target, an A record, and an
+   NS record with its address as additional data */
+
+static	PUCHAR	replynames[NREPLY] = {
+	"www.example.com", "host.example.com", "host.example.com",
+	"example.com", "ns.example.com", "ns.example.com"
+};
+
+
+/*
+ * Main program. Loads a small HOSTS file, and runs the tests on it; then
+ * runs the PTR test on a larger one.
+ *
+ */
+
+INT main(INT argc, UCHAR *argv[])
+{	LONG iters = DEFAULT_ITERS;
+	FILE *fp;
+	PDB db;
+
+	if(argc > 1) iters = atol(argv[1]);
+	if(iters <= 0) {
+		error("usage: replytest [iterations]");
+		exit(EXIT_FAILURE);
+	}
+	if(DosTmrQueryFreq(&tmrfreq) != 0) {
+		error("no high resolution timer");
+		exit(EXIT_FAILURE);
+	}
+
+	tconfig.domain = "x.com";
+	tconfig.myname = "ns.x.com";
+	tconfig.health_type = HEALTH_NONE;
+	nets[0].network.s_addr = inet_addr("192.168.42.0");
+	nets[0].masklen = 24;
+	nets[0].next = &nets[1];
+	nets[1].network.s_addr = inet_addr("10.0.0.0");
+	nets[1].masklen = 8;
+	tconfig.authnets = &nets[0];
+	if(auth_init(&tconfig) == FALSE) {
+		error("cannot set up authority");
+		exit(EXIT_FAILURE);
+	}
+
+	fp = fopen(HOSTSFILE, "w");
+	if(fp == (FILE *) NULL) {
+		error("cannot create %s", HOSTSFILE);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "192.168.42.1 a ns\n");
+	fprintf(fp, "2001:db8::1 a b\n");
+	fprintf(fp, "192.168.42.5 v4only\n");
+	fclose(fp);
+	db = load_test(HOSTSFILE, (PZONEFILE) NULL);
+
+	printf("Replies built in advance and at query time:\n");
+	check_same(db);
+
+	printf("Replies sent over a loopback socket:\n");
+	check_send(db);
+
+	printf("Time to build a reply (ns):\n");
+	time_reply(db, "a.x.com", T_A, iters);
+	time_reply(db, "b.x.com", T_AAAA, iters);
+	time_reply(db, "1.42.168.192.in-addr.arpa", T_PTR, iters);
+
+	check_ptrs();
+
+	printf("Name compression, compared with dn_comp:\n");
+	check_comp();
+	time_comp(iters);
+
+	printf("Compressed names in queries:\n");
+	check_pointers();
+
+	printf("Records that do not fit in a reply:\n");
+	check_truncation();
+
+	if(failures != 0) {
+		printf(
+			"%d check%s failed\n",
+			failures,
+			failures == 1 ? "" : "s");
+		return(EXIT_FAILURE);
+	}
+	printf("All checks passed\n");
+
+	return(EXIT_SUCCESS);
+}
+
+
+/*
+ * Load a database from a HOSTS file and (optionally) a zone file, and
+ * build the replies in advance. The files are removed afterwards.
+ *
+ * Returns a pointer to the database; exits on failure.
+ *
+ */
+
+static PDB load_test(PUCHAR hostsfile, PZONEFILE zf)
+{	PDB db;
+
+	db = db_init((PDB) NULL);
+	if(db == (PDB) NULL ||
+	   load_hosts(&tconfig, db, hostsfile) == FALSE ||
+	   (zf != (PZONEFILE) NULL && zone_load(db, zf) == FALSE) ||
+	   make_answers(&tconfig, db) == FALSE) {
+		error("cannot load test data");
+		remove(hostsfile);
+		if(zf != (PZONEFILE) NULL) remove(zf->filename);
+		exit(EXIT_FAILURE);
+	}
+	remove(hostsfile);
+	if(zf != (PZONEFILE) NULL) remove(zf->filename);
+
+	return(db);
+}
+
+
+/*
+ * Build the reply to a query, as the server would send it; any part
+ * built in advance is put after the rest.
+ *
+ *	db	points to the database to use
+ *	name	points to the name to ask about
+ *	qtype	is the type of query
+ *	reply	points to a buffer of 2*PACKETSZ bytes for the reply
+ *
+ * Returns the length of the reply, or -1 if the query could not be made.
+ *
+ */
+
+static INT ask(PDB db, PUCHAR name, INT qtype, PUCHAR reply)
+{	INT n;
+	THREADINFO ti;
+	QNAME qn;
+	UCHAR buf[PACKETSZ];
+
+	memset((PUCHAR) &ti, 0, sizeof(THREADINFO));
+	ti.config = &tconfig;
+	ti.db = db;
+	ti.buf = buf;
+	ti.qname = &qn;
+	if(start_answer(&ti, name, qtype) == FALSE) return(-1);
+	ti.qp = buf + sizeof(HEADER);
+
+	process_query(&ti);
+
+	n = ti.pktlen;
+	memcpy(reply, buf, n);
+	if(ti.answer != (PANSWER) NULL) {
+		memcpy(reply + n, ti.answer->data, ti.answer->len);
+		n += ti.answer->len;
+	}
+
+	return(n);
+}
+
+
+/*
+ * Check that each reply built in advance is byte for byte the same as
+ * the reply built at query time.
+ *
+ */
+
+static VOID check_same(PDB db)
+{	INT i, n1, n2;
+	UCHAR r1[2*PACKETSZ], r2[2*PACKETSZ];
+
+	for(i = 0; queries[i].name[0] != '\0'; i++) {
+		n1 = ask(db, queries[i].name, queries[i].type, r1);
+		clear_answers(db);
+		n2 = ask(db, queries[i].name, queries[i].type, r2);
+		if(make_answers(&tconfig, db) == FALSE) {
+			error("cannot build replies");
+			exit(EXIT_FAILURE);
+		}
+		if(n1 < 0 || n1 != n2 || memcmp(r1, r2, n1) != 0) {
+			printf("  %-24.24s type %-2d DIFFERENT\n",
+				queries[i].name, queries[i].type);
+			failures++;
+		} else {
+			printf("  %-24.24s type %-2d same, %d bytes\n",
+				queries[i].name, queries[i].type, n1);
+		}
+	}
+}
+
+
+/*
+ * Send the reply to each test query over a loopback socket, through
+ * 'handle_packet_worker' as the server does, first with the replies
+ * built in advance and then with them built at query time. What arrives
+ * must be the same as the reply built by 'ask', with the response and
+ * recursion available flags set.
+ *
+ */
+
+static VOID check_send(PDB db)
+{	INT i, pass, n1, n2, ssock, rsock, bad = 0;
+	INT sockset[1];
+	PTHREADINFO ti;
+	HEADER *h;
+	QNAME qn;
+	SOCK sa;
+	DBVERSION ver;
+	UCHAR r1[2*PACKETSZ], r2[2*PACKETSZ];
+
+	memset((PUCHAR) &ver, 0, sizeof(DBVERSION));
+	ver.db = db;
+	tconfig.current = &ver;
+
+	rsock = loopback_socket(&sa);
+	ssock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(rsock < 0 || ssock < 0) {
+		error("cannot create sockets");
+		exit(EXIT_FAILURE);
+	}
+
+	for(pass = 0; pass < 2; pass++) {
+		if(pass == 1) clear_answers(db);
+		for(i = 0; queries[i].name[0] != '\0'; i++) {
+			n1 = ask(db, queries[i].name, queries[i].type, r1);
+			h = (HEADER *) r1;
+			h->qr = 1;
+			h->ra = 1;
+
+			ti = (PTHREADINFO) calloc(1, sizeof(THREADINFO));
+			if(ti == (PTHREADINFO) NULL ||
+			   (ti->buf = makepktbuf()) == (PUCHAR) NULL) {
+				error("cannot allocate thread information");
+				exit(EXIT_FAILURE);
+			}
+			ti->config = &tconfig;
+			ti->qname = &qn;
+			ti->sockno = ssock;
+			memcpy((PUCHAR) &ti->sa, (PUCHAR) &sa, sizeof(SOCK));
+			if(start_answer(ti, queries[i].name, queries[i].type) ==
+			   FALSE) {
+				error("cannot make query for %s",
+					queries[i].name);
+				exit(EXIT_FAILURE);
+			}
+			handle_packet_worker(ti);
+			free(ti->buf);
+			free(ti);
+
+			sockset[0] = rsock;
+			n2 = -1;
+			if(select(sockset, 1, 0, 0, RECV_WAIT) > 0)
+				n2 = recv(rsock, r2, sizeof(r2), 0);
+			if(n1 < 0 || n1 != n2 || memcmp(r1, r2, n1) != 0) {
+				printf(
+					"  %-24.24s type %-2d %s: %s\n",
+					queries[i].name,
+					queries[i].type,
+					pass == 0 ? "in advance" : "at query time",
+					n2 < 0 ? "nothing arrived" : "DIFFERENT");
+				bad++;
+			}
+		}
+	}
+	if(make_answers(&tconfig, db) == FALSE) {
+		error("cannot build replies");
+		exit(EXIT_FAILURE);
+	}
+	soclose(ssock);
+	soclose(rsock);
+	tconfig.current = (PDBVERSION) NULL;
+
+	printf("  %d replies sent, %d wrong\n", 2*i, bad);
+	failures += bad;
+}
+
+
+/*
+ * Create a UDP socket bound to a port chosen by the system on the
+ * loopback address.
+ *
+ *	psa	points to where to store the address of the socket
+ *
+ * Returns the socket, or -1 on failure.
+ *
+ */
+
+static INT loopback_socket(PSOCK psa)
+{	INT sockno, namelen = sizeof(SOCK);
+
+	sockno = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sockno < 0) return(-1);
+
+	memset((PUCHAR) psa, 0, sizeof(SOCK));
+	psa->sin_family = AF_INET;
+	psa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(sockno, (PSOCKG) psa, sizeof(SOCK)) < 0 ||
+	   getsockname(sockno, (PSOCKG) psa, &namelen) < 0) {
+		soclose(sockno);
+		return(-1);
+	}
+
+	return(sockno);
+}
+
+
+/*
+ * Time the building of the reply to one query, first at query time and
+ * then using the reply built in advance.
+ *
+ */
+
+static VOID time_reply(PDB db, PUCHAR name, INT qtype, LONG iters)
+{	LONG i;
+	INT qlen;
+	double t1, t2;
+	THREADINFO ti;
+	QNAME qn;
+	UCHAR query[PACKETSZ], buf[PACKETSZ];
+
+	memset((PUCHAR) &ti, 0, sizeof(THREADINFO));
+	ti.config = &tconfig;
+	ti.db = db;
+	ti.buf = query;
+	ti.qname = &qn;
+	if(start_answer(&ti, name, qtype) == FALSE) {
+		error("cannot make query for %s", name);
+		return;
+	}
+	qlen = ti.pktlen;
+	ti.buf = buf;
+
+	clear_answers(db);
+	timer_start();
+	for(i = 0; i < iters; i++) {
+		memcpy(buf, query, qlen);
+		ti.pktlen = qlen;
+		ti.qp = buf + sizeof(HEADER);
+		ti.rp = buf + qlen;
+		ti.answer = (PANSWER) NULL;
+		process_query(&ti);
+	}
+	t1 = timer_ns(iters);
+
+	if(make_answers(&tconfig, db) == FALSE) {
+		error("cannot build replies");
+		exit(EXIT_FAILURE);
+	}
+	timer_start();
+	for(i = 0; i < iters; i++) {
+		memcpy(buf, query, qlen);
+		ti.pktlen = qlen;
+		ti.qp = buf + sizeof(HEADER);
+		ti.rp = buf + qlen;
+		ti.answer = (PANSWER) NULL;
+		process_query(&ti);
+	}
+	t2 = timer_ns(iters);
+
+	printf(
+		"  %-26.26s type %-2d: at query time %.0f, in advance %.0f\n",
+		name,
+		qtype,
+		t1,
+		t2);
+}
+
+
+/*
+ * Free all the replies built in advance for a database, so that replies
+ * are built at query time.
+ *
+ */
+
+static VOID clear_answers(PDB db)
+{	ULONG i;
+	PNAMENODE node;
+	PDBENT p;
+
+	for(i = 0; i < db->hashsize; i++) {
+		for(node = db->hashtab[i];
+		    node != (PNAMENODE) NULL;
+		    node = node->hnext) {
+			if(node->answers[0] != (PANSWER) NULL)
+				free(node->answers[0]);
+			if(node->answers[1] != (PANSWER) NULL)
+				free(node->answers[1]);
+			node->answers[0] = node->answers[1] = (PANSWER) NULL;
+		}
+	}
+	for(p = db->head; p != (PDBENT) NULL; p = p->next) {
+		if(p->ptr != (PANSWER) NULL) free(p->ptr);
+		p->ptr = (PANSWER) NULL;
+	}
+}
+
+
+/*
+ * Check the PTR replies for a HOSTS file of NPTRHOSTS entries, with one
+ * address given twice and one overridden by a zone file. For every
+ * address, 'db_find_address' must give the same entry as a scan of the
+ * whole list (the way it used to work), and the reply to a PTR query
+ * must give that entry's name, or the zone file's for the override.
+ *
+ */
+
+static VOID check_ptrs(VOID)
+{	INT i, n, bad = 0;
+	ULONG a;
+	INADDR addr;
+	FILE *fp;
+	PDB db;
+	PDBENT p;
+	PUCHAR want;
+	ZONEFILE zf;
+	UCHAR name[MAXDNAME+1], target[MAXDNAME+1], host[MAXDNAME+1];
+	UCHAR reply[2*PACKETSZ];
+
+	fp = fopen(HOSTSFILE, "w");
+	if(fp == (FILE *) NULL) {
+		error("cannot create %s", HOSTSFILE);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "10.0.0.1 ns\n10.0.0.2 first\n10.0.0.2 second\n");
+	for(i = 0; i < NPTRHOSTS; i++)
+		fprintf(fp, "10.0.%d.%d h%d\n", 1 + i/250, 1 + i%250, i);
+	fclose(fp);
+
+	fp = fopen(ZONEFNAME, "w");
+	if(fp == (FILE *) NULL) {
+		error("cannot create %s", ZONEFNAME);
+		remove(HOSTSFILE);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "$TTL 3600\n");
+	fprintf(fp, "@ IN SOA ns.x.com. admin.x.com. 5 3600 600 86400 60\n");
+	fprintf(fp, "3.1.0.10.in-addr.arpa. IN PTR %s.\n", ZONEPTR);
+	fclose(fp);
+
+	memset((PUCHAR) &zf, 0, sizeof(ZONEFILE));
+	zf.origin = "10.in-addr.arpa";
+	zf.filename = ZONEFNAME;
+	db = load_test(HOSTSFILE, &zf);
+
+	printf("PTR replies for %d hosts:\n", NPTRHOSTS + 2);
+	for(i = -1; i < NPTRHOSTS; i++) {	/* -1 is the one given twice */
+		a = i < 0 ? 0x0a000002UL :
+			0x0a000000UL + ((ULONG) (1 + i/250) << 8) + 1 + i%250;
+		addr.s_addr = htonl(a);
+		sprintf(
+			name,
+			"%lu.%lu.%lu.%lu.in-addr.arpa",
+			a & 0xff,
+			(a >> 8) & 0xff,
+			(a >> 16) & 0xff,
+			a >> 24);
+
+		p = scan_address(db, addr);
+		if(p == (PDBENT) NULL || db_find_address(db, addr) != p) {
+			if(bad++ < 5) printf("  %s: wrong entry\n", name);
+			continue;
+		}
+		want = strcmp(name, "3.1.0.10.in-addr.arpa") == 0 ?
+			ZONEPTR : db_node_name(p->node, host);
+
+		n = ask(db, name, T_PTR, reply);
+		if(n < 0 || answer_name(reply, n, target) < 0 ||
+		   stricmp(target, want) != 0) {
+			if(bad++ < 5) printf("  %s: wrong reply\n", name);
+		}
+	}
+	printf("  %d wrong\n", bad);
+	failures += bad;
+}
+
+
+/*
+ * Compress a list of names into a message with 'dn_comp' and with
+ * 'comp_name', both starting after the same question. Each name must
+ * expand to the same text (ignoring case) both ways, and 'comp_name'
+ * must never give a longer result.
+ *
+ */
+
+static VOID check_comp(VOID)
+{	INT i, n1, n2, bad = 0;
+	THREADINFO t1, t2;
+	QNAME qn1, qn2;
+	COMP comp;
+	PUCHAR r1, r2;
+	PUCHAR dnptrs[MAXDNPTRS];
+	UCHAR m1[PACKETSZ], m2[PACKETSZ];
+	UCHAR e1[MAXDNAME+1], e2[MAXDNAME+1];
+
+	memset((PUCHAR) &t1, 0, sizeof(THREADINFO));
+	memset((PUCHAR) &t2, 0, sizeof(THREADINFO));
+	t1.buf = m1;
+	t1.qname = &qn1;
+	t2.buf = m2;
+	t2.qname = &qn2;
+	if(start_answer(&t1, QUESTION, T_A) == FALSE ||
+	   start_answer(&t2, QUESTION, T_A) == FALSE) {
+		error("cannot make query for %s", QUESTION);
+		exit(EXIT_FAILURE);
+	}
+	r1 = t1.rp;
+	r2 = t2.rp;
+	dnptrs[0] = m1;
+	dnptrs[1] = m1 + sizeof(HEADER);
+	dnptrs[2] = (PUCHAR) NULL;
+	comp_init(&comp, m2, &qn2);
+
+	for(i = 0; compnames[i] != (PUCHAR) NULL; i++) {
+		n1 = dn_comp(compnames[i], r1, m1 + PACKETSZ - r1,
+				dnptrs, &dnptrs[MAXDNPTRS-1]);
+		n2 = comp_name(&comp, compnames[i], r2, m2 + PACKETSZ - r2);
+		if(n1 < 0 || n2 < 0 ||
+		   dn_expand(m1, r1 + n1, r1, e1, sizeof(e1)) < 0 ||
+		   dn_expand(m2, r2 + n2, r2, e2, sizeof(e2)) < 0) {
+			printf("  '%s': cannot compress\n", compnames[i]);
+			bad++;
+			break;
+		}
+		if(n2 > n1 || stricmp(e1, e2) != 0) {
+			printf(
+				"  '%s': dn_comp %d bytes '%s', "
+				"comp_name %d bytes '%s'\n",
+				compnames[i],
+				n1,
+				e1,
+				n2,
+				e2);
+			bad++;
+		}
+		r1 += n1;
+		r2 += n2;
+	}
+	printf(
+		"  %d names: dn_comp %d bytes, comp_name %d bytes, %d wrong\n",
+		i,
+		r1 - m1,
+		r2 - m2,
+		bad);
+	failures += bad;
+}
+
+
+/*
+ * Time the compression of the names in a typical reply, with 'dn_comp'
+ * and with 'comp_name'. The ten bytes after each name stand for the
+ * fixed part of a record.
+ *
+ */
+
+static VOID time_comp(LONG iters)
+{	LONG k;
+	INT i;
+	double t1, t2;
+	THREADINFO ti;
+	QNAME qn;
+	COMP comp;
+	PUCHAR r1, r2, start;
+	PUCHAR dnptrs[MAXDNPTRS];
+	UCHAR msg[PACKETSZ];
+
+	memset((PUCHAR) &ti, 0, sizeof(THREADINFO));
+	ti.buf = msg;
+	ti.qname = &qn;
+	if(start_answer(&ti, QUESTION, T_A) == FALSE) {
+		error("cannot make query for %s", QUESTION);
+		exit(EXIT_FAILURE);
+	}
+	start = ti.rp;
+
+	timer_start();
+	for(k = 0; k < iters; k++) {
+		r1 = start;
+		dnptrs[0] = msg;
+		dnptrs[1] = msg + sizeof(HEADER);
+		dnptrs[2] = (PUCHAR) NULL;
+		for(i = 0; i < NREPLY; i++)
+			r1 += dn_comp(replynames[i], r1, msg + PACKETSZ - r1,
+					dnptrs, &dnptrs[MAXDNPTRS-1]) + RRFIXEDSZ;
+	}
+	t1 = timer_ns(iters);
+
+	timer_start();
+	for(k = 0; k < iters; k++) {
+		r2 = start;
+		comp_init(&comp, msg, &qn);
+		for(i = 0; i < NREPLY; i++)
+			r2 += comp_name(&comp, replynames[i], r2,
+					msg + PACKETSZ - r2) + RRFIXEDSZ;
+	}
+	t2 = timer_ns(iters);
+
+	printf(
+		"  %d names: dn_comp %.0f ns, %d bytes; "
+		"comp_name %.0f ns, %d bytes\n",
+		NREPLY,
+		t1,
+		r1 - msg,
+		t2,
+		r2 - msg);
+}
+
+
+/*
+ * Check that 'parse_name' follows a compression pointer in a second
+ * question back into the first, and rejects one that points into the
+ * header or does not point back.
+ *
+ */
+
+static VOID check_pointers(VOID)
+{	INT i, n, bad = 0;
+	THREADINFO ti;
+	QNAME qn;
+	PUCHAR q2;
+	UCHAR buf[PACKETSZ];
+	UCHAR text[MAXDNAME+1];
+
+	memset((PUCHAR) &ti, 0, sizeof(THREADINFO));
+	ti.buf = buf;
+	ti.qname = &qn;
+	if(start_answer(&ti, QUESTION, T_A) == FALSE) {
+		error("cannot make query for %s", QUESTION);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Second question: "ftp", then a pointer */
+
+	q2 = ti.rp;
+	q2[0] = 3;
+	memcpy(q2 + 1, "ftp", 3);
+	q2[4] = INDIR_MASK;
+	memset(q2 + 6, 0, QFIXEDSZ);
+	ti.pktlen = q2 + 6 + QFIXEDSZ - buf;
+
+	for(i = 0; i <= q2 - buf; i++) {
+		q2[5] = (UCHAR) i;
+		n = parse_name(&ti, q2, &qn, text);
+		if(i == sizeof(HEADER) + 4) {	/* "example.com" */
+			if(n != 6 || strcmp(text, "ftp.example.com") != 0) {
+				printf("  pointer to %d: not followed\n", i);
+				bad++;
+			}
+		} else if(i < sizeof(HEADER) || i == q2 - buf) {
+			if(n >= 0) {
+				printf("  pointer to %d: accepted\n", i);
+				bad++;
+			}
+		}
+	}
+	printf("  %d wrong\n", bad);
+	failures += bad;
+}
+
+
+/*
+ * Fill most of a reply with PTR records, then add one with a new owner
+ * name and a target too long for the space left. Nothing of that record
+ * may be left: the reply
+ * pointer must be back where the record started, and nothing in the
+ * compression state may refer to the space beyond it. A shorter record
+ * must then fit, and the whole reply must parse, with each target
+ * expanding to the name that was written.
+ *
+ */
+
+static VOID check_truncation(VOID)
+{	INT i, j, n, stale, nrecs = 0, bad = 0;
+	THREADINFO ti;
+	QNAME qn;
+	PUCHAR p, save;
+	UCHAR buf[PACKETSZ];
+	UCHAR target[MAXDNAME+1];
+
+	memset((PUCHAR) &ti, 0, sizeof(THREADINFO));
+	ti.buf = buf;
+	ti.qname = &qn;
+	if(start_answer(&ti, "host.example.com", T_PTR) == FALSE) {
+		error("cannot make query for %s", "host.example.com");
+		exit(EXIT_FAILURE);
+	}
+	comp_init(&ti.comp, ti.buf, ti.qname);
+
+	while(buf + PACKETSZ - ti.rp >= FILLROOM) {
+		sprintf(target, "n%03d.%s", nrecs, LONGSUFFIX);
+		if(put_name_rr(&ti, "host.example.com", T_PTR, 60, target) ==
+		   FALSE) {
+			printf("  record %d did not fit\n", nrecs);
+			bad++;
+			break;
+		}
+		nrecs++;
+	}
+
+	/* Three labels of MAXLABEL characters, that cannot be compressed */
+
+	for(i = 0, p = target; i < 3; i++) {
+		memset(p, 'p' + i, MAXLABEL);
+		p += MAXLABEL;
+		*p++ = '.';
+	}
+	strcpy(p, "example.com");
+	save = ti.rp;
+	if(put_name_rr(&ti, NEWOWNER, T_PTR, 60, target) == TRUE) {
+		printf("  long record fitted\n");
+		bad++;
+	} else if(ti.rp != save) {
+		printf("  reply pointer not put back\n");
+		bad++;
+	}
+
+	n = ti.rp - buf;
+	stale = 0;
+	for(j = 0; j < MAXCOMP; j++)
+		if(ti.comp.off[j] >= n) stale++;
+	for(j = 0; j < ti.comp.nnames && j < MAXCOMPNAMES; j++)
+		if(ti.comp.name[j] != (PUCHAR) NULL &&
+		   ti.comp.nameoff[j] >= n)
+			stale++;
+	if(stale != 0) {
+		printf("  %d compression entries beyond the reply\n", stale);
+		bad++;
+	}
+
+	sprintf(target, "z.%s", strchr(LONGSUFFIX, '.') + 1);
+	if(put_name_rr(&ti, NEWOWNER, T_PTR, 60, target) == FALSE) {
+		printf("  shorter record did not fit\n");
+		bad++;
+	} else {
+		nrecs++;
+	}
+	((HEADER *) buf)->ancount = htons(nrecs);
+	if(count_names(buf, ti.rp - buf) != nrecs) {
+		printf("  reply does not parse\n");
+		bad++;
+	}
+
+	printf(
+		"  %d records fitted, %d bytes left, %d wrong\n",
+		nrecs,
+		buf + PACKETSZ - ti.rp,
+		bad);
+	failures += bad;
+}
+
+
+/*
+ * Go through the answer records in a reply, whose data must be single
+ * names, expanding each. Each name must use exactly the data length of
+ * its record, and all but the last must be the names written by
+ * 'check_truncation'. The owner of the last must be NEWOWNER.
+ *
+ * Returns the number of records that passed.
+ *
+ */
+
+static INT count_names(PUCHAR reply, INT len)
+{	INT i, n, rdlen, ok = 0;
+	HEADER *h = (HEADER *) reply;
+	PUCHAR p = reply + sizeof(HEADER);
+	PUCHAR end = reply + len;
+	UCHAR name[MAXDNAME+1], want[MAXDNAME+1];
+
+	n = dn_skipname(p, end);		/* Question */
+	if(n < 0) return(0);
+	p += n + QFIXEDSZ;
+
+	for(i = 0; i < ntohs(h->ancount); i++) {
+		n = dn_expand(reply, end, p, name, sizeof(name));
+		if(n < 0 || p + n + RRFIXEDSZ > end) break;
+		if(i == ntohs(h->ancount) - 1 && stricmp(name, NEWOWNER) != 0)
+			break;
+		p += n + RRFIXEDSZ;
+		rdlen = _getshort(p - 2);
+		n = dn_expand(reply, end, p, name, sizeof(name));
+		if(n != rdlen) break;
+		p += n;
+		sprintf(want, "n%03d.%s", i, LONGSUFFIX);
+		if(i < ntohs(h->ancount) - 1 && stricmp(name, want) != 0)
+			break;
+		ok++;
+	}
+	if(p != end) return(-1);
+
+	return(ok);
+}
+
+
+/*
+ * Find the entry for an IPv4 address by scanning the whole list, the
+ * way 'db_find_address' used to work.
+ *
+ */
+
+static PDBENT scan_address(PDB db, INADDR address)
+{	PDBENT p;
+
+	for(p = db->head; p != (PDBENT) NULL; p = p->next) {
+		if(p->type == ENT_TYPE_PRIMARY &&
+		   p->address.s_addr == address.s_addr)
+			return(p);
+	}
+
+	return(PDBENT) NULL;
+}
+
+
+/*
+ * Get the target of the first answer record in a reply, which must be a
+ * single name (as for PTR or CNAME).
+ *
+ * Returns 0 if all went well, or -1 if there is no such answer.
+ *
+ */
+
+static INT answer_name(PUCHAR reply, INT len, PUCHAR name)
+{	INT n;
+	HEADER *h = (HEADER *) reply;
+	PUCHAR p = reply + sizeof(HEADER);
+	PUCHAR end = reply + len;
+
+	if(h->rcode != NOERROR || ntohs(h->ancount) == 0) return(-1);
+
+	n = dn_skipname(p, end);		/* Question */
+	if(n < 0) return(-1);
+	p += n + QFIXEDSZ;
+	n = dn_skipname(p, end);		/* Owner of answer */
+	if(n < 0 || p + n + RRFIXEDSZ > end) return(-1);
+	p += n + RRFIXEDSZ;
+
+	return(dn_expand(reply, end, p, name, MAXDNAME+1) < 0 ? -1 : 0);
+}
+
+
+/*
+ * Note the time at the start of a test.
+ *
+ */
+
+static VOID timer_start(VOID)
+{	(VOID) DosTmrQueryTime(&tmrstart);
+}
+
+
+/*
+ * Work out the average time for one of 'n' iterations of a test, in
+ * nanoseconds.
+ *
+ */
+
+static double timer_ns(LONG n)
+{	QWORD t;
+	double d;
+
+	(VOID) DosTmrQueryTime(&t);
+	d = ((double) t.ulHi - (double) tmrstart.ulHi)*4294967296.0 +
+	    ((double) t.ulLo - (double) tmrstart.ulLo);
+
+	return(d*1.0e9/(double) tmrfreq/(double) n);
+}
+
+
+/*
+ * Show a message that the server modules would write to the logfile; it
+ * goes to standard output instead.
+ *
+ */
+
+VOID dolog(PUCHAR s)
+{	fputs(s, stdout);
+	if(s[0] == '\0' || s[strlen(s)-1] != '\n') fputc('\n', stdout);
+}
+
+
+#ifdef	DEBUG
+/*
+ * Show a trace message from the server modules, in printf style.
+ *
+ */
+
+VOID trace(PUCHAR mes, ...)
+{	va_list ap;
+
+	va_start(ap, mes);
+	vprintf(mes, ap);
+	va_end(ap);
+
+	fputc('\n', stdout);
+}
+#endif
+
+
+/*
+ * Print message on standard error in printf style; the server modules
+ * use this too.
+ *
+ */
+
+VOID error(PUCHAR mes, ...)
+{	va_list ap;
+
+	fprintf(stderr, "replytest: ");
+
+	va_start(ap, mes);
+	vfprintf(stderr, mes, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+}
+
+/*
+ * End of file: replytest.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,621 @@
+/*
+ * File: uptest.c
+ *
+ * Name server for OS/2.
+ *
+ * Checks of the shared sockets for referred queries.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/*
+ * This program is not part of the server. It sends queries through the
+ * shared referral sockets to a fake name server, run by a thread of its
+ * own on the loopback address, and checks that:
+ *
+ *	- the random number generator gives the RFC 8439 test vector
+ *	  for an all-zero key;
+ *	- a reply is handed over, and the query keeps its own ID;
+ *	- a reply with the wrong ID, or with a changed question, is
+ *	  dropped, as is a query that gets no reply at all;
+ *	- many queries outstanding at once, answered in the reverse
+ *	  order, each get their own reply;
+ *	- queries sent from several threads are all answered, from more
+ *	  source ports than there are sockets, none of them below
+ *	  MINPORT; and that afterwards no queries are left outstanding
+ *	  and there are still NUPSOCKS sockets open.
+ *
+ * Any failed check is reported, and makes the exit status non-zero.
+ *
+ * The server's own source is used; upstream.c is included here, so that
+ * its tables can be examined. Only the modules that upstream.c needs are
+ * linked in, and the logging functions are replaced here.
+ *
+ * Usage: uptest
+ *
+ */
+
+#include "upstream.c"
+
+#define	SERVER_STACK	16384		/* Stack size for fake server thread */
+#define	QUERY_STACK	16384		/* Stack size for query threads */
+#define	SHORT_WAIT	1000		/* Wait for a reply not expected (ms) */
+#define	LONG_WAIT	5000		/* Wait for a reply expected (ms) */
+#define	NBATCH		1000		/* Queries outstanding at once */
+#define	NROTATE		8		/* Threads sending many queries */
+#define	ROTATE_QUERIES	2000		/* Queries sent by each thread */
+#define	TESTNAME	"Foo.Example.COM"/* Name in single queries */
+
+#define	MODE_NORMAL	0		/* Fake server replies at once */
+#define	MODE_WRONGID	1		/* Reply has the wrong ID */
+#define	MODE_WRONGQ	2		/* Reply has a changed question */
+#define	MODE_SILENT	3		/* No reply */
+#define	MODE_BATCH	4		/* Replies held, then sent in reverse */
+
+/* Forward references */
+
+static	VOID	batch_thread(PVOID);
+static	VOID	check_batch(VOID);
+static	VOID	check_keystream(VOID);
+static	VOID	check_modes(VOID);
+static	BOOL	check_reply(PTHREADINFO, INT, PUCHAR);
+static	VOID	check_rotation(VOID);
+static	VOID	fake_server(PVOID);
+static	INT	loopback_socket(PSOCK);
+static	INT	make_query(PUCHAR, PUCHAR, USHORT);
+static	PTHREADINFO new_thread(VOID);
+static	INT	query(PTHREADINFO, ULONG);
+static	VOID	rotate_thread(PVOID);
+static	VOID	run_threads(VOID (*)(PVOID), INT);
+static	VOID	thread_done(INT);
+
+/* Local storage */
+
+static	CONFIG	tconfig;		/* Configuration for the tests */
+static	SERVERS	tservers;		/* The fake name server */
+static	INADDR	fakeaddr;		/* Address of fake name server */
+static	INT	failures;		/* Number of failed checks */
+static	INT	fsock;			/* Socket of fake name server */
+static	INT volatile mode;		/* How the fake server replies */
+static	UCHAR	held[NBATCH][PACKETSZ];	/* Replies held by fake server */
+static	INT	heldlen[NBATCH];	/* Lengths of replies held */
+static	SOCK	heldfrom[NBATCH];	/* Where replies held are to go */
+static	INT	nheld;			/* Number of replies held */
+static	UCHAR	seen[65536];		/* Source ports seen by fake server */
+static	INT	nports;			/* Number of source ports seen */
+static	INT	nlow;			/* Number of those below MINPORT */
+static	INT	ndone;			/* Query threads finished */
+static	INT	nthreads;		/* Query threads started */
+static	INT	nok;			/* Queries answered correctly */
+static	HMTX	donesem;		/* Semaphore for the three above */
+static	HEV	alldone;		/* Posted when all threads finish */
+
+
+/*
+ * Main program. Starts the fake name server and the shared sockets, and
+ * runs the tests.
+ *
+ */
+
+INT main(INT argc, UCHAR *argv[])
+{	SOCK sa;
+
+	/* Check the random numbers first, as the sockets are bound using
+	   them; starting the sockets sets a new key anyway */
+
+	check_keystream();
+
+	fsock = loopback_socket(&sa);
+	if(fsock < 0) {
+		error("cannot create socket for fake name server");
+		exit(EXIT_FAILURE);
+	}
+	if(DosCreateMutexSem((PSZ) NULL, &donesem, 0, FALSE) != 0 ||
+	   DosCreateEventSem((PSZ) NULL, &alldone, 0, FALSE) != 0) {
+		error("cannot create semaphores");
+		exit(EXIT_FAILURE);
+	}
+	if(_beginthread(fake_server, NULL, SERVER_STACK, (PVOID) NULL) == -1) {
+		error("cannot start fake name server");
+		exit(EXIT_FAILURE);
+	}
+
+	fakeaddr = sa.sin_addr;
+	tconfig.nsport = sa.sin_port;
+	tservers.nservers = 1;
+	tservers.servers[0] = fakeaddr;
+	tconfig.servlist = &tservers;
+	if(upstream_start(&tconfig) == FALSE) {
+		error("cannot start shared sockets");
+		exit(EXIT_FAILURE);
+	}
+
+	check_modes();
+	check_batch();
+	check_rotation();
+
+	if(failures != 0) {
+		printf(
+			"%d check%s failed\n",
+			failures,
+			failures == 1 ? "" : "s");
+		return(EXIT_FAILURE);
+	}
+	printf("All checks passed\n");
+
+	return(EXIT_SUCCESS);
+}
+
+
+/*
+ * Check the random number generator against the first test vector of
+ * RFC 8439 (section A.1), which is the block for an all-zero key, block
+ * counter and nonce. The new key is the first half of the block, and the
+ * random numbers are made from the second half.
+ *
+ */
+
+static VOID check_keystream(VOID)
+{	INT i, bad = 0;
+	static ULONG want[16] = {
+		0xade0b876UL, 0x903df1a0UL, 0xe56a5d40UL, 0x28bd8653UL,
+		0xb819d2bdUL, 0x1aed8da0UL, 0xccef36a8UL, 0xc70d778bUL,
+		0x7c5941daUL, 0x8d485751UL, 0x3fe02477UL, 0x374ad8b8UL,
+		0xf4b8436aUL, 0x1ca11815UL, 0x69b687c3UL, 0x8665eeb2UL
+	};
+
+	printf("Random numbers, compared with RFC 8439:\n");
+	memset((PUCHAR) rkey, 0, sizeof(rkey));
+	rcount = 0;
+	noise = 0;
+	new_key();
+
+	for(i = 0; i < 8; i++) {
+		if(rkey[i] != want[i]) bad++;
+		if(rpool[2*i] != (USHORT) want[8+i] ||
+		   rpool[2*i+1] != (USHORT) (want[8+i] >> 16)) bad++;
+	}
+	printf("  %d wrong\n", bad);
+	failures += bad;
+}
+
+
+/*
+ * Send a single query with the fake server replying in each way in turn,
+ * and check that only the proper reply is taken.
+ *
+ */
+
+static VOID check_modes(VOID)
+{	INT i, n, bad = 0;
+	PTHREADINFO ti;
+	static struct {
+		INT	mode;
+		PUCHAR	desc;
+		BOOL	answered;
+	} tests[] = {
+		{ MODE_NORMAL,	"proper reply",		TRUE },
+		{ MODE_WRONGID,	"reply with wrong ID",	FALSE },
+		{ MODE_WRONGQ,	"reply with changed question", FALSE },
+		{ MODE_SILENT,	"no reply",		FALSE }
+	};
+
+	printf("Replies of each kind:\n");
+	for(i = 0; i < sizeof(tests)/sizeof(tests[0]); i++) {
+		mode = tests[i].mode;
+		ti = new_thread();
+		ti->pktlen = make_query(ti->buf, TESTNAME, (USHORT) (0x1000+i));
+		n = query(ti, tests[i].answered == TRUE ? LONG_WAIT : SHORT_WAIT);
+		if(ntohs(((HEADER *) ti->buf)->id) != 0x1000+i) {
+			printf("  %s: query lost its own ID\n", tests[i].desc);
+			bad++;
+		}
+		if(tests[i].answered == TRUE) {
+			if(check_reply(ti, n, TESTNAME) == FALSE) {
+				printf("  %s: not taken\n", tests[i].desc);
+				bad++;
+			}
+		} else {
+			if(n >= 0) {
+				printf("  %s: taken\n", tests[i].desc);
+				bad++;
+			}
+		}
+	}
+	mode = MODE_NORMAL;
+	printf("  %d wrong\n", bad);
+	failures += bad;
+}
+
+
+/*
+ * Send NBATCH queries at once, each from a thread of its own and with a
+ * different name. The fake server holds the replies until all the
+ * queries have arrived, then sends them in the reverse order.
+ *
+ */
+
+static VOID check_batch(VOID)
+{	ULONG start;
+
+	printf("Queries outstanding at once, answered in reverse:\n");
+	nheld = 0;
+	mode = MODE_BATCH;
+	start = upstream_clock();
+	run_threads(batch_thread, NBATCH);
+	printf(
+		"  %d queries, %d answered, %lu ms\n",
+		NBATCH,
+		nok,
+		upstream_clock() - start);
+	mode = MODE_NORMAL;
+	if(nok != NBATCH) failures++;
+}
+
+
+/*
+ * Send NROTATE * ROTATE_QUERIES queries, from NROTATE threads, and note
+ * the source ports they come from. Then wait for the sockets that have
+ * sent their share of queries to be opened again, and check that none
+ * are left closed or with queries outstanding.
+ *
+ */
+
+static VOID check_rotation(VOID)
+{	INT i, open = 0, outstanding = 0, bad = 0;
+
+	printf("Source ports:\n");
+	memset(seen, 0, sizeof(seen));
+	nports = nlow = 0;
+	run_threads(rotate_thread, NROTATE);
+	printf(
+		"  %d queries, %d answered, from %d source ports\n",
+		NROTATE*ROTATE_QUERIES,
+		nok,
+		nports);
+	if(nok != NROTATE*ROTATE_QUERIES) bad++;
+	if(nports <= NUPSOCKS) {
+		printf("  source ports were not changed\n");
+		bad++;
+	}
+	if(nlow != 0) {
+		printf("  %d source ports below %d\n", nlow, MINPORT);
+		bad++;
+	}
+
+	DosSleep(3*DISPATCH_WAIT);
+	(VOID) DosRequestMutexSem(pendsem, SEM_INDEFINITE_WAIT);
+	for(i = 0; i < NUPSOCKS; i++) {
+		if(socks[i] >= 0) open++;
+		outstanding += sockuse[i];
+	}
+	(VOID) DosReleaseMutexSem(pendsem);
+	printf(
+		"  afterwards %d sockets open, %d queries outstanding\n",
+		open,
+		outstanding);
+	if(open != NUPSOCKS || outstanding != 0) bad++;
+	printf("  %d wrong\n", bad);
+	failures += bad;
+}
+
+
+/*
+ * Thread that sends a single query, with a name made from its number.
+ *
+ */
+
+static VOID batch_thread(PVOID param)
+{	INT n, num = (INT) param;
+	PTHREADINFO ti = new_thread();
+	UCHAR name[MAXDNAME];
+
+	sprintf(name, "host%d.example", num);
+	ti->pktlen = make_query(ti->buf, name, (USHORT) num);
+	n = query(ti, LONG_WAIT);
+	thread_done(check_reply(ti, n, name) == TRUE ? 1 : 0);
+}
+
+
+/*
+ * Thread that sends ROTATE_QUERIES queries, one after the other.
+ *
+ */
+
+static VOID rotate_thread(PVOID param)
+{	INT i, n, ok = 0, num = (INT) param;
+	PTHREADINFO ti = new_thread();
+	UCHAR name[MAXDNAME];
+
+	sprintf(name, "rotate%d.example", num);
+	for(i = 0; i < ROTATE_QUERIES; i++) {
+		ti->pktlen = make_query(ti->buf, name, (USHORT) i);
+		n = query(ti, LONG_WAIT);
+		if(check_reply(ti, n, name) == TRUE) ok++;
+	}
+	thread_done(ok);
+}
+
+
+/*
+ * Start a number of query threads, and wait for them all to finish.
+ *
+ *	fn	is the function run by each thread; it is passed the
+ *		number of the thread
+ *	n	is the number of threads
+ *
+ */
+
+static VOID run_threads(VOID (*fn)(PVOID), INT n)
+{	INT i;
+	ULONG count;
+
+	(VOID) DosResetEventSem(alldone, &count);
+	ndone = 0;
+	nok = 0;
+	nthreads = n;
+	for(i = 0; i < n; i++) {
+		if(_beginthread(fn, NULL, QUERY_STACK, (PVOID) i) == -1) {
+			error("cannot start query thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	(VOID) DosWaitEventSem(alldone, SEM_INDEFINITE_WAIT);
+}
+
+
+/*
+ * Note that a query thread has finished.
+ *
+ *	ok	is the number of its queries that were answered properly
+ *
+ */
+
+static VOID thread_done(INT ok)
+{	(VOID) DosRequestMutexSem(donesem, SEM_INDEFINITE_WAIT);
+	nok += ok;
+	if(++ndone == nthreads) (VOID) DosPostEventSem(alldone);
+	(VOID) DosReleaseMutexSem(donesem);
+}
+
+
+/*
+ * Allocate a thread information structure, with its packet and referral
+ * buffers. These are not freed, as the program does not run for long.
+ *
+ */
+
+static PTHREADINFO new_thread(VOID)
+{	PTHREADINFO ti;
+
+	ti = (PTHREADINFO) calloc(1, sizeof(THREADINFO));
+	if(ti == (PTHREADINFO) NULL ||
+	   (ti->buf = (PUCHAR) malloc(PACKETSZ)) == (PUCHAR) NULL ||
+	   (ti->rbuf = (PUCHAR) malloc(PACKETSZ)) == (PUCHAR) NULL) {
+		error("cannot allocate thread information");
+		exit(EXIT_FAILURE);
+	}
+	ti->config = &tconfig;
+
+	return(ti);
+}
+
+
+/*
+ * Send the query in the packet buffer of a thread to the fake server,
+ * and wait for the reply.
+ *
+ *	ti	points to the thread information structure
+ *	ms	is the most time to wait, in milliseconds
+ *
+ * Returns the length of the reply, which is then in the referral buffer
+ * of the thread, or -1 if there was no reply.
+ *
+ */
+
+static INT query(PTHREADINFO ti, ULONG ms)
+{	INT group;
+
+	group = upstream_send(ti, fakeaddr, -1);
+	if(group < 0) return(-1);
+	(VOID) upstream_wait(group, ms);
+
+	return(upstream_end(ti, group));
+}
+
+
+/*
+ * Check that a reply is for the name asked about.
+ *
+ *	ti	points to the thread information structure
+ *	n	is the length of the reply, or -1 if there was none
+ *	want	is the name in the query
+ *
+ * Returns TRUE if the reply is for that name, FALSE if not.
+ *
+ */
+
+static BOOL check_reply(PTHREADINFO ti, INT n, PUCHAR want)
+{	UCHAR name[MAXDNAME];
+
+	if(n < (INT) sizeof(HEADER)) return(FALSE);
+	if(dn_expand(ti->rbuf, ti->rbuf + n, ti->rbuf + sizeof(HEADER),
+			name, sizeof(name)) < 0) return(FALSE);
+
+	return(stricmp(name, want) == 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Make a query with a single question, in the same way as the server
+ * makes up queries for its replies built in advance.
+ *
+ * Returns the length of the query, or -1 if the name is malformed.
+ *
+ */
+
+static INT make_query(PUCHAR buf, PUCHAR name, USHORT id)
+{	INT n;
+	HEADER *h = (HEADER *) buf;
+	PUCHAR p;
+
+	memset(buf, 0, sizeof(HEADER));
+	h->id = htons(id);
+	h->rd = 1;
+	h->qdcount = htons(1);
+	n = dn_comp(name,
+		buf + sizeof(HEADER),
+		PACKETSZ - sizeof(HEADER) - QFIXEDSZ,
+		(PUCHAR *) NULL,
+		(PUCHAR *) NULL);
+	if(n < 0) return(-1);
+	p = buf + sizeof(HEADER) + n;
+	putshort(T_A, p);
+	p += 2;
+	putshort(C_IN, p);
+	p += 2;
+
+	return(p - buf);
+}
+
+
+/*
+ * The fake name server thread. Every query received is sent back as a
+ * reply, in the way set by 'mode'. The source port of each query is
+ * noted.
+ *
+ */
+
+static VOID fake_server(PVOID param)
+{	INT i, n, port, namelen;
+	HEADER *h;
+	SOCK sa;
+	UCHAR buf[PACKETSZ];
+
+	for(;;) {
+		namelen = sizeof(SOCK);
+		n = recvfrom(fsock, buf, sizeof(buf), 0, (PSOCKG) &sa,
+				&namelen);
+		if(n < (INT) sizeof(HEADER)) continue;
+
+		port = ntohs(sa.sin_port);
+		if(seen[port]++ == 0) {
+			nports++;
+			if(port < MINPORT) nlow++;
+		}
+
+		h = (HEADER *) buf;
+		h->qr = 1;
+		switch(mode) {
+			case MODE_SILENT:
+				continue;
+
+			case MODE_WRONGID:
+				h->id ^= htons(1);
+				break;
+
+			case MODE_WRONGQ:
+				buf[sizeof(HEADER)+1] ^= 0x01;
+				break;
+
+			case MODE_BATCH:
+				memcpy(held[nheld], buf, n);
+				heldlen[nheld] = n;
+				heldfrom[nheld] = sa;
+				if(++nheld < NBATCH) continue;
+				for(i = nheld - 1; i >= 0; i--)
+					(VOID) sendto(fsock, held[i],
+						heldlen[i], 0,
+						(PSOCKG) &heldfrom[i],
+						sizeof(SOCK));
+				nheld = 0;
+				continue;
+		}
+		(VOID) sendto(fsock, buf, n, 0, (PSOCKG) &sa, sizeof(SOCK));
+	}
+}
+
+
+/*
+ * Create a UDP socket bound to a port chosen by the system on the
+ * loopback address.
+ *
+ *	psa	points to where to store the address of the socket
+ *
+ * Returns the socket, or -1 on failure.
+ *
+ */
+
+static INT loopback_socket(PSOCK psa)
+{	INT sockno, namelen = sizeof(SOCK);
+
+	sockno = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sockno < 0) return(-1);
+
+	memset((PUCHAR) psa, 0, sizeof(SOCK));
+	psa->sin_family = AF_INET;
+	psa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(sockno, (PSOCKG) psa, sizeof(SOCK)) < 0 ||
+	   getsockname(sockno, (PSOCKG) psa, &namelen) < 0) {
+		soclose(sockno);
+		return(-1);
+	}
+
+	return(sockno);
+}
+
+
+/*
+ * Show a message that the server modules would write to the logfile; it
+ * goes to standard output instead.
+ *
+ */
+
+VOID dolog(PUCHAR s)
+{	fputs(s, stdout);
+	if(s[0] == '\0' || s[strlen(s)-1] != '\n') fputc('\n', stdout);
+}
+
+
+#ifdef	DEBUG
+/*
+ * Show a trace message from the server modules, in printf style.
+ *
+ */
+
+VOID trace(PUCHAR mes, ...)
+{	va_list ap;
+
+	va_start(ap, mes);
+	vprintf(mes, ap);
+	va_end(ap);
+
+	fputc('\n', stdout);
+}
+#endif
+
+
+/*
+ * Print message on standard error in printf style; the server modules
+ * use this too.
+ *
+ */
+
+VOID error(PUCHAR mes, ...)
+{	va_list ap;
+
+	fprintf(stderr, "uptest: ");
+
+	va_start(ap, mes);
+	vfprintf(stderr, mes, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+}
+
+/*
+ * End of file: uptest.c
+ *
+ */
+
\ No newline at end of file